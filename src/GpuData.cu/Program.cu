@@ -1,5 +1,6 @@
 //#include "..\GpuData\Core\Core.cu.h"
 #include "..\GpuData.net\Core+Pager\Core+Pager.cu.h"
+#include "..\GpuData.net\Core\55.GpuVSystem.cu.h"
 using namespace Core;
 using namespace Core::IO;
 
@@ -16,8 +17,15 @@ __global__ void MainTest(void *heap)
 
 void __main(cudaRuntimeHost &r)
 {	
+	if (GpuVHost::Start() != RC::OK)
+		return;
 	cudaRuntimeSetHeap(r.heap);
 	MainTest<<<1, 1>>>(r.heap);
+	cudaDeviceSynchronize();
+	int64 requests, batches;
+	GpuVHost::Stats(&requests, &batches);
+	printf("gpu vfs: %lld requests in %lld batches\n", requests, batches);
+	GpuVHost::Stop();
 }
 
 __device__ static void TestVFS()
@@ -41,7 +49,7 @@ __device__ static Pager *Open(VSystem *vfs)
 	auto vfsFlags = (VSystem::OPEN)((int)VSystem::OPEN_CREATE | (int)VSystem::OPEN_READWRITE | (int)VSystem::OPEN_MAIN_DB);
 	//
 	Pager *pager;
-	auto rc = Pager::Open(vfs, &pager, "memory", 0, flags, vfsFlags, nullptr);
+	auto rc = Pager::Open(vfs, &pager, "C:\\T_\\Test.db", 0, flags, vfsFlags, nullptr);
 	if (rc == RC::OK)
 		rc = pager->ReadFileheader(sizeof(dbHeader), dbHeader);
 	if (rc != RC::OK)
@@ -1140,6 +1140,19 @@ ptrmap_exit:
 	{
 		MemPage *page = (MemPage *)Pager::GetExtra(dbPage);
 		_assert(Pager::get_PageRefs(dbPage) > 0);
+		uint8 *data = (uint8 *)Pager::GetData(dbPage);
+		if (page->Data != data)
+		{
+			// The pager has moved the page content without changing it (a memory mapped page is copied into the cache when first written), so
+			// rebase the pointers cached on the page instead of parsing it again.
+			if (page->IsInit)
+			{
+				page->DataEnd = &data[page->DataEnd - page->Data];
+				page->CellIdx = &data[page->CellIdx - page->Data];
+			}
+			page->Data = data;
+			return;
+		}
 		if (page->IsInit)
 		{
 			_assert(MutexEx::Held(page->Bt->Mutex));
@@ -1204,6 +1217,7 @@ ptrmap_exit:
 		RC rc = RC::OK; // Result code from this function
 		BtShared *bt = nullptr; // Shared part of btree structure
 		MutexEx mutexOpen;
+		mutexOpen.Tag = nullptr;
 #if !defined(OMIT_SHARED_CACHE) && !defined(OMIT_DISKIO)
 		// If this Btree is a candidate for shared cache, try to find an existing BtShared object that we can share with
 		if (!tempDB && (!memoryDB || (vfsFlags & VSystem::OPEN_URI) != 0))
@@ -1230,6 +1244,7 @@ ptrmap_exit:
 					}
 				}
 				MutexEx mutexShared;
+				mutexShared.Tag = nullptr;
 #if THREADSAFE
 				mutexOpen = MutexEx::Alloc(MutexEx::MUTEX_STATIC_OPEN); // Prevents a race condition. Ticket #3537
 				MutexEx::Enter(mutexOpen);
@@ -1339,6 +1354,7 @@ ptrmap_exit:
 			{
 				bt->Refs = 1;
 				MutexEx mutexShared;
+				mutexShared.Tag = nullptr;
 #if THREADSAFE
 				mutexShared = MutexEx::Alloc(MutexEx::MUTEX_STATIC_MASTER);
 				bt->Mutex = MutexEx::Alloc(MutexEx::MUTEX_FAST);
@@ -1397,10 +1413,11 @@ btree_open_out:
 			// do not change the pager-cache size.
 			if (p->Schema(0, nullptr) == nullptr)
 				p->Bt->Pager->SetCacheSize(DEFAULT_CACHE_SIZE);
-#if THREADSAFE
-		_assert(MutexEx::Held(mutexOpen));
-		MutexEx::Leave(mutexOpen);
-#endif
+		if (mutexOpen.Tag)
+		{
+			_assert(MutexEx::Held(mutexOpen));
+			MutexEx::Leave(mutexOpen);
+		}
 		return rc;
 	}
 
@@ -1409,6 +1426,7 @@ btree_open_out:
 #ifndef OMIT_SHARED_CACHE
 		_assert(MutexEx::Held(bt->Mutex));
 		MutexEx master;
+		master.Tag = nullptr;
 #if THREADSAFE
 		master = MutexEx::Alloc(MutexEx::MUTEX_STATIC_MASTER);
 #endif
@@ -1509,6 +1527,15 @@ btree_open_out:
 		return RC::OK;
 	}
 
+	__device__ RC Btree::SetMmapLimit(int64 limit)
+	{
+		_assert(MutexEx::Held(Ctx->Mutex));
+		Enter();
+		Bt->Pager->SetMmapLimit(limit);
+		Leave();
+		return RC::OK;
+	}
+
 #ifndef OMIT_PAGER_PRAGMAS
 	__device__ RC Btree::SetSafetyLevel(int level, bool fullSync, bool ckptFullSync)
 	{
@@ -2948,6 +2975,31 @@ set_child_ptrmaps_out:
 
 #pragma region Move Cursor
 
+#ifndef BTREE_PREFETCH_PAGES // Leaves named in one read-ahead hint by a cursor with BTREE_SEQSCAN set
+#define BTREE_PREFETCH_PAGES 8
+#endif
+
+	// The cursor is entering child idx of parent on its way to a leaf. Pass the next BTREE_PREFETCH_PAGES leaves, in the direction the cursor is
+	// stepping through parent, to the pager as a read-ahead hint. The window is refilled once the cursor has used half of it, so a scan keeps its
+	// reads ahead of it without naming the same leaf twice.
+	__device__ static void btreePrefetch(BtCursor *cur, MemPage *parent, int idx)
+	{
+		int dir = (cur->PrefetchParent == parent->ID && idx < cur->PrefetchIdx ? -1 : 1); // Stepping backwards if Previous() moved to a lower index
+		int ahead = (cur->PrefetchParent == parent->ID ? (cur->PrefetchEnd - idx) * dir : 0); // Leaves already hinted beyond this one
+		cur->PrefetchParent = parent->ID;
+		cur->PrefetchIdx = idx;
+		if (ahead >= BTREE_PREFETCH_PAGES / 2)
+			return;
+		Pid ids[BTREE_PREFETCH_PAGES];
+		int count = 0;
+		int k;
+		for (k = (ahead > 0 ? cur->PrefetchEnd : idx) + dir; count < BTREE_PREFETCH_PAGES && k >= 0 && k <= parent->Cells; k += dir)
+			ids[count++] = ConvertEx::Get4(k == parent->Cells ? &parent->Data[parent->HdrOffset + 8] : findCell(parent, k));
+		cur->PrefetchEnd = k - dir;
+		if (count > 0)
+			cur->Bt->Pager->Prefetch(ids, count);
+	}
+
 	__device__ static RC moveToChild(BtCursor *cur, uint32 newID)
 	{
 		_assert(cursorHoldsMutex(cur));
@@ -2968,6 +3020,8 @@ set_child_ptrmaps_out:
 		cur->ValidNKey = 0;
 		if (newPage->Cells < 1 || newPage->IntKey != cur->Pages[i]->IntKey)
 			return SysEx_CORRUPT_BKPT;
+		if ((cur->Hints & BTREE_SEQSCAN) && newPage->Leaf)
+			btreePrefetch(cur, cur->Pages[i], cur->Idxs[i]);
 		return RC::OK;
 	}
 
@@ -5029,7 +5083,7 @@ balance_cleanup:
 						// has completed, it is safe to release the pSpace buffer used by the previous call, as the overflow cell data will have been 
 						// copied either into the body of a database page or into the new pSpace buffer passed to the latter call to balance_nonroot().
 						uint8 *space = (uint8 *)PCache::PageAlloc(cur->Bt->PageSize);
-						rc = balance_nonroot(parent, idx, space, pageID == 1, cur->Hints);
+						rc = balance_nonroot(parent, idx, space, pageID == 1, (cur->Hints & BTREE_BULKLOAD) != 0);
 						if (free)
 						{
 							// If pFree is not NULL, it points to the pSpace buffer used  by a previous call to balance_nonroot(). Its contents are
@@ -6201,8 +6255,9 @@ cleardatabasepage_out:
 
 	__device__ void Btree::CursorHints(BtCursor *cur, unsigned int mask)
 	{
-		_assert(mask == BTREE_BULKLOAD || mask == 0);
+		_assert((mask & ~(BTREE_BULKLOAD | BTREE_SEQSCAN)) == 0);
 		cur->Hints = (uint8)mask;
+		cur->PrefetchParent = 0;
 	}
 
 #pragma endregion
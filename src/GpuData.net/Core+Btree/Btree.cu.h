@@ -94,6 +94,7 @@ namespace Core
 		__device__ static RC Open(VSystem *vfs, const char *filename, Context *ctx, Btree **btree, OPEN flags, VSystem::OPEN vfsFlags);
 		__device__ RC Close();
 		__device__ RC SetCacheSize(int maxPage);
+		__device__ RC SetMmapLimit(int64 limit);
 		__device__ RC SetSafetyLevel(int level, bool fullSync, bool ckptFullSync);
 		__device__ bool SyncDisabled();
 		__device__ RC SetPageSize(int pageSize, int reserves, bool fix);
@@ -152,6 +153,7 @@ namespace Core
 		__device__ RC NewDb();
 
 #define BTREE_BULKLOAD 0x00000001
+#define BTREE_SEQSCAN 0x00000002
 
 		__device__ RC Cursor(Pid tableID, bool wrFlag, struct KeyInfo *keyInfo, BtCursor *cur);
 		__device__ static int CursorSize();
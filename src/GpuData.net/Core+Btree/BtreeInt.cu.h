@@ -141,6 +141,9 @@ namespace Core
 		bool IsIncrblobHandle;  // True if this cursor is an incr. io handle
 #endif
 		uint8 Hints;			// As configured by CursorSetHints()
+		Pid PrefetchParent;		// Interior page whose children were last passed to Pager::Prefetch()
+		int PrefetchIdx;		// Child index of the last leaf entered under PrefetchParent
+		int PrefetchEnd;		// Last child index of PrefetchParent already prefetched
 		int16 ID;				// Index of current page in apPage
 		uint16 Idxs[BTCURSOR_MAX_DEPTH]; // Current index in apPage[i]
 		MemPage *Pages[BTCURSOR_MAX_DEPTH]; // Pages from root to current page
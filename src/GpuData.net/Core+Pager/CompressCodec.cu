@@ -0,0 +1,207 @@
+﻿// codec.c
+#include "Core+Pager.cu.h"
+
+#ifdef HAS_CODEC
+namespace Core
+{
+#pragma region Compression
+
+	// The format is a sequence of LZ4-style blocks. Each starts with a token byte whose high nibble is a count of literal bytes and low nibble a
+	// match length less 4, either of which continues in bytes of 255 and one less than 255 when it is 15. The literals follow, then the match as
+	// a 2-byte little-endian distance back into the output. The last block has literals only.
+
+	__device__ inline static uint32 hash4(const uint8 *p)
+	{
+		return ((uint32)(p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24)) * 2654435761U) >> (32 - COMPRESSCODEC_HASHBITS);
+	}
+
+	__device__ static uint8 *putLength(uint8 *op, uint8 *end, int length)
+	{
+		for (length -= 15; length >= 255; length -= 255)
+		{
+			if (op >= end) return nullptr;
+			*op++ = 255;
+		}
+		if (op >= end) return nullptr;
+		*op++ = (uint8)length;
+		return op;
+	}
+
+	__device__ static int getLength(const uint8 *in, int length, int *ip, int value)
+	{
+		if (value != 15)
+			return value;
+		int b;
+		do
+		{
+			if (*ip >= length) return -1;
+			b = in[(*ip)++];
+			value += b;
+		} while (b == 255);
+		return value;
+	}
+
+	// Compress in[0..length-1] into out[], returning the compressed length, or 0 if it does not fit in outLength bytes.
+	__device__ int CompressCodec::Compress(const uint8 *in, int length, uint8 *out, int outLength, uint16 *hash)
+	{
+		_assert(length <= 65536);
+		_memset(hash, 0, sizeof(uint16) << COMPRESSCODEC_HASHBITS);
+		uint8 *op = out;
+		uint8 *end = out + outLength;
+		int anchor = 0; // Start of the literals not yet written
+		int i = 0;
+		while (i + 4 <= length)
+		{
+			uint32 h = hash4(&in[i]);
+			int ref = hash[h];
+			hash[h] = (uint16)i;
+			if (ref >= i || _memcmp(&in[ref], &in[i], 4) != 0)
+			{
+				i++;
+				continue;
+			}
+			int matchLength = 4;
+			while (i + matchLength < length && in[ref + matchLength] == in[i + matchLength])
+				matchLength++;
+
+			int literals = i - anchor;
+			if (op >= end) return 0;
+			uint8 *token = op++;
+			*token = (uint8)(((literals < 15 ? literals : 15) << 4) | (matchLength - 4 < 15 ? matchLength - 4 : 15));
+			if (literals >= 15 && (op = putLength(op, end, literals)) == nullptr) return 0;
+			if (literals + 2 > end - op) return 0;
+			_memcpy(op, &in[anchor], literals);
+			op += literals;
+			int distance = i - ref;
+			op[0] = (uint8)distance;
+			op[1] = (uint8)(distance >> 8);
+			op += 2;
+			if (matchLength - 4 >= 15 && (op = putLength(op, end, matchLength - 4)) == nullptr) return 0;
+			i += matchLength;
+			anchor = i;
+		}
+
+		int literals = length - anchor;
+		if (op >= end) return 0;
+		*op++ = (uint8)((literals < 15 ? literals : 15) << 4);
+		if (literals >= 15 && (op = putLength(op, end, literals)) == nullptr) return 0;
+		if (literals > end - op) return 0;
+		_memcpy(op, &in[anchor], literals);
+		op += literals;
+		return (int)(op - out);
+	}
+
+	// Expand in[0..length-1] into out[], returning the expanded length, or -1 if the input is malformed or expands past outLength bytes.
+	__device__ int CompressCodec::Decompress(const uint8 *in, int length, uint8 *out, int outLength)
+	{
+		int ip = 0;
+		int op = 0;
+		while (ip < length)
+		{
+			int token = in[ip++];
+			int literals = getLength(in, length, &ip, token >> 4);
+			if (literals < 0 || literals > length - ip || literals > outLength - op) return -1;
+			_memcpy(&out[op], &in[ip], literals);
+			ip += literals;
+			op += literals;
+			if (ip == length) break;
+			if (ip + 2 > length) return -1;
+			int distance = in[ip] | (in[ip + 1] << 8);
+			ip += 2;
+			int matchLength = getLength(in, length, &ip, token & 15);
+			if (matchLength < 0) return -1;
+			matchLength += 4;
+			if (distance == 0 || distance > op || matchLength > outLength - op) return -1;
+			// Byte by byte, as a match may overlap the bytes it is copying, as a run of zeros does
+			for (int k = 0; k < matchLength; k++, op++)
+				out[op] = out[op - distance];
+		}
+		return op;
+	}
+
+#pragma endregion
+
+#pragma region Codec
+
+	__device__ RC CompressCodec::Attach(Pager *pager)
+	{
+		CompressCodec *p = (CompressCodec *)SysEx::Alloc(sizeof(CompressCodec), true);
+		if (!p)
+			return RC::NOMEM;
+		sqlite3PagerSetCodec(pager, Code, SizeChange, Free, p);
+		return RC::OK;
+	}
+
+	// The pager calls this with op 3 to expand a page just read, in place, and with op 6 or 7 for the encoded copy of a page about to be written to
+	// the database or the journal, which must leave the page itself alone.
+	__device__ void *CompressCodec::Code(void *arg, void *data, Pid id, int op)
+	{
+		CompressCodec *p = (CompressCodec *)arg;
+		if (p->ReserveBytes < COMPRESSCODEC_RESERVE)
+			return data;
+		if (!p->Buffer)
+			return nullptr;
+		uint8 *page = (uint8 *)data;
+		uint8 *header = &page[p->PageSize - COMPRESSCODEC_RESERVE]; // Compressed length, 0 if stored as it is
+		int start = (id == 1 ? 100 : 0); // The database header on page 1 stays readable
+		int length = p->PageSize - COMPRESSCODEC_RESERVE - start; // Bytes of the page compressed
+		switch (op)
+		{
+		case 3: {
+			uint32 stored = ConvertEx::Get4(header);
+			if (stored == 0)
+				return data;
+			if (stored > (uint32)length || Decompress(&page[start], (int)stored, p->Buffer, length) != length)
+			{
+				// Not a page this codec wrote. It is zeroed, which the btree layer reports as corruption.
+				_memset(&page[start], 0, p->PageSize - start);
+				return data;
+			}
+			_memcpy(&page[start], p->Buffer, length);
+			_memset(header, 0, COMPRESSCODEC_RESERVE);
+			return data; }
+		case 6:
+		case 7: {
+			uint8 *out = p->Buffer;
+			int stored = Compress(&page[start], length, &out[start], length - 1, p->Hash);
+			if (stored == 0)
+			{
+				_memcpy(out, page, p->PageSize - COMPRESSCODEC_RESERVE);
+				stored = length;
+			}
+			else
+			{
+				_memcpy(out, page, start);
+				_memset(&out[start + stored], 0, length - stored);
+			}
+			ConvertEx::Put4(&out[p->PageSize - COMPRESSCODEC_RESERVE], (stored == length ? 0 : stored));
+			p->Pages++;
+			p->Stored += (stored == length ? p->PageSize : start + stored + COMPRESSCODEC_RESERVE);
+			return out; }
+		default:
+			return data;
+		}
+	}
+
+	__device__ void CompressCodec::SizeChange(void *arg, int pageSize, int reserveBytes)
+	{
+		CompressCodec *p = (CompressCodec *)arg;
+		if (pageSize != p->PageSize || !p->Buffer)
+		{
+			SysEx::Free(p->Buffer);
+			p->Buffer = (uint8 *)SysEx::Alloc(pageSize);
+			p->PageSize = pageSize;
+		}
+		p->ReserveBytes = reserveBytes;
+	}
+
+	__device__ void CompressCodec::Free(void *arg)
+	{
+		CompressCodec *p = (CompressCodec *)arg;
+		SysEx::Free(p->Buffer);
+		SysEx::Free(p);
+	}
+
+#pragma endregion
+}
+#endif
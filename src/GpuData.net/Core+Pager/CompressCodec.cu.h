@@ -0,0 +1,37 @@
+﻿// codec.h
+#ifdef HAS_CODEC
+namespace Core
+{
+#define COMPRESSCODEC_RESERVE 4		// Bytes at the end of each page the database must reserve for the codec's header
+#ifndef COMPRESSCODEC_HASHBITS // Log2 of the number of entries in the compressor's match table
+#define COMPRESSCODEC_HASHBITS 12
+#endif
+
+	// A page codec that compresses each page on its way to disk with a small LZ4-style compressor and expands it again as it is read, so the
+	// page cache and the btree only ever see whole, uncompressed pages. A page keeps its usual slot in the file: the compressed bytes come first,
+	// the rest of the slot is zero, and the last COMPRESSCODEC_RESERVE bytes of the page hold the compressed length, or zero for a page that did
+	// not shrink and is stored as it is. The first 100 bytes of page 1, the database header, are never compressed. Where the VFS supports
+	// FCNTL_PUNCH_HOLE the pager writes only the compressed bytes and the header and punches the zeros between them out of the file, so with
+	// pages larger than a file system block a page that shrank takes, and is read back from, fewer blocks.
+	//
+	// The database must reserve the header bytes (Btree::SetPageSize() with reserve of at least COMPRESSCODEC_RESERVE); until it does, pages pass
+	// through unchanged. Attach() before the first page is read.
+	class CompressCodec
+	{
+	public:
+		int PageSize;				// Page size last reported by the pager
+		int ReserveBytes;			// Reserved bytes at the end of each page
+		uint8 *Buffer;				// PageSize bytes into which a page is compressed for writing, or expanded after reading
+		uint16 Hash[1 << COMPRESSCODEC_HASHBITS]; // Compressor match table, the last offset at which each hash of 4 bytes was seen
+		int64 Pages;				// Pages encoded for writing
+		int64 Stored;				// Bytes of those pages that went to disk, counting a page that did not shrink as a whole page
+
+		__device__ static RC Attach(Pager *pager);
+		__device__ static void *Code(void *arg, void *data, Pid id, int op);
+		__device__ static void SizeChange(void *arg, int pageSize, int reserveBytes);
+		__device__ static void Free(void *arg);
+		__device__ static int Compress(const uint8 *in, int length, uint8 *out, int outLength, uint16 *hash);
+		__device__ static int Decompress(const uint8 *in, int length, uint8 *out, int outLength);
+	};
+}
+#endif
@@ -16,3 +16,4 @@ public:
 #include "Pager.cu.h"
 #include "PCache.cu.h"
 #include "Wal.cu.h"
+#include "CompressCodec.cu.h"
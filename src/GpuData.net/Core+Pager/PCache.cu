@@ -142,6 +142,8 @@ namespace Core
 			if (!p)
 				return RC::NOMEM;
 			p->Cachesize(get_CacheSize());
+			if (Policy != IPCache::POLICY_LRU && !p->SetPolicy(Policy))
+				Policy = IPCache::POLICY_LRU;
 			Cache = p;
 		}
 		ICachePage *page = nullptr;
@@ -187,7 +189,7 @@ namespace Core
 			}
 			_assert(pgHdr->Cache == this);
 			_assert(pgHdr->ID == id);
-			_assert(pgHdr->Data == page->Buffer);
+			_assert(pgHdr->Data == page->Buffer || (pgHdr->Flags & PgHdr::PGHDR_MMAP));
 			_assert(pgHdr->Extra == (void *)&pgHdr[1]);
 			if (pgHdr->Refs == 0)
 				Refs++;
@@ -392,6 +394,24 @@ namespace Core
 		return SortDirtyList(Dirty);
 	}
 
+	// Return first and up to max-1 other unreferenced dirty pages, coldest first from the tail of the dirty list, linked through PgHdr.Dirty and
+	// sorted by page number. A page with PGHDR_NEED_SYNC set is only taken if needSync is true, as writing it requires a journal sync.
+	__device__ PgHdr *PCache::SpillList(PgHdr *first, int max, bool needSync)
+	{
+		_assert(first->Flags & PgHdr::PGHDR_DIRTY);
+		first->Dirty = nullptr;
+		PgHdr *list = first;
+		int n = 1;
+		for (PgHdr *p = DirtyTail; p && n < max; p = p->DirtyPrev)
+			if (p != first && p->Refs == 0 && (needSync || (p->Flags & PgHdr::PGHDR_NEED_SYNC) == 0))
+			{
+				p->Dirty = list;
+				list = p;
+				n++;
+			}
+		return SortDirtyList(list);
+	}
+
 	__device__ int PCache::get_Refs()
 	{
 		return Refs;
@@ -420,6 +440,23 @@ namespace Core
 			Cache->Shrink();
 	}
 
+	// Returns false, keeping the policy it had, if the cache cannot use the policy.
+	__device__ bool PCache::SetPolicy(IPCache::POLICY policy)
+	{
+		if (Cache && !Cache->SetPolicy(policy))
+			return false;
+		Policy = policy;
+		return true;
+	}
+
+	__device__ void PCache::GetPolicyStats(IPCache::PolicyStats *stats, bool reset)
+	{
+		if (Cache)
+			Cache->GetPolicyStats(stats, reset);
+		else
+			_memset(stats, 0, sizeof(IPCache::PolicyStats));
+	}
+
 #if defined(CHECK_PAGES) || defined(_DEBUG)
 	__device__ void PCache::IterateDirty(void (*iter)(PgHdr *))
 	{
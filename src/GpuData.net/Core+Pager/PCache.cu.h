@@ -13,6 +13,22 @@ namespace Core
 	class IPCache
 	{
 	public:
+		// How a cache picks the unpinned page to reuse. POLICY_LRU takes the least recently used one. POLICY_ARC keeps pages used more than once
+		// on a list of their own, and only takes from it while the list of pages used once is shorter than a target it adapts, so one long scan
+		// cannot push out a working set. It also remembers pages it recently evicted, as ghosts, to tell when the cache is too small.
+		enum POLICY : uint8
+		{
+			POLICY_LRU = 0,
+			POLICY_ARC = 1,
+		};
+
+		// Ghost hits, which only the cache can see. Hits and misses are counted by the pager (IPager::CACHESTAT_HIT and CACHESTAT_MISS)
+		struct PolicyStats
+		{
+			int64 GhostRecent;		// Misses on a page evicted when it had been used once. A larger cache would have kept it
+			int64 GhostFrequent;	// Misses on a page evicted when it had been used more than once
+		};
+
 		__device__ virtual RC Init() = 0;
 		__device__ virtual void Shutdown() = 0;
 		__device__ virtual IPCache *Create(int sizePage, int sizeExtra, bool purgeable) = 0;
@@ -24,6 +40,8 @@ namespace Core
 		__device__ virtual void Rekey(ICachePage *pg, Pid old, Pid new_) = 0;
 		__device__ virtual void Truncate(Pid limit) = 0;
 		__device__ virtual void Destroy(IPCache *p) = 0;
+		__device__ virtual bool SetPolicy(POLICY policy) { return (policy == POLICY_LRU); }
+		__device__ virtual void GetPolicyStats(PolicyStats *stats, bool reset) { _memset(stats, 0, sizeof(PolicyStats)); }
 	};
 
 	struct PgHdr
@@ -34,7 +52,8 @@ namespace Core
 			PGHDR_NEED_SYNC = 0x004,		// Fsync the rollback journal before writing this page to the database
 			PGHDR_NEED_READ = 0x008,		// Content is unread
 			PGHDR_REUSE_UNLIKELY = 0x010, // A hint that reuse is unlikely
-			PGHDR_DONT_WRITE = 0x020		// Do not write content to disk 
+			PGHDR_DONT_WRITE = 0x020,		// Do not write content to disk 
+			PGHDR_MMAP = 0x040				// Data points into the memory mapped database file
 		};
 		ICachePage *Page;			// Pcache object page handle
 		void *Data;					// Page data
@@ -66,6 +85,7 @@ namespace Core
 		void *StressArg;            // Argument to xStress
 		IPCache *Cache;				// Pluggable cache module
 		PgHdr *Page1;				// Reference to page 1
+		IPCache::POLICY Policy;		// Replacement policy, given to Cache when it is created
 	public:
 		__device__ static RC Initialize();
 		__device__ static void Shutdown();
@@ -85,12 +105,15 @@ namespace Core
 		__device__ void Close();
 		__device__ void Clear();
 		__device__ PgHdr *DirtyList();
+		__device__ PgHdr *SpillList(PgHdr *first, int max, bool needSync);
 		__device__ int get_Refs();
 		__device__ static int get_PageRefs(PgHdr *p);
 		__device__ int get_Pages();
 		__device__ uint get_CacheSize();
 		__device__ void set_CacheSize(int maxPage);
 		__device__ void Shrink();
+		__device__ bool SetPolicy(IPCache::POLICY policy);
+		__device__ void GetPolicyStats(IPCache::PolicyStats *stats, bool reset);
 #if defined(CHECK_PAGES) || defined(_DEBUG)
 		__device__ void IterateDirty(void (*iter)(PgHdr *));
 #endif
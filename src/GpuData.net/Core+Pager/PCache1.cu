@@ -1,21 +1,118 @@
 ﻿// pcache1.c
 #include "Core+Pager.cu.h"
 #include <new.h>
+#if !defined(__CUDACC__) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if !defined(__CUDACC__) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define PCACHE1_SSE2 1
+#endif
 
 namespace Core
 {
 #pragma region Struct
 
 	typedef struct PgHdr1 PgHdr1;
+	typedef struct PSlab PSlab;
+	typedef struct PSlabClass PSlabClass;
+
+#ifndef PCACHE1_STRIPES // Locks a PGroup splits its caches' hash tables and its LRU list over. A power of two no larger than 256
+#define PCACHE1_STRIPES 8
+#endif
+#ifndef PCACHE1_PINNED // Slots of the table each cache finds its pinned pages in without a lock. A power of two
+#define PCACHE1_PINNED 64
+#endif
+#ifndef PCACHE1_GHOSTS // Most ghosts a POLICY_ARC cache remembers, however large it is. A power of two
+#define PCACHE1_GHOSTS 65536
+#endif
+#ifndef PCACHE1_MIGRATE // Slot groups of the old hash table each Fetch() moves to the new one while the table grows
+#define PCACHE1_MIGRATE 2
+#endif
+#ifndef PCACHE1_SLAB // Bytes of page buffers in each slab pages are carved from, or one page where a page is larger
+#define PCACHE1_SLAB 262144
+#endif
+#ifndef PCACHE_ALIGN // Page buffers of at least this many bytes start on a multiple of it, for VSystem::OPEN_DIRECT. A power of two, or 0 for none
+#define PCACHE_ALIGN 4096
+#endif
+#ifndef PCACHE1_CLASSES // Size classes of slabs, one per page size and extra size in use. Caches of further sizes take each page from the heap
+#define PCACHE1_CLASSES 8
+#endif
+#define PCACHE1_STRIPE(ID) ((ID) & (PCACHE1_STRIPES - 1))
+#define PCACHE1_GROUP 8 // Slots of a PHashGroup, compared at once
+#define PCACHE1_TOMB ((Pid)-1) // ID of a slot whose page was removed. Lookups go past it, where an empty slot (ID 0) stops them
+
+	// Page ID maps to stripe ID % PCACHE1_STRIPES. Hash tables are sized in multiples of PCACHE1_STRIPES slot groups, so group h of every cache
+	// in the group also belongs to stripe h % PCACHE1_STRIPES, and a stripe's mutex guards those groups along with its share of the LRU list.
+	// Caches of the same group then only wait on each other when their pages share a stripe.
+	//
+	// Unpinned pages used once since they were fetched are on the LRU list, and the ones used again are on the frequent list, which only caches
+	// with POLICY_ARC put pages on. Pages are taken from the LRU list while it holds more than Target pages. Target grows by one each time an
+	// ARC cache fetches again a page it evicted from the LRU list, and shrinks by one each time it fetches again one evicted from the frequent
+	// list, as ARC adapts its target for the recency list.
+	struct PGroupStripe
+	{
+		MutexEx Mutex;					// MUTEX_FAST, or NULL where the group has no mutex
+		PgHdr1 *LruHead, *LruTail;		// LRU list of the unpinned pages of the stripe used once
+		PgHdr1 *FreqHead, *FreqTail;	// LRU list of the unpinned pages of the stripe used more than once
+		uint Recents;					// Pages on the LRU list
+		uint Frequents;					// Pages on the frequent list
+		uint Target;					// Pages the LRU list may hold before pages are taken from the frequent list
+		uint CurrentPages;				// Number of purgeable pages of the stripe allocated
+	};
+
+	// Hash tables are open addressed over groups of slots that keep the page number next to the page, so a lookup reads one or two cache
+	// lines and does not chase headers. A page's probe starts at a group of its stripe picked by hashing its ID, compares the ID with all the
+	// slots of the group at once, and moves on to the stripe's next group until it finds the page or a group with an empty slot.
+	struct PHashGroup
+	{
+		Pid IDs[PCACHE1_GROUP];			// Page of each slot, 0 if the slot is empty or PCACHE1_TOMB
+		PgHdr1 *Pages[PCACHE1_GROUP];
+	};
+
+	// A page a POLICY_ARC cache evicted, which the cache remembers in slot ID % Ghosts.length until another page evicted takes the slot.
+	struct PGhost
+	{
+		Pid ID;							// Page evicted, or 0
+		bool Frequent;					// It was on the frequent list
+	};
+
+	// Pages not taken from the SQLITE_CONFIG_PAGECACHE buffer are carved from slabs, large heap allocations shared by the caches whose pages
+	// have the same size and extra size, so a cache of a million pages makes a few thousand heap calls rather than a million. A slab holds its
+	// page buffers one after the other, then their headers with the extra space, so page buffers stay aligned without padding each block.
+	// Blocks are handed out from the start of a slab the first time, so memory of a new slab is not touched until it is used, and after that
+	// from the slab's free list, which is linked through PgHdr1::LruNext and keeps Page.Buffer and Page.Extra pointing at the block.
+	//
+	// A slab is returned to the heap as soon as its last page is freed, unless it is the one empty slab a class keeps so that a cache at its
+	// limit does not allocate and free a slab over and over. Shrink(), Truncate() and ReleaseMemory() give up that one too.
+	struct PSlab
+	{
+		PSlabClass *Class;				// Size class of the slab
+		PSlab *Next, *Prev;				// List of the class's slabs with a free block
+		PgHdr1 *Free;					// Blocks freed since they were carved, linked through LruNext
+		int Carved;						// Blocks from the start of the slab handed out at least once
+		int Used;						// Blocks in use
+	};
+
+	struct PSlabClass
+	{
+		MutexEx Mutex;					// MUTEX_FAST, or NULL. Taken after a stripe mutex, never before one
+		int SizePage;					// Size of each page buffer, 0 while the class is unused
+		int SizeExtra;					// Size of the extra space of each page
+		int SizeHdr;					// Bytes of each header with its extra space
+		int Blocks;						// Pages per slab
+		PSlab *Partial;					// Slabs with a free block, the one last freed into first
+		PSlab *Empty;					// Slab with no page in use, kept for the next page
+	};
 
 	struct PGroup 
 	{
-		MutexEx Mutex;					// MUTEX_STATIC_LRU or NULL
+		MutexEx Mutex;					// MUTEX_STATIC_LRU or NULL. Guards the budget below, and is taken before any stripe
 		uint MaxPages;					// Sum of nMax for purgeable caches
 		uint MinPages;					// Sum of nMin for purgeable caches
 		uint MaxPinned;					// nMaxpage + 10 - nMinPage
-		uint CurrentPages;				// Number of purgeable pages allocated
-		PgHdr1 *LruHead, *LruTail;		// LRU list of unpinned pages
+		uint Evict;						// Stripe EnforceMaxPage() takes the next page from
+		PGroupStripe Stripes[PCACHE1_STRIPES];
 	};
 
 	class PCache1 : IPCache
@@ -27,14 +124,30 @@ namespace Core
 		int SizePage;           // Size of allocated pages in bytes
 		int SizeExtra;          // Size of extra space in bytes
 		bool Purgeable;			// True if cache is purgeable
+		PSlabClass *Class;		// Size class its pages are carved from, or null if every class is taken by other sizes
 		uint Min;				// Minimum number of pages reserved
 		uint Max;				// Configured "cache_size" value
 		uint N90pct;			// nMax*9/10
 		uint MaxID;				// Largest key seen since xTruncate()
-		// Hash table of all pages. The following variables may only be accessed when the accessor is holding the PGroup mutex.
-		uint Recyclables;       // Number of pages in the LRU list
-		uint Pages;             // Total number of pages in apHash
-		array_t<PgHdr1 *>Hash;	// Hash table for fast lookup by key
+		// Hash table of all pages. Element s of the counters and the groups of stripe s may only be accessed when holding the stripe's mutex.
+		// Only this cache's own calls resize the table, with every stripe held, so they may read Hash.length without one. A table that grows
+		// keeps its old one in OldHash, and each Fetch() moves a few groups of its stripe across, so no call stops to rehash every page. Only
+		// this cache's own calls add to the tables, so they may also read Used, Migrated and Migrating without a mutex.
+		uint Recyclables[PCACHE1_STRIPES];	// Number of pages in the LRU list
+		uint Pages[PCACHE1_STRIPES];		// Total number of pages in Hash and OldHash
+		uint Used[PCACHE1_STRIPES];			// Slots of the stripe in Hash that are not empty, counting removed pages
+		array_t<PHashGroup> Hash;			// Hash table for fast lookup by key
+		array_t<PHashGroup> OldHash;		// Table Hash replaced, until its pages are all moved
+		uint Migrated[PCACHE1_STRIPES];		// Groups of the stripe in OldHash moved so far
+		uint Migrating;						// Stripes with groups in OldHash still to move
+		// Pinned pages by ID % PCACHE1_PINNED. Only this cache's own calls touch it, and another cache only ever evicts unpinned pages, so
+		// Fetch() can return a page found here without taking a mutex.
+		PgHdr1 *Pinned[PCACHE1_PINNED];
+		// Replacement policy. Ghosts.length is a multiple of PCACHE1_STRIPES, and slot g may only be accessed when holding the mutex of stripe
+		// g % PCACHE1_STRIPES, as any cache of the group may evict a page. Only this cache's own calls touch Stats.
+		POLICY Policy;
+		array_t<PGhost> Ghosts;
+		PolicyStats Stats;
 	public:
 		//static void *PageAlloc(int size);
 		//static void PageFree(void *p);
@@ -51,16 +164,19 @@ namespace Core
 		__device__ void Rekey(ICachePage *pg, Pid old, Pid new_);
 		__device__ void Truncate(Pid limit);
 		__device__ void Destroy(IPCache *p);
+		__device__ bool SetPolicy(POLICY policy);
+		__device__ void GetPolicyStats(PolicyStats *stats, bool reset);
 	};
 
 	struct PgHdr1
 	{
 		ICachePage Page;
 		Pid ID;					// Key value (page number)
-		PgHdr1 *Next;			// Next in hash table chain
 		PCache1 *Cache;			// Cache that currently owns this page
 		PgHdr1 *LruNext;		// Next in LRU list of unpinned pages
 		PgHdr1 *LruPrev;		// Previous in LRU list of unpinned pages
+		bool Frequent;			// Used again since it was fetched. Says which list of its stripe the page is on when unpinned
+		PSlab *Slab;			// Slab the page was carved from, or null for a page of the page buffer or the heap
 	};
 
 	struct PgFreeslot
@@ -85,19 +201,52 @@ namespace Core
 		// The following value requires a mutex to change.  We skip the mutex on reading because (1) most platforms read a 32-bit integer atomically and
 		// (2) even if an incorrect value is read, no great harm is done since this is really just an optimization.
 		bool UnderPressure;		// True if low on PAGECACHE memory
+		// Size classes are added under Mutex and stay until Shutdown(), so a cache keeps a pointer to its own.
+		PSlabClass Classes[PCACHE1_CLASSES];
 	};
 
 #pragma endregion
 
 	__device__ static struct PCacheGlobal _pcache1;
-	__device__ static bool _config_coreMutex = false;
 
 #pragma region Page Allocation
 
+	// Page buffers of PCACHE_ALIGN bytes or more start on a multiple of it, so a file opened with VSystem::OPEN_DIRECT can move them without a
+	// bounce buffer. Smaller pages are never whole blocks of such a file, so they are not padded. A heap buffer to be aligned is over-allocated
+	// and aligned lead bytes in, and the pointer SysEx::Alloc() returned is kept in the word before it.
+#if PCACHE_ALIGN
+	__device__ static void *HeapAlloc(int bytes, int lead, bool align)
+	{
+		int pad = (align ? PCACHE_ALIGN : 0);
+		void *raw = SysEx::Alloc(bytes + pad + sizeof(void *));
+		if (!raw)
+			return nullptr;
+		char *p = &((char *)raw)[sizeof(void *)];
+		if (align)
+			p += (-(p + lead - (char *)0)) & (PCACHE_ALIGN - 1);
+		((void **)p)[-1] = raw;
+		return p;
+	}
+	__device__ static void *HeapBase(void *p) { return (p ? ((void **)p)[-1] : nullptr); }
+#else
+#define HeapAlloc(bytes, lead, align) SysEx::Alloc(bytes)
+#define HeapBase(p) (p)
+#endif
+
 	__device__ void BufferSetup(void *buffer, int size, int n)
 	{
 		if (_pcache1.IsInit)
 		{
+#if PCACHE_ALIGN
+			// Slots sized in multiples of PCACHE_ALIGN are aligned, giving up the bytes in front of the first aligned one. Other sizes are
+			// taken as they are, as rounding them up would cost up to a page a slot.
+			if (size >= PCACHE_ALIGN && (size & (PCACHE_ALIGN - 1)) == 0)
+			{
+				char *end = &((char *)buffer)[size * n];
+				buffer = (void *)&((char *)buffer)[(-((char *)buffer - (char *)0)) & (PCACHE_ALIGN - 1)];
+				n = (end > (char *)buffer ? (int)((end - (char *)buffer) / size) : 0);
+			}
+#endif
 			size = SysEx_ROUNDDOWN8(size);
 			_pcache1.SizeSlot = size;
 			_pcache1.Slots = _pcache1.FreeSlots = n;
@@ -138,17 +287,17 @@ namespace Core
 		if (!p)
 		{
 			// Memory is not available in the SQLITE_CONFIG_PAGECACHE pool.  Get it from sqlite3Malloc instead.
-			p = SysEx::Alloc(bytes);
+			p = HeapAlloc(bytes, 0, bytes >= PCACHE_ALIGN);
 #ifndef DISABLE_PAGECACHE_OVERFLOW_STATS
 			if (p)
 			{
-				int size = SysEx::AllocSize(p);
+				int size = SysEx::AllocSize(HeapBase(p));
 				MutexEx::Enter(_pcache1.Mutex);
 				StatusEx::StatusAdd(StatusEx::STATUS_PAGECACHE_OVERFLOW, size);
 				MutexEx::Leave(_pcache1.Mutex);
 			}
 #endif
-			SysEx::MemdebugSetType(p, SysEx::MEMTYPE_PCACHE);
+			SysEx::MemdebugSetType(HeapBase(p), SysEx::MEMTYPE_PCACHE);
 		}
 		return p;
 	}
@@ -172,6 +321,7 @@ namespace Core
 		}
 		else
 		{
+			p = HeapBase(p);
 			_assert(SysEx::MemdebugHasType(p, SysEx::MEMTYPE_PCACHE));
 			SysEx::MemdebugSetType(p, SysEx::MEMTYPE_HEAP);
 			freed = SysEx::AllocSize(p);
@@ -185,64 +335,235 @@ namespace Core
 		return freed;
 	}
 
-#ifdef ENABLE_MEMORY_MANAGEMENT
-	__device__ static int MemSize(void *p)
+#pragma endregion
+
+#pragma region Slabs
+
+	// Page buffers of a slab start this far into it. HeapAlloc() aligns them rather than the slab, so the header takes none of the padding
+#define PCACHE1_SLABHDR SysEx_ROUND8((int)sizeof(PSlab))
+
+	// Returns the size class of pages of sizePage bytes with sizeExtra bytes of extra space, adding it if there is none, or null once every
+	// class is taken by other sizes.
+	__device__ static PSlabClass *SlabClass(int sizePage, int sizeExtra)
 	{
-		if (p >= _pcache1.Start && p < _pcache1.End)
-			return _pcache1.SizeSlot;
+		PSlabClass *c = nullptr;
+		MutexEx::Enter(_pcache1.Mutex);
+		for (int i = 0; i < PCACHE1_CLASSES && !c; i++)
+		{
+			PSlabClass *x = &_pcache1.Classes[i];
+			if (x->SizePage == 0)
+			{
+				x->SizeExtra = sizeExtra;
+				x->SizeHdr = SysEx_ROUND8((int)sizeof(PgHdr1) + sizeExtra);
+				x->Blocks = (sizePage < PCACHE1_SLAB ? PCACHE1_SLAB / sizePage : 1);
+				x->SizePage = sizePage;
+			}
+			if (x->SizePage == sizePage && x->SizeExtra == sizeExtra)
+				c = x;
+		}
+		MutexEx::Leave(_pcache1.Mutex);
+		return c;
+	}
+
+	__device__ static void SlabLink(PSlabClass *c, PSlab *slab)
+	{
+		slab->Prev = nullptr;
+		slab->Next = c->Partial;
+		if (c->Partial)
+			c->Partial->Prev = slab;
+		c->Partial = slab;
+	}
+
+	__device__ static void SlabUnlink(PSlabClass *c, PSlab *slab)
+	{
+		if (slab->Prev)
+			slab->Prev->Next = slab->Next;
+		else
+			c->Partial = slab->Next;
+		if (slab->Next)
+			slab->Next->Prev = slab->Prev;
+	}
+
+	// Returns slab to the heap, and the bytes of the slab that gave back.
+	__device__ static int SlabRelease(PSlab *slab)
+	{
+		if (!slab)
+			return 0;
+		PSlabClass *c = slab->Class;
+		void *p = HeapBase(slab);
 		_assert(SysEx::MemdebugHasType(p, SysEx::MEMTYPE_PCACHE));
 		SysEx::MemdebugSetType(p, SysEx::MEMTYPE_HEAP);
+#ifndef DISABLE_PAGECACHE_OVERFLOW_STATS
 		int size = SysEx::AllocSize(p);
-		SysEx::MemdebugSetType(p, SysEx::MEMTYPE_PCACHE);
-		return size;
+		MutexEx::Enter(_pcache1.Mutex);
+		StatusEx::StatusAdd(StatusEx::STATUS_PAGECACHE_OVERFLOW, -size);
+		MutexEx::Leave(_pcache1.Mutex);
+#endif
+		SysEx::Free(p);
+		return PCACHE1_SLABHDR + c->Blocks * (c->SizePage + c->SizeHdr);
 	}
+
+	__device__ static PgHdr1 *SlabAlloc(PSlabClass *c)
+	{
+		MutexEx::Enter(c->Mutex);
+		PSlab *slab = c->Partial;
+		if (!slab && c->Empty)
+		{
+			slab = c->Empty;
+			c->Empty = nullptr;
+			SlabLink(c, slab);
+		}
+		if (!slab)
+		{
+			// Allocating may call ReleaseMemory(), which frees pages into this class, so the class mutex is let go meanwhile.
+			MutexEx::Leave(c->Mutex);
+			slab = (PSlab *)HeapAlloc(PCACHE1_SLABHDR + c->Blocks * (c->SizePage + c->SizeHdr), PCACHE1_SLABHDR, c->SizePage >= PCACHE_ALIGN);
+			if (!slab)
+				return nullptr;
+			SysEx::MemdebugSetType(HeapBase(slab), SysEx::MEMTYPE_PCACHE);
+#ifndef DISABLE_PAGECACHE_OVERFLOW_STATS
+			int size = SysEx::AllocSize(HeapBase(slab));
+			MutexEx::Enter(_pcache1.Mutex);
+			StatusEx::StatusAdd(StatusEx::STATUS_PAGECACHE_OVERFLOW, size);
+			MutexEx::Leave(_pcache1.Mutex);
 #endif
+			slab->Class = c;
+			slab->Free = nullptr;
+			slab->Carved = 0;
+			slab->Used = 0;
+			MutexEx::Enter(c->Mutex);
+			SlabLink(c, slab);
+		}
+		PgHdr1 *p = slab->Free;
+		if (p)
+			slab->Free = p->LruNext;
+		else
+		{
+			char *buffers = &((char *)slab)[PCACHE1_SLABHDR];
+			p = (PgHdr1 *)&buffers[c->Blocks * c->SizePage + slab->Carved * c->SizeHdr];
+			p->Page.Buffer = &buffers[slab->Carved * c->SizePage];
+			p->Page.Extra = &p[1];
+			p->Slab = slab;
+			slab->Carved++;
+		}
+		if (++slab->Used == c->Blocks)
+			SlabUnlink(c, slab);
+		MutexEx::Leave(c->Mutex);
+		return p;
+	}
+
+	// Returns the block of p to its slab, and the bytes returned to the heap: none, unless a slab was given up.
+	__device__ static int SlabFree(PgHdr1 *p)
+	{
+		PSlab *slab = p->Slab;
+		PSlabClass *c = slab->Class;
+		MutexEx::Enter(c->Mutex);
+		if (slab->Used == c->Blocks)
+			SlabLink(c, slab);
+		p->LruNext = slab->Free;
+		slab->Free = p;
+		PSlab *release = nullptr;
+		if (--slab->Used == 0)
+		{
+			// Keep the slab just emptied, as its memory is the more likely to be in cache, and return the one kept before.
+			SlabUnlink(c, slab);
+			release = c->Empty;
+			c->Empty = slab;
+		}
+		MutexEx::Leave(c->Mutex);
+		return SlabRelease(release);
+	}
 
-	__device__ static PgHdr1 *AllocPage(PCache1 *cache)
+	// Returns to the heap the empty slab each class keeps, and the bytes that gave back.
+	__device__ static int SlabTrim()
 	{
-		// The group mutex must be released before pcache1Alloc() is called. This is because it may call sqlite3_release_memory(), which assumes that this mutex is not held.
-		_assert(MutexEx::Held(cache->Group->Mutex));
-		MutexEx::Leave(cache->Group->Mutex);
+		int freed = 0;
+		for (int i = 0; i < PCACHE1_CLASSES && _pcache1.Classes[i].SizePage; i++)
+		{
+			PSlabClass *c = &_pcache1.Classes[i];
+			MutexEx::Enter(c->Mutex);
+			PSlab *release = c->Empty;
+			c->Empty = nullptr;
+			MutexEx::Leave(c->Mutex);
+			freed += SlabRelease(release);
+		}
+		return freed;
+	}
+
+#pragma endregion
+
+#pragma region Pages
+
+	__device__ static PgHdr1 *AllocPage(PCache1 *cache, PGroupStripe *stripe)
+	{
+		// The stripe mutex must be released before pcache1Alloc() is called. This is because it may call sqlite3_release_memory(), which assumes that no group mutex is held.
+		_assert(MutexEx::Held(stripe->Mutex));
+		MutexEx::Leave(stripe->Mutex);
 		PgHdr1 *p = nullptr;
 		void *pg;
-#ifdef PCACHE_SEPARATE_HEADER
-		pg = Alloc(cache->SizePage);
-		p = (PgHdr1 *)SysEx::Alloc(sizeof(PgHdr1) + cache->SizeExtra);
-		if (!pg || !p)
+		PSlabClass *c = cache->Class;
+		// Pages come from the SQLITE_CONFIG_PAGECACHE buffer while it has slots that fit them. FreeSlots is read without the mutex, as only a hint.
+		if (c && !(_pcache1.FreeSlots > 0 && (int)sizeof(PgHdr1) + cache->SizePage + cache->SizeExtra <= _pcache1.SizeSlot))
 		{
-			Free(pg);
-			SysEx::Free(p);
-			pg = nullptr;
+			StatusEx::StatusSet(StatusEx::STATUS_PAGECACHE_SIZE, c->SizePage + c->SizeHdr);
+			p = SlabAlloc(c);
+			pg = (p ? p->Page.Buffer : nullptr);
 		}
+		else
+		{
+#ifdef PCACHE_SEPARATE_HEADER
+			pg = Alloc(cache->SizePage);
+			p = (PgHdr1 *)SysEx::Alloc(sizeof(PgHdr1) + cache->SizeExtra);
+			if (!pg || !p)
+			{
+				Free(pg);
+				SysEx::Free(p);
+				pg = nullptr;
+			}
 #else
-		pg = Alloc(sizeof(PgHdr1) + cache->SizePage + cache->SizeExtra);
-		p = (PgHdr1 *)&((uint8 *)pg)[cache->SizePage];
+			pg = Alloc(sizeof(PgHdr1) + cache->SizePage + cache->SizeExtra);
+			p = (PgHdr1 *)&((uint8 *)pg)[cache->SizePage];
 #endif
-		MutexEx::Enter(cache->Group->Mutex);
+			if (pg)
+			{
+				p->Page.Buffer = pg;
+				p->Page.Extra = &p[1];
+				p->Slab = nullptr;
+			}
+		}
+		MutexEx::Enter(stripe->Mutex);
 		if (pg)
 		{
-			p->Page.Buffer = pg;
-			p->Page.Extra = &p[1];
 			if (cache->Purgeable)
-				cache->Group->CurrentPages++;
+				stripe->CurrentPages++;
 			return p;
 		}
 		return nullptr;
 	}
 
-	__device__ static void FreePage(PgHdr1 *p)
+	// Frees page p, and returns the bytes that gave back to the heap. A page of a slab gives back none until the slab is released.
+	__device__ static int FreePage(PgHdr1 *p)
 	{
+		int freed = 0;
 		if (SysEx_ALWAYS(p))
 		{
 			PCache1 *cache = p->Cache;
-			_assert(MutexEx::Held(p->Cache->Group->Mutex));
-			Free(p->Page.Buffer);
+			PGroupStripe *stripe = &cache->Group->Stripes[PCACHE1_STRIPE(p->ID)];
+			_assert(MutexEx::Held(stripe->Mutex));
+			if (p->Slab)
+				freed = SlabFree(p);
+			else
+			{
+				freed = Free(p->Page.Buffer);
 #ifdef PCACHE_SEPARATE_HEADER
-			SysEx::Free(p);
+				freed += SysEx::AllocSize(p);
+				SysEx::Free(p);
 #endif
+			}
 			if (cache->Purgeable)
-				cache->Group->CurrentPages--;
+				stripe->CurrentPages--;
 		}
+		return freed;
 	}
 
 	__device__ static bool UnderMemoryPressure(PCache1 *cache)
@@ -254,110 +575,358 @@ namespace Core
 
 #pragma region General
 
-	__device__ static int ResizeHash(PCache1 *p)
+	__device__ static uint GroupPages(PGroup *group)
 	{
-		_assert(MutexEx::Held(p->Group->Mutex));
-		uint newLength = p->Hash.length * 2;
-		if (newLength < 256)
-			newLength = 256;
-		MutexEx::Leave(p->Group->Mutex);
-		if (p->Hash.length) SysEx::BeginBenignAlloc();
-		PgHdr1 **newHash = (PgHdr1 **)SysEx::Alloc(sizeof(PgHdr1 *) * newLength, true);
-		if (p->Hash.length) SysEx::EndBenignAlloc();
-		MutexEx::Enter(p->Group->Mutex);
-		if (newHash)
+		// Stripes not held may be changing. That only puts the budget checks out by a page or two, which does no more harm than a late check would
+		uint pages = 0;
+		for (int s = 0; s < PCACHE1_STRIPES; s++)
+			pages += group->Stripes[s].CurrentPages;
+		return pages;
+	}
+
+	__device__ static uint CachePages(PCache1 *p, uint *recyclables)
+	{
+		uint pages = 0;
+		if (recyclables) *recyclables = 0;
+		for (int s = 0; s < PCACHE1_STRIPES; s++)
 		{
-			for (uint i = 0; i < p->Hash.length; i++)
+			pages += p->Pages[s];
+			if (recyclables) *recyclables += p->Recyclables[s];
+		}
+		return pages;
+	}
+
+	__device__ static void EnterStripes(PGroup *group)
+	{
+		for (int s = 0; s < PCACHE1_STRIPES; s++)
+			MutexEx::Enter(group->Stripes[s].Mutex);
+	}
+
+	__device__ static void LeaveStripes(PGroup *group)
+	{
+		for (int s = PCACHE1_STRIPES - 1; s >= 0; s--)
+			MutexEx::Leave(group->Stripes[s].Mutex);
+	}
+
+	// Bit i of the result is set if slot i of the group holds id.
+	__device__ static uint GroupMatch(const PHashGroup *group, Pid id)
+	{
+#if PCACHE1_SSE2
+		__m128i key = _mm_set1_epi32((int)id);
+		__m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&group->IDs[0]), key);
+		__m128i hi = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&group->IDs[4]), key);
+		return (uint)_mm_movemask_ps(_mm_castsi128_ps(lo)) | ((uint)_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4);
+#else
+		uint mask = 0;
+		for (int i = 0; i < PCACHE1_GROUP; i++)
+			if (group->IDs[i] == id)
+				mask |= (1U << i);
+		return mask;
+#endif
+	}
+
+	__device__ static int LowestBit(uint mask)
+	{
+#if defined(__CUDACC__)
+		return __ffs(mask) - 1;
+#elif defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward(&i, mask);
+		return (int)i;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// Group of the stripe where the probe for id starts, out of perStripe, a power of two. IDs of a stripe step by PCACHE1_STRIPES, which the
+	// multiply scatters so strided page numbers do not pile into the same groups.
+	__device__ static uint HashHome(Pid id, uint perStripe)
+	{
+		uint x = (uint)(id / PCACHE1_STRIPES) * 0x9E3779B1U;
+		return ((x ^ (x >> 16)) & (perStripe - 1));
+	}
+
+	// Returns the slot of table hash holding id, with its group in *groupOut, or -1.
+	__device__ static int HashSlot(array_t<PHashGroup> &hash, Pid id, PHashGroup **groupOut)
+	{
+		if (!hash.length)
+			return -1;
+		uint perStripe = hash.length / PCACHE1_STRIPES;
+		uint s = PCACHE1_STRIPE(id);
+		uint k = HashHome(id, perStripe);
+		for (uint n = 0; n < perStripe; n++, k = (k + 1) & (perStripe - 1))
+		{
+			PHashGroup *group = &hash[k * PCACHE1_STRIPES + s];
+			uint match = GroupMatch(group, id);
+			if (match)
 			{
-				PgHdr1 *page;
-				PgHdr1 *next = p->Hash[i];
-				while ((page = next) != 0)
+				*groupOut = group;
+				return LowestBit(match);
+			}
+			if (GroupMatch(group, 0))
+				return -1;
+		}
+		return -1;
+	}
+
+	// Adds a page that is in neither table to Hash, in the first empty or removed slot its probe meets. Returns false if the stripe has none.
+	__device__ static bool HashInsert(PCache1 *p, PgHdr1 *page)
+	{
+		uint perStripe = p->Hash.length / PCACHE1_STRIPES;
+		uint s = PCACHE1_STRIPE(page->ID);
+		_assert(MutexEx::Held(p->Group->Stripes[s].Mutex));
+		uint k = HashHome(page->ID, perStripe);
+		for (uint n = 0; n < perStripe; n++, k = (k + 1) & (perStripe - 1))
+		{
+			PHashGroup *group = &p->Hash[k * PCACHE1_STRIPES + s];
+			uint free = GroupMatch(group, 0) | GroupMatch(group, PCACHE1_TOMB);
+			if (free)
+			{
+				int i = LowestBit(free);
+				if (group->IDs[i] == 0)
+					p->Used[s]++;
+				group->IDs[i] = page->ID;
+				group->Pages[i] = page;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	__device__ static PgHdr1 *HashFind(PCache1 *p, Pid id)
+	{
+		_assert(MutexEx::Held(p->Group->Stripes[PCACHE1_STRIPE(id)].Mutex));
+		PHashGroup *group;
+		int i = HashSlot(p->Hash, id, &group);
+		if (i < 0 && p->OldHash.length)
+			i = HashSlot(p->OldHash, id, &group);
+		return (i >= 0 ? group->Pages[i] : nullptr);
+	}
+
+	__device__ static void HashRemove(PCache1 *p, PgHdr1 *page)
+	{
+		_assert(MutexEx::Held(p->Group->Stripes[PCACHE1_STRIPE(page->ID)].Mutex));
+		PHashGroup *group;
+		int i = HashSlot(p->Hash, page->ID, &group);
+		if (i < 0)
+			i = HashSlot(p->OldHash, page->ID, &group);
+		_assert(i >= 0 && group->Pages[i] == page);
+		group->IDs[i] = PCACHE1_TOMB;
+		group->Pages[i] = nullptr;
+	}
+
+	// Moves up to groups groups of stripe s from OldHash to Hash. Moved slots become removed ones, so lookups still pass them to groups not yet moved.
+	__device__ static void MigrateHash(PCache1 *p, int s, uint groups)
+	{
+		_assert(MutexEx::Held(p->Group->Stripes[s].Mutex));
+		uint perStripe = p->OldHash.length / PCACHE1_STRIPES;
+		while (groups-- > 0 && p->Migrated[s] < perStripe)
+		{
+			PHashGroup *group = &p->OldHash[p->Migrated[s] * PCACHE1_STRIPES + s];
+			for (int i = 0; i < PCACHE1_GROUP; i++)
+				if (group->IDs[i] != 0 && group->IDs[i] != PCACHE1_TOMB)
 				{
-					uint h = (page->ID % newLength);
-					next = page->Next;
-					page->Next = newHash[h];
-					newHash[h] = page;
+					ASSERTONLY(bool inserted =) HashInsert(p, group->Pages[i]);
+					_assert(inserted);
+					group->IDs[i] = PCACHE1_TOMB;
+					group->Pages[i] = nullptr;
 				}
-			}
-			SysEx::Free(p->Hash);
+			if (++p->Migrated[s] == perStripe)
+				p->Migrating--;
+		}
+	}
+
+	// Frees OldHash once every stripe has moved its pages. Other caches may be removing evicted pages from it until every stripe is held.
+	__device__ static void DropOldHash(PCache1 *p)
+	{
+		_assert(p->Migrating == 0);
+		EnterStripes(p->Group);
+		PHashGroup *oldHash = p->OldHash;
+		p->OldHash = nullptr;
+		p->OldHash.length = 0;
+		LeaveStripes(p->Group);
+		SysEx::Free(oldHash);
+	}
+
+	// Past this many slots used, a stripe of Hash is rebuilt, larger if its pages need it, or to clear removed slots if they do not.
+	__device__ static uint HashLimit(PCache1 *p)
+	{
+		return (p->Hash.length / PCACHE1_STRIPES) * PCACHE1_GROUP * 7 / 8;
+	}
+
+	// Starts moving the pages to a new table sized so its fullest stripe fills under 5/8 of it. A move still under way is first finished,
+	// which only happens should the table need to grow again before a Fetch() touched every stripe.
+	__device__ static int ResizeHash(PCache1 *p)
+	{
+		uint maxPages = 0;
+		for (int s = 0; s < PCACHE1_STRIPES; s++)
+			if (p->Pages[s] > maxPages)
+				maxPages = p->Pages[s];
+		uint newLength = (p->Hash.length ? p->Hash.length : PCACHE1_STRIPES * 4);
+		while ((newLength / PCACHE1_STRIPES) * PCACHE1_GROUP * 5 / 8 <= maxPages)
+			newLength *= 2;
+		_assert((newLength % PCACHE1_STRIPES) == 0);
+		if (p->Hash.length) SysEx::BeginBenignAlloc();
+		PHashGroup *newHash = (PHashGroup *)SysEx::Alloc(sizeof(PHashGroup) * newLength, true);
+		if (p->Hash.length) SysEx::EndBenignAlloc();
+		if (!newHash)
+			return RC::NOMEM;
+		EnterStripes(p->Group);
+		PHashGroup *oldHash = p->OldHash;
+		if (p->OldHash.length)
+		{
+			// Finish the last move into the new table, so there are never more than two.
+			PHashGroup *hash = p->Hash;
+			uint length = p->Hash.length;
 			p->Hash = newHash;
 			p->Hash.length = newLength;
+			_memset(p->Used, 0, sizeof(p->Used));
+			for (int s = 0; s < PCACHE1_STRIPES; s++)
+				MigrateHash(p, s, p->OldHash.length / PCACHE1_STRIPES);
+			_assert(p->Migrating == 0);
+			p->Hash = hash;
+			p->Hash.length = length;
 		}
-		return (p->Hash ? RC::OK : RC::NOMEM);
+		else
+			_memset(p->Used, 0, sizeof(p->Used));
+		p->OldHash = p->Hash;
+		p->OldHash.length = p->Hash.length;
+		p->Hash = newHash;
+		p->Hash.length = newLength;
+		_memset(p->Migrated, 0, sizeof(p->Migrated));
+		p->Migrating = (p->OldHash.length ? PCACHE1_STRIPES : 0);
+		LeaveStripes(p->Group);
+		SysEx::Free(oldHash);
+		return RC::OK;
 	}
 
-	__device__ static void PinPage(PgHdr1 *page)
+	// Takes the page off the list of unpinned pages it is on, if any. Returns true if it was on one.
+	__device__ static bool PinPage(PgHdr1 *page)
 	{
 		if (page == nullptr)
-			return;
+			return false;
 		PCache1 *cache = page->Cache;
-		PGroup *group = cache->Group;
-		_assert(MutexEx::Held(group->Mutex));
-		if (page->LruNext || page == group->LruTail)
+		PGroupStripe *stripe = &cache->Group->Stripes[PCACHE1_STRIPE(page->ID)];
+		_assert(MutexEx::Held(stripe->Mutex));
+		PgHdr1 **head = (page->Frequent ? &stripe->FreqHead : &stripe->LruHead);
+		PgHdr1 **tail = (page->Frequent ? &stripe->FreqTail : &stripe->LruTail);
+		if (page->LruNext || page == *tail)
 		{
 			if (page->LruPrev)
 				page->LruPrev->LruNext = page->LruNext;
 			if (page->LruNext)
 				page->LruNext->LruPrev = page->LruPrev;
-			if (group->LruHead == page)
-				group->LruHead = page->LruNext;
-			if (group->LruTail == page)
-				group->LruTail = page->LruPrev;
+			if (*head == page)
+				*head = page->LruNext;
+			if (*tail == page)
+				*tail = page->LruPrev;
 			page->LruNext = 0;
 			page->LruPrev = 0;
-			page->Cache->Recyclables--;
+			if (page->Frequent)
+				stripe->Frequents--;
+			else
+				stripe->Recents--;
+			page->Cache->Recyclables[PCACHE1_STRIPE(page->ID)]--;
+			return true;
+		}
+		return false;
+	}
+
+	// The unpinned page of the stripe to evict next: the least recently used page used once, unless the pages used once are no more than the
+	// target, or there are none.
+	__device__ static PgHdr1 *StripeVictim(PGroupStripe *stripe)
+	{
+		_assert(MutexEx::Held(stripe->Mutex));
+		if (stripe->FreqTail && (!stripe->LruTail || stripe->Recents <= stripe->Target))
+			return stripe->FreqTail;
+		return stripe->LruTail;
+	}
+
+	// Remembers an unpinned page about to be evicted as a ghost of its cache, if the cache keeps ghosts.
+	__device__ static void GhostPage(PgHdr1 *page)
+	{
+		PCache1 *cache = page->Cache;
+		_assert(MutexEx::Held(cache->Group->Stripes[PCACHE1_STRIPE(page->ID)].Mutex));
+		if (cache->Ghosts.length)
+		{
+			PGhost *ghost = &cache->Ghosts[page->ID & (cache->Ghosts.length - 1)];
+			ghost->ID = page->ID;
+			ghost->Frequent = page->Frequent;
 		}
 	}
 
 	__device__ static void RemoveFromHash(PgHdr1 *page)
 	{
 		PCache1 *cache = page->Cache;
-		_assert(MutexEx::Held(cache->Group->Mutex));
-		uint h = (page->ID % cache->Hash.length);
-		PgHdr1 **pp;
-		for (pp = &cache->Hash[h]; (*pp) != page; pp = &(*pp)->Next);
-		*pp = (*pp)->Next;
-		cache->Pages--;
+		HashRemove(cache, page);
+		cache->Pages[PCACHE1_STRIPE(page->ID)]--;
 	}
 
 	__device__ static void EnforceMaxPage(PGroup *group)
 	{
 		_assert(MutexEx::Held(group->Mutex));
-		while (group->CurrentPages > group->MaxPages && group->LruTail)
+		// Take the least recently used page of each stripe in turn, so the pages kept stay spread over the stripes. Give up once a full
+		// round found every LRU list empty.
+		int emptys = 0;
+		while (emptys < PCACHE1_STRIPES && GroupPages(group) > group->MaxPages)
 		{
-			PgHdr1 *p = group->LruTail;
-			_assert(p->Cache->Group == group);
-			PinPage(p);
-			RemoveFromHash(p);
-			FreePage(p);
+			PGroupStripe *stripe = &group->Stripes[group->Evict++ & (PCACHE1_STRIPES - 1)];
+			MutexEx::Enter(stripe->Mutex);
+			PgHdr1 *p = StripeVictim(stripe);
+			if (p)
+			{
+				_assert(p->Cache->Group == group);
+				GhostPage(p);
+				PinPage(p);
+				RemoveFromHash(p);
+				FreePage(p);
+				emptys = 0;
+			}
+			else
+				emptys++;
+			MutexEx::Leave(stripe->Mutex);
 		}
 	}
 
 	__device__ static void TruncateUnsafe(PCache1 *p, Pid limit)
 	{
+		for (int i = 0; i < PCACHE1_PINNED; i++)
+			if (p->Pinned[i] && p->Pinned[i]->ID >= limit)
+				p->Pinned[i] = nullptr;
 		ASSERTONLY(uint pages = 0;)
-			_assert(MutexEx::Held(p->Group->Mutex));
-		for (uint h = 0; h < p->Hash.length; h++)
+		for (int s = 0; s < PCACHE1_STRIPES; s++)
 		{
-			PgHdr1 **pp = &p->Hash[h]; 
-			PgHdr1 *page;
-			while ((page = *pp) != 0)
+			MutexEx::Enter(p->Group->Stripes[s].Mutex);
+			for (int t = 0; t < 2; t++)
 			{
-				if (page->ID >= limit)
+				array_t<PHashGroup> &hash = (t ? p->OldHash : p->Hash);
+				for (uint h = s; h < hash.length; h += PCACHE1_STRIPES)
 				{
-					p->Pages--;
-					*pp = page->Next;
-					PinPage(page);
-					FreePage(page);
-				}
-				else
-				{
-					pp = &page->Next;
-					ASSERTONLY(pages++;)
+					PHashGroup *group = &hash[h];
+					for (int i = 0; i < PCACHE1_GROUP; i++)
+					{
+						if (group->IDs[i] == 0 || group->IDs[i] == PCACHE1_TOMB)
+							continue;
+						if (group->IDs[i] >= limit)
+						{
+							PgHdr1 *page = group->Pages[i];
+							p->Pages[s]--;
+							group->IDs[i] = PCACHE1_TOMB;
+							group->Pages[i] = nullptr;
+							PinPage(page);
+							FreePage(page);
+						}
+						else
+							ASSERTONLY(pages++;)
+					}
 				}
 			}
+			for (uint g = s; g < p->Ghosts.length; g += PCACHE1_STRIPES)
+				if (p->Ghosts[g].ID >= limit)
+					p->Ghosts[g].ID = 0;
+			MutexEx::Leave(p->Group->Stripes[s].Mutex);
 		}
-		_assert(p->Pages == pages);
+		_assert(CachePages(p, nullptr) == pages);
 	}
 
 #pragma endregion
@@ -370,9 +939,13 @@ namespace Core
 	{
 		_assert(!_pcache1.IsInit);
 		_memset(&_pcache1, 0, sizeof(_pcache1));
-		if (_config_coreMutex)
+		if (MutexEx::WantsCoreMutex())
 		{
 			_pcache1.Group.Mutex = MutexEx::Alloc(MutexEx::MUTEX_STATIC_LRU);
+			for (int s = 0; s < PCACHE1_STRIPES; s++)
+				_pcache1.Group.Stripes[s].Mutex = MutexEx::Alloc(MutexEx::MUTEX_FAST);
+			for (int i = 0; i < PCACHE1_CLASSES; i++)
+				_pcache1.Classes[i].Mutex = MutexEx::Alloc(MutexEx::MUTEX_FAST);
 			_pcache1.Mutex = MutexEx::Alloc(MutexEx::MUTEX_STATIC_PMEM);
 		}
 		_pcache1.Group.MaxPinned = 10;
@@ -383,6 +956,14 @@ namespace Core
 	__device__ void PCache1::Shutdown()
 	{
 		_assert(_pcache1.IsInit);
+		for (int s = 0; s < PCACHE1_STRIPES; s++)
+			MutexEx::Free(_pcache1.Group.Stripes[s].Mutex);
+		SlabTrim();
+		for (int i = 0; i < PCACHE1_CLASSES; i++)
+		{
+			_assert(_pcache1.Classes[i].Partial == nullptr);
+			MutexEx::Free(_pcache1.Classes[i].Mutex);
+		}
 		_memset(&_pcache1, 0, sizeof(_pcache1));
 	}
 
@@ -396,7 +977,7 @@ namespace Core
 #if defined(ENABLE_MEMORY_MANAGEMENT) || THREADSAFE == 0
 		const bool separateCache = false;
 #else
-		bool separateCache = _config_coreMutex > 0;
+		bool separateCache = MutexEx::WantsCoreMutex();
 #endif
 		_assert((sizePage & (sizePage - 1)) == 0 && sizePage >= 512 && sizePage <= 65536);
 		_assert(sizeExtra < 300);
@@ -416,6 +997,7 @@ namespace Core
 			cache->Group = group;
 			cache->SizePage = sizePage;
 			cache->SizeExtra = sizeExtra;
+			cache->Class = SlabClass(sizePage, sizeExtra);
 			cache->Purgeable = purgeable;
 			if (purgeable)
 			{
@@ -455,14 +1037,15 @@ namespace Core
 			EnforceMaxPage(group);
 			group->MaxPages = savedMaxPages;
 			MutexEx::Leave(group->Mutex);
+			SlabTrim();
 		}
 	}
 
 	__device__ int PCache1::get_Pages()
 	{
-		MutexEx::Enter(Group->Mutex);
-		int pages = Pages;
-		MutexEx::Leave(Group->Mutex);
+		EnterStripes(Group);
+		int pages = (int)CachePages(this, nullptr);
+		LeaveStripes(Group);
 		return pages;
 	}
 
@@ -471,46 +1054,52 @@ namespace Core
 		_assert(Purgeable || !createFlag);
 		_assert(Purgeable || Min == 0);
 		_assert(!Purgeable || Min == 10);
-		PGroup *group;
-		MutexEx::Enter((group = Group)->Mutex);
+
+		// Step 0: A page this cache has pinned needs no mutex to find.
+		PgHdr1 *page = Pinned[id & (PCACHE1_PINNED - 1)];
+		if (page && page->ID == id)
+			return &page->Page;
+
+		// Grow the hash table before entering the stripe, as growing it takes every stripe. If it cannot grow, Step 3 notices should a page be added.
+		int s = PCACHE1_STRIPE(id);
+		if (OldHash.length && !Migrating)
+			DropOldHash(this);
+		if (createFlag && Used[s] >= HashLimit(this))
+			ResizeHash(this);
+		PGroup *group = Group;
+		PGroupStripe *stripe = &group->Stripes[s];
+		MutexEx::Enter(stripe->Mutex);
+		if (Migrated[s] < OldHash.length / PCACHE1_STRIPES)
+			MigrateHash(this, s, PCACHE1_MIGRATE);
 
 		// Step 1: Search the hash table for an existing entry.
-		PgHdr1 *page = nullptr;
-		if (Hash.length > 0)
-		{
-			uint h = (id % Hash.length);
-			for (page = Hash[h]; page && page->ID != id; page = page->Next) ;
-		}
+		page = HashFind(this, id);
 
 		// Step 2: Abort if no existing page is found and createFlag is 0
-		uint pinned;
+		uint pages, recyclables, pinned;
 		if (page || !createFlag)
 		{
-			PinPage(page);
+			if (PinPage(page) && Policy == POLICY_ARC)
+				page->Frequent = true;
 			goto fetch_out;
 		}
 
-		// The pGroup local variable will normally be initialized by the pcache1EnterMutex() macro above.  But if SQLITE_MUTEX_OMIT is defined,
-		// then pcache1EnterMutex() is a no-op, so we have to initialize the local variable here.  Delaying the initialization of pGroup is an
-		// optimization:  The common case is to exit the module before reaching this point.
-#ifdef MUTEX_OMIT
-		group = cache->Group;
-#endif
-
-		// Step 3: Abort if createFlag is 1 but the cache is nearly full
-		_assert(Pages >= Recyclables);
-		pinned = Pages - Recyclables;	
-		_assert(group->MaxPinned == group->MaxPages + 10 - group->MinPages);
+		// Step 3: Abort if createFlag is 1 but the cache is nearly full, or its hash table is full. The counts of other stripes, and the group's
+		// budget, are read without their mutexes, and may be a page or two out.
+		pages = CachePages(this, &recyclables);
+		_assert(pages >= recyclables);
+		pinned = pages - recyclables;	
 		_assert(N90pct == Max * 9 / 10);
 		if (createFlag && (pinned >= group->MaxPinned || pinned >= N90pct || UnderMemoryPressure(this)))
 			goto fetch_out;
-		if (Pages >= Hash.length && ResizeHash(this))
+		if (Used[s] >= HashLimit(this))
 			goto fetch_out;
 
-		// Step 4. Try to recycle a page.
-		if (Purgeable && group->LruTail && ((Pages + 1 >= Max) || group->CurrentPages >= group->MaxPages || UnderMemoryPressure(this)))
+		// Step 4. Try to recycle a page of the stripe. When it has no unpinned page while another stripe has, the group goes over its
+		// budget for a while, until Unpin() frees pages to bring it back.
+		if (Purgeable && (page = StripeVictim(stripe)) != nullptr && ((pages + 1 >= Max) || GroupPages(group) >= group->MaxPages || UnderMemoryPressure(this)))
 		{
-			page = group->LruTail;
+			GhostPage(page);
 			RemoveFromHash(page);
 			PinPage(page);
 			PCache1 *other = page->Cache;
@@ -527,33 +1116,58 @@ namespace Core
 				page = nullptr;
 			}
 			else
-				group->CurrentPages -= (other->Purgeable - Purgeable);
+				stripe->CurrentPages -= (other->Purgeable - Purgeable);
 		}
+		else
+			page = nullptr;
 
 		// Step 5. If a usable page buffer has still not been found, attempt to allocate a new one. 
 		if (!page)
 		{
 			if (createFlag) SysEx::BeginBenignAlloc();
-			page = AllocPage(this);
+			page = AllocPage(this, stripe);
 			if (createFlag) SysEx::EndBenignAlloc();
 		}
 		if (page)
 		{
-			uint h = (id % Hash.length);
-			Pages++;
+			Pages[s]++;
 			page->ID = id;
-			page->Next = Hash[h];
 			page->Cache = this;
 			page->LruPrev = nullptr;
 			page->LruNext = nullptr;
+			page->Frequent = false;
 			*(void **)page->Page.Extra = nullptr;
-			Hash[h] = page;
+			ASSERTONLY(bool inserted =) HashInsert(this, page);
+			_assert(inserted);
+			// A page this cache evicted not long ago comes back as a frequent page, and moves the stripe's target toward the list it left.
+			PGhost *ghost = (Ghosts.length ? &Ghosts[id & (Ghosts.length - 1)] : nullptr);
+			if (ghost && ghost->ID == id)
+			{
+				if (ghost->Frequent)
+				{
+					Stats.GhostFrequent++;
+					if (stripe->Target > 0)
+						stripe->Target--;
+				}
+				else
+				{
+					Stats.GhostRecent++;
+					if (stripe->Target < stripe->CurrentPages)
+						stripe->Target++;
+				}
+				ghost->ID = 0;
+				page->Frequent = true;
+			}
 		}
 
 fetch_out:
-		if (page && id > MaxID)
-			MaxID = id;
-		MutexEx::Leave(group->Mutex);
+		if (page)
+		{
+			if (id > MaxID)
+				MaxID = id;
+			Pinned[id & (PCACHE1_PINNED - 1)] = page;
+		}
+		MutexEx::Leave(stripe->Mutex);
 		return &page->Page;
 	}
 
@@ -562,32 +1176,46 @@ fetch_out:
 		PgHdr1 *page = (PgHdr1 *)pg;
 		PGroup *group = Group;
 		_assert(page->Cache == this);
-		MutexEx::Enter(group->Mutex);
+		// An unpinned page may be evicted by another cache, so it must leave Pinned[] first.
+		if (Pinned[page->ID & (PCACHE1_PINNED - 1)] == page)
+			Pinned[page->ID & (PCACHE1_PINNED - 1)] = nullptr;
+		int s = PCACHE1_STRIPE(page->ID);
+		PGroupStripe *stripe = &group->Stripes[s];
+		MutexEx::Enter(stripe->Mutex);
 		// It is an error to call this function if the page is already part of the PGroup LRU list.
 		_assert(page->LruPrev == nullptr && page->LruNext == nullptr);
-		_assert(group->LruHead != page && group->LruTail != page);
-		if (reuseUnlikely || group->CurrentPages > group->MaxPages)
+		_assert(stripe->LruHead != page && stripe->LruTail != page);
+		_assert(stripe->FreqHead != page && stripe->FreqTail != page);
+		if (reuseUnlikely || GroupPages(group) > group->MaxPages)
 		{
+			if (!reuseUnlikely)
+				GhostPage(page);
 			RemoveFromHash(page);
 			FreePage(page);
 		}
 		else
 		{
-			// Add the page to the PGroup LRU list.
-			if (group->LruHead)
+			// Add the page to the head of the list of its stripe its use says.
+			PgHdr1 **head = (page->Frequent ? &stripe->FreqHead : &stripe->LruHead);
+			PgHdr1 **tail = (page->Frequent ? &stripe->FreqTail : &stripe->LruTail);
+			if (*head)
 			{
-				group->LruHead->LruPrev = page;
-				page->LruNext = group->LruHead;
-				group->LruHead = page;
+				(*head)->LruPrev = page;
+				page->LruNext = *head;
+				*head = page;
 			}
 			else
 			{
-				group->LruTail = page;
-				group->LruHead = page;
+				*tail = page;
+				*head = page;
 			}
-			Recyclables++;
+			if (page->Frequent)
+				stripe->Frequents++;
+			else
+				stripe->Recents++;
+			Recyclables[s]++;
 		}
-		MutexEx::Leave(Group->Mutex);
+		MutexEx::Leave(stripe->Mutex);
 	}
 
 	__device__ void PCache1::Rekey(ICachePage *pg, Pid old, Pid new_)
@@ -595,30 +1223,45 @@ fetch_out:
 		PgHdr1 *page = (PgHdr1 *)pg;
 		_assert(page->ID == old);
 		_assert(page->Cache == this);
-		MutexEx::Enter(Group->Mutex);
-		uint h = (old % Hash.length);
-		PgHdr1 **pp = &Hash[h];
-		while ((*pp) != page)
-			pp = &(*pp)->Next;
-		*pp = page->Next;
-		h = (new_ % Hash.length);
+		// The page is pinned, so it is on no LRU list, but it moves between stripes when its ID does. Take both, in order.
+		int olds = PCACHE1_STRIPE(old);
+		int news = PCACHE1_STRIPE(new_);
+		PGroupStripe *stripes = Group->Stripes;
+		MutexEx::Enter(stripes[olds < news ? olds : news].Mutex);
+		if (olds != news) MutexEx::Enter(stripes[olds < news ? news : olds].Mutex);
+		// The stripe of new_ is never full: Fetch() grows the table before a stripe reaches HashLimit(), which leaves an eighth of its slots.
+		HashRemove(this, page);
 		page->ID = new_;
-		page->Next = Hash[h];
-		Hash[h] = page;
+		ASSERTONLY(bool inserted =) HashInsert(this, page);
+		_assert(inserted);
+		if (olds != news)
+		{
+			Pages[olds]--;
+			Pages[news]++;
+			if (Purgeable)
+			{
+				stripes[olds].CurrentPages--;
+				stripes[news].CurrentPages++;
+			}
+		}
 		if (new_ > MaxID)
 			MaxID = new_;
-		MutexEx::Leave(Group->Mutex);
+		if (olds != news) MutexEx::Leave(stripes[olds < news ? news : olds].Mutex);
+		MutexEx::Leave(stripes[olds < news ? olds : news].Mutex);
+		if (Pinned[old & (PCACHE1_PINNED - 1)] == page)
+			Pinned[old & (PCACHE1_PINNED - 1)] = nullptr;
+		Pinned[new_ & (PCACHE1_PINNED - 1)] = page;
 	}
 
 	__device__ void PCache1::Truncate(Pid limit)
 	{
-		MutexEx::Enter(Group->Mutex);
+		// MaxID is only touched by this cache's own calls, and TruncateUnsafe() takes the stripes itself.
 		if (limit <= MaxID)
 		{
 			TruncateUnsafe(this, limit);
 			MaxID = limit - 1;
+			SlabTrim();
 		}
-		MutexEx::Leave(Group->Mutex);
 	}
 
 	__device__ void PCache1::Destroy(IPCache *p)
@@ -636,9 +1279,50 @@ fetch_out:
 		EnforceMaxPage(group);
 		MutexEx::Leave(group->Mutex);
 		SysEx::Free(cache->Hash);
+		SysEx::Free(cache->OldHash);
+		SysEx::Free(cache->Ghosts);
 		SysEx::Free(cache);
 	}
 
+	// POLICY_ARC needs a slot for a ghost per page the cache may hold, up to PCACHE1_GHOSTS, and returns false if it cannot have them. Pages
+	// already on the frequent lists when a cache returns to POLICY_LRU stay there until they are evicted.
+	__device__ bool PCache1::SetPolicy(POLICY policy)
+	{
+		if (policy != POLICY_LRU && policy != POLICY_ARC)
+			return false;
+		PGhost *ghosts = nullptr;
+		uint length = 0;
+		if (policy == POLICY_ARC)
+		{
+			if (Ghosts.length)
+			{
+				Policy = policy;
+				return true;
+			}
+			for (length = 64; length < Max && length < PCACHE1_GHOSTS; length *= 2) { }
+			_assert((length % PCACHE1_STRIPES) == 0);
+			ghosts = (PGhost *)SysEx::Alloc(sizeof(PGhost) * length, true);
+			if (!ghosts)
+				return false;
+		}
+		// Other caches write ghosts while holding a stripe, so the table changes with every stripe held.
+		EnterStripes(Group);
+		PGhost *oldGhosts = Ghosts;
+		Ghosts = ghosts;
+		Ghosts.length = length;
+		Policy = policy;
+		LeaveStripes(Group);
+		SysEx::Free(oldGhosts);
+		return true;
+	}
+
+	__device__ void PCache1::GetPolicyStats(PolicyStats *stats, bool reset)
+	{
+		*stats = Stats;
+		if (reset)
+			_memset(&Stats, 0, sizeof(PolicyStats));
+	}
+
 #ifdef ENABLE_MEMORY_MANAGEMENT
 	__device__ int PCache::ReleaseMemory(int required)
 	{
@@ -648,18 +1332,21 @@ fetch_out:
 		if (_pcache1.Start == nullptr)
 		{
 			PgHdr1 *p;
-			MutexEx::Enter(_pcache1.Group.Mutex);
-			while ((required < 0 || free < required) && ((p = _pcache1.Group.LruTail) != nullptr))
+			for (int s = 0; s < PCACHE1_STRIPES && (required < 0 || free < required); s++)
 			{
-				free += MemSize(p->Page.Buffer);
-#ifdef PCACHE_SEPARATE_HEADER
-				free += MemSize(p);
-#endif
-				PinPage(p);
-				RemoveFromHash(p);
-				FreePage(p);
+				PGroupStripe *stripe = &_pcache1.Group.Stripes[s];
+				MutexEx::Enter(stripe->Mutex);
+				// Only memory the heap gets back counts: a page of a slab frees nothing until the whole slab does.
+				while ((required < 0 || free < required) && ((p = StripeVictim(stripe)) != nullptr))
+				{
+					GhostPage(p);
+					PinPage(p);
+					RemoveFromHash(p);
+					free += FreePage(p);
+				}
+				MutexEx::Leave(stripe->Mutex);
 			}
-			MutexEx::Leave(_pcache1.Group.Mutex);
+			free += SlabTrim();
 		}
 		return free;
 	}
@@ -673,9 +1360,14 @@ fetch_out:
 	__device__ void PCache1_testStats(uint *current, uint *max, uint *min, uint *recyclables)
 	{
 		uint recyclables2 = 0;
-		for (PgHdr1 *p = _pcache1.Group.LruHead; p; p = p->LruNext)
-			recyclables2++;
-		*current = _pcache1.Group.CurrentPages;
+		for (int s = 0; s < PCACHE1_STRIPES; s++)
+		{
+			for (PgHdr1 *p = _pcache1.Group.Stripes[s].LruHead; p; p = p->LruNext)
+				recyclables2++;
+			for (PgHdr1 *p = _pcache1.Group.Stripes[s].FreqHead; p; p = p->LruNext)
+				recyclables2++;
+		}
+		*current = GroupPages(&_pcache1.Group);
 		*max = _pcache1.Group.MaxPages;
 		*min = _pcache1.Group.MinPages;
 		*recyclables = recyclables2;
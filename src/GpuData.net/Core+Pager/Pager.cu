@@ -23,6 +23,24 @@ namespace Core
 #define MAX_PAGE_COUNT 1073741823
 	// pager.h
 #define DEFAULT_JOURNAL_SIZE_LIMIT -1
+#ifndef DEFAULT_MMAP_SIZE
+#define DEFAULT_MMAP_SIZE 0
+#endif
+#ifndef PAGER_ASYNC_PAGES
+#define PAGER_ASYNC_PAGES 32
+#endif
+#ifndef PAGER_MAX_IOVECS
+#define PAGER_MAX_IOVECS 64
+#endif
+#ifndef PAGER_SPILL_BATCH // Dirty pages written by one cache spill, unless changed by SetSpillBatch()
+#define PAGER_SPILL_BATCH 16
+#endif
+#ifndef PAGER_PLAYBACK_CHUNK // Journal records read by one call during a hot-journal rollback
+#define PAGER_PLAYBACK_CHUNK 64
+#endif
+#ifndef PAGER_HOLE_MIN // Shortest run of zeros in an encoded page that is punched out of the file rather than written. About a file system block
+#define PAGER_HOLE_MIN 4096
+#endif
 
 #ifdef HAS_CODEC
 #define CODEC1(p, d, n, x, e) \
@@ -55,6 +73,10 @@ namespace Core
 		STAT_HIT = 0,
 		STAT_MISS = 1,
 		STAT_WRITE = 2,
+		STAT_SPILL = 3,
+		STAT_SPILL_PAGES = 4,
+		STAT_GHOST_RECENT = 5,
+		STAT_GHOST_FREQUENT = 6,
 	};
 
 #ifdef TEST
@@ -72,6 +94,12 @@ namespace Core
 
 #define MAX_PID 2147483647
 
+#ifdef HAS_CODEC
+#define UseFetch(p) ((p)->SizeMmap > 0 && (p)->Codec == nullptr)
+#else
+#define UseFetch(p) ((p)->SizeMmap > 0)
+#endif
+
 #ifndef OMIT_WAL
 	__device__ static int UseWal(Pager *pager) { return (pager->Wal != nullptr); }
 #else
@@ -155,7 +183,7 @@ namespace Core
 				// It is possible that if journal_mode=wal here that neither the journal file nor the WAL file are open. This happens during
 				// a rollback transaction that switches from journal_mode=off to journal_mode=wal.
 				_assert(p->Lock >= VFile::LOCK_RESERVED);
-				_assert(p->JournalFile->Opened || p->JournalMode == IPager::JOURNALMODE_OFF || p->JournalMode == IPager::JOURNALMODE_WAL);
+				_assert(p->JournalFile->Opened || p->JournalMode == IPager::JOURNALMODE_OFF || p->JournalMode == IPager::JOURNALMODE_WAL || p->JournalMode == IPager::JOURNALMODE_SHADOW);
 			}
 			_assert(p->DBOrigSize == p->DBFileSize);
 			_assert(p->DBOrigSize == p->DBHintSize);
@@ -166,7 +194,7 @@ namespace Core
 			_assert(p->ErrorCode == RC::OK);
 			_assert(!UseWal(p));
 			_assert(p->Lock >= VFile::LOCK_EXCLUSIVE);
-			_assert(p->JournalFile->Opened || p->JournalMode == IPager::JOURNALMODE_OFF || p->JournalMode == IPager::JOURNALMODE_WAL);
+			_assert(p->JournalFile->Opened || p->JournalMode == IPager::JOURNALMODE_OFF || p->JournalMode == IPager::JOURNALMODE_WAL || p->JournalMode == IPager::JOURNALMODE_SHADOW);
 			_assert(p->DBOrigSize <= p->DBHintSize);
 			break;
 
@@ -174,7 +202,7 @@ namespace Core
 			_assert(p->Lock == VFile::LOCK_EXCLUSIVE);
 			_assert(p->ErrorCode == RC::OK);
 			_assert(!UseWal(p));
-			_assert(p->JournalFile->Opened || p->JournalMode == IPager::JOURNALMODE_OFF || p->JournalMode == IPager::JOURNALMODE_WAL);
+			_assert(p->JournalFile->Opened || p->JournalMode == IPager::JOURNALMODE_OFF || p->JournalMode == IPager::JOURNALMODE_WAL || p->JournalMode == IPager::JOURNALMODE_SHADOW);
 			break;
 
 		case Pager::PAGER_ERROR:
@@ -219,7 +247,8 @@ namespace Core
 			p->JournalMode == IPager::JOURNALMODE_DELETE ? "delete" :
 			p->JournalMode == IPager::JOURNALMODE_PERSIST ? "persist" :
 			p->JournalMode == IPager::JOURNALMODE_TRUNCATE ? "truncate" :
-			p->JournalMode == IPager::JOURNALMODE_WAL ? "wal" : "?error?"
+			p->JournalMode == IPager::JOURNALMODE_WAL ? "wal" :
+			p->JournalMode == IPager::JOURNALMODE_SHADOW ? "shadow" : "?error?"
 			, (int)p->TempFile, (int)p->MemoryDB, (int)p->UseJournal);
 		__snprintf(r + len, 1024,
 			"Journal:       journalOff=%lld journalHdr=%lld\n"
@@ -232,6 +261,42 @@ namespace Core
 #endif
 #pragma endregion
 
+#pragma region Metrics
+
+	// Move the pager to state, charging the time spent in the state it leaves to Metrics.StateMicros[].
+	__device__ static void pagerSetState(Pager *pager, Pager::PAGER state)
+	{
+		int64 now = SysEx::Now();
+		if (pager->StateSince)
+			pager->Metrics.StateMicros[pager->State] += now - pager->StateSince;
+		pager->StateSince = now;
+		pager->State = state;
+	}
+
+	// Add the time since start to *micros and to its bucket of histogram.
+	__device__ static void pagerMetricsTime(int64 *histogram, int64 *micros, int64 start)
+	{
+		int64 elapsed = SysEx::Now() - start;
+		if (elapsed < 0) elapsed = 0;
+		*micros += elapsed;
+		int bucket = 0;
+		for (int64 v = elapsed; v > 0 && bucket < PAGER_METRICS_BUCKETS - 1; v >>= 1)
+			bucket++;
+		histogram[bucket]++;
+	}
+
+	// Sync file, counting the call and its time against the METRICFILE it is.
+	__device__ static RC pagerSyncFile(Pager *pager, VFile *file, IPager::METRICFILE metricFile, int flags)
+	{
+		int64 start = SysEx::Now();
+		RC rc = file->Sync(flags);
+		pager->Metrics.Syncs[metricFile]++;
+		pager->Metrics.SyncMicros[metricFile] += SysEx::Now() - start;
+		return rc;
+	}
+
+#pragma endregion
+
 #pragma region Name1
 
 	__device__ static bool subjRequiresPage(PgHdr *pg)
@@ -392,7 +457,7 @@ namespace Core
 			else
 				rc = pager->JournalFile->Write(zeroHeader, sizeof(zeroHeader), 0);
 			if (rc == RC::OK && !pager->NoSync)
-				rc = pager->JournalFile->Sync(VFile::SYNC_DATAONLY | pager->SyncFlags);
+				rc = pagerSyncFile(pager, pager->JournalFile, IPager::METRICFILE_JOURNAL, VFile::SYNC_DATAONLY | pager->SyncFlags);
 			// At this point the transaction is committed but the write lock is still held on the file. If there is a size limit configured for 
 			// the persistent journal and the journal file currently consumes more space than that limit allows for, truncate it now. There is no need
 			// to sync the file following this operation.
@@ -462,6 +527,7 @@ namespace Core
 		{
 			SysEx_IOTRACE("JHDR %p %lld %d\n", pager, pager->JournalHeader, headerSize);
 			rc = pager->JournalFile->Write(header, headerSize, pager->JournalOffset);
+			pager->Metrics.JournalBytes += headerSize;
 			_assert(pager->JournalHeader <= pager->JournalOffset);
 			pager->JournalOffset += headerSize;
 		}
@@ -543,7 +609,8 @@ namespace Core
 
 		if (!master ||
 			pager->JournalMode == IPager::JOURNALMODE_JMEMORY ||
-			pager->JournalMode == IPager::JOURNALMODE_OFF)
+			pager->JournalMode == IPager::JOURNALMODE_OFF ||
+			pager->JournalMode == IPager::JOURNALMODE_SHADOW)
 			return RC::OK;
 		pager->SetMaster = true;
 		_assert(pager->JournalFile->Opened);
@@ -570,6 +637,7 @@ namespace Core
 			(rc = pager->JournalFile->Write(_journalMagic, 8, headerOffset + 4 + masterLength + 8)) != RC::OK)
 			return rc;
 		pager->JournalOffset += (masterLength + 20);
+		pager->Metrics.JournalBytes += (masterLength + 20);
 
 		// If the pager is in peristent-journal mode, then the physical journal-file may extend past the end of the master-journal name
 		// and 8 bytes of magic data just written to the file. This is dangerous because the code to rollback a hot-journal file
@@ -594,11 +662,44 @@ namespace Core
 		return p;
 	}
 
+	// Copy a PGHDR_MMAP page into its own cache buffer and hand the mapped reference back to the file. The mapping is read-only, so this must happen
+	// before anything changes the page content. Reiniter is told about the move, as the b-tree layer caches pointers into the page.
+	__device__ static void pagerUnmapPage(PgHdr *pg)
+	{
+		Pager *pager = pg->Pager;
+		_assert(pg->Flags & PgHdr::PGHDR_MMAP);
+		void *data = pg->Data;
+		_memcpy(pg->Page->Buffer, data, pager->PageSize);
+		pg->Data = pg->Page->Buffer;
+		pg->Flags &= ~PgHdr::PGHDR_MMAP;
+		pager->MmapOuts--;
+		pager->File->Unfetch((int64)(pg->ID - 1) * pager->PageSize, data);
+		pager->Reiniter(pg);
+	}
+
+	// Release the last reference to a PGHDR_MMAP page. Such pages are never left in the cache, since the mapping already holds them: the page is
+	// pointed back at its own buffer and dropped, so the slot comes back from the cache looking like any other unread page.
+	__device__ static void pagerReleaseMapPage(PgHdr *pg)
+	{
+		Pager *pager = pg->Pager;
+		_assert(pg->Flags & PgHdr::PGHDR_MMAP);
+		_assert(PCache::get_PageRefs(pg) == 1);
+		void *data = pg->Data;
+		pg->Data = pg->Page->Buffer;
+		pg->Flags &= ~PgHdr::PGHDR_MMAP;
+		pager->MmapOuts--;
+		pager->File->Unfetch((int64)(pg->ID - 1) * pager->PageSize, data);
+		PCache::Drop(pg);
+	}
+
 	__device__ static void pager_reset(Pager *pager)
 	{
 		if (pager->Backup != nullptr)
 			pager->Backup->Restart();
 		pager->PCache->Clear();
+		// The database file may have changed size underneath us, so have the next fetch map it afresh.
+		if (UseFetch(pager) && pager->MmapOuts == 0 && pager->File->Opened)
+			pager->File->Unfetch(0, nullptr);
 	}
 
 	__device__ static void releaseAllSavepoints(Pager *pager)
@@ -643,7 +744,7 @@ namespace Core
 		{
 			_assert(!pager->JournalFile->Opened);
 			pager->Wal->EndReadTransaction();
-			pager->State = Pager::PAGER_OPEN;
+			pagerSetState(pager, Pager::PAGER_OPEN);
 		}
 		else if (!pager->ExclusiveMode)
 		{
@@ -652,6 +753,7 @@ namespace Core
 			_assert((IPager::JOURNALMODE_JMEMORY & 5) != 1);
 			_assert((IPager::JOURNALMODE_OFF & 5) != 1);
 			_assert((IPager::JOURNALMODE_WAL & 5) != 1);
+			_assert((IPager::JOURNALMODE_SHADOW & 5) != 1);
 			_assert((IPager::JOURNALMODE_DELETE & 5) != 1);
 			_assert((IPager::JOURNALMODE_TRUNCATE & 5) == 1);
 			_assert((IPager::JOURNALMODE_PERSIST & 5) == 1);
@@ -669,7 +771,7 @@ namespace Core
 			// code is cleared and the cache reset in the block below.
 			_assert(pager->ErrorCode || pager->State != Pager::PAGER_ERROR);
 			pager->ChangeCountDone = 0;
-			pager->State = Pager::PAGER_OPEN;
+			pagerSetState(pager, Pager::PAGER_OPEN);
 		}
 
 		// If Pager.errCode is set, the contents of the pager cache cannot be trusted. Now that there are no outstanding references to the pager,
@@ -679,7 +781,7 @@ namespace Core
 			_assert(!pager->MemoryDB);
 			pager_reset(pager);
 			pager->ChangeCountDone = pager->TempFile;
-			pager->State = Pager::PAGER_OPEN;
+			pagerSetState(pager, Pager::PAGER_OPEN);
 			pager->ErrorCode = RC::OK;
 		}
 
@@ -698,7 +800,7 @@ namespace Core
 		if (rc2 == RC::FULL || rc2 == RC::IOERR)
 		{
 			pager->ErrorCode = rc;
-			pager->State = Pager::PAGER_ERROR;
+			pagerSetState(pager, Pager::PAGER_ERROR);
 		}
 		return rc;
 	}
@@ -724,7 +826,7 @@ namespace Core
 			return RC::OK;
 
 		releaseAllSavepoints(pager);
-		_assert(pager->JournalFile->Opened || pager->InJournal == nullptr);
+		_assert(pager->JournalFile->Opened || pager->InJournal == nullptr || pager->JournalMode == IPager::JOURNALMODE_SHADOW);
 		RC rc = RC::OK;
 		if (pager->JournalFile->Opened)
 		{
@@ -800,7 +902,7 @@ namespace Core
 			rc2 = pagerUnlockDb(pager, VFile::LOCK_SHARED);
 			pager->ChangeCountDone = 0;
 		}
-		pager->State = Pager::PAGER_READER;
+		pagerSetState(pager, Pager::PAGER_READER);
 		pager->SetMaster = false;
 
 		return (rc == RC::OK ? rc2 : rc);
@@ -842,12 +944,26 @@ namespace Core
 	__device__ static void pagerReportSize(Pager *pager)
 	{
 		if (pager->CodecSizeChange)
-			pager->CodecSizeChange(pager->Codec, pager->PageSize, (int)pager->ReserveBytes);
+			pager->CodecSizeChange(pager->CodecArg, pager->PageSize, (int)pager->ReserveBytes);
 	}
 #else
 #define pagerReportSize(X)
 #endif
 
+	// Hand out the next page buffer of AsyncSpace. Once every buffer has been used, the writes still reading from them are waited on before the
+	// first is handed out again.
+	__device__ static RC pagerAsyncSlot(Pager *pager, uint8 **dataOut)
+	{
+		if (pager->AsyncSlot == PAGER_ASYNC_PAGES)
+		{
+			pager->AsyncSlot = 0;
+			RC rc = pager->File->Wait();
+			if (rc != RC::OK) return rc;
+		}
+		*dataOut = &((uint8 *)pager->AsyncSpace)[pager->AsyncSlot++ * pager->PageSize];
+		return RC::OK;
+	}
+
 	__device__ static RC pager_playback_one_page(Pager *pager, int64 *offset, Bitvec *done, bool isMainJournal, bool isSavepoint)
 	{
 		_assert(isMainJournal || done);			// pDone always used on sub-journals
@@ -856,6 +972,9 @@ namespace Core
 		uint8 *data = (uint8 *)pager->TmpSpace; // Temporary storage for the page
 		_assert(data != nullptr); // Temp storage must have already been allocated
 		_assert(!UseWal(pager) || (!isMainJournal && isSavepoint));
+		RC rc;
+		if (pager->AsyncSpace && (rc = pagerAsyncSlot(pager, &data)) != RC::OK)
+			return rc;
 
 		// Either the state is greater than PAGER_WRITER_CACHEMOD (a transaction or savepoint rollback done at the request of the caller) or this is
 		// a hot-journal rollback. If it is a hot-journal rollback, the pager is in state OPEN and holds an EXCLUSIVE lock. Hot-journal rollback
@@ -866,7 +985,7 @@ namespace Core
 		// Read the page number and page data from the journal or sub-journal file. Return an error code to the caller if an IO error occurs.
 		VFile *journalFile = (isMainJournal ? pager->JournalFile : pager->SubJournalFile); // The file descriptor for the journal file
 		Pid id; // The page number of a page in journal
-		RC rc = journalFile->Read4(*offset, &id);
+		rc = journalFile->Read4(*offset, &id);
 		if (rc != RC::OK) return rc;
 		rc = journalFile->Read(data, pager->PageSize, (*offset) + 4);
 		if (rc != RC::OK) return rc;
@@ -936,7 +1055,7 @@ namespace Core
 			int64 offset = (id - 1) * (int64)pager->PageSize;
 			ASSERTCOVERAGE(!isSavepoint && pg != nullptr && (pg->Flags & PgHdr::PGHDR_NEED_SYNC) != 0);
 			_assert(!UseWal(pager));
-			rc = pager->File->Write(data, pager->PageSize, offset);
+			rc = (pager->AsyncSpace ? pager->File->WriteAsync(data, pager->PageSize, offset) : pager->File->Write(data, pager->PageSize, offset));
 			if (id > pager->DBFileSize)
 				pager->DBFileSize = id;
 			if (pager->Backup)
@@ -972,6 +1091,8 @@ namespace Core
 			// No page should ever be explicitly rolled back that is in use, except for page 1 which is held in use in order to keep the lock on the
 			// database active. However such a page may be rolled back as a result of an internal error resulting in an automatic call to
 			// sqlite3PagerRollback().
+			if (pg->Flags & PgHdr::PGHDR_MMAP)
+				pagerUnmapPage(pg);
 			uint8 *pageData = (uint8 *)pg->Data;
 			_memcpy(pageData, data, pager->PageSize);
 			pager->Reiniter(pg);
@@ -1138,10 +1259,150 @@ delmaster_out:
 			pager->SectorSize = pager->File->get_SectorSize();
 	}
 
+	// Writes a run of consecutive pages starting at page first. A lone page is queued with WriteAsync(), a longer run goes out in one Writev() call.
+	__device__ static RC pagerWriteRun(Pager *pager, VFile::IOVec *vecs, int count, Pid first)
+	{
+		int64 offset = (first - 1) * (int64)pager->PageSize; // Offset to write
+		if (count == 1)
+			return pager->File->WriteAsync(vecs[0].Buffer, vecs[0].Amount, offset);
+		return pager->File->Writev(vecs, count, offset);
+	}
+
+#ifdef HAS_CODEC
+	// Writes a page a codec encoded. Where the encoding leaves at least PAGER_HOLE_MIN zeros in front of the reserved bytes, as CompressCodec does
+	// with a page it shrank, only the bytes either side of them are written and the zeros are punched out of the file, so the page takes only
+	// the blocks its encoding needs and reading it back does not touch the others. A VFS without FCNTL_PUNCH_HOLE gets the whole page.
+	__device__ static RC pagerWriteCoded(Pager *pager, const char *data, Pid id)
+	{
+		int64 offset = (id - 1) * (int64)pager->PageSize; // Offset to write
+		int end = pager->PageSize - pager->ReserveBytes; // Start of the reserved bytes
+		int used = end; // Bytes in front of the zeros
+		while (used > 0 && data[used - 1] == 0)
+			used--;
+		if (end - used >= PAGER_HOLE_MIN)
+		{
+			int64 range[2] = { offset + used, end - used };
+			if (pager->File->FileControl(VFile::FCNTL_PUNCH_HOLE, range) == RC::OK)
+			{
+				RC rc = (used > 0 ? pager->File->Write(data, used, offset) : RC::OK);
+				if (rc == RC::OK && pager->ReserveBytes > 0)
+					rc = pager->File->Write(&data[end], pager->ReserveBytes, offset + end);
+				return rc;
+			}
+		}
+		return pager->File->Write(data, pager->PageSize, offset);
+	}
+#endif
+
+	// Plays back the next records records of a hot journal, reading PAGER_PLAYBACK_CHUNK of them at a time in one call. Each record is checked
+	// by the same rules as pager_playback_one_page(). The pages of a chunk are then written in page order, gathered into runs, and where a page
+	// appears more than once the later image is the one written, as it would have been had the records been played one by one. The writes are
+	// waited on before the buffer is reused, so a page in a later chunk always lands after the same page from an earlier one. Returns RC::DONE
+	// at a record that ends the journal and RC::IOERR_SHORT_READ if the file ends part way through the records.
+	__device__ static RC pager_playback_chunks(Pager *pager, uint8 *chunk, uint32 records, int64 sizeJournal)
+	{
+		_assert(pager->State == Pager::PAGER_OPEN && pager->Lock == VFile::LOCK_EXCLUSIVE);
+		_assert(!UseWal(pager) && pager->File->Opened && !pager->Backup);
+		int recordSize = JOURNAL_PG_SZ(pager); // Bytes in one journal record
+		uint8 **pages = (uint8 **)&chunk[PAGER_PLAYBACK_CHUNK * recordSize]; // Records of the chunk to be written, by page number
+		RC rc = RC::OK;
+		RC stop = RC::OK; // Why the rollback ends after this chunk, if it does
+		while (records > 0 && stop == RC::OK)
+		{
+			// Read as many whole records as the file holds, up to a chunk.
+			int64 offset = pager->JournalOffset; // Offset of the next record
+			uint32 n = (records < PAGER_PLAYBACK_CHUNK ? records : PAGER_PLAYBACK_CHUNK); // Records in this chunk
+			if (offset + n * (int64)recordSize > sizeJournal)
+			{
+				n = (uint32)((sizeJournal - offset) / recordSize);
+				stop = RC::IOERR_SHORT_READ;
+			}
+			if (n > 0 && (rc = pager->JournalFile->Read(chunk, n * recordSize, offset)) != RC::OK)
+				return rc;
+			records -= n;
+
+			// Check each record and file it by page number. Unlike a single page, a failed checksum ends the chunk at that record, as the
+			// journal would have ended there had the records been played one at a time.
+			int pagesLength = 0;
+			for (uint32 i = 0U; i < n; i++)
+			{
+				uint8 *record = &chunk[i * recordSize];
+				Pid id = ConvertEx::Get4(record);
+				offset += recordSize;
+				if (id == 0 || id == MJ_PID(pager))
+				{
+					stop = RC::DONE;
+					break;
+				}
+				if (id > (Pid)pager->DBSize)
+					continue;
+				if (pager_cksum(pager, record + 4) != ConvertEx::Get4(record + 4 + pager->PageSize))
+				{
+					stop = RC::DONE;
+					break;
+				}
+				if (!pager->NoSync && offset > pager->JournalHeader)
+					continue;
+				int lo = 0, hi = pagesLength;
+				while (lo < hi)
+				{
+					int mid = (lo + hi) / 2;
+					if (ConvertEx::Get4(pages[mid]) < id) lo = mid + 1;
+					else hi = mid;
+				}
+				if (lo < pagesLength && ConvertEx::Get4(pages[lo]) == id)
+					pages[lo] = record;
+				else
+				{
+					for (int j = pagesLength; j > lo; j--)
+						pages[j] = pages[j - 1];
+					pages[lo] = record;
+					pagesLength++;
+				}
+			}
+			pager->JournalOffset = offset;
+
+			// Write the pages that survived, consecutive pages together.
+			VFile::IOVec vecs[PAGER_MAX_IOVECS]; // Pages of the current run
+			int vecsLength = 0; // Number of pages in vecs
+			Pid runFirst = 0; // Page number of vecs[0]
+			for (int i = 0; rc == RC::OK && i < pagesLength; i++)
+			{
+				Pid id = ConvertEx::Get4(pages[i]);
+				uint8 *data = pages[i] + 4;
+				if (id == 1 && pager->ReserveBytes != data[20])
+				{
+					pager->ReserveBytes = data[20];
+					pagerReportSize(pager);
+				}
+				PAGERTRACE("PLAYBACK %d page %d hash(%08x) main-journal\n", PAGERID(pager), id, pager_datahash(pager->PageSize, data));
+				if (vecsLength > 0 && (vecsLength == PAGER_MAX_IOVECS || id != runFirst + vecsLength))
+				{
+					rc = pagerWriteRun(pager, vecs, vecsLength, runFirst);
+					vecsLength = 0;
+				}
+				if (vecsLength == 0) runFirst = id;
+				vecs[vecsLength].Buffer = data;
+				vecs[vecsLength].Amount = pager->PageSize;
+				vecsLength++;
+				if (id > pager->DBFileSize)
+					pager->DBFileSize = id;
+			}
+			if (rc == RC::OK && vecsLength > 0)
+				rc = pagerWriteRun(pager, vecs, vecsLength, runFirst);
+			RC rc2 = pager->File->Wait();
+			if (rc == RC::OK) rc = rc2;
+			if (rc != RC::OK)
+				return rc;
+		}
+		return stop;
+	}
+
 	__device__ static RC pager_playback(Pager *pager, bool isHot)
 	{
 		int res = 1;
 		char *master = nullptr;
+		uint8 *chunk = nullptr; // Buffer for pager_playback_chunks(), if a hot journal is played back that way
 
 		// Figure out how many records are in the journal.  Abort early if the journal is empty.
 		_assert(pager->JournalFile->Opened);
@@ -1169,6 +1430,16 @@ delmaster_out:
 		pager->JournalOffset = 0;
 		needPagerReset = isHot; // True to reset page prior to first page rollback
 
+		// Give each page written back to the database its own buffer so the writes can be queued rather than made one at a time. Without the
+		// memory, or when a codec transforms the data in place, pages are written synchronously from TmpSpace as before.
+#ifdef HAS_CODEC
+		if (!pager->Codec)
+#endif
+		{
+			pager->AsyncSpace = PCache::PageAlloc(pager->PageSize * PAGER_ASYNC_PAGES); // Aligned like the page cache, for direct I/O
+			pager->AsyncSlot = 0;
+		}
+
 		// This loop terminates either when a readJournalHdr() or pager_playback_one_page() call returns SQLITE_DONE or an IO error occurs. 
 		while (true)
 		{
@@ -1212,6 +1483,34 @@ delmaster_out:
 				pager->DBSize = maxPage;
 			}
 
+			// A hot journal is played back into an empty cache, so the records can be read in chunks and the pages written in runs rather than one
+			// at a time. The buffer is sized once the first header has set the page size. Without it, or with a codec or a backup to feed, each
+			// record is played back by itself as below.
+			if (isHot && !chunk && pager->State == Pager::PAGER_OPEN && pager->File->Opened && !pager->Backup
+#ifdef HAS_CODEC
+				&& !pager->Codec
+#endif
+				)
+				chunk = (uint8 *)SysEx::Alloc(PAGER_PLAYBACK_CHUNK * (JOURNAL_PG_SZ(pager) + sizeof(uint8 *)));
+			if (chunk)
+			{
+				if (needPagerReset && records > 0)
+				{
+					pager_reset(pager);
+					needPagerReset = false;
+				}
+				rc = pager_playback_chunks(pager, chunk, records, sizeJournal);
+				if (rc == RC::DONE)
+					pager->JournalOffset = sizeJournal;
+				else if (rc != RC::OK)
+				{
+					if (rc == RC::IOERR_SHORT_READ)
+						rc = RC::OK;
+					goto end_playback;
+				}
+				continue;
+			}
+
 			// Copy original pages out of the journal and back into the database file and/or page cache.
 			for (uint32 u = 0U; u < records; u++)
 			{
@@ -1245,6 +1544,15 @@ delmaster_out:
 		}
 
 end_playback:
+		if (pager->AsyncSpace)
+		{
+			RC rc2 = (pager->File->Opened ? pager->File->Wait() : RC::OK);
+			if (rc == RC::OK) rc = rc2;
+			PCache::PageFree(pager->AsyncSpace);
+			pager->AsyncSpace = nullptr;
+		}
+		SysEx::Free(chunk);
+
 		// Following a rollback, the database file should be back in its original state prior to the start of the transaction, so invoke the
 		// SQLITE_FCNTL_DB_UNCHANGED file-control method to disable the assertion that the transaction counter was modified.
 #ifdef _DEBUG
@@ -1297,6 +1605,9 @@ end_playback:
 			return RC::OK;
 		}
 
+		if (pg->Flags & PgHdr::PGHDR_MMAP)
+			pagerUnmapPage(pg);
+
 		RC rc = RC::OK;
 		Pid id = pg->ID; // Page number to read
 		bool isInWal = 0; // True if page is in log file
@@ -1309,7 +1620,10 @@ end_playback:
 			rc = pager->File->Read(pg->Data, pageSize, offset);
 			if (rc == RC::IOERR_SHORT_READ)
 				rc = RC::OK;
+			pager->Metrics.ReadsDB++;
 		}
+		else if (isInWal)
+			pager->Metrics.ReadsWal++;
 
 		if (id == 1)
 		{
@@ -1334,6 +1648,41 @@ end_playback:
 		return rc;
 	}
 
+	// Load a page by pointing its Data straight into the memory mapped database file rather than copying it. Falls back to readDbPage() when the
+	// page has a newer copy in the WAL, or when the file cannot map it (mmap disabled, or the file has grown past a mapping still in use).
+	__device__ static RC pagerAcquireMapPage(PgHdr *pg)
+	{
+		Pager *pager = pg->Pager;
+		_assert(UseFetch(pager) && pager->State == Pager::PAGER_READER);
+		_assert((pg->Flags & PgHdr::PGHDR_MMAP) == 0 && pg->ID != 1);
+
+		RC rc = RC::OK;
+		Pid id = pg->ID; // Page number to read
+		if (UseWal(pager))
+		{
+			// The WAL copy, if there is one, is the current version of the page. It is read into the page buffer exactly as readDbPage() would.
+			bool isInWal = false; // True if page is in log file
+			rc = pager->Wal->Read(id, &isInWal, pager->PageSize, (uint8 *)pg->Data);
+			if (rc != RC::OK || isInWal)
+				return rc;
+		}
+
+		void *data = nullptr;
+		rc = pager->File->Fetch((int64)(id - 1) * pager->PageSize, pager->PageSize, &data);
+		if (rc != RC::OK)
+			return rc;
+		if (!data)
+			return readDbPage(pg);
+		pg->Data = data;
+		pg->Flags |= PgHdr::PGHDR_MMAP;
+		pager->MmapOuts++;
+
+		PAGER_INCR(_readdb_count);
+		SysEx_IOTRACE("PGMAP %p %d\n", pager, id);
+		PAGERTRACE("MMAP %d page %d hash(%08x)\n", PAGERID(pager), id, pager_pagehash(pg));
+		return RC::OK;
+	}
+
 	__device__ static void pager_write_changecounter(PgHdr *pg)
 	{
 		// Increment the value just read and write it back to byte 24.
@@ -1345,7 +1694,6 @@ end_playback:
 		ConvertEx::Put4(((uint8 *)pg->Data) + 96, SysEx_VERSION_NUMBER);
 	}
 
-#ifndef OMIT_WAL
 	__device__ static RC pagerUndoCallback(void *ctx, Pid id)
 	{
 		RC rc = RC::OK;
@@ -1365,15 +1713,33 @@ end_playback:
 		}
 
 		// Normally, if a transaction is rolled back, any backup processes are updated as data is copied out of the rollback journal and into the
-		// database. This is not generally possible with a WAL database, as rollback involves simply truncating the log file. Therefore, if one
-		// or more frames have already been written to the log (and therefore also copied into the backup databases) as part of this transaction,
-		// the backups must be restarted.
+		// database. This is not generally possible with a WAL or journal_mode=shadow database, as rollback involves simply truncating the log file
+		// or dropping the shadow pages. Therefore, if one or more pages have already been written out (and therefore also copied into the backup
+		// databases) as part of this transaction, the backups must be restarted.
 		if (pager->Backup != nullptr)
 			pager->Backup->Restart();
 
 		return rc;
 	}
 
+	// Roll back a journal_mode=shadow transaction. The VFS drops whatever the transaction wrote to the database file, after which every page the
+	// transaction changed is dropped from the cache or read back, as pagerRollbackWal() does. Pages past the original end are dropped by pager_end_transaction().
+	__device__ static RC pagerRollbackShadow(Pager *pager)
+	{
+		RC rc = RC::OK;
+		if (pager->State > Pager::PAGER_WRITER_LOCKED)
+			rc = pager->File->FileControl(VFile::FCNTL_SHADOW_ROLLBACK, nullptr);
+		pager->DBSize = pager->DBOrigSize;
+		pager->ChangeCountDone = pager->TempFile;
+		if (pager->InJournal)
+			for (Pid id = 1; id <= pager->DBOrigSize && rc == RC::OK; id++)
+				if (pager->InJournal->Get(id))
+					rc = pagerUndoCallback((void *)pager, id);
+		RC rc2 = pager_end_transaction(pager, false, false);
+		return (rc == RC::OK ? rc2 : rc);
+	}
+
+#ifndef OMIT_WAL
 	__device__ static RC pagerRollbackWal(Pager *pager)
 	{
 		// For all pages in the cache that are currently dirty or have already been written (but not committed) to the log file, do one of the following:
@@ -1404,7 +1770,6 @@ end_playback:
 			_assert(p->ID < p->Dirty->ID);
 #endif
 		int listPages; // Number of pages in pList
-		_assert(list->Dirty == nullptr || isCommit);
 		if (isCommit)
 		{
 			// If a WAL transaction is being committed, there is no point in writing any pages with page numbers greater than nTruncate into the WAL file.
@@ -1420,11 +1785,22 @@ end_playback:
 				_assert(list != nullptr);
 		}
 		else
-			listPages = 1;
+			for (listPages = 0, p = list; p; p = p->Dirty)
+				listPages++;
 		pager->Stats[STAT_WRITE] += listPages;
 
+		RC rc;
+		VFile::SYNC syncFlags = pager->WalSyncFlags;
+		if (isCommit && pager->AsyncCommit && syncFlags)
+		{
+			// An asynchronous commit is written without its sync, which the WAL's flusher does later. Frames() fails it unwritten if a
+			// deferred sync has failed, as the WAL can no longer promise the commits before it.
+			syncFlags = (VFile::SYNC)((syncFlags & ~VFile::SYNC_WAL_TRANSACTIONS) | VFile::SYNC_WAL_DEFERRED);
+		}
 		if (list->ID == 1) pager_write_changecounter(list);
-		RC rc = pager->Wal->Frames(pager->PageSize, list, truncate, isCommit, pager->WalSyncFlags);
+		rc = pager->Wal->Frames(pager->PageSize, list, truncate, isCommit, syncFlags);
+		if (rc == RC::OK && isCommit && syncFlags != pager->WalSyncFlags)
+			pager->Wal->RequestSync(pager->Commits, (VFile::SYNC)(pager->WalSyncFlags & VFile::SYNC_WAL_MASK));
 		if (rc == RC::OK && pager->Backup)
 			for (p = list; p; p = p->Dirty)
 				pager->Backup->Update(p->ID, (uint8 *)p->Data);
@@ -1447,8 +1823,10 @@ end_playback:
 		// are in locking_mode=NORMAL and EndRead() was previously called, the duplicate call is harmless.
 		pager->Wal->EndReadTransaction();
 
-		int changed = 0; // True if cache must be reset
-		RC rc = pager->Wal->BeginReadTransaction(&changed);
+		// When other connections have only appended commits since the last read transaction, drop (or reload, if referenced) just the pages
+		// those commits wrote, as a rollback does, and keep the rest of the cache warm. Otherwise the WAL was restarted and everything goes.
+		bool changed = false; // True if cache must be reset
+		RC rc = pager->Wal->BeginReadTransaction(&changed, (int (*)(void *, Pid))pagerUndoCallback, (void *)pager);
 		if (rc != RC::OK || changed)
 			pager_reset(pager);
 
@@ -1618,6 +1996,41 @@ end_playback:
 		PCache->set_CacheSize(maxPages);
 	}
 
+	// Sets the page replacement policy, unless policy is CACHEPOLICY_QUERY, and returns the policy in use. CACHEPOLICY_ARC keeps index
+	// interior pages and other pages used again through a table scan. A cache that cannot use it keeps the policy it had.
+	__device__ IPager::CACHEPOLICY Pager::SetCachePolicy(IPager::CACHEPOLICY policy)
+	{
+		_assert(IPager::CACHEPOLICY_LRU == (int)IPCache::POLICY_LRU && IPager::CACHEPOLICY_ARC == (int)IPCache::POLICY_ARC);
+		if (policy >= 0)
+			PCache->SetPolicy((IPCache::POLICY)policy);
+		return (IPager::CACHEPOLICY)PCache->Policy;
+	}
+
+	// Pass the mmap limit down to the database file and keep the limit the file actually accepted. A file that does not understand
+	// FCNTL_MMAP_SIZE leaves mmap switched off.
+	__device__ static void pagerFixMaplimit(Pager *pager)
+	{
+		VFile *file = pager->File;
+		if (pager->TempFile || !file->Opened)
+			return;
+		int64 size = pager->SizeMmap;
+		if (pager->MmapOuts > 0 || file->FileControl(VFile::FCNTL_MMAP_SIZE, &size) != RC::OK)
+			return;
+		pager->SizeMmap = size;
+	}
+
+	__device__ void Pager::SetMmapLimit(int64 limit)
+	{
+		SizeMmap = limit;
+		pagerFixMaplimit(this);
+	}
+
+	// Set the most dirty pages one cache spill writes. 1 spills a single page at a time, as SQLite does.
+	__device__ void Pager::SetSpillBatch(int pages)
+	{
+		SpillBatch = (pages < 1 ? 1 : pages);
+	}
+
 	__device__ void Pager::Shrink()
 	{
 		PCache->Shrink();
@@ -1703,10 +2116,17 @@ end_playback:
 			if (State > Pager::PAGER_OPEN && File->Opened)
 				rc = File->get_FileSize(bytes);
 			char *tempSpace = nullptr; // New temp space
+			uint8 *journalRecord = nullptr; // New journal record buffer
 			if (rc == RC::OK)
 			{
 				tempSpace = (char *)PCache::PageAlloc(pageSize);
-				if (!tempSpace) rc = RC::NOMEM;
+				journalRecord = (uint8 *)SysEx::Alloc(pageSize + 8);
+				if (!tempSpace || !journalRecord)
+				{
+					PCache::PageFree(tempSpace);
+					SysEx::Free(journalRecord);
+					rc = RC::NOMEM;
+				}
 			}
 			if (rc == RC::OK)
 			{
@@ -1715,6 +2135,8 @@ end_playback:
 				PageSize = (int)pageSize;
 				PCache::PageFree(TmpSpace);
 				TmpSpace = tempSpace;
+				SysEx::Free(JournalRecord);
+				JournalRecord = journalRecord;
 				PCache->SetPageSize(pageSize);
 			}
 		}
@@ -1775,7 +2197,15 @@ end_playback:
 		if (File->Opened)
 		{
 			SysEx_IOTRACE("DBHDR %p 0 %d\n", this, n);
-			rc = File->Read(dest, n, 0);
+			if ((VfsFlags & VSystem::OPEN_DIRECT) && n <= PageSize)
+			{
+				// Read the whole first page into the page-aligned TmpSpace, so direct I/O does not need a bounce buffer for the few header bytes.
+				_memset(TmpSpace, 0, PageSize);
+				rc = File->Read(TmpSpace, PageSize, 0);
+				_memcpy(dest, TmpSpace, n);
+			}
+			else
+				rc = File->Read(dest, n, 0);
 			if (rc == RC::IOERR_SHORT_READ)
 				rc = RC::OK;
 		}
@@ -1797,11 +2227,15 @@ end_playback:
 			(pager->Lock == VFile::LOCK_NO && locktype == VFile::LOCK_SHARED) ||
 			(pager->Lock == VFile::LOCK_RESERVED && locktype == VFile::LOCK_EXCLUSIVE));
 
-		RC rc;
-		do
+		RC rc = pagerLockDb(pager, locktype);
+		if (rc == RC::BUSY)
 		{
-			rc = pagerLockDb(pager, locktype);
-		} while(rc == RC::BUSY && pager->BusyHandler(pager->BusyHandlerArg));
+			int64 start = SysEx::Now();
+			while (rc == RC::BUSY && pager->BusyHandler(pager->BusyHandlerArg))
+				rc = pagerLockDb(pager, locktype);
+			pager->Metrics.LockWaits++;
+			pager->Metrics.LockWaitMicros += SysEx::Now() - start;
+		}
 		return rc;
 	}
 
@@ -1837,7 +2271,7 @@ end_playback:
 	{
 		RC rc = RC::OK;
 		if (!pager->NoSync)
-			rc = pager->JournalFile->Sync(VFile::SYNC_NORMAL);
+			rc = pagerSyncFile(pager, pager->JournalFile, IPager::METRICFILE_JOURNAL, VFile::SYNC_NORMAL);
 		if (rc == RC::OK)
 			rc = pager->JournalFile->get_FileSize(pager->JournalHeader);
 		return rc;
@@ -1877,10 +2311,11 @@ end_playback:
 		JournalFile->Close();
 		File->Close();
 		PCache::PageFree(tmp);
+		SysEx::Free(JournalRecord);
 		PCache->Close();
 
 #ifdef HAS_CODEC
-		if (CodecFree) CodecFree(Codec);
+		if (CodecFree) CodecFree(CodecArg);
 #endif
 
 		_assert(!Savepoints && !InJournal);
@@ -1964,18 +2399,19 @@ end_playback:
 					{
 						PAGERTRACE("SYNC journal of %d\n", PAGERID(pager));
 						SysEx_IOTRACE("JSYNC %p\n", pager);
-						rc = pager->JournalFile->Sync(pager->SyncFlags);
+						rc = pagerSyncFile(pager, pager->JournalFile, IPager::METRICFILE_JOURNAL, pager->SyncFlags);
 						if (rc != RC::OK) return rc;
 					}
 					SysEx_IOTRACE("JHDR %p %lld\n", pager, pager->JournalHeader);
 					rc = pager->JournalFile->Write(header, sizeof(header), pager->JournalHeader);
 					if (rc != RC::OK) return rc;
+					pager->Metrics.JournalBytes += sizeof(header);
 				}
 				if ((dc & VFile::IOCAP_SEQUENTIAL) == 0)
 				{
 					PAGERTRACE("SYNC journal of %d\n", PAGERID(pager));
 					SysEx_IOTRACE("JSYNC %p\n", pager);
-					rc = pager->JournalFile->Sync(pager->SyncFlags | (pager->SyncFlags == VFile::SYNC_FULL ? VFile::SYNC_DATAONLY : 0));
+					rc = pagerSyncFile(pager, pager->JournalFile, IPager::METRICFILE_JOURNAL, pager->SyncFlags | (pager->SyncFlags == VFile::SYNC_FULL ? VFile::SYNC_DATAONLY : 0));
 					if (rc != RC::OK) return rc;
 				}
 
@@ -1991,9 +2427,16 @@ end_playback:
 				pager->JournalHeader = pager->JournalOffset;
 		}
 
+		// Records still held by a write-behind journal reach the file before any database page they protect, synced or not.
+		if (pager->JournalFile->Opened)
+		{
+			rc = VFile::JournalVFileFlush(pager->JournalFile);
+			if (rc != RC::OK) return rc;
+		}
+
 		// Unless the pager is in noSync mode, the journal file was just successfully synced. Either way, clear the PGHDR_NEED_SYNC flag on all pages.
 		pager->PCache->ClearSyncFlags();
-		pager->State = Pager::PAGER_WRITER_DBMOD;
+		pagerSetState(pager, Pager::PAGER_WRITER_DBMOD);
 		_assert(assert_pager_state(pager));
 		return RC::OK;
 	}
@@ -2023,6 +2466,10 @@ end_playback:
 			pager->DBHintSize = pager->DBSize;
 		}
 
+		// The list is sorted by page number, so pages that follow on from each other in the file are gathered into a run and written together.
+		VFile::IOVec vecs[PAGER_MAX_IOVECS]; // Pages of the current run
+		int vecsLength = 0; // Number of pages in vecs
+		Pid runFirst = 0; // Page number of vecs[0]
 		while (rc == RC::OK && list)
 		{
 			Pid id = list->ID;
@@ -2040,9 +2487,24 @@ end_playback:
 				char *data; // Data to write
 				CODEC2(char, data, pager, list->Data, id, 6, return RC::NOMEM);
 
-				// Write out the page data.
-				int64 offset = (id - 1) * (int64)pager->PageSize; // Offset to write
-				rc = pager->File->Write(data, pager->PageSize, offset);
+				// Write out the page data. The page buffers stay put until the Wait() below, so the pages are gathered into runs and the writes left
+				// to run together; a codec encodes every page into one shared buffer, which has to be written before it is reused.
+#ifdef HAS_CODEC
+				if (pager->Codec)
+					rc = pagerWriteCoded(pager, data, id);
+				else
+#endif
+				{
+					if (vecsLength > 0 && (vecsLength == PAGER_MAX_IOVECS || id != runFirst + vecsLength))
+					{
+						rc = pagerWriteRun(pager, vecs, vecsLength, runFirst);
+						vecsLength = 0;
+					}
+					if (vecsLength == 0) runFirst = id;
+					vecs[vecsLength].Buffer = data;
+					vecs[vecsLength].Amount = pager->PageSize;
+					vecsLength++;
+				}
 
 				// If page 1 was just written, update Pager.dbFileVers to match the value now stored in the database file. If writing this 
 				// page caused the database file to grow, update dbFileSize. 
@@ -2064,7 +2526,15 @@ end_playback:
 			pager_set_pagehash(list);
 			list = list->Dirty;
 		}
+		if (rc == RC::OK && vecsLength > 0)
+			rc = pagerWriteRun(pager, vecs, vecsLength, runFirst);
 
+		// The caller may reuse or discard the pages as soon as this returns.
+		if (pager->File->Opened)
+		{
+			RC rc2 = pager->File->Wait();
+			if (rc == RC::OK) rc = rc2;
+		}
 		return rc;
 	}
 
@@ -2089,7 +2559,7 @@ end_playback:
 		{
 			// Open the sub-journal, if it has not already been opened
 			_assert(pager->UseJournal);
-			_assert(pager->JournalFile->Opened || UseWal(pager));
+			_assert(pager->JournalFile->Opened || UseWal(pager) || pager->JournalMode == IPager::JOURNALMODE_SHADOW);
 			_assert(pager->SubJournalFile->Opened || pager->SubRecords == 0);
 			_assert(UseWal(Pager) ||
 				pageInJournal(pg) ||
@@ -2137,20 +2607,26 @@ end_playback:
 		if (pager->DoNotSyncSpill && (pg->Flags & PgHdr::PGHDR_NEED_SYNC) != 0)
 			return RC::OK;
 
-		pg->Dirty = nullptr;
+		// Spill pg together with up to SpillBatch-1 of the coldest other unreferenced dirty pages, so that one journal sync and one write sorted by
+		// page number cover them all. Pages that need the journal synced are only taken when pg forces that sync anyway, and never while
+		// doNotSyncSpill is set, as the sync starts a new journal header.
+		bool needSync = (!UseWal(pager) && ((pg->Flags & PgHdr::PGHDR_NEED_SYNC) || pager->State == Pager::PAGER_WRITER_CACHEMOD));
+		PgHdr *list = pager->PCache->SpillList(pg, pager->SpillBatch, needSync && !pager->DoNotSyncSpill);
+		PgHdr *page;
 		RC rc = RC::OK;
 		if (UseWal(pager))
 		{
-			// Write a single frame for this page to the log.
-			if (subjRequiresPage(pg))
-				rc = subjournalPage(pg); 
+			// Write a frame for each page to the log.
+			for (page = list; rc == RC::OK && page; page = page->Dirty)
+				if (subjRequiresPage(page))
+					rc = subjournalPage(page); 
 			if (rc == RC::OK)
-				rc = pagerWalFrames(pager, pg, 0, false);
+				rc = pagerWalFrames(pager, list, 0, false);
 		}
 		else
 		{
 			// Sync the journal file if required.
-			if (pg->Flags & PgHdr::PGHDR_NEED_SYNC || pager->State == Pager::PAGER_WRITER_CACHEMOD)
+			if (needSync)
 				rc = syncJournal(pager, true);
 
 			// If the page number of this page is larger than the current size of the database image, it may need to be written to the sub-journal.
@@ -2172,22 +2648,36 @@ end_playback:
 			//
 			// The solution is to write the current data for page X into the sub-journal file now (if it is not already there), so that it will
 			// be restored to its current value when the "ROLLBACK TO sp" is executed.
-			if (SysEx_NEVER(rc == RC::OK && pg->ID > pager->DBSize && subjRequiresPage(pg)))
-				rc = subjournalPage(pg);
+			for (page = list; rc == RC::OK && page; page = page->Dirty)
+				if (SysEx_NEVER(page->ID > pager->DBSize && subjRequiresPage(page)))
+					rc = subjournalPage(page);
 
-			// Write the contents of the page out to the database file.
+			// Write the contents of the pages out to the database file.
 			if (rc == RC::OK)
 			{
-				_assert((pg->Flags & PgHdr::PGHDR_NEED_SYNC) == 0);
-				rc = pager_write_pagelist(pager, pg);
+#ifdef _DEBUG
+				for (page = list; page; page = page->Dirty)
+					_assert((page->Flags & PgHdr::PGHDR_NEED_SYNC) == 0);
+#endif
+				rc = pager_write_pagelist(pager, list);
 			}
 		}
 
-		// Mark the page as clean.
+		// Mark the pages as clean.
 		if (rc == RC::OK)
 		{
-			PAGERTRACE("STRESS %d page %d\n", PAGERID(pager), pg->ID);
-			PCache::MakeClean(pg);
+			int pages = 0;
+			PgHdr *next;
+			for (page = list; page; page = next)
+			{
+				next = page->Dirty;
+				PAGERTRACE("STRESS %d page %d\n", PAGERID(pager), page->ID);
+				PCache::MakeClean(page);
+				pages++;
+			}
+			pager->Stats[STAT_SPILL]++;
+			pager->Metrics.Spills++;
+			pager->Stats[STAT_SPILL_PAGES] += pages;
 		}
 
 		return pager_error(pager, rc); 
@@ -2310,6 +2800,8 @@ end_playback:
 			rc = vfs->Open(pager->Filename, pager->File, vfsFlags, &fout);
 			_assert(!memoryDB);
 			readOnly = (fout & VSystem::OPEN_READONLY);
+			if (!(fout & VSystem::OPEN_DIRECT))
+				pager->VfsFlags = (VSystem::OPEN)(pager->VfsFlags & ~VSystem::OPEN_DIRECT); // The VFS could not bypass the OS cache
 
 			// If the file was successfully opened for read/write access, choose a default page size in case we have to create the
 			// database file. The default page size is the maximum of:
@@ -2344,7 +2836,7 @@ end_playback:
 			// This branch is also run for an in-memory database. An in-memory database is the same as a temp-file that is never written out to
 			// disk and uses an in-memory rollback journal.
 			tempFile = true;
-			pager->State = Pager::PAGER_READER;
+			pagerSetState(pager, Pager::PAGER_READER);
 			pager->Lock = VFile::LOCK_EXCLUSIVE;
 			readOnly = (vfsFlags & VSystem::OPEN_READONLY);
 		}
@@ -2402,6 +2894,10 @@ end_playback:
 		}
 		pager->ExtraBytes = (uint16)extraBytes;
 		pager->JournalSizeLimit = DEFAULT_JOURNAL_SIZE_LIMIT;
+		pager->SizeMmap = (memoryDB || tempFile ? 0 : DEFAULT_MMAP_SIZE);
+		pagerFixMaplimit(pager);
+		pager->SpillBatch = PAGER_SPILL_BATCH;
+		pager->StateSince = SysEx::Now();
 		_assert(pager->File->Opened || tempFile);
 		setSectorSize(pager);
 		if (!useJournal)
@@ -2573,7 +3069,7 @@ end_playback:
 					if (rc == RC::OK)
 					{
 						rc = pager_playback(this, true);
-						State = Pager::PAGER_OPEN;
+						pagerSetState(this, Pager::PAGER_OPEN);
 					}
 				}
 				else if (!ExclusiveMode)
@@ -2653,7 +3149,7 @@ failed:
 			_assert(State == Pager::PAGER_OPEN);
 		}
 		else
-			State = Pager::PAGER_READER;
+			pagerSetState(this, Pager::PAGER_READER);
 		return rc;
 	}
 
@@ -2729,6 +3225,9 @@ failed:
 				ASSERTCOVERAGE(rc == RC::NOMEM);
 				SysEx::EndBenignAlloc();
 			}
+			// A cached page a read cursor still holds may point into the mapping, which is read-only.
+			if (pg->Flags & PgHdr::PGHDR_MMAP)
+				pagerUnmapPage(pg);
 			_memset(pg->Data, 0, PageSize);
 			SysEx_IOTRACE("ZERO %p %d\n", this, id);
 		}
@@ -2736,7 +3235,9 @@ failed:
 		{
 			_assert(pg->Pager == this);
 			Stats[STAT_MISS]++;
-			rc = readDbPage(pg);
+			// Outside of a write transaction a page other than page 1 may be served straight from the memory mapped file. Page 1 is always read, as
+			// it refreshes DBFileVersion.
+			rc = (UseFetch(this) && State == Pager::PAGER_READER && id != 1 ? pagerAcquireMapPage(pg) : readDbPage(pg));
 			if (rc != RC::OK)
 				goto pager_acquire_err;
 		}
@@ -2753,6 +3254,177 @@ pager_acquire_err:
 		return rc;
 	}
 
+	// Acquire the pages ids[0..count-1] into pagesOut[], as count calls to Acquire(id, &pagesOut[i], false) would, but with the pages that miss the
+	// cache read together: they are sorted by page number and each run of consecutive pages is read with one Readv(), a lone page with
+	// ReadAsync(). A page may be asked for more than once and holds a reference for each. On error no page is left referenced and pagesOut[] is
+	// all nullptr.
+	__device__ RC Pager::AcquireBatch(const Pid *ids, int count, IPage **pagesOut)
+	{
+		_assert(State >= Pager::PAGER_READER);
+		_assert(assert_pager_state(this));
+		int i;
+		for (i = 0; i < count; i++)
+			pagesOut[i] = nullptr;
+		if (count <= 0)
+			return RC::OK;
+		if (ErrorCode != RC::OK)
+		{
+			pagerUnlockIfUnused(this);
+			return ErrorCode;
+		}
+		PgHdr **misses = (PgHdr **)SysEx::Alloc(count * sizeof(PgHdr *)); // Pages created by this call whose content is still to be read
+		if (!misses)
+		{
+			pagerUnlockIfUnused(this);
+			return RC::NOMEM;
+		}
+		int missesLength = 0;
+
+		// Look every page up first. Pages the cache holds, pages past the end of the file and pages served from the WAL, the memory map or (for
+		// page 1) readDbPage() are finished here; the rest wait in misses[].
+		RC rc = RC::OK;
+		for (i = 0; i < count; i++)
+		{
+			Pid id = ids[i];
+			if (id == 0)
+			{
+				rc = SysEx_CORRUPT_BKPT;
+				break;
+			}
+			PgHdr *pg;
+			rc = PCache->Fetch(id, true, &pg);
+			if (rc != RC::OK)
+				break;
+			_assert(pg->ID == id);
+			pagesOut[i] = pg;
+			if (pg->Pager)
+			{
+				// Already in the cache, or asked for earlier in this batch and filled in with the rest of misses[] below
+				Stats[STAT_HIT]++;
+				continue;
+			}
+			pg->Pager = this;
+			misses[missesLength++] = pg;
+			if (id > MAX_PID || id == MJ_PID(this))
+			{
+				rc = SysEx_CORRUPT_BKPT;
+				break;
+			}
+			if (MemoryDB || DBSize < id || !File->Opened)
+			{
+				if (id > MaxPid)
+				{
+					rc = RC::FULL;
+					break;
+				}
+				_memset(pg->Data, 0, PageSize);
+				SysEx_IOTRACE("ZERO %p %d\n", this, id);
+				missesLength--;
+				pager_set_pagehash(pg);
+				continue;
+			}
+			Stats[STAT_MISS]++;
+			if (id == 1)
+				rc = readDbPage(pg);
+			else if (UseFetch(this) && State == Pager::PAGER_READER)
+				rc = pagerAcquireMapPage(pg);
+			else
+			{
+				bool isInWal = false; // True if the page was read from the WAL
+				if (UseWal(this))
+					rc = Wal->Read(id, &isInWal, PageSize, (uint8 *)pg->Data);
+				if (rc == RC::OK && !isInWal)
+					continue;
+				if (rc == RC::OK)
+				{
+					Metrics.ReadsWal++;
+					CODEC1(this, pg->Data, id, 3, rc = RC::NOMEM);
+				}
+			}
+			if (rc != RC::OK)
+				break;
+			missesLength--;
+			pager_set_pagehash(pg);
+		}
+
+		if (rc == RC::OK && missesLength > 0)
+		{
+			// Sort the misses by page number. Callers mostly ask for pages in order, which an insertion sort gets through in one pass.
+			for (int j = 1; j < missesLength; j++)
+			{
+				PgHdr *pg = misses[j];
+				int k;
+				for (k = j; k > 0 && misses[k - 1]->ID > pg->ID; k--)
+					misses[k] = misses[k - 1];
+				misses[k] = pg;
+			}
+
+			// Queue a read for each run of consecutive pages, then wait for them all before finishing the pages as readDbPage() would.
+			VFile::IOVec vecs[PAGER_MAX_IOVECS]; // Pages of the current run
+			for (int j = 0; rc == RC::OK && j < missesLength; )
+			{
+				Pid first = misses[j]->ID; // Page number of vecs[0]
+				int run = 0; // Number of pages in vecs
+				while (j + run < missesLength && run < PAGER_MAX_IOVECS && misses[j + run]->ID == first + run)
+				{
+					vecs[run].Buffer = misses[j + run]->Data;
+					vecs[run].Amount = PageSize;
+					run++;
+				}
+				int64 offset = (first - 1) * (int64)PageSize;
+				rc = (run == 1 ? File->ReadAsync(vecs[0].Buffer, PageSize, offset) : File->Readv(vecs, run, offset));
+				if (rc == RC::IOERR_SHORT_READ)
+					rc = RC::OK;
+				j += run;
+			}
+			RC rc2 = File->Wait();
+			if (rc == RC::OK && rc2 != RC::IOERR_SHORT_READ) rc = rc2;
+			Metrics.ReadsDB += missesLength;
+			for (int j = 0; rc == RC::OK && j < missesLength; j++)
+			{
+				PgHdr *pg = misses[j];
+				Pid id = pg->ID;
+				CODEC1(this, pg->Data, id, 3, rc = RC::NOMEM);
+				PAGER_INCR(_readdb_count);
+				PAGER_INCR(Reads);
+				SysEx_IOTRACE("PGIN %p %d\n", this, id);
+				PAGERTRACE("FETCH %d page %d hash(%08x)\n", PAGERID(this), id, pager_pagehash(pg));
+				pager_set_pagehash(pg);
+			}
+			if (rc == RC::OK)
+				missesLength = 0;
+		}
+
+		if (rc != RC::OK)
+		{
+			// A page whose content was never read is dropped from the cache, as Acquire() does, once the references from later duplicates in
+			// the batch are released. Every other page is released as Unref() would.
+			for (int j = 0; j < missesLength; j++)
+				misses[j]->Pager = nullptr;
+			for (i = count - 1; i >= 0; i--)
+			{
+				PgHdr *pg = pagesOut[i];
+				if (!pg)
+					continue;
+				if (pg->Pager)
+				{
+					if ((pg->Flags & PgHdr::PGHDR_MMAP) && PCache::get_PageRefs(pg) == 1)
+						pagerReleaseMapPage(pg);
+					else
+						PCache::Release(pg);
+				}
+				else if (PCache::get_PageRefs(pg) == 1)
+					PCache::Drop(pg);
+				else
+					PCache::Release(pg);
+				pagesOut[i] = nullptr;
+			}
+			pagerUnlockIfUnused(this);
+		}
+		SysEx::Free(misses);
+		return rc;
+	}
+
 	__device__ IPage *Pager::Lookup(Pid id)
 	{
 		_assert(id != 0);
@@ -2763,12 +3435,49 @@ pager_acquire_err:
 		return pg;
 	}
 
+	// Tell the VFS that the pages in ids[] are about to be read, so it can start reading them now. Pages already in the cache, or past the end of
+	// the file, are skipped and runs of adjacent page numbers are passed as one range. This is only a hint: nothing is read into the cache here
+	// and a VFS that does not know FCNTL_PREFETCH simply ignores it.
+	__device__ void Pager::Prefetch(Pid *ids, int count)
+	{
+		_assert(State >= Pager::PAGER_READER && State != Pager::PAGER_ERROR);
+		if (MemoryDB || !File->Opened || ErrorCode != RC::OK)
+			return;
+		int64 range[2] = {0, 0}; // Offset and length of the run being built
+		for (int i = 0; i <= count; i++)
+		{
+			int64 offset = -1;
+			if (i < count && ids[i] != 0 && ids[i] <= DBSize)
+			{
+				PgHdr *pg = pager_lookup(this, ids[i]);
+				if (pg)
+					Unref(pg);
+				else
+					offset = (ids[i] - 1) * (int64)PageSize;
+			}
+			if (offset >= 0 && range[1] > 0 && (offset == range[0] + range[1] || offset + PageSize == range[0]))
+			{
+				// Extend the run at whichever end this page continues it, so a descending scan coalesces as well as an ascending one
+				if (offset < range[0]) range[0] = offset;
+				range[1] += PageSize;
+				continue;
+			}
+			if (range[1] > 0)
+				File->FileControl(VFile::FCNTL_PREFETCH, range);
+			range[0] = offset;
+			range[1] = (offset >= 0 ? PageSize : 0);
+		}
+	}
+
 	__device__ void Pager::Unref(IPage *pg)
 	{
 		if (pg)
 		{
 			Pager *pager = pg->Pager;
-			PCache::Release(pg);
+			if ((pg->Flags & PgHdr::PGHDR_MMAP) && PCache::get_PageRefs(pg) == 1)
+				pagerReleaseMapPage(pg);
+			else
+				PCache::Release(pg);
 			pagerUnlockIfUnused(pager);
 		}
 	}
@@ -2790,8 +3499,9 @@ pager_acquire_err:
 			if (pager->InJournal == nullptr)
 				return RC::NOMEM;
 
-			// Open the journal file if it is not already open.
-			if (!pager->JournalFile->Opened)
+			// Open the journal file if it is not already open. journal_mode=shadow has none, InJournal only records which pages the transaction
+			// changed, so a rollback knows which to read back from the database.
+			if (!pager->JournalFile->Opened && pager->JournalMode != IPager::JOURNALMODE_SHADOW)
 			{
 				if (pager->JournalMode == IPager::JOURNALMODE_JMEMORY)
 					VFile::MemoryVFileOpen(pager->JournalFile);
@@ -2801,14 +3511,14 @@ pager_acquire_err:
 #ifdef ENABLE_ATOMIC_WRITE
 					rc = VFile::JournalVFileOpen(pager->Vfs, pager->Journal, pager->JournalFile, flags, jrnlBufferSize(pager));
 #else
-					rc = pager->Vfs->Open(pager->Journal, pager->JournalFile, flags, 0);
+					rc = VFile::JournalVFileOpen(pager->Vfs, pager->Journal, pager->JournalFile, flags, 0);
 #endif
 				}
 				_assert(rc != RC::OK || pager->JournalFile->Opened);
 			}
 
 			// Write the first journal header to the journal file and open the sub-journal if necessary.
-			if (rc == RC::OK)
+			if (rc == RC::OK && pager->JournalMode != IPager::JOURNALMODE_SHADOW)
 			{
 				// TODO: Check if all of these are really required.
 				pager->Records = 0;
@@ -2827,7 +3537,7 @@ pager_acquire_err:
 		else
 		{
 			_assert(pager->State == Pager::PAGER_WRITER_LOCKED);
-			pager->State = Pager::PAGER_WRITER_CACHEMOD;
+			pagerSetState(pager, Pager::PAGER_WRITER_CACHEMOD);
 		}
 
 		return rc;
@@ -2875,7 +3585,7 @@ pager_acquire_err:
 				// WAL mode sets Pager.eState to PAGER_WRITER_LOCKED or CACHEMOD when it has an open transaction, but never to DBMOD or FINISHED.
 				// This is because in those states the code to roll back savepoint transactions may copy data from the sub-journal into the database 
 				// file as well as into the page cache. Which would be incorrect in WAL mode.
-				State = Pager::PAGER_WRITER_LOCKED;
+				pagerSetState(this, Pager::PAGER_WRITER_LOCKED);
 				DBHintSize = DBSize;
 				DBFileSize = DBSize;
 				DBOrigSize = DBSize;
@@ -2893,8 +3603,11 @@ pager_acquire_err:
 
 	__device__ static RC pager_write(PgHdr *pg)
 	{
-		void *data = pg->Data;
 		Pager *pager = pg->Pager;
+		// A page served from the memory mapped file is copied into its own buffer the first time it is written.
+		if (pg->Flags & PgHdr::PGHDR_MMAP)
+			pagerUnmapPage(pg);
+		void *data = pg->Data;
 
 		// This routine is not called unless a write-transaction has already been started. The journal file may or may not be open at this point. It is never called in the ERROR state.
 		_assert(pager->State == Pager::PAGER_WRITER_LOCKED ||
@@ -2934,7 +3647,18 @@ pager_acquire_err:
 			if (!pageInJournal(pg) && !UseWal(pager))
 			{
 				_assert(UseWal(pager) == 0);
-				if (pg->ID <= pager->DBOrigSize && pager->JournalFile->Opened)
+				if (pg->ID <= pager->DBOrigSize && pager->JournalMode == IPager::JOURNALMODE_SHADOW)
+				{
+					// The VFS never overwrites the committed page, so there is nothing to journal or sync first. Not adding the page to the
+					// savepoint bitvecs leaves statement rollback to the sub-journal.
+					rc = pager->InJournal->Set(pg->ID);
+					if (rc != RC::OK)
+					{
+						_assert(rc == RC::NOMEM);
+						return rc;
+					}
+				}
+				else if (pg->ID <= pager->DBOrigSize && pager->JournalFile->Opened)
 				{
 					// We should never write to the journal file the page that contains the database locks.  The following assert verifies that we do not.
 					_assert(pg->ID != MJ_PID(pager));
@@ -2949,13 +3673,16 @@ pager_acquire_err:
 					// in the database file. And if an IO error occurs while doing so, then corruption may follow.
 					pg->Flags |= PgHdr::PGHDR_NEED_SYNC;
 
-					int64 offset = pager->JournalOffset;
-					rc = pager->JournalFile->Write4(offset, pg->ID);
-					if (rc != RC::OK) return rc;
-					rc = pager->JournalFile->Write(data2, pager->PageSize, offset + 4);
-					if (rc != RC::OK) return rc;
-					rc = pager->JournalFile->Write4(offset + pager->PageSize + 4, checksum);
+					// The page number, page image and checksum are laid out as they appear in the journal and handed over in one write. A write-behind
+					// journal then merges consecutive records into large writes of its own until the journal is synced.
+					uint8 *record = pager->JournalRecord;
+					ConvertEx::Put4(record, pg->ID);
+					_memcpy(&record[4], data2, pager->PageSize);
+					ConvertEx::Put4(&record[pager->PageSize + 4], checksum);
+					rc = pager->JournalFile->Write(record, pager->PageSize + 8, pager->JournalOffset);
 					if (rc != RC::OK) return rc;
+					pager->Metrics.JournalRecords++;
+					pager->Metrics.JournalBytes += pager->PageSize + 8;
 
 					SysEx_IOTRACE("JOUT %p %d %lld %d\n", pager, pg->ID, pager->JournalOffset, pager->PageSize);
 					PAGER_INCR(_writej_count);
@@ -3165,7 +3892,7 @@ pager_acquire_err:
 		if (!NoSync)
 		{
 			_assert(!MemoryDB);
-			rc = File->Sync(SyncFlags);
+			rc = pagerSyncFile(this, File, IPager::METRICFILE_DB, SyncFlags);
 		}
 		else if (File->Opened)
 		{
@@ -3209,6 +3936,8 @@ pager_acquire_err:
 		// If no database changes have been made, return early.
 		if (State < Pager::PAGER_WRITER_CACHEMOD) return RC::OK;
 
+		Commits++;
+		int64 start = SysEx::Now(); // For Metrics.PhaseOne[]
 		RC rc = RC::OK;
 		if (MemoryDB)
 		{
@@ -3310,16 +4039,22 @@ pager_acquire_err:
 					if (rc != RC::OK) goto commit_phase_one_exit;
 				}
 
-				// Finally, sync the database file.
+				// Finally, sync the database file. Under journal_mode=shadow the sync is also the commit, so a commit without one still publishes.
 				if (!noSync)
 					rc = Sync();
+				else if (JournalMode == IPager::JOURNALMODE_SHADOW)
+				{
+					int syncFlags = 0;
+					rc = File->FileControl(VFile::FCNTL_SHADOW_COMMIT, &syncFlags);
+				}
 				SysEx_IOTRACE("DBSYNC %p\n", this);
 			}
 		}
 
 commit_phase_one_exit:
 		if (rc == RC::OK && !UseWal(this))
-			State = Pager::PAGER_WRITER_FINISHED;
+			pagerSetState(this, Pager::PAGER_WRITER_FINISHED);
+		pagerMetricsTime(Metrics.PhaseOne, &Metrics.PhaseOneMicros, start);
 		return rc;
 	}
 
@@ -3344,15 +4079,32 @@ commit_phase_one_exit:
 			JournalMode == IPager::JOURNALMODE_PERSIST)
 		{
 			_assert(JournalOffset == JOURNAL_HDR_SZ(this) || !JournalOffset);
-			State = Pager::PAGER_READER;
+			pagerSetState(this, Pager::PAGER_READER);
 			return RC::OK;
 		}
 
 		PAGERTRACE("COMMIT %d\n", PAGERID(this));
+		int64 start = SysEx::Now(); // For Metrics.PhaseTwo[]
 		RC rc = pager_end_transaction(this, SetMaster, true);
+		pagerMetricsTime(Metrics.PhaseTwo, &Metrics.PhaseTwoMicros, start);
 		return pager_error(this, rc);
 	}
 
+	// Returns the id of the last commit, which WaitDurable() takes.
+	__device__ uint64 Pager::get_CommitID()
+	{
+		return Commits;
+	}
+
+	// Waits until commit commitId, and every commit before it, is as durable as PRAGMA synchronous makes it. Only WAL commits made under
+	// SetAsyncCommit() ever return before that; the rollback journal and shadow paging modes sync inline, as each commit's sync orders its
+	// writes against the next one's, so for them this returns at once. Returns the error the deferred sync hit, if one failed.
+	__device__ RC Pager::WaitDurable(uint64 commitId)
+	{
+		if (commitId > Commits) commitId = Commits;
+		return (Wal ? Wal->WaitSync(commitId) : RC::OK);
+	}
+
 	__device__ RC Pager::Rollback()
 	{
 		PAGERTRACE("ROLLBACK %d\n", PAGERID(this));
@@ -3368,6 +4120,8 @@ commit_phase_one_exit:
 			RC rc2 = pager_end_transaction(this, SetMaster, false);
 			if (rc == RC::OK) rc = rc2;
 		}
+		else if (JournalMode == IPager::JOURNALMODE_SHADOW)
+			rc = pagerRollbackShadow(this);
 		else if (!JournalFile->Opened || State == Pager::PAGER_WRITER_LOCKED)
 		{
 			PAGER state = State;
@@ -3376,7 +4130,7 @@ commit_phase_one_exit:
 			{
 				// This can happen using journal_mode=off. Move the pager to the error state to indicate that the contents of the cache may not be trusted. Any active readers will get SQLITE_ABORT.
 				ErrorCode = RC::ABORT;
-				State = Pager::PAGER_ERROR;
+				pagerSetState(this, Pager::PAGER_ERROR);
 				return rc;
 			}
 		}
@@ -3436,18 +4190,37 @@ commit_phase_one_exit:
 
 	__device__ void Pager::CacheStat(int dbStatus, bool reset, int *value)
 	{
-		//_assert(dbStatus == DBSTATUS_CACHE_HIT ||
-		//	dbStatus == DBSTATUS_CACHE_MISS ||
-		//	dbStatus == DBSTATUS_CACHE_WRITE);
-		//_assert(DBSTATUS_CACHE_HIT + 1 == DBSTATUS_CACHE_MISS);
-		//_assert(DBSTATUS_CACHE_HIT + 2 == DBSTATUS_CACHE_WRITE);
-		//_assert(STAT_HIT == 0 &&
-		//	STAT_MISS == 1 &&
-		//	STAT_WRITE == 2);
+		_assert(dbStatus >= IPager::CACHESTAT_HIT && dbStatus <= IPager::CACHESTAT_GHOST_FREQUENT);
+		_assert(STAT_HIT == IPager::CACHESTAT_HIT &&
+			STAT_MISS == IPager::CACHESTAT_MISS &&
+			STAT_WRITE == IPager::CACHESTAT_WRITE &&
+			STAT_SPILL == IPager::CACHESTAT_SPILL &&
+			STAT_SPILL_PAGES == IPager::CACHESTAT_SPILL_PAGES &&
+			STAT_GHOST_RECENT == IPager::CACHESTAT_GHOST_RECENT &&
+			STAT_GHOST_FREQUENT == IPager::CACHESTAT_GHOST_FREQUENT);
+
+		// The page cache counts ghost hits itself. Move them here, where they are reset one at a time
+		if (dbStatus >= IPager::CACHESTAT_GHOST_RECENT)
+		{
+			IPCache::PolicyStats stats;
+			PCache->GetPolicyStats(&stats, true);
+			Stats[STAT_GHOST_RECENT] += (int)stats.GhostRecent;
+			Stats[STAT_GHOST_FREQUENT] += (int)stats.GhostFrequent;
+		}
+		*value += Stats[dbStatus];
+		if (reset)
+			Stats[dbStatus] = 0;
+	}
 
-		//*value += Stats[dbStatus - DBSTATUS_CACHE_HIT];
-		//if (reset)
-		//	Stats[dbStatus - DBSTATUS_CACHE_HIT] = 0;
+	// Copy out the pager's metrics, with the time in the current state counted up to now, and zero them if reset is set.
+	__device__ void Pager::GetMetrics(IPager::Metrics *metrics, bool reset)
+	{
+		pagerSetState(this, State);
+		if (Wal)
+			Wal->CollectSyncs(Metrics.Syncs, Metrics.SyncMicros);
+		*metrics = Metrics;
+		if (reset)
+			_memset(&Metrics, 0, sizeof(Metrics));
 	}
 
 	__device__ bool Pager::get_MemoryDB()
@@ -3521,7 +4294,7 @@ commit_phase_one_exit:
 			}
 			// Else this is a rollback operation, playback the specified savepoint. If this is a temp-file, it is possible that the journal file has
 			// not yet been opened. In this case there have been no changes to the database file, so the playback operation can be skipped.
-			else if (UseWal(this) || JournalFile->Opened)
+			else if (UseWal(this) || JournalFile->Opened || JournalMode == IPager::JOURNALMODE_SHADOW)
 			{
 				PagerSavepoint *savepoint = (newLength == 0 ? nullptr : &Savepoints[newLength - 1]);
 				rc = pagerPlaybackSavepoint(this, savepoint);
@@ -3559,7 +4332,7 @@ commit_phase_one_exit:
 #ifdef HAS_CODEC
 	__device__ void sqlite3PagerSetCodec(Pager *pager, void *(*codec)(void *,void *, Pid, int), void (*codecSizeChange)(void *, int, int), void (*codecFree)(void *), void *codecArg)
 	{
-		if (pager->CodecFree) pager->CodecFree(pager->Codec);
+		if (pager->CodecFree) pager->CodecFree(pager->CodecArg);
 		pager->Codec = (pager->MemoryDB ? nullptr : codec);
 		pager->CodecSizeChange = codecSizeChange;
 		pager->CodecFree = codecFree;
@@ -3705,6 +4478,20 @@ commit_phase_one_exit:
 		return (int)ExclusiveMode;
 	}
 
+	// Turns asynchronous commit on (on > 0) or off (on == 0), or only queries it (on < 0), returning the setting. An asynchronous commit in
+	// journal_mode=wal returns once its frames are written and a flusher thread syncs the WAL behind it, once for every commit that queued
+	// since its last sync; WaitDurable() waits for it. Turning it off waits for the commits already made.
+	__device__ bool Pager::SetAsyncCommit(int on)
+	{
+		if (on >= 0)
+		{
+			if (!on && AsyncCommit)
+				WaitDurable(Commits);
+			AsyncCommit = (on != 0);
+		}
+		return AsyncCommit;
+	}
+
 	__device__ IPager::JOURNALMODE Pager::SetJournalMode(IPager::JOURNALMODE mode)
 	{
 #ifdef _DEBUG
@@ -3718,7 +4505,8 @@ commit_phase_one_exit:
 			mode == IPager::JOURNALMODE_PERSIST ||
 			mode == IPager::JOURNALMODE_OFF ||
 			mode == IPager::JOURNALMODE_WAL ||
-			mode == IPager::JOURNALMODE_JMEMORY);
+			mode == IPager::JOURNALMODE_JMEMORY ||
+			mode == IPager::JOURNALMODE_SHADOW);
 
 		// This routine is only called from the OP_JournalMode opcode, and the logic there will never allow a temporary file to be changed to WAL mode.
 		_assert(!TempFile || mode != IPager::JOURNALMODE_WAL);
@@ -3732,6 +4520,14 @@ commit_phase_one_exit:
 				mode = old;
 		}
 
+		// journal_mode=shadow needs a database file that a ShadowVSystem shadow pages. Any other keeps the mode it has.
+		if (mode == IPager::JOURNALMODE_SHADOW && mode != old)
+		{
+			uint32 generation;
+			if (MemoryDB || TempFile || !File->Opened || File->FileControl(VFile::FCNTL_SHADOW_GENERATION, &generation) != RC::OK)
+				mode = old;
+		}
+
 		if (mode != old)
 		{
 			// Change the journal mode
@@ -3744,6 +4540,7 @@ commit_phase_one_exit:
 			_assert((IPager::JOURNALMODE_PERSIST & 5) == 1);
 			_assert((IPager::JOURNALMODE_DELETE & 5) == 0);
 			_assert((IPager::JOURNALMODE_JMEMORY & 5) == 4);
+			_assert((IPager::JOURNALMODE_SHADOW & 5) == 4);
 			_assert((IPager::JOURNALMODE_OFF & 5) == 0);
 			_assert((IPager::JOURNALMODE_WAL & 5) == 5);
 
@@ -3895,7 +4692,7 @@ commit_phase_one_exit:
 			if (rc == RC::OK)
 			{
 				JournalMode = IPager::JOURNALMODE_WAL;
-				State = Pager::PAGER_OPEN;
+				pagerSetState(this, Pager::PAGER_OPEN);
 			}
 		}
 		else
@@ -1,6 +1,10 @@
 ﻿// pager.h
 namespace Core
 {
+#ifndef PAGER_METRICS_BUCKETS // Latency buckets in the commit histograms of IPager::Metrics
+#define PAGER_METRICS_BUCKETS 24
+#endif
+
 	typedef class Pager Pager;
 	typedef struct Wal Wal;
 	typedef struct PgHdr IPage;
@@ -33,6 +37,7 @@ namespace Core
 			JOURNALMODE_TRUNCATE = 3,	// Commit by truncating journal
 			JOURNALMODE_JMEMORY = 4,    // In-memory journal file
 			JOURNALMODE_WAL = 5,        // Use write-ahead logging
+			JOURNALMODE_SHADOW = 6,     // No journal, the VFS writes pages copy-on-write and commits by switching maps (ShadowVSystem)
 		};
 
 		// sqlite3.h
@@ -43,6 +48,55 @@ namespace Core
 			CHECKPOINT_RESTART = 2,
 		};
 
+		// Counters read by Pager::CacheStat()
+		enum CACHESTAT : char
+		{
+			CACHESTAT_HIT = 0,
+			CACHESTAT_MISS = 1,
+			CACHESTAT_WRITE = 2,
+			CACHESTAT_SPILL = 3,			// Cache spills, each writing one batch of dirty pages
+			CACHESTAT_SPILL_PAGES = 4,		// Pages written by cache spills. Times the page size, the bytes they wrote
+			CACHESTAT_GHOST_RECENT = 5,		// Misses on pages the cache evicted after one use. Many say a larger cache would pay off
+			CACHESTAT_GHOST_FREQUENT = 6,	// Misses on pages the cache evicted after more than one use
+		};
+
+		// Page replacement policies of Pager::SetCachePolicy(). These values must match the corresponding IPCache::POLICY values.
+		enum CACHEPOLICY : char
+		{
+			CACHEPOLICY_QUERY = -1,
+			CACHEPOLICY_LRU = 0,			// Evict the least recently used page
+			CACHEPOLICY_ARC = 1,			// Keep pages used more than once through a scan, and count ghost hits
+		};
+
+		// Files whose syncs Pager::GetMetrics() counts separately
+		enum METRICFILE : char
+		{
+			METRICFILE_DB = 0,
+			METRICFILE_JOURNAL = 1,
+			METRICFILE_WAL = 2,				// Every sync of the WAL: by commits, asynchronous or not, and by checkpoints. Checkpoint syncs of the database count as METRICFILE_DB
+			METRICFILE_COUNT = 3,
+		};
+
+		// What a pager has done since it was opened or its metrics were last reset, for finding out where the time went. Times are in
+		// microseconds, and histogram bucket b counts calls that took under 2^b microseconds, the last bucket taking everything slower.
+		struct Metrics
+		{
+			int64 ReadsDB;					// Pages read from the database file
+			int64 ReadsWal;					// Pages read from the WAL
+			int64 JournalRecords;			// Page records written to the main journal
+			int64 JournalBytes;				// Bytes written to the main journal: records, headers and the master journal name
+			int64 Syncs[METRICFILE_COUNT];
+			int64 SyncMicros[METRICFILE_COUNT];
+			int64 Spills;					// Cache spills, each writing one batch of dirty pages
+			int64 StateMicros[7];			// Time spent in each Pager::PAGER state
+			int64 LockWaits;				// Lock requests that were busy at least once and went through the busy handler
+			int64 LockWaitMicros;			// Time those requests took
+			int64 PhaseOne[PAGER_METRICS_BUCKETS];	// CommitPhaseOne() calls that had changes to commit, by latency
+			int64 PhaseOneMicros;
+			int64 PhaseTwo[PAGER_METRICS_BUCKETS];	// CommitPhaseTwo() calls, by latency
+			int64 PhaseTwoMicros;
+		};
+
 		// sqliteInt.h
 		enum SAVEPOINT : char
 		{
@@ -75,6 +129,7 @@ namespace Core
 		bool UseJournal;			// Use a rollback journal on this file
 		bool NoSync;				// Do not sync the journal if true
 		bool FullSync;				// Do extra syncs of the journal for robustness
+		bool AsyncCommit;			// WAL commits leave their sync to the WAL's flusher. See SetAsyncCommit()
 		VFile::SYNC CheckpointSyncFlags;	// SYNC_NORMAL or SYNC_FULL for checkpoint
 		VFile::SYNC WalSyncFlags;	// SYNC_NORMAL or SYNC_FULL for wal writes
 		VFile::SYNC SyncFlags;		// SYNC_NORMAL or SYNC_FULL otherwise
@@ -121,7 +176,13 @@ namespace Core
 		char *Journal;				// Name of the journal file
 		int (*BusyHandler)(void*);	// Function to call when busy
 		void *BusyHandlerArg;		// Context argument for xBusyHandler
-		int Stats[3];               // Total cache hits, misses and writes
+		int Stats[7];               // Total cache hits, misses, writes, spills and ghost hits, indexed by IPager::CACHESTAT
+		int SpillBatch;				// Most dirty pages written by one cache spill
+		IPager::Metrics Metrics;	// Counters read by GetMetrics()
+		int64 StateSince;			// When State last changed, for Metrics.StateMicros[]
+		uint64 Commits;				// Id of the last commit CommitPhaseOne() began, for WaitDurable()
+		int64 SizeMmap;				// Upper bound on the memory mapped region, 0 disables mmap
+		int MmapOuts;				// Number of PGHDR_MMAP pages currently referenced
 #ifdef TEST
 		int Reads;                  // Database pages read
 #endif
@@ -133,6 +194,9 @@ namespace Core
 		void *CodecArg;								// First argument to xCodec... methods
 #endif
 		void *TmpSpace;				// Pager.pageSize bytes of space for tmp use
+		uint8 *JournalRecord;		// Pager.pageSize+8 bytes in which pager_write() builds a journal record
+		void *AsyncSpace;			// PAGER_ASYNC_PAGES page buffers for writes queued during journal playback
+		int AsyncSlot;				// Next free buffer in AsyncSpace
 		PCache *PCache;				// Pointer to page cache object
 #ifndef OMIT_WAL
 		Wal *Wal;					// Write-ahead log used by "journal_mode=wal"
@@ -150,9 +214,13 @@ namespace Core
 		__device__ RC SetPageSize(uint32 *pageSizeRef, int reserveBytes);
 		__device__ int MaxPages(int maxPages);
 		__device__ void SetCacheSize(int maxPages);
+		__device__ IPager::CACHEPOLICY SetCachePolicy(IPager::CACHEPOLICY policy);
+		__device__ void SetMmapLimit(int64 limit);
+		__device__ void SetSpillBatch(int pages);
 		__device__ void Shrink();
 		__device__ void SetSafetyLevel(int level, bool fullFsync, bool checkpointFullFsync);
 		__device__ int LockingMode(IPager::LOCKINGMODE mode);
+		__device__ bool SetAsyncCommit(int on);
 		__device__ IPager::JOURNALMODE SetJournalMode(IPager::JOURNALMODE mode);
 		__device__ IPager::JOURNALMODE Pager::GetJournalMode();
 		__device__ bool OkToChangeJournalMode();
@@ -161,7 +229,9 @@ namespace Core
 
 		// Functions used to obtain and release page references.
 		__device__ RC Acquire(Pid id, IPage **pageOut, bool noContent);
+		__device__ RC AcquireBatch(const Pid *ids, int count, IPage **pagesOut);
 		__device__ IPage *Lookup(Pid id);
+		__device__ void Prefetch(Pid *ids, int count);
 		__device__ static void Ref(IPage *pg);
 		__device__ static void Unref(IPage *pg);
 
@@ -180,6 +250,8 @@ namespace Core
 		__device__ RC ExclusiveLock();
 		__device__ RC Sync();
 		__device__ RC CommitPhaseTwo();
+		__device__ uint64 get_CommitID();
+		__device__ RC WaitDurable(uint64 commitId);
 		__device__ RC Rollback();
 		__device__ RC OpenSavepoint(int savepoints);
 		__device__ RC Savepoint(IPager::SAVEPOINT op, int savepoints);
@@ -207,6 +279,7 @@ namespace Core
 		__device__ void *get_TempSpace();
 		__device__ bool get_MemoryDB();
 		__device__ void CacheStat(int dbStatus, bool reset, int *value);
+		__device__ void GetMetrics(IPager::Metrics *metrics, bool reset);
 		__device__ void ClearCache();
 		__device__ static int get_SectorSize(VFile *file);
 
@@ -226,6 +299,11 @@ namespace Core
 #endif
 	};
 
+#ifdef HAS_CODEC
+	__device__ void sqlite3PagerSetCodec(Pager *pager, void *(*codec)(void *, void *, Pid, int), void (*codecSizeChange)(void *, int, int), void (*codecFree)(void *), void *codecArg);
+	__device__ void *sqlite3PagerGetCodec(Pager *pager);
+#endif
+
 #ifdef TEST
 	__device__ void disable_simulated_io_errors();
 	__device__ void enable_simulated_io_errors();
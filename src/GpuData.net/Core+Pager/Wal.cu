@@ -1,6 +1,13 @@
 ﻿// wal.c
 #include "Core+Pager.cu.h"
 #include <stddef.h> 
+#ifndef __CUDACC__
+#if _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
 
 #ifndef OMIT_WAL
 namespace Core
@@ -41,6 +48,12 @@ namespace Core
 #define WAL_HDRSIZE 32
 #define WAL_MAGIC 0x377f0682
 #define walFrameOffset(frame, sizePage) (WAL_HDRSIZE + ((frame) - 1) * (int64)((sizePage) + WAL_FRAME_HDRSIZE))
+#ifndef WAL_CHECKPOINT_BATCH
+#define WAL_CHECKPOINT_BATCH 32
+#endif
+#ifndef WAL_WRITE_BATCH
+#define WAL_WRITE_BATCH 32
+#endif
 
 	typedef uint16 ht_slot;
 
@@ -586,6 +599,186 @@ recovery_error:
 
 #pragma endregion
 
+#pragma region Flusher
+
+	// Pager::SetAsyncCommit() hands a commit to Frames() with SYNC_WAL_DEFERRED in place of SYNC_WAL_TRANSACTIONS, so it returns once its frames
+	// are written, and then queues the commit's ticket with RequestSync(). A flusher thread syncs the WAL once for all the commits queued since
+	// its last sync. Frames are written in order, so a sync that covers a ticket covers every ticket before it. Builds without host threads, and
+	// a WAL whose flusher would not start, sync in WaitSync() instead.
+#ifndef __CUDACC__
+	struct WalFlusher
+	{
+#if _WIN32
+		CRITICAL_SECTION Mutex;			// Guards the deferred sync members of Wal and Stop
+		CRITICAL_SECTION Io;			// Held around the calls on WalFile that use its queue of asynchronous I/O. See walFileEnter()
+		CONDITION_VARIABLE Work;		// Signalled when a ticket is queued or Stop is set
+		CONDITION_VARIABLE Done;		// Signalled when a sync finishes
+		HANDLE Thread;
+#else
+		pthread_mutex_t Mutex;
+		pthread_mutex_t Io;
+		pthread_cond_t Work;
+		pthread_cond_t Done;
+		pthread_t Thread;
+#endif
+		bool Stop;						// Set by walFlusherStop(). The thread syncs what is queued before it exits
+	};
+
+#if _WIN32
+#define FLUSHER_ENTER(F) EnterCriticalSection(&(F)->Mutex)
+#define FLUSHER_LEAVE(F) LeaveCriticalSection(&(F)->Mutex)
+#define FLUSHER_WAIT(F, C) SleepConditionVariableCS(&(F)->C, &(F)->Mutex, INFINITE)
+#define FLUSHER_WAKE(F, C) WakeAllConditionVariable(&(F)->C)
+#define FLUSHER_IO_ENTER(F) EnterCriticalSection(&(F)->Io)
+#define FLUSHER_IO_LEAVE(F) LeaveCriticalSection(&(F)->Io)
+#else
+#define FLUSHER_ENTER(F) pthread_mutex_lock(&(F)->Mutex)
+#define FLUSHER_LEAVE(F) pthread_mutex_unlock(&(F)->Mutex)
+#define FLUSHER_WAIT(F, C) pthread_cond_wait(&(F)->C, &(F)->Mutex)
+#define FLUSHER_WAKE(F, C) pthread_cond_broadcast(&(F)->C)
+#define FLUSHER_IO_ENTER(F) pthread_mutex_lock(&(F)->Io)
+#define FLUSHER_IO_LEAVE(F) pthread_mutex_unlock(&(F)->Io)
+#endif
+
+#if _WIN32
+	static DWORD WINAPI walFlusherThread(void *arg)
+#else
+	static void *walFlusherThread(void *arg)
+#endif
+	{
+		Wal *wal = (Wal *)arg;
+		WalFlusher *f = wal->Flusher;
+		FLUSHER_ENTER(f);
+		for (;;)
+		{
+			if (wal->SyncedTicket >= wal->SyncTicket)
+			{
+				if (f->Stop) break;
+				FLUSHER_WAIT(f, Work);
+				continue;
+			}
+			uint64 ticket = wal->SyncTicket;
+			VFile::SYNC flags = wal->DeferredSyncFlags;
+			FLUSHER_LEAVE(f);
+			FLUSHER_IO_ENTER(f);
+			int64 start = SysEx::Now();
+			RC rc = wal->WalFile->Sync(flags);
+			int64 micros = SysEx::Now() - start;
+			FLUSHER_IO_LEAVE(f);
+			FLUSHER_ENTER(f);
+			wal->Syncs[IPager::METRICFILE_WAL]++;
+			wal->SyncMicros[IPager::METRICFILE_WAL] += micros;
+			if (rc != RC::OK)
+			{
+				if (wal->SyncErrorRC == RC::OK)
+					wal->SyncErrorRC = rc;
+				wal->FailedTicket = ticket;
+				wal->FailedRC = rc;
+			}
+			wal->SyncedTicket = ticket;
+			FLUSHER_WAKE(f, Done);
+		}
+		FLUSHER_LEAVE(f);
+		return 0;
+	}
+
+	// Starts the flusher of wal. On failure wal->Flusher is left null and the caller syncs inline.
+	static void walFlusherStart(Wal *wal)
+	{
+		WalFlusher *f = (WalFlusher *)SysEx::Alloc(sizeof(WalFlusher), true);
+		if (!f) return;
+#if _WIN32
+		InitializeCriticalSection(&f->Mutex);
+		InitializeCriticalSection(&f->Io);
+		InitializeConditionVariable(&f->Work);
+		InitializeConditionVariable(&f->Done);
+		wal->Flusher = f;
+		f->Thread = CreateThread(nullptr, 0, walFlusherThread, wal, 0, nullptr);
+		if (f->Thread) return;
+		DeleteCriticalSection(&f->Io);
+		DeleteCriticalSection(&f->Mutex);
+#else
+		pthread_mutex_init(&f->Mutex, nullptr);
+		pthread_mutex_init(&f->Io, nullptr);
+		pthread_cond_init(&f->Work, nullptr);
+		pthread_cond_init(&f->Done, nullptr);
+		wal->Flusher = f;
+		if (pthread_create(&f->Thread, nullptr, walFlusherThread, wal) == 0) return;
+		pthread_cond_destroy(&f->Done);
+		pthread_cond_destroy(&f->Work);
+		pthread_mutex_destroy(&f->Io);
+		pthread_mutex_destroy(&f->Mutex);
+#endif
+		wal->Flusher = nullptr;
+		SysEx::Free(f);
+	}
+
+	// Stops the flusher of wal, if it has one, once it has synced every queued commit.
+	static void walFlusherStop(Wal *wal)
+	{
+		WalFlusher *f = wal->Flusher;
+		if (!f) return;
+		FLUSHER_ENTER(f);
+		f->Stop = true;
+		FLUSHER_WAKE(f, Work);
+		FLUSHER_LEAVE(f);
+#if _WIN32
+		WaitForSingleObject(f->Thread, INFINITE);
+		CloseHandle(f->Thread);
+		DeleteCriticalSection(&f->Io);
+		DeleteCriticalSection(&f->Mutex);
+#else
+		pthread_join(f->Thread, nullptr);
+		pthread_cond_destroy(&f->Done);
+		pthread_cond_destroy(&f->Work);
+		pthread_mutex_destroy(&f->Io);
+		pthread_mutex_destroy(&f->Mutex);
+#endif
+		wal->Flusher = nullptr;
+		SysEx::Free(f);
+	}
+#endif
+
+	// The flusher's Sync() of WalFile waits on the file's queue of asynchronous I/O, as do Wait(), Truncate() and the connection's own syncs,
+	// and ReadAsync() adds to it, none of which may run on two threads at once. The connection holds Io around those calls while the WAL has a
+	// flusher. Plain reads and writes do not touch the queue, so a commit's frames are still written while the flusher syncs the one before.
+	__device__ static void walFileEnter(Wal *wal)
+	{
+#ifndef __CUDACC__
+		if (wal->Flusher) FLUSHER_IO_ENTER(wal->Flusher);
+#endif
+	}
+
+	__device__ static void walFileLeave(Wal *wal)
+	{
+#ifndef __CUDACC__
+		if (wal->Flusher) FLUSHER_IO_LEAVE(wal->Flusher);
+#endif
+	}
+
+	// Syncs file, the WAL or, from a checkpoint, the database, counting the call and its time against metricFile for CollectSyncs().
+	__device__ static RC walSync(Wal *wal, VFile *file, IPager::METRICFILE metricFile, int flags)
+	{
+		bool isWal = (file == wal->WalFile);
+		if (isWal) walFileEnter(wal);
+		int64 start = SysEx::Now();
+		RC rc = file->Sync(flags);
+		int64 micros = SysEx::Now() - start;
+		if (isWal) walFileLeave(wal);
+#ifndef __CUDACC__
+		WalFlusher *f = wal->Flusher;
+		if (f) FLUSHER_ENTER(f);
+#endif
+		wal->Syncs[metricFile]++;
+		wal->SyncMicros[metricFile] += micros;
+#ifndef __CUDACC__
+		if (f) FLUSHER_LEAVE(f);
+#endif
+		return rc;
+	}
+
+#pragma endregion
+
 #pragma region Interface
 
 	__device__ RC Wal::Open(VSystem *vfs, VFile *dbFile, const char *walName, bool noShm, int64 maxWalSize, Wal **walOut)
@@ -836,6 +1029,21 @@ recovery_error:
 		return (wal->Header.SizePage & 0xfe00) + ((wal->Header.SizePage & 0x0001) << 16);
 	}
 
+	// Copy the n frames gathered in batch[] into the database file: wait for their reads from the WAL, queue all of the writes, then wait for
+	// those too so the buffers can be refilled.
+	__device__ static RC walCheckpointFlush(Wal *wal, uint8 *batch, uint32 *dbpages, int n, int sizePage)
+	{
+		RC rc = wal->WalFile->Wait();
+		for (int i = 0; rc == RC::OK && i < n; i++)
+		{
+			int64 offset = (dbpages[i] - 1) * (int64)sizePage;
+			ASSERTCOVERAGE(IS_BIG_INT(offset));
+			rc = wal->DBFile->WriteAsync(&batch[i * sizePage], sizePage, offset);
+		}
+		RC rc2 = wal->DBFile->Wait();
+		return (rc != RC::OK ? rc : rc2);
+	}
+
 	__device__ static int walCheckpoint(Wal *wal, IPager::CHECKPOINT mode, int (*busyCall)(void *), void *busyArg, VFile::SYNC sync_flags, uint8 *buf)
 	{
 		int sizePage = walPagesize(wal); // Database page-size
@@ -887,7 +1095,7 @@ recovery_error:
 		{
 			// Sync the WAL to disk
 			if (sync_flags)
-				rc = wal->WalFile->Sync(sync_flags);
+				rc = walSync(wal, wal->WalFile, IPager::METRICFILE_WAL, sync_flags);
 
 			// If the database file may grow as a result of this checkpoint, hint about the eventual size of the db file to the VFS layer. 
 			if (rc == RC::OK)
@@ -900,20 +1108,44 @@ recovery_error:
 			}
 
 			uint32 backfills = info->Backfills;
-			// Iterate through the contents of the WAL, copying data to the db file.
+			// Iterate through the contents of the WAL, copying data to the db file. Frames are read WAL_CHECKPOINT_BATCH at a time and written back
+			// the same way, so a whole batch of page I/Os is in flight at once. If the batch buffer cannot be had, buf is used one frame at a time.
+			int batchSize = WAL_CHECKPOINT_BATCH;
+			uint8 *batch = (uint8 *)SysEx::Alloc(sizePage * WAL_CHECKPOINT_BATCH);
+			if (!batch)
+			{
+				batch = buf;
+				batchSize = 1;
+			}
+			uint32 dbpages[WAL_CHECKPOINT_BATCH]; // Database page of each frame in batch[]
+			int n = 0; // Frames gathered in batch[]
+			walFileEnter(wal);
 			while (rc == RC::OK && !walIteratorNext(iter, &dbpage, &frame))
 			{
 				_assert(walFramePgno(wal, frame) == dbpage);
 				if (frame <= backfills || frame> maxSafeFrame || dbpage > maxPage) continue;
-				int offset = walFrameOffset(frame, sizePage) + WAL_FRAME_HDRSIZE;
+				int64 offset = walFrameOffset(frame, sizePage) + WAL_FRAME_HDRSIZE;
 				// ASSERTCOVERAGE(IS_BIG_INT(offset)); // requires a 4GiB WAL file
-				rc = wal->WalFile->Read(buf, sizePage, offset);
-				if (rc != RC::OK) break;
-				offset = (dbpage - 1) * (int64)sizePage;
-				ASSERTCOVERAGE(IS_BIG_INT(offset));
-				rc = wal->DBFile->Write(buf, sizePage, offset);
+				rc = wal->WalFile->ReadAsync(&batch[n * sizePage], sizePage, offset);
 				if (rc != RC::OK) break;
+				dbpages[n++] = dbpage;
+				if (n == batchSize)
+				{
+					rc = walCheckpointFlush(wal, batch, dbpages, n, sizePage);
+					n = 0;
+				}
+			}
+			if (rc == RC::OK && n > 0)
+				rc = walCheckpointFlush(wal, batch, dbpages, n, sizePage);
+			else if (rc != RC::OK)
+			{
+				// Nothing may still be reading into or writing from batch[] once it is freed.
+				wal->WalFile->Wait();
+				wal->DBFile->Wait();
 			}
+			walFileLeave(wal);
+			if (batch != buf)
+				SysEx::Free(batch);
 
 			// If work was actually accomplished...
 			if (rc == RC::OK)
@@ -924,7 +1156,7 @@ recovery_error:
 					ASSERTCOVERAGE(IS_BIG_INT(sizeDB));
 					rc = wal->DBFile->Truncate(sizeDB);
 					if (rc == RC::OK && sync_flags)
-						rc = wal->DBFile->Sync(sync_flags);
+						rc = walSync(wal, wal->DBFile, IPager::METRICFILE_DB, sync_flags);
 				}
 				if (rc == RC::OK)
 					info->Backfills = maxSafeFrame;
@@ -964,7 +1196,11 @@ walcheckpoint_out:
 		int64 size;
 		RC rc = wal->WalFile->get_FileSize(size);
 		if (rc == RC::OK && size > max)
+		{
+			walFileEnter(wal);
 			rc = wal->WalFile->Truncate(max);
+			walFileLeave(wal);
+		}
 		SysEx::EndBenignAlloc();
 		if (rc != RC::OK)
 			SysEx_LOG(rc, "cannot limit WAL size: %s", wal->WalName);
@@ -978,6 +1214,13 @@ walcheckpoint_out:
 		//
 		// The EXCLUSIVE lock is not released before returning.
 		bool isDelete = 0; // True to unlink wal and wal-index files
+
+		// Make the commits queued by RequestSync() durable before anything else touches the file.
+		WaitSync(SyncTicket);
+#ifndef __CUDACC__
+		walFlusherStop(this);
+#endif
+
 		RC rc = DBFile->Lock(VFile::LOCK_EXCLUSIVE);
 		if (rc == RC::OK)
 		{
@@ -1255,8 +1498,37 @@ walcheckpoint_out:
 
 #pragma region Interface2
 
-	__device__ RC Wal::BeginReadTransaction(bool *changed)
+	// Call change() for the page of every frame the snapshot in wal->Header has that the snapshot in last did not, and clear *changed. This is
+	// only possible when the new snapshot extends the old one: the same WAL generation (salts), no fewer frames and no fewer pages. Otherwise
+	// the WAL was restarted or the database shrank, and *changed is left set so the caller drops everything.
+	__device__ static RC walChanges(Wal *wal, const Wal::IndexHeader *last, bool *changed, int (*change)(void *, Pid), void *changeCtx)
+	{
+		if (!last->IsInit || last->Salt[0] != wal->Header.Salt[0] || last->Salt[1] != wal->Header.Salt[1] ||
+			last->MaxFrame > wal->Header.MaxFrame || last->Pages > wal->Header.Pages || last->SizePage != wal->Header.SizePage)
+			return RC::OK;
+		RC rc = RC::OK;
+		uint32 frame = last->MaxFrame + 1;
+		for (int hash = walFramePage(frame); rc == RC::OK && frame <= wal->Header.MaxFrame; hash++)
+		{
+			volatile ht_slot *hashs; // Pointer to hash table
+			volatile Pid *ids; // Pointer to array of page numbers
+			uint32 zero; // Frame number corresponding to aPgno[0]
+			if ((rc = walHashGet(wal, hash, &hashs, &ids, &zero)) != RC::OK)
+				break;
+			uint32 end = zero + (hash == 0 ? HASHTABLE_NPAGE_ONE : HASHTABLE_NPAGE); // Last frame this hash block indexes
+			if (end > wal->Header.MaxFrame)
+				end = wal->Header.MaxFrame;
+			for (; rc == RC::OK && frame <= end; frame++)
+				rc = (RC)change(changeCtx, ids[frame - zero]);
+		}
+		if (rc == RC::OK)
+			*changed = false;
+		return rc;
+	}
+
+	__device__ RC Wal::BeginReadTransaction(bool *changed, int (*change)(void *, Pid), void *changeCtx)
 	{
+		IndexHeader last = Header; // Snapshot of the previous read transaction
 		int count = 0; // Number of TryBeginRead attempts
 		RC rc;
 		do
@@ -1267,6 +1539,8 @@ walcheckpoint_out:
 		ASSERTCOVERAGE((rc & 0xff) == RC::IOERR);
 		ASSERTCOVERAGE(rc == RC::PROTOCOL);
 		ASSERTCOVERAGE(rc == RC::OK);
+		if (rc == RC::OK && *changed && change)
+			rc = walChanges(this, &last, changed, change, changeCtx);
 		return rc;
 	}
 
@@ -1535,7 +1809,7 @@ walcheckpoint_out:
 			amount -= firstAmount;
 			content = (void *)(firstAmount + (char *)content);
 			_assert(p->SyncFlags & (VFile::SYNC_NORMAL | VFile::SYNC_FULL));
-			rc = p->File->Sync(p->SyncFlags);
+			rc = walSync(p->Wal, p->File, IPager::METRICFILE_WAL, p->SyncFlags);
 			if (amount == 0 || rc) return rc;
 		}
 		rc = p->File->Write(content, amount, offset);
@@ -1559,6 +1833,20 @@ walcheckpoint_out:
 		return rc;
 	}
 
+	// Lets frames be written again once the log is empty, so that no frame a failed deferred sync left behind is still in it. WaitSync() goes
+	// on reporting the error for the commits that sync covered.
+	__device__ static void walClearSyncError(Wal *wal)
+	{
+#ifndef __CUDACC__
+		WalFlusher *f = wal->Flusher;
+		if (f) FLUSHER_ENTER(f);
+#endif
+		wal->SyncErrorRC = RC::OK;
+#ifndef __CUDACC__
+		if (f) FLUSHER_LEAVE(f);
+#endif
+	}
+
 	__device__ RC Wal::Frames(int sizePage, PgHdr *list, Pid truncate, bool isCommit, VFile::SYNC sync_flags)
 	{
 		_assert(list);
@@ -1580,6 +1868,13 @@ walcheckpoint_out:
 		if ((rc = walRestartLog(this)) != RC::OK)
 			return rc;
 
+		// After a deferred sync failed, the log may hold frames that never reached the disk. Frame checksums chain, so recovery would drop every
+		// frame written after them: nothing is written until a checkpoint lets the log restart from its start, or the log is opened anew.
+		if (Header.MaxFrame == 0)
+			walClearSyncError(this);
+		else if ((rc = WaitSync(0)) != RC::OK)
+			return rc;
+
 		// If this is the first frame written into the log, write the WAL header to the start of the WAL file. See comments at the top of
 		// this source file for a description of the WAL header format.
 		uint32 frame = Header.MaxFrame; // Next frame address
@@ -1613,7 +1908,7 @@ walcheckpoint_out:
 			// an out-of-order write following a WAL restart could result in database corruption.
 			if (SyncHeader && sync_flags)
 			{
-				rc = WalFile->Sync(sync_flags & VFile::SYNC_WAL_MASK);
+				rc = walSync(this, WalFile, IPager::METRICFILE_WAL, sync_flags & VFile::SYNC_WAL_MASK);
 				if (rc) return rc;
 			}
 		}
@@ -1629,18 +1924,42 @@ walcheckpoint_out:
 		int64 offset = walFrameOffset(frame + 1, sizePage); // Next byte to write in WAL file
 		int sizeFrame = sizePage + WAL_FRAME_HDRSIZE; // The size of a single frame
 
-		// Write all frames into the log file exactly once
+		// Write all frames into the log file exactly once. The frames follow on from each other in the file, so their headers and page images
+		// are gathered and written WAL_WRITE_BATCH frames at a time with Writev(). No sync point falls inside these writes (w.SyncPoint is 0).
 		PgHdr *last = nullptr; // Last frame in list
+		uint8 headers[WAL_WRITE_BATCH][WAL_FRAME_HDRSIZE]; // Frame-headers of the current batch
+		VFile::IOVec vecs[WAL_WRITE_BATCH * 2]; // Header and page image of each frame in the batch
+		int batched = 0; // Number of frames in the batch
+		int64 batchOffset = offset; // Offset of the first frame in the batch
 		for (PgHdr *p = list; p; p = p->Dirty)
 		{
 			int dbSize; // 0 normally.  Positive == commit flag
 			frame++;
 			_assert(offset == walFrameOffset(frame, sizePage));
 			dbSize = (isCommit && p->Dirty == nullptr ? truncate : 0);
-			rc = walWriteOneFrame(&w, p, dbSize, offset);
-			if (rc) return rc;
+			void *data; // Data actually written
+#if defined(HAS_CODEC)
+			if ((data = sqlite3PagerCodec(p)) == nullptr) return RC::NOMEM;
+#else
+			data = p->Data;
+#endif
+			walEncodeFrame(this, p->ID, dbSize, (uint8 *)data, headers[batched]);
+			vecs[batched * 2].Buffer = headers[batched];
+			vecs[batched * 2].Amount = WAL_FRAME_HDRSIZE;
+			vecs[batched * 2 + 1].Buffer = data;
+			vecs[batched * 2 + 1].Amount = sizePage;
+			batched++;
 			last = p;
 			offset += sizeFrame;
+
+			// A codec encodes every page into one shared buffer, so an encoded frame is written before the next page is encoded.
+			if (batched == WAL_WRITE_BATCH || p->Dirty == nullptr || data != p->Data)
+			{
+				rc = WalFile->Writev(vecs, batched * 2, batchOffset);
+				if (rc) return rc;
+				batched = 0;
+				batchOffset = offset;
+			}
 		}
 
 		// If this is the end of a transaction, then we might need to pad the transaction and/or sync the WAL file.
@@ -1651,14 +1970,19 @@ walcheckpoint_out:
 		// If SQLITE_IOCAP_POWERSAFE_OVERWRITE is defined, then padding is not needed and only the sync is done.  If padding is needed, then the
 		// final frame is repeated (with its commit mark) until the next sector boundary is crossed.  Only the part of the WAL prior to the last
 		// sector boundary is synced; the part of the last frame that extends past the sector boundary is written after the sync.
+		//
+		// A commit whose sync is deferred (SYNC_WAL_DEFERRED) is padded the same way but not synced, so the next commit cannot tear the last
+		// sector of one the deferred sync has since made durable.
 		int extras = 0; // Number of extra copies of last page
-		if (isCommit && (sync_flags & VFile::SYNC_WAL_TRANSACTIONS) != 0)
+		if (isCommit && (sync_flags & (VFile::SYNC_WAL_TRANSACTIONS | VFile::SYNC_WAL_DEFERRED)) != 0)
 		{
 			if (PadToSectorBoundary)
 			{
 				int sectorSize = WalFile->get_SectorSize();
-				w.SyncPoint = ((offset + sectorSize - 1) / sectorSize) * sectorSize;
-				while (offset < w.SyncPoint)
+				int64 padTo = ((offset + sectorSize - 1) / sectorSize) * sectorSize; // End of the last sector the commit reaches
+				if (sync_flags & VFile::SYNC_WAL_TRANSACTIONS)
+					w.SyncPoint = padTo;
+				while (offset < padTo)
 				{
 					rc = walWriteOneFrame(&w, last, truncate, offset);
 					if (rc) return rc;
@@ -1666,8 +1990,8 @@ walcheckpoint_out:
 					extras++;
 				}
 			}
-			else
-				rc = w.File->Sync(sync_flags & VFile::SYNC_WAL_MASK);
+			else if (sync_flags & VFile::SYNC_WAL_TRANSACTIONS)
+				rc = walSync(this, w.File, IPager::METRICFILE_WAL, sync_flags & VFile::SYNC_WAL_MASK);
 		}
 
 		// If this frame set completes the first transaction in the WAL and if PRAGMA journal_size_limit is set, then truncate the WAL to the
@@ -1836,6 +2160,89 @@ walcheckpoint_out:
 		return (ExclusiveMode_ == MODE_HEAPMEMORY);
 	}
 
+	// Queues commit ticket, whose frames Frames() has written without syncing, to be synced with sync_flags. Tickets must increase.
+	__device__ void Wal::RequestSync(uint64 ticket, VFile::SYNC sync_flags)
+	{
+		_assert(ticket > SyncTicket);
+#ifndef __CUDACC__
+		if (!Flusher)
+			walFlusherStart(this);
+		WalFlusher *f = Flusher;
+		if (f)
+		{
+			FLUSHER_ENTER(f);
+			SyncTicket = ticket;
+			DeferredSyncFlags = sync_flags;
+			FLUSHER_WAKE(f, Work);
+			FLUSHER_LEAVE(f);
+			return;
+		}
+#endif
+		SyncTicket = ticket;
+		DeferredSyncFlags = sync_flags;
+	}
+
+	// The error WaitSync() reports for ticket: that of the failed sync that covered it, or any failed sync the log has not restarted since.
+	__device__ static RC walSyncError(Wal *wal, uint64 ticket)
+	{
+		if (wal->SyncErrorRC != RC::OK)
+			return wal->SyncErrorRC;
+		return (ticket && ticket <= wal->FailedTicket ? wal->FailedRC : RC::OK);
+	}
+
+	// Waits until a sync covers commit ticket and returns the error of a deferred sync that failed, as walSyncError() picks it. Tickets never
+	// queued belong to commits Frames() synced itself, or that synchronous=OFF never syncs, so only the queued part of ticket is waited for, and
+	// ticket 0 only reads the error.
+	__device__ RC Wal::WaitSync(uint64 ticket)
+	{
+		uint64 asked = ticket;
+		if (ticket > SyncTicket) ticket = SyncTicket;
+		RC rc;
+#ifndef __CUDACC__
+		WalFlusher *f = Flusher;
+		if (f)
+		{
+			FLUSHER_ENTER(f);
+			while (SyncedTicket < ticket && SyncErrorRC == RC::OK)
+				FLUSHER_WAIT(f, Done);
+			rc = walSyncError(this, asked);
+			FLUSHER_LEAVE(f);
+			return rc;
+		}
+#endif
+		if (SyncedTicket < ticket && SyncErrorRC == RC::OK)
+		{
+			rc = walSync(this, WalFile, IPager::METRICFILE_WAL, DeferredSyncFlags);
+			if (rc != RC::OK)
+			{
+				SyncErrorRC = FailedRC = rc;
+				FailedTicket = SyncTicket;
+			}
+			SyncedTicket = SyncTicket;
+		}
+		return walSyncError(this, asked);
+	}
+
+	// Adds the syncs done since the last call, and their time, to syncs[] and micros[], which are indexed by IPager::METRICFILE: the WAL's, with
+	// the deferred ones, and the database's by checkpoints.
+	__device__ void Wal::CollectSyncs(int64 *syncs, int64 *micros)
+	{
+#ifndef __CUDACC__
+		WalFlusher *f = Flusher;
+		if (f) FLUSHER_ENTER(f);
+#endif
+		for (int i = 0; i < IPager::METRICFILE_COUNT; i++)
+		{
+			syncs[i] += Syncs[i];
+			micros[i] += SyncMicros[i];
+			Syncs[i] = 0;
+			SyncMicros[i] = 0;
+		}
+#ifndef __CUDACC__
+		if (f) FLUSHER_LEAVE(f);
+#endif
+	}
+
 #ifdef ENABLE_ZIPVFS
 	__device__ int Wal::get_Framesize()
 	{
@@ -8,7 +8,7 @@ namespace Core
 		__device__ inline static RC Open(VSystem *vfs, VFile *dbFile, const char *walName, bool noShm, int64 maxWalSize, Wal **walOut) { return RC::OK; }
 		__device__ inline void Limit(int64 limit) { }
 		__device__ inline RC Close(VFile::SYNC sync_flags, int bufLength, uint8 *buf) { return RC::OK; }
-		__device__ inline RC BeginReadTransaction(bool *changed) { return RC::OK; }
+		__device__ inline RC BeginReadTransaction(bool *changed, int (*change)(void *, Pid), void *changeCtx) { return RC::OK; }
 		__device__ inline void EndReadTransaction() { }
 		__device__ inline RC Read(Pid id, bool *inWal, int bufLength, uint8 *buf) { return RC::OK; }
 		__device__ inline Pid DBSize() { return 0; }
@@ -22,6 +22,9 @@ namespace Core
 		__device__ inline int get_Callback() { return 0; }
 		__device__ inline bool ExclusiveMode(int op) { return false; }
 		__device__ inline bool get_HeapMemory() { return false; }
+		__device__ inline void RequestSync(uint64 ticket, VFile::SYNC sync_flags) { }
+		__device__ inline RC WaitSync(uint64 ticket) { return RC::OK; }
+		__device__ inline void CollectSyncs(int64 *syncs, int64 *micros) { }
 #ifdef ENABLE_ZIPVFS
 		__device__ inline int get_Framesize() { return 0; }
 #endif
@@ -75,6 +78,15 @@ namespace Core
 		} Header; // Wal-index header for current transaction
 		const char *WalName;			// Name of WAL file
 		uint32 Checkpoints;				// Checkpoint sequence counter in the wal-header
+		uint64 SyncTicket;				// Highest commit ticket queued by RequestSync()
+		uint64 SyncedTicket;			// Highest ticket a finished deferred sync covers
+		VFile::SYNC DeferredSyncFlags;	// Flags the queued commits are synced with
+		RC SyncErrorRC;					// First error a deferred sync returned. No commit is taken as durable, or written, until the log restarts
+		uint64 FailedTicket;			// Highest ticket a failed deferred sync covered, and the error it returned
+		RC FailedRC;
+		int64 Syncs[IPager::METRICFILE_COUNT]; // Syncs of the WAL and, by checkpoints, the database, and the time they took, not yet taken by CollectSyncs()
+		int64 SyncMicros[IPager::METRICFILE_COUNT];
+		struct WalFlusher *Flusher;		// Thread doing the deferred syncs, or null to do them in WaitSync()
 #ifdef _DEBUG
 		uint8 LockError;				// True if a locking error has occurred
 #endif
@@ -82,7 +94,7 @@ namespace Core
 		static RC Open(VSystem *vfs, VFile *dbFile, const char *walName, bool noShm, int64 maxWalSize, Wal **walOut);
 		void Limit(int64 limit);
 		RC Close(VFile::SYNC sync_flags, int bufLength, uint8 *buf);
-		RC BeginReadTransaction(bool *changed);
+		RC BeginReadTransaction(bool *changed, int (*change)(void *, Pid), void *changeCtx);
 		void EndReadTransaction();
 		RC Read(Pid id, bool *inWal, int bufLength, uint8 *buf);
 		Pid DBSize();
@@ -96,6 +108,9 @@ namespace Core
 		int get_Callback();
 		bool ExclusiveMode(int op);
 		bool get_HeapMemory();
+		void RequestSync(uint64 ticket, VFile::SYNC sync_flags);
+		RC WaitSync(uint64 ticket);
+		void CollectSyncs(int64 *syncs, int64 *micros);
 #ifdef ENABLE_ZIPVFS
 		int get_Framesize();
 #endif
@@ -0,0 +1,261 @@
+﻿// mutex_unix.c, mutex_w32.c
+#include "Core.cu.h"
+#if THREADSAFE && !defined(__CUDACC__)
+#if _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Core
+{
+#pragma region Preamble
+
+#if _WIN32
+#define MUTEX_PAUSE() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define MUTEX_PAUSE() __builtin_ia32_pause()
+#else
+#define MUTEX_PAUSE() __asm__ __volatile__("" ::: "memory")
+#endif
+
+	struct MutexObj
+	{
+#if _WIN32
+		CRITICAL_SECTION Mutex;
+		volatile DWORD Owner;	// Thread holding the mutex, when Refs > 0
+#else
+		pthread_mutex_t Mutex;
+		volatile pthread_t Owner;
+#endif
+		MutexEx::MUTEX Id;
+		volatile int Refs;		// Times the owner has entered. Only a MUTEX_RECURSIVE mutex goes above 1
+		int SpinLimit;			// Running average of the polls a contended enter needed, which sizes the next spin
+		MutexEx::Stats Stats;
+	};
+
+	static MutexEx::METHODS _methods = MutexEx::METHODS_NATIVE;
+	static bool _isInit = false;
+	static MutexObj _statics[6]; // MUTEX_STATIC_MASTER through MUTEX_STATIC_PMEM
+
+#if _WIN32
+#define MUTEX_SELF() GetCurrentThreadId()
+#define MUTEX_ISSELF(O) ((O)->Owner == GetCurrentThreadId())
+#else
+#define MUTEX_SELF() pthread_self()
+#define MUTEX_ISSELF(O) pthread_equal((O)->Owner, pthread_self())
+#endif
+
+	static void mutexInit(MutexObj *p, MutexEx::MUTEX id)
+	{
+		_memset(p, 0, sizeof(MutexObj));
+		p->Id = id;
+#if _WIN32
+		InitializeCriticalSection(&p->Mutex);
+#else
+		pthread_mutex_init(&p->Mutex, nullptr);
+#endif
+	}
+
+	static void mutexDestroy(MutexObj *p)
+	{
+		_assert(p->Refs == 0);
+#if _WIN32
+		DeleteCriticalSection(&p->Mutex);
+#else
+		pthread_mutex_destroy(&p->Mutex);
+#endif
+	}
+
+	static bool mutexTryLock(MutexObj *p)
+	{
+#if _WIN32
+		return (TryEnterCriticalSection(&p->Mutex) != 0);
+#else
+		return (pthread_mutex_trylock(&p->Mutex) == 0);
+#endif
+	}
+
+	static void mutexLock(MutexObj *p)
+	{
+#if _WIN32
+		EnterCriticalSection(&p->Mutex);
+#else
+		pthread_mutex_lock(&p->Mutex);
+#endif
+	}
+
+	static void mutexUnlock(MutexObj *p)
+	{
+#if _WIN32
+		LeaveCriticalSection(&p->Mutex);
+#else
+		pthread_mutex_unlock(&p->Mutex);
+#endif
+	}
+
+#pragma endregion
+
+#pragma region MutexEx
+
+	__device__ RC MutexEx::Config(METHODS methods)
+	{
+		if (_isInit) return SysEx_MISUSE_BKPT;
+		_methods = methods;
+		return RC::OK;
+	}
+
+	__device__ RC MutexEx::Initialize()
+	{
+		if (_isInit) return RC::OK;
+		for (int i = 0; i < __arrayStaticLength(_statics); i++)
+			mutexInit(&_statics[i], (MUTEX)(MUTEX_STATIC_MASTER + i));
+		_isInit = true;
+		return RC::OK;
+	}
+
+	__device__ void MutexEx::Shutdown()
+	{
+		if (!_isInit) return;
+		for (int i = 0; i < __arrayStaticLength(_statics); i++)
+			mutexDestroy(&_statics[i]);
+		_isInit = false;
+	}
+
+	__device__ bool MutexEx::WantsCoreMutex()
+	{
+		return (_methods == METHODS_NATIVE);
+	}
+
+	// Returns a new MUTEX_FAST or MUTEX_RECURSIVE mutex, or one of the static mutexes, which every call for the same id shares.
+	__device__ MutexEx MutexEx::Alloc(MUTEX id)
+	{
+		MutexEx m;
+		m.Tag = nullptr;
+		if (_methods == METHODS_NOOP) return m;
+		if (id == MUTEX_FAST || id == MUTEX_RECURSIVE)
+		{
+			MutexObj *p = (MutexObj *)SysEx::Alloc(sizeof(MutexObj));
+			if (p) mutexInit(p, id);
+			m.Tag = p;
+			return m;
+		}
+		_assert(id >= MUTEX_STATIC_MASTER && id - MUTEX_STATIC_MASTER < __arrayStaticLength(_statics));
+		if (!_isInit) Initialize();
+		m.Tag = &_statics[id - MUTEX_STATIC_MASTER];
+		return m;
+	}
+
+	__device__ void MutexEx::Free(MutexEx mutex)
+	{
+		MutexObj *p = (MutexObj *)mutex.Tag;
+		if (!p) return;
+		_assert(p->Id == MUTEX_FAST || p->Id == MUTEX_RECURSIVE);
+		mutexDestroy(p);
+		SysEx::Free(p);
+	}
+
+	// Takes the mutex, first polling it while the owner is likely to let go soon. How long to poll adapts as in glibc's adaptive mutexes:
+	// each mutex keeps a running average of the polls its contended enters needed and polls up to twice that, capped at MUTEXEX_SPINS.
+	__device__ void MutexEx::Enter(MutexEx mutex)
+	{
+		MutexObj *p = (MutexObj *)mutex.Tag;
+		if (!p) return;
+		_assert(p->Id == MUTEX_RECURSIVE || NotHeld(mutex));
+		if (p->Id == MUTEX_RECURSIVE && p->Refs > 0 && MUTEX_ISSELF(p))
+		{
+			p->Refs++;
+			return;
+		}
+		if (mutexTryLock(p))
+		{
+			p->Stats.Enters++;
+			p->Owner = MUTEX_SELF();
+			p->Refs = 1;
+			return;
+		}
+		int limit = p->SpinLimit * 2 + 10;
+		if (limit > MUTEXEX_SPINS) limit = MUTEXEX_SPINS;
+		int spins = 0;
+		bool blocked = true;
+		while (spins < limit)
+		{
+			spins++;
+			MUTEX_PAUSE();
+			if (mutexTryLock(p))
+			{
+				blocked = false;
+				break;
+			}
+		}
+		if (blocked)
+			mutexLock(p);
+		p->Owner = MUTEX_SELF();
+		p->Refs = 1;
+		p->SpinLimit += (spins - p->SpinLimit) / 8;
+		p->Stats.Enters++;
+		p->Stats.Contended++;
+		p->Stats.Spins += spins;
+		if (blocked) p->Stats.Blocks++;
+	}
+
+	// Takes the mutex if no other thread holds it. Returns false, without waiting, if one does.
+	__device__ bool MutexEx::TryEnter(MutexEx mutex)
+	{
+		MutexObj *p = (MutexObj *)mutex.Tag;
+		if (!p) return true;
+		if (p->Id == MUTEX_RECURSIVE && p->Refs > 0 && MUTEX_ISSELF(p))
+		{
+			p->Refs++;
+			return true;
+		}
+		if (!mutexTryLock(p)) return false;
+		p->Stats.Enters++;
+		p->Owner = MUTEX_SELF();
+		p->Refs = 1;
+		return true;
+	}
+
+	__device__ void MutexEx::Leave(MutexEx mutex)
+	{
+		MutexObj *p = (MutexObj *)mutex.Tag;
+		if (!p) return;
+		_assert(Held(mutex));
+		if (--p->Refs > 0) return;
+		mutexUnlock(p);
+	}
+
+	// Held() and NotHeld() are for asserts. Both answer true for a null handle, so asserts pass when mutexes are off.
+	__device__ bool MutexEx::Held(MutexEx mutex)
+	{
+		MutexObj *p = (MutexObj *)mutex.Tag;
+		return (!p || (p->Refs > 0 && MUTEX_ISSELF(p)));
+	}
+
+	__device__ bool MutexEx::NotHeld(MutexEx mutex)
+	{
+		MutexObj *p = (MutexObj *)mutex.Tag;
+		return (!p || p->Refs == 0 || !MUTEX_ISSELF(p));
+	}
+
+	// Copies out the contention counters of mutex, which the caller must not hold.
+	__device__ void MutexEx::GetStats(MutexEx mutex, Stats *stats, bool reset)
+	{
+		MutexObj *p = (MutexObj *)mutex.Tag;
+		if (!p)
+		{
+			_memset(stats, 0, sizeof(Stats));
+			return;
+		}
+		_assert(NotHeld(mutex));
+		mutexLock(p); // Not Enter(), which would count itself
+		*stats = p->Stats;
+		if (reset)
+			_memset(&p->Stats, 0, sizeof(Stats));
+		mutexUnlock(p);
+	}
+
+#pragma endregion
+}
+#endif
@@ -1,6 +1,18 @@
 ﻿namespace Core
 {
-	class MutexEx 
+#ifndef THREADSAFE
+#define THREADSAFE 1
+#endif
+#ifndef MUTEXEX_SPINS // Most times Enter() polls a busy mutex before it blocks. Each mutex learns how many of these it needs
+#define MUTEXEX_SPINS 100
+#endif
+
+	// Mutexes come from one of two sets of methods, chosen by Config() before Initialize(). METHODS_NATIVE uses pthread mutexes, which are
+	// futex based on Linux, or critical sections on Windows, and spins briefly before it blocks. METHODS_NOOP makes every call do nothing, for
+	// processes that use the engine from one thread. Builds with THREADSAFE=0, and device code, only have the no-op methods.
+	//
+	// A MutexEx is a handle and is copied freely. A null handle, which Alloc() returns when mutexes are off or memory ran out, does nothing.
+	class MutexEx
 	{
 	public:
 		enum MUTEX
@@ -17,15 +29,54 @@
 			MUTEX_STATIC_PMEM = 7, // sqlite3PageMalloc()
 		};
 
+		enum METHODS : uint8
+		{
+			METHODS_NOOP = 0,
+			METHODS_NATIVE = 1,
+		};
+
+		// Contention counters of one mutex, kept while it is held
+		struct Stats
+		{
+			int64 Enters;			// Calls to Enter() that took the mutex, not counting recursive ones
+			int64 Contended;		// Enters that found the mutex held by another thread
+			int64 Spins;			// Polls those enters made while spinning
+			int64 Blocks;			// Contended enters that gave up spinning and blocked
+		};
+
+		void *Tag;					// The mutex, or null. Not initialized, so that __device__ globals holding one need no constructor: set locals to null
+
+#if !THREADSAFE || defined(__CUDACC__)
+		__device__ inline static RC Config(METHODS methods) { return (methods == METHODS_NOOP ? RC::OK : RC::ERROR); }
+		__device__ inline static RC Initialize() { return RC::OK; }
+		__device__ inline static void Shutdown() { }
+		__device__ inline static bool WantsCoreMutex() { return false; }
 		__device__ inline static MutexEx Alloc(MUTEX id)
-		{ 
+		{
 			MutexEx m;
+			m.Tag = nullptr;
 			return m;
 		}
 		__device__ inline static void Enter(MutexEx mutex) { }
+		__device__ inline static bool TryEnter(MutexEx mutex) { return true; }
 		__device__ inline static void Leave(MutexEx mutex) { }
 		__device__ inline static bool Held(MutexEx mutex) { return true; }
 		__device__ inline static bool NotHeld(MutexEx mutex) { return true; }
 		__device__ inline static void Free(MutexEx mutex) { }
+		__device__ inline static void GetStats(MutexEx mutex, Stats *stats, bool reset) { _memset(stats, 0, sizeof(Stats)); }
+#else
+		__device__ static RC Config(METHODS methods);
+		__device__ static RC Initialize();
+		__device__ static void Shutdown();
+		__device__ static bool WantsCoreMutex();
+		__device__ static MutexEx Alloc(MUTEX id);
+		__device__ static void Enter(MutexEx mutex);
+		__device__ static bool TryEnter(MutexEx mutex);
+		__device__ static void Leave(MutexEx mutex);
+		__device__ static bool Held(MutexEx mutex);
+		__device__ static bool NotHeld(MutexEx mutex);
+		__device__ static void Free(MutexEx mutex);
+		__device__ static void GetStats(MutexEx mutex, Stats *stats, bool reset);
+#endif
 	};
 }
@@ -1,6 +1,11 @@
 ﻿//#include "Core.cu.h"
 #include "..\Core+Pager\Core+Pager.cu.h"
 #include <stdarg.h>
+#if _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 namespace Core
 {
@@ -10,7 +15,7 @@ namespace Core
 	__device__ RC SysEx::Initialize()
 	{
 		// mutex
-		RC rc = RC::OK; // = 3MutexEx::Initialize();
+		RC rc = MutexEx::Initialize();
 		if (rc) return rc;
 		//rc = Alloc::Initialize();
 		rc = PCache::Initialize();
@@ -26,7 +31,7 @@ namespace Core
 		VSystem::Shutdown();
 		PCache::Shutdown();
 		//Alloc::Shutdown();
-		//MutexEx::Shutdown();
+		MutexEx::Shutdown();
 	}
 
 	__device__ static uint8 randomByte()
@@ -69,4 +74,23 @@ namespace Core
 			*(b++) = randomByte();
 		MutexEx::Leave(mutex);
 	}
+
+	// A monotonic clock in microseconds. On the device this is the global nanosecond timer, which is shared by every multiprocessor.
+	__device__ int64 SysEx::Now()
+	{
+#if __CUDA_ARCH__
+		uint64 ns;
+		asm volatile("mov.u64 %0, %%globaltimer;" : "=l"(ns));
+		return (int64)(ns / 1000);
+#elif _WIN32
+		LARGE_INTEGER count, frequency;
+		QueryPerformanceCounter(&count);
+		QueryPerformanceFrequency(&frequency);
+		return (count.QuadPart / frequency.QuadPart) * 1000000 + (count.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	}
 }
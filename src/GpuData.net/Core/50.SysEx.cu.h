@@ -116,6 +116,7 @@ namespace Core
 		__device__ static RC Initialize();
 		__device__ static void Shutdown();
 		__device__ static void PutRandom(int length, void *buffer);
+		__device__ static int64 Now();
 	};
 
 #define SysEx_ALWAYS(X) (X)
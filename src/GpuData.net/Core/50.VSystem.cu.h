@@ -43,6 +43,7 @@ namespace Core
 			OPEN_SHAREDCACHE = 0x00020000,       // Ok for sqlite3_open_v2() 
 			OPEN_PRIVATECACHE = 0x00040000,      // Ok for sqlite3_open_v2() 
 			OPEN_WAL = 0x00080000,               // VFS only 
+			OPEN_DIRECT = 0x01000000,            // VFS only: bypass the OS cache (O_DIRECT) for a main database or WAL file; cleared in the output flags if the file system cannot
 		};
 
 		enum ACCESS
@@ -1,21 +1,371 @@
-﻿// os_win.c
+﻿// os_gpu.c
 #define OS_GPU 1
 #if OS_GPU
 #include "Core.cu.h"
+#include "55.GpuVSystem.cu.h"
 #include <new.h>
+#if _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 namespace Core
 {
 #pragma region Preamble
 
 #if defined(TEST) || defined(_DEBUG)
-	__device__ bool OsTrace = true;
+	__device__ static bool OsTrace = true;
 #define OSTRACE(X, ...) if (OsTrace) { _printf(X, __VA_ARGS__); }
 #else
 #define OSTRACE(X, ...)
 #endif
 
-#define INVALID_HANDLE_VALUE -1
+	// The gpu VFS does no I/O of its own. Each call is cut into requests that are posted to a ring of GPU_RING_SLOTS slots kept in memory the
+	// device and the host can both see, and a host thread runs them against the real file. GPU_RING_SLOTS must be a power of two.
+#ifndef GPU_RING_SLOTS
+#define GPU_RING_SLOTS 64
+#endif
+#ifndef GPU_RING_CHUNK
+#define GPU_RING_CHUNK 8192		// Largest transfer one slot carries
+#endif
+#ifndef GPU_RING_INFLIGHT
+#define GPU_RING_INFLIGHT 8		// Slots one Read() or Write() keeps posted at a time
+#endif
+#ifndef GPU_RING_BATCH
+#define GPU_RING_BATCH 16		// Requests the host completes together
+#endif
+
+	// Only clients move the ring head, so the compare-and-swap never has to reach across the bus and a device-wide atomic is enough.
+#if defined(__CUDA_ARCH__)
+#define gpuRingCAS(P, C, V) atomicCAS((uint *)(P), (C), (V))
+#define gpuRingFence() __threadfence_system()
+#define gpuRingPause()
+#elif _WIN32
+#define gpuRingCAS(P, C, V) (uint)InterlockedCompareExchange((volatile LONG *)(P), (LONG)(V), (LONG)(C))
+#define gpuRingFence() MemoryBarrier()
+#define gpuRingPause() SwitchToThread()
+#else
+#define gpuRingCAS(P, C, V) __sync_val_compare_and_swap((P), (C), (V))
+#define gpuRingFence() __sync_synchronize()
+#define gpuRingPause() sched_yield()
+#endif
+
+#pragma endregion
+
+#pragma region GpuVRing
+
+	enum GPUOP : int
+	{
+		GPUOP_OPEN,
+		GPUOP_CLOSE,
+		GPUOP_READ,
+		GPUOP_WRITE,
+		GPUOP_TRUNCATE,
+		GPUOP_SYNC,
+		GPUOP_FILESIZE,
+		GPUOP_DELETE,
+		GPUOP_ACCESS,
+		GPUOP_FULLPATHNAME,
+	};
+
+	// A slot is handed out by ticket. Seq walks it through one lap of the ring: equal to the ticket while free, ticket+1 once the client has
+	// posted the request, ticket+2 once the host has completed it, and ticket+GPU_RING_SLOTS after the client has taken the result.
+	struct GpuVRingSlot
+	{
+		volatile uint Seq;		// Where the slot is in its lap
+		volatile int Op;		// GPUOP_ code of the request
+		volatile int H;			// File handle the request is for
+		volatile int Flags;		// OPEN_ or ACCESS_ flags, or the dirSync flag of a delete
+		volatile int Amount;	// Bytes of Data the request uses
+		volatile int64 Offset;	// File offset, or the size to truncate to
+		volatile RC Result;		// Outcome of the request
+		volatile int Got;		// Bytes transferred, the handle opened or the access result
+		volatile int64 Value;	// File size
+		volatile int Errno;		// Host errno when the request failed
+		char Data[GPU_RING_CHUNK]; // Data read or written, or a pathname
+	};
+
+	struct GpuVRing
+	{
+		volatile uint Head;		// Next ticket to hand out, moved by the clients
+		uint Tail;				// Next ticket to service, only used by the host
+		volatile int Stop;		// Set to end the host thread
+		int64 Requests;			// Requests completed
+		int64 Batches;			// Batches those were completed in
+		GpuVRingSlot Slots[GPU_RING_SLOTS];
+	};
+
+	__device__ static GpuVRing *_gpuRing;
+
+	// Claims the slot for the next ticket. Returns false if that slot is still held by a client from the previous lap.
+	__device__ static bool gpuRingClaim(GpuVRing *ring, uint *ticket)
+	{
+		for (;;)
+		{
+			uint pos = ring->Head;
+			int diff = (int)(ring->Slots[pos % GPU_RING_SLOTS].Seq - pos);
+			if (diff < 0)
+				return false;
+			if (diff == 0 && gpuRingCAS(&ring->Head, pos, pos + 1) == pos)
+			{
+				*ticket = pos;
+				return true;
+			}
+		}
+	}
+
+	__device__ static GpuVRingSlot *gpuRingBegin(GpuVRing *ring, uint *ticket)
+	{
+		while (!gpuRingClaim(ring, ticket))
+			gpuRingPause();
+		return &ring->Slots[*ticket % GPU_RING_SLOTS];
+	}
+
+	__device__ static void gpuRingPost(GpuVRing *ring, uint ticket)
+	{
+		gpuRingFence();
+		ring->Slots[ticket % GPU_RING_SLOTS].Seq = ticket + 1;
+	}
+
+	__device__ static GpuVRingSlot *gpuRingWait(GpuVRing *ring, uint ticket)
+	{
+		GpuVRingSlot *slot = &ring->Slots[ticket % GPU_RING_SLOTS];
+		while (slot->Seq != ticket + 2)
+			gpuRingPause();
+		gpuRingFence();
+		return slot;
+	}
+
+	__device__ static void gpuRingRelease(GpuVRing *ring, uint ticket)
+	{
+		gpuRingFence();
+		ring->Slots[ticket % GPU_RING_SLOTS].Seq = ticket + GPU_RING_SLOTS;
+	}
+
+	// Posts a request that carries no more than GPU_RING_CHUNK bytes of Data and waits for it. The caller releases the slot.
+	__device__ static GpuVRingSlot *gpuRingCall(GpuVRing *ring, uint *ticket, GPUOP op, int h, int flags, const char *path)
+	{
+		GpuVRingSlot *slot = gpuRingBegin(ring, ticket);
+		slot->Op = op;
+		slot->H = h;
+		slot->Flags = flags;
+		slot->Amount = 0;
+		slot->Offset = 0;
+		if (path)
+		{
+			int pathLength = _strlen30(path);
+			_assert(pathLength < GPU_RING_CHUNK);
+			_memcpy(slot->Data, path, pathLength + 1);
+			slot->Amount = pathLength + 1;
+		}
+		gpuRingPost(ring, *ticket);
+		return gpuRingWait(ring, *ticket);
+	}
+
+#pragma endregion
+
+#pragma region GpuVHost
+
+	static GpuVRing *_hostRing; // The ring as the host sees it
+#if _WIN32
+	static HANDLE _hostThread;
+#else
+	static pthread_t _hostThread;
+#endif
+
+	// Reads or writes all of amount bytes unless the end of the file or an error comes first. Returns the bytes transferred, or -1.
+	static int gpuHostTransfer(int h, char *buffer, int amount, int64 offset, bool isWrite)
+	{
+		int done = 0;
+		while (done < amount)
+		{
+			int got;
+#if _WIN32
+			if (_lseeki64(h, offset + done, SEEK_SET) != offset + done) return -1;
+			got = (isWrite ? _write(h, buffer + done, amount - done) : _read(h, buffer + done, amount - done));
+#else
+			got = (int)(isWrite ? pwrite(h, buffer + done, amount - done, offset + done) : pread(h, buffer + done, amount - done, offset + done));
+			if (got < 0 && errno == EINTR) continue;
+#endif
+			if (got < 0) return -1;
+			if (got == 0) break;
+			done += got;
+		}
+		return done;
+	}
+
+	static int gpuHostOpen(GpuVRingSlot *slot)
+	{
+		int flags = slot->Flags;
+		int oflags = ((flags & VSystem::OPEN_READWRITE) ? O_RDWR : O_RDONLY);
+		if (flags & VSystem::OPEN_CREATE) oflags |= O_CREAT;
+		if (flags & VSystem::OPEN_EXCLUSIVE) oflags |= O_EXCL;
+#if _WIN32
+		oflags |= _O_BINARY;
+		if (flags & VSystem::OPEN_DELETEONCLOSE) oflags |= _O_TEMPORARY;
+		if (slot->Amount == 0)
+		{
+			char *tempName = _tempnam(nullptr, "gpu_");
+			if (!tempName) return -1;
+			int h = _open(tempName, oflags | _O_CREAT | _O_EXCL | _O_TEMPORARY, _S_IREAD | _S_IWRITE);
+			free(tempName);
+			return h;
+		}
+		return _open(slot->Data, oflags, _S_IREAD | _S_IWRITE);
+#else
+		int h;
+		if (slot->Amount == 0)
+		{
+			char tempName[] = "/tmp/gpu_XXXXXX";
+			h = mkstemp(tempName);
+			if (h >= 0) unlink(tempName);
+			return h;
+		}
+		h = open(slot->Data, oflags, 0644);
+		if (h >= 0 && (flags & VSystem::OPEN_DELETEONCLOSE)) unlink(slot->Data);
+		return h;
+#endif
+	}
+
+	static void gpuHostExecute(GpuVRingSlot *slot)
+	{
+		RC rc = RC::OK;
+		int h = slot->H;
+		switch (slot->Op)
+		{
+		case GPUOP_OPEN: {
+			slot->Got = gpuHostOpen(slot);
+			if (slot->Got < 0) rc = RC::CANTOPEN;
+			break; }
+		case GPUOP_CLOSE: {
+#if _WIN32
+			if (_close(h) != 0) rc = RC::IOERR_CLOSE;
+#else
+			if (close(h) != 0) rc = RC::IOERR_CLOSE;
+#endif
+			break; }
+		case GPUOP_READ: {
+			slot->Got = gpuHostTransfer(h, slot->Data, slot->Amount, slot->Offset, false);
+			if (slot->Got < 0) rc = RC::IOERR_READ;
+			break; }
+		case GPUOP_WRITE: {
+			slot->Got = gpuHostTransfer(h, slot->Data, slot->Amount, slot->Offset, true);
+			if (slot->Got < slot->Amount)
+				rc = (slot->Got >= 0 || errno == ENOSPC ? RC::FULL : RC::IOERR_WRITE);
+			break; }
+		case GPUOP_TRUNCATE: {
+#if _WIN32
+			if (_chsize_s(h, slot->Offset) != 0) rc = RC::IOERR_TRUNCATE;
+#else
+			if (ftruncate(h, (off_t)slot->Offset) != 0) rc = RC::IOERR_TRUNCATE;
+#endif
+			break; }
+		case GPUOP_SYNC: {
+#if _WIN32
+			if (_commit(h) != 0) rc = RC::IOERR_FSYNC;
+#else
+			if (fsync(h) != 0) rc = RC::IOERR_FSYNC;
+#endif
+			break; }
+		case GPUOP_FILESIZE: {
+#if _WIN32
+			struct _stat64 buf;
+			if (_fstat64(h, &buf) != 0) rc = RC::IOERR_FSTAT;
+#else
+			struct stat buf;
+			if (fstat(h, &buf) != 0) rc = RC::IOERR_FSTAT;
+#endif
+			else slot->Value = buf.st_size;
+			break; }
+		case GPUOP_DELETE: {
+#if _WIN32
+			if (_unlink(slot->Data) != 0) rc = (errno == ENOENT ? RC::IOERR_DELETE_NOENT : RC::IOERR_DELETE);
+#else
+			if (unlink(slot->Data) != 0) rc = (errno == ENOENT ? RC::IOERR_DELETE_NOENT : RC::IOERR_DELETE);
+#endif
+			break; }
+		case GPUOP_ACCESS: {
+			int mode = (slot->Flags == VSystem::ACCESS_READWRITE ? 6 : slot->Flags == VSystem::ACCESS_READ ? 4 : 0);
+#if _WIN32
+			slot->Got = (_access(slot->Data, mode) == 0);
+#else
+			slot->Got = (access(slot->Data, mode) == 0);
+#endif
+			break; }
+		case GPUOP_FULLPATHNAME: {
+			char full[GPU_RING_CHUNK];
+#if _WIN32
+			if (!_fullpath(full, slot->Data, sizeof(full))) rc = RC::CANTOPEN;
+#else
+			if (slot->Data[0] == '/')
+				snprintf(full, sizeof(full), "%s", slot->Data);
+			else if (!getcwd(full, sizeof(full) - 1))
+				rc = RC::CANTOPEN;
+			else
+			{
+				int fullLength = (int)strlen(full);
+				snprintf(&full[fullLength], sizeof(full) - fullLength, "/%s", slot->Data);
+			}
+#endif
+			if (rc == RC::OK)
+			{
+				full[sizeof(full) - 1] = 0;
+				memcpy(slot->Data, full, strlen(full) + 1);
+			}
+			break; }
+		}
+		slot->Errno = (rc != RC::OK ? errno : 0);
+		slot->Result = rc;
+	}
+
+	// Runs the requests posted at the tail of the ring, GPU_RING_BATCH at most, and then completes them together with a single fence.
+	static int gpuHostService(GpuVRing *ring)
+	{
+		int batch = 0;
+		while (batch < GPU_RING_BATCH)
+		{
+			uint ticket = ring->Tail + batch;
+			GpuVRingSlot *slot = &ring->Slots[ticket % GPU_RING_SLOTS];
+			if (slot->Seq != ticket + 1)
+				break;
+			gpuRingFence();
+			gpuHostExecute(slot);
+			batch++;
+		}
+		if (batch == 0)
+			return 0;
+		gpuRingFence();
+		for (int i = 0; i < batch; i++)
+		{
+			uint ticket = ring->Tail + i;
+			ring->Slots[ticket % GPU_RING_SLOTS].Seq = ticket + 2;
+		}
+		ring->Tail += batch;
+		ring->Requests += batch;
+		ring->Batches++;
+		return batch;
+	}
+
+#if _WIN32
+	static DWORD WINAPI gpuHostThread(void *arg)
+#else
+	static void *gpuHostThread(void *arg)
+#endif
+	{
+		GpuVRing *ring = (GpuVRing *)arg;
+		while (!ring->Stop)
+			if (gpuHostService(ring) == 0)
+				gpuRingPause();
+		while (gpuHostService(ring) > 0) { }
+		return 0;
+	}
 
 #pragma endregion
 
@@ -28,7 +378,7 @@ namespace Core
 		VSystem *Vfs;			// The VFS used to open this file
 		int H;					// Handle for accessing the file
 		LOCK Lock_;				// Type of lock currently held on this file
-		int	LastErrno;			// The Windows errno from the last I/O error
+		int	LastErrno;			// The host errno from the last I/O error
 		const char *Path;		// Full pathname of this file
 		int SizeChunk;          // Chunk size configured by FCNTL_CHUNK_SIZE
 
@@ -83,106 +433,125 @@ namespace Core
 
 #pragma region GpuVFile
 
+	// Simple requests carry no data, so they go through gpuRingCall() and only the result comes back.
+	__device__ static RC gpuFileCall(GpuVFile *file, GPUOP op, int64 offset, int64 *value)
+	{
+		uint ticket;
+		GpuVRingSlot *slot = gpuRingBegin(_gpuRing, &ticket);
+		slot->Op = op;
+		slot->H = file->H;
+		slot->Amount = 0;
+		slot->Offset = offset;
+		gpuRingPost(_gpuRing, ticket);
+		slot = gpuRingWait(_gpuRing, ticket);
+		RC rc = slot->Result;
+		if (rc != RC::OK) file->LastErrno = slot->Errno;
+		else if (value) *value = slot->Value;
+		gpuRingRelease(_gpuRing, ticket);
+		return rc;
+	}
+
+	// Reads or writes through the ring. The transfer is cut into GPU_RING_CHUNK pieces and up to GPU_RING_INFLIGHT of them are kept posted, so
+	// the host can complete several in one batch while the next ones are being filled. Results are taken back oldest first.
+	__device__ static RC gpuFileTransfer(GpuVFile *file, char *buffer, int amount, int64 offset, bool isWrite)
+	{
+		uint tickets[GPU_RING_INFLIGHT]; // Posted requests, oldest at tickets[first]
+		int starts[GPU_RING_INFLIGHT]; // Where in buffer each posted request starts
+		int first = 0;
+		int posted = 0;
+		int done = 0; // Bytes of buffer handed to the ring
+		RC rc = RC::OK;
+		bool shortRead = false;
+		while (done < amount || posted > 0)
+		{
+			uint ticket;
+			if (done < amount && rc == RC::OK && posted < GPU_RING_INFLIGHT && gpuRingClaim(_gpuRing, &ticket))
+			{
+				GpuVRingSlot *slot = &_gpuRing->Slots[ticket % GPU_RING_SLOTS];
+				int n = amount - done;
+				if (n > GPU_RING_CHUNK) n = GPU_RING_CHUNK;
+				slot->Op = (isWrite ? GPUOP_WRITE : GPUOP_READ);
+				slot->H = file->H;
+				slot->Amount = n;
+				slot->Offset = offset + done;
+				if (isWrite) _memcpy(slot->Data, &buffer[done], n);
+				gpuRingPost(_gpuRing, ticket);
+				int i = (first + posted) % GPU_RING_INFLIGHT;
+				tickets[i] = ticket;
+				starts[i] = done;
+				posted++;
+				done += n;
+				continue;
+			}
+			if (posted == 0)
+			{
+				if (rc != RC::OK) break;
+				gpuRingPause(); // The ring is full of other clients' requests
+				continue;
+			}
+			GpuVRingSlot *slot = gpuRingWait(_gpuRing, tickets[first]);
+			if (slot->Result != RC::OK)
+			{
+				if (rc == RC::OK) rc = slot->Result;
+				file->LastErrno = slot->Errno;
+			}
+			else if (!isWrite)
+			{
+				int got = slot->Got;
+				int n = slot->Amount;
+				_memcpy(&buffer[starts[first]], slot->Data, got);
+				if (got < n)
+				{
+					// Unread parts of the buffer must be zero-filled
+					_memset(&buffer[starts[first] + got], 0, n - got);
+					shortRead = true;
+				}
+			}
+			gpuRingRelease(_gpuRing, tickets[first]);
+			first = (first + 1) % GPU_RING_INFLIGHT;
+			posted--;
+		}
+		if (rc == RC::OK && shortRead)
+			rc = RC::IOERR_SHORT_READ;
+		return rc;
+	}
+
 	RC GpuVFile::Close()
 	{
 		OSTRACE("CLOSE %d\n", H);
-		//_assert(H != NULL && H != INVALID_HANDLE_VALUE);
-		//int rc;
-		//rc = osCloseHandle(H);
-		//OSTRACE("CLOSE %d %s\n", H, rc ? "ok" : "failed");
-		//if (rc)
-		//	H = NULL;
-		//return (rc ? RC::OK : gpuLogError(RC::IOERR_CLOSE, gpuGetLastError(), "gpuClose", Path));
+		_assert(H >= 0);
+		RC rc = gpuFileCall(this, GPUOP_CLOSE, 0, nullptr);
+		OSTRACE("CLOSE %d %s\n", H, rc ? "failed" : "ok");
+		if (rc == RC::OK)
+		{
+			H = -1;
+			Opened = false;
+		}
+		return rc;
 	}
 
 	RC GpuVFile::Read(void *buffer, int amount, int64 offset)
 	{
 		OSTRACE("READ %d lock=%d\n", H, Lock_);
-		return RC::OK;
-		//int retry = 0; // Number of retrys
-		//DWORD read; // Number of bytes actually read from file
-		//if (seekGpuFile(this, offset))
-		//	return RC::FULL;
-		//while (!gpuReadFile(H, buffer, amount, &read, 0))
-		//{
-		//	DWORD lastErrno;
-		//	if (retryIoerr(&retry, &lastErrno)) continue;
-		//	LastErrno = lastErrno;
-		//	return winLogError(RC::IOERR_READ, LastErrno, "winRead", Path);
-		//}
-		//logIoerr(retry);
-		//if (read < (DWORD)amount)
-		//{
-		//	// Unread parts of the buffer must be zero-filled
-		//	memset(&((char *)buffer)[read], 0, amount - read);
-		//	return RC::IOERR_SHORT_READ;
-		//}
-		//return RC::OK;
+		return gpuFileTransfer(this, (char *)buffer, amount, offset, false);
 	}
 
 	RC GpuVFile::Write(const void *buffer, int amount, int64 offset)
 	{
 		_assert(amount > 0);
 		OSTRACE("WRITE %d lock=%d\n", H, Lock_);
-		return RC::OK;
-		//int rc = 0; // True if error has occurred, else false
-		//int retry = 0; // Number of retries
-		//{
-		//	uint8 *remain = (uint8 *)buffer; // Data yet to be written
-		//	int remainLength = amount; // Number of bytes yet to be written
-		//	DWORD write; // Bytes written by each WriteFile() call
-		//	DWORD lastErrno = NO_ERROR; // Value returned by GetLastError()
-		//	while (remainLength > 0)
-		//	{
-		//		if (!osWriteFile(H, remain, remainLength, &write, 0)) {
-		//			if (retryIoerr(&retry, &lastErrno)) continue;
-		//			break;
-		//		}
-		//		_assert(write == 0 || write <= (DWORD)remainLength);
-		//		if (write == 0 || write > (DWORD)remainLength)
-		//		{
-		//			lastErrno = osGetLastError();
-		//			break;
-		//		}
-		//		remain += write;
-		//		remainLength -= write;
-		//	}
-		//	if (remainLength > 0)
-		//	{
-		//		LastErrno = lastErrno;
-		//		rc = 1;
-		//	}
-		//}
-		//if (rc)
-		//{
-		//	if (LastErrno == ERROR_HANDLE_DISK_FULL ||  LastErrno == ERROR_DISK_FULL)
-		//		return RC::FULL;
-		//	return winLogError(RC::IOERR_WRITE, LastErrno, "winWrite", Path);
-		//}
-		//else
-		//	logIoerr(retry);
-		//return RC::OK;
+		return gpuFileTransfer(this, (char *)buffer, amount, offset, true);
 	}
 
 	RC GpuVFile::Truncate(int64 size)
 	{
-		OSTRACE("TRUNCATE %d %lld\n", H, size);
-		return RC::OK;
-		//RC rc = RC::OK;
-		//// If the user has configured a chunk-size for this file, truncate the file so that it consists of an integer number of chunks (i.e. the
-		//// actual file size after the operation may be larger than the requested size).
-		//if (SizeChunk > 0)
-		//	size = ((size+SizeChunk-1)/SizeChunk)*SizeChunk;
-		//// SetEndOfFile() returns non-zero when successful, or zero when it fails.
-		//if (seekWinFile(this, size))
-		//	rc = winLogError(RC::IOERR_TRUNCATE, LastErrno, "winTruncate1", Path);
-		//else if (!osSetEndOfFile(H))
-		//{
-		//	LastErrno = osGetLastError();
-		//	rc = winLogError(RC::IOERR_TRUNCATE, LastErrno, "winTruncate2", Path);
-		//}
-		//OSTRACE("TRUNCATE %d %lld %s\n", H, size, rc ? "failed" : "ok");
-		//return rc;
+		// If the user has configured a chunk-size for this file, truncate the file so that it consists of an integer number of chunks (i.e. the
+		// actual file size after the operation may be larger than the requested size).
+		if (SizeChunk > 0)
+			size = ((size + SizeChunk - 1) / SizeChunk) * SizeChunk;
+		RC rc = gpuFileCall(this, GPUOP_TRUNCATE, size, nullptr);
+		OSTRACE("TRUNCATE %d %lld %s\n", H, size, rc ? "failed" : "ok");
+		return rc;
 	}
 
 	RC GpuVFile::Sync(int flags)
@@ -190,41 +559,48 @@ namespace Core
 		// Check that one of SQLITE_SYNC_NORMAL or FULL was passed
 		_assert((flags&0x0F) == SYNC_NORMAL || (flags&0x0F) == SYNC_FULL);
 		OSTRACE("SYNC %d lock=%d\n", H, Lock_);
-		return RC::OK;
+		return gpuFileCall(this, GPUOP_SYNC, 0, nullptr);
 	}
 
 	RC GpuVFile::get_FileSize(int64 &size)
 	{
-		return RC::OK;
-		//RC rc = RC::OK;
-		//FILE_STANDARD_INFO info;
-		//if (osGetFileInformationByHandleEx(H, FileStandardInfo, &info, sizeof(info)))
-		//	size = info.EndOfFile.QuadPart;
-		//else
-		//{
-		//	LastErrno = osGetLastError();
-		//	rc = winLogError(RC::IOERR_FSTAT, LastErrno, "winFileSize", Path);
-		//}
-		//return rc;
+		return gpuFileCall(this, GPUOP_FILESIZE, 0, &size);
 	}
 
+	// The ring has a single host behind it and the file is not shared with other processes, so locks are only tracked.
 	RC GpuVFile::Lock(LOCK lock)
 	{
+		if (Lock_ < lock) Lock_ = lock;
 		return RC::OK;
 	}
 
 	RC GpuVFile::CheckReservedLock(int &lock)
 	{
+		lock = 0;
 		return RC::OK;
 	}
 
 	RC GpuVFile::Unlock(LOCK lock)
 	{
+		_assert(lock <= LOCK_SHARED);
+		Lock_ = lock;
 		return RC::OK;
 	}
 
 	RC GpuVFile::FileControl(FCNTL op, void *arg)
 	{
+		switch (op)
+		{
+		case FCNTL_LOCKSTATE: {
+			*(int *)arg = Lock_;
+			return RC::OK; }
+		case FCNTL_LAST_ERRNO: {
+			*(int *)arg = LastErrno;
+			return RC::OK; }
+		case FCNTL_CHUNK_SIZE: {
+			SizeChunk = *(int *)arg;
+			return RC::OK; }
+		}
 		return RC::NOTFOUND;
 	}
 
@@ -249,151 +625,102 @@ namespace Core
 
 	__device__ RC GpuVSystem::Open(const char *name, VFile *id, OPEN flags, OPEN *outFlags)
 	{
-		//		// 0x87f7f is a mask of SQLITE_OPEN_ flags that are valid to be passed down into the VFS layer.  Some SQLITE_OPEN_ flags (for example,
-		//		// SQLITE_OPEN_FULLMUTEX or SQLITE_OPEN_SHAREDCACHE) are blocked before reaching the VFS.
-		//		flags = (OPEN)((uint)flags & 0x87f7f);
-		//
-		//		RC rc = RC::OK;
-		//		OPEN type = (OPEN)(flags & 0xFFFFFF00);  // Type of file to open
-		//		bool isExclusive = (flags & OPEN_EXCLUSIVE);
-		//		bool isDelete = (flags & OPEN_DELETEONCLOSE);
-		//		bool isCreate = (flags & OPEN_CREATE);
-		//		bool isReadonly = (flags & OPEN_READONLY);
-		//		bool isReadWrite = (flags & OPEN_READWRITE);
-		//		bool isOpenJournal = (isCreate && (type == OPEN_MASTER_JOURNAL || type == OPEN_MAIN_JOURNAL || type == OPEN_WAL));
-		//
-		//		// Check the following statements are true: 
-		//		//
-		//		//   (a) Exactly one of the READWRITE and READONLY flags must be set, and 
-		//		//   (b) if CREATE is set, then READWRITE must also be set, and
-		//		//   (c) if EXCLUSIVE is set, then CREATE must also be set.
-		//		//   (d) if DELETEONCLOSE is set, then CREATE must also be set.
-		//		_assert((!isReadonly || !isReadWrite) && (isReadWrite || isReadonly));
-		//		_assert(!isCreate || isReadWrite);
-		//		_assert(!isExclusive || isCreate);
-		//		_assert(!isDelete || isCreate);
-		//
-		//		// The main DB, main journal, WAL file and master journal are never automatically deleted. Nor are they ever temporary files.
-		//		_assert((!isDelete && name) || type != OPEN_MAIN_DB);
-		//		_assert((!isDelete && name) || type != OPEN_MAIN_JOURNAL);
-		//		_assert((!isDelete && name) || type != OPEN_MASTER_JOURNAL);
-		//		_assert((!isDelete && name) || type != OPEN_WAL);
-		//
-		//		// Assert that the upper layer has set one of the "file-type" flags.
-		//		_assert(type == OPEN_MAIN_DB || type == OPEN_TEMP_DB ||
-		//			type == OPEN_MAIN_JOURNAL || type == OPEN_TEMP_JOURNAL ||
-		//			type == OPEN_SUBJOURNAL || type == OPEN_MASTER_JOURNAL ||
-		//			type == OPEN_TRANSIENT_DB || type == OPEN_WAL);
-		//
-		//		GpuVFile *file = (GpuVFile *)id;
-		//		_assert(file != nullptr);
-		//		_memset(file, 0, sizeof(GpuVFile));
-		//		file = new (file) GpuVFile();
-		//		file->H = INVALID_HANDLE_VALUE;
-		//
-		//		// If the second argument to this function is NULL, generate a temporary file name to use 
-		//		const char *utf8Name = name; // Filename in UTF-8 encoding
-		//		//char tmpname[MAX_PATH+2];     // Buffer used to create temp filename
-		//		//if (!utf8Name)
-		//		//{
-		//		//	_assert(isDelete && !isOpenJournal);
-		//		//	_memset(tmpname, 0, MAX_PATH+2);
-		//		//	rc = getTempname(MAX_PATH+2, tmpname);
-		//		//	if (rc != RC::OK)
-		//		//		return rc;
-		//		//	utf8Name = tmpname;
-		//		//}
-		//
-		//		// Database filenames are double-zero terminated if they are not URIs with parameters.  Hence, they can always be passed into
-		//		// sqlite3_uri_parameter().
-		//		_assert(type != OPEN_MAIN_DB || (flags & OPEN_URI) || utf8Name[_strlen30(utf8Name)+1]==0);
-		//
-		//		// Convert the filename to the system encoding.
-		//		void *converted = ConvertUtf8Filename(utf8Name); // Filename in OS encoding
-		//		if (!converted)
-		//			return RC::IOERR_NOMEM;
-		//
-		//		if (winIsDir(converted))
-		//		{
-		//			SysEx::Free(converted);
-		//			return RC::CANTOPEN_ISDIR;
-		//		}
-		//
-		//		DWORD dwDesiredAccess;
-		//		if (isReadWrite)
-		//			dwDesiredAccess = GENERIC_READ | GENERIC_WRITE;
-		//		else
-		//			dwDesiredAccess = GENERIC_READ;
-		//
-		//		// SQLITE_OPEN_EXCLUSIVE is used to make sure that a new file is created. SQLite doesn't use it to indicate "exclusive access"
-		//		// as it is usually understood.
-		//		DWORD dwCreationDisposition;
-		//		if (isExclusive) // Creates a new file, only if it does not already exist. If the file exists, it fails.
-		//			dwCreationDisposition = CREATE_NEW;
-		//		else if (isCreate) // Open existing file, or create if it doesn't exist
-		//			dwCreationDisposition = OPEN_ALWAYS;
-		//		else // Opens a file, only if it exists.
-		//			dwCreationDisposition = OPEN_EXISTING;
-		//
-		//		DWORD dwShareMode = FILE_SHARE_READ | FILE_SHARE_WRITE;
-		//
-		//		DWORD dwFlagsAndAttributes = 0;
-		//		if (isDelete)
-		//			dwFlagsAndAttributes = FILE_ATTRIBUTE_TEMPORARY | FILE_ATTRIBUTE_HIDDEN | FILE_FLAG_DELETE_ON_CLOSE;
-		//		else
-		//			dwFlagsAndAttributes = FILE_ATTRIBUTE_NORMAL;
-		//
-		//		HANDLE h;
-		//		DWORD lastErrno;
-		//		int cnt = 0;
-		//		if (isNT())
-		//			while ((h = osCreateFileW((LPCWSTR)converted, dwDesiredAccess, dwShareMode, NULL, dwCreationDisposition, dwFlagsAndAttributes, NULL)) == INVALID_HANDLE_VALUE && retryIoerr(&cnt, &lastErrno)) { }
-		//#ifdef WIN32_HAS_ANSI
-		//		else
-		//			while ((h = osCreateFileA((LPCSTR)converted, dwDesiredAccess, dwShareMode, NULL, dwCreationDisposition, dwFlagsAndAttributes, NULL)) == INVALID_HANDLE_VALUE && retryIoerr(&cnt, &lastErrno)) { }
-		//#endif
-		//			logIoerr(cnt);
-		//
-		//			OSTRACE("OPEN %d %s 0x%lx %s\n", h, name, dwDesiredAccess, h == INVALID_HANDLE_VALUE ? "failed" : "ok");
-		//			if (h == INVALID_HANDLE_VALUE)
-		//			{
-		//				file->LastErrno = lastErrno;
-		//				winLogError(RC::CANTOPEN, file->LastErrno, "winOpen", utf8Name);
-		//				SysEx::Free(converted);
-		//				if (isReadWrite && !isExclusive)
-		//					return Open(name, id, (OPEN)((flags|OPEN_READONLY) & ~(OPEN_CREATE|OPEN_READWRITE)), outFlags);
-		//				else
-		//					return SysEx_CANTOPEN_BKPT;
-		//			}
+		// 0x87f7f is a mask of SQLITE_OPEN_ flags that are valid to be passed down into the VFS layer.  Some SQLITE_OPEN_ flags (for example,
+		// SQLITE_OPEN_FULLMUTEX or SQLITE_OPEN_SHAREDCACHE) are blocked before reaching the VFS.
+		flags = (OPEN)((uint)flags & 0x87f7f);
+
+		OPEN type = (OPEN)(flags & 0xFFFFFF00);  // Type of file to open
+		bool isExclusive = (flags & OPEN_EXCLUSIVE);
+		bool isDelete = (flags & OPEN_DELETEONCLOSE);
+		bool isCreate = (flags & OPEN_CREATE);
+		bool isReadonly = (flags & OPEN_READONLY);
+		bool isReadWrite = (flags & OPEN_READWRITE);
+
+		// Check the following statements are true:
 		//
-		//			if (outFlags)
-		//				*outFlags = (isReadWrite ? OPEN_READWRITE : OPEN_READONLY);
-		//			SysEx::Free(converted);
-		//			file->Opened = true;
-		//			file->Vfs = this;
-		//			file->H = h;
-		//			//if (sqlite3_uri_boolean(name, "psow", POWERSAFE_OVERWRITE))
-		//			//	file->CtrlFlags |= WinVFile::WINFILE_PSOW;
-		//			file->LastErrno = NO_ERROR;
-		//			file->Path = name;
-		//			OpenCounter(+1);
-		//			return rc;
-		return RC::ERROR;
+		//   (a) Exactly one of the READWRITE and READONLY flags must be set, and
+		//   (b) if CREATE is set, then READWRITE must also be set, and
+		//   (c) if EXCLUSIVE is set, then CREATE must also be set.
+		//   (d) if DELETEONCLOSE is set, then CREATE must also be set.
+		_assert((!isReadonly || !isReadWrite) && (isReadWrite || isReadonly));
+		_assert(!isCreate || isReadWrite);
+		_assert(!isExclusive || isCreate);
+		_assert(!isDelete || isCreate);
+
+		// The main DB, main journal, WAL file and master journal are never automatically deleted. Nor are they ever temporary files.
+		_assert((!isDelete && name) || type != OPEN_MAIN_DB);
+		_assert((!isDelete && name) || type != OPEN_MAIN_JOURNAL);
+		_assert((!isDelete && name) || type != OPEN_MASTER_JOURNAL);
+		_assert((!isDelete && name) || type != OPEN_WAL);
+
+		GpuVFile *file = (GpuVFile *)id;
+		_assert(file != nullptr);
+		_memset(file, 0, sizeof(GpuVFile));
+		file = new (file) GpuVFile();
+		file->H = -1;
+		if (!_gpuRing)
+			return SysEx_CANTOPEN_BKPT;
+
+		// A null name asks the host for a temporary file, which goes away when it is closed.
+		uint ticket;
+		GpuVRingSlot *slot = gpuRingCall(_gpuRing, &ticket, GPUOP_OPEN, 0, flags, name);
+		RC rc = slot->Result;
+		int h = slot->Got;
+		file->LastErrno = slot->Errno;
+		gpuRingRelease(_gpuRing, ticket);
+		OSTRACE("OPEN %d %s 0x%x %s\n", h, name, flags, rc ? "failed" : "ok");
+		if (rc != RC::OK)
+		{
+			if (isReadWrite && !isExclusive)
+				return Open(name, id, (OPEN)((flags|OPEN_READONLY) & ~(OPEN_CREATE|OPEN_READWRITE)), outFlags);
+			return SysEx_CANTOPEN_BKPT;
+		}
+
+		if (outFlags)
+			*outFlags = (isReadWrite ? OPEN_READWRITE : OPEN_READONLY);
+		file->Opened = true;
+		file->Vfs = this;
+		file->H = h;
+		file->Path = name;
+		return RC::OK;
 	}
 
 	__device__ RC GpuVSystem::Delete(const char *filename, bool syncDir)
 	{
-		return RC::ERROR;
+		if (!_gpuRing) return RC::ERROR;
+		uint ticket;
+		GpuVRingSlot *slot = gpuRingCall(_gpuRing, &ticket, GPUOP_DELETE, 0, syncDir, filename);
+		RC rc = slot->Result;
+		gpuRingRelease(_gpuRing, ticket);
+		OSTRACE("DELETE \"%s\" %s\n", filename, rc ? "failed" : "ok");
+		return rc;
 	}
 
 	__device__ RC GpuVSystem::Access(const char *filename, ACCESS flags, int *resOut)
 	{
-		return RC::ERROR;
+		if (!_gpuRing) return RC::ERROR;
+		uint ticket;
+		GpuVRingSlot *slot = gpuRingCall(_gpuRing, &ticket, GPUOP_ACCESS, 0, flags, filename);
+		*resOut = slot->Got;
+		gpuRingRelease(_gpuRing, ticket);
+		return RC::OK;
 	}
 
+	// The device has no working directory, so relative names are resolved by the host.
 	__device__ RC GpuVSystem::FullPathname(const char *relative, int fullLength, char *full)
 	{
-		return RC::ERROR;
+		if (!_gpuRing) return RC::ERROR;
+		uint ticket;
+		GpuVRingSlot *slot = gpuRingCall(_gpuRing, &ticket, GPUOP_FULLPATHNAME, 0, 0, relative);
+		RC rc = slot->Result;
+		if (rc == RC::OK)
+		{
+			int length = _strlen30(slot->Data);
+			if (length >= fullLength) rc = SysEx_CANTOPEN_BKPT;
+			else _memcpy(full, slot->Data, length + 1);
+		}
+		gpuRingRelease(_gpuRing, ticket);
+		return rc;
 	}
 
 #ifndef OMIT_LOAD_EXTENSION
@@ -462,21 +789,105 @@ namespace Core
 
 	__device__ static char _gpuVfsBuf[sizeof(GpuVSystem)];
 	__device__ static GpuVSystem *_gpuVfs;
-	__device__ RC VSystem::Initialize()
+	__device__ static void gpuVfsRegister(bool _default)
 	{
 		_gpuVfs = new (_gpuVfsBuf) GpuVSystem();
-		_gpuVfs->SizeOsFile = 0;
+		_gpuVfs->SizeOsFile = sizeof(GpuVFile);
 		_gpuVfs->MaxPathname = 260;
 		_gpuVfs->Name = "gpu";
-		RegisterVfs(_gpuVfs, true);
-		return RC::OK; 
+		VSystem::RegisterVfs(_gpuVfs, _default);
+	}
+
+#ifdef __CUDACC__
+	__device__ RC VSystem::Initialize()
+	{
+		gpuVfsRegister(true);
+		return RC::OK;
 	}
 
 	__device__ void VSystem::Shutdown()
-	{ 
+	{
+	}
+#endif
+
+#pragma endregion
+
+#pragma region GpuVHost
+
+	RC GpuVHost::Start()
+	{
+		if (_hostRing) return RC::MISUSE;
+#ifdef __CUDACC__
+		GpuVRing *deviceRing;
+		if (cudaHostAlloc((void **)&_hostRing, sizeof(GpuVRing), cudaHostAllocMapped) != cudaSuccess)
+			return RC::NOMEM;
+		if (cudaHostGetDevicePointer((void **)&deviceRing, _hostRing, 0) != cudaSuccess)
+		{
+			cudaFreeHost(_hostRing);
+			_hostRing = nullptr;
+			return RC::ERROR;
+		}
+#else
+		_hostRing = (GpuVRing *)malloc(sizeof(GpuVRing));
+		if (!_hostRing) return RC::NOMEM;
+#endif
+		memset(_hostRing, 0, sizeof(GpuVRing));
+		for (uint i = 0; i < GPU_RING_SLOTS; i++)
+			_hostRing->Slots[i].Seq = i;
+#if _WIN32
+		_hostThread = CreateThread(nullptr, 0, gpuHostThread, _hostRing, 0, nullptr);
+		bool started = (_hostThread != nullptr);
+#else
+		bool started = (pthread_create(&_hostThread, nullptr, gpuHostThread, _hostRing) == 0);
+#endif
+		if (!started)
+		{
+#ifdef __CUDACC__
+			cudaFreeHost(_hostRing);
+#else
+			free(_hostRing);
+#endif
+			_hostRing = nullptr;
+			return RC::ERROR;
+		}
+#ifdef __CUDACC__
+		cudaMemcpyToSymbol(_gpuRing, &deviceRing, sizeof(deviceRing));
+#else
+		_gpuRing = _hostRing;
+		gpuVfsRegister(false);
+#endif
+		return RC::OK;
+	}
+
+	void GpuVHost::Stop()
+	{
+		if (!_hostRing) return;
+		_hostRing->Stop = 1;
+#if _WIN32
+		WaitForSingleObject(_hostThread, INFINITE);
+		CloseHandle(_hostThread);
+#else
+		pthread_join(_hostThread, nullptr);
+#endif
+#ifdef __CUDACC__
+		GpuVRing *deviceRing = nullptr;
+		cudaMemcpyToSymbol(_gpuRing, &deviceRing, sizeof(deviceRing));
+		cudaFreeHost(_hostRing);
+#else
+		VSystem::UnregisterVfs(_gpuVfs);
+		_gpuRing = nullptr;
+		free(_hostRing);
+#endif
+		_hostRing = nullptr;
+	}
+
+	void GpuVHost::Stats(int64 *requests, int64 *batches)
+	{
+		*requests = (_hostRing ? _hostRing->Requests : 0);
+		*batches = (_hostRing ? _hostRing->Batches : 0);
 	}
 
 #pragma endregion
 
 }
-#endif
\ No newline at end of file
+#endif
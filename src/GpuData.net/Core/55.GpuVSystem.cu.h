@@ -0,0 +1,15 @@
+﻿// os_gpu.h
+#pragma once
+namespace Core
+{
+	// Host side of the "gpu" VFS. Start() allocates the request ring in memory both sides can see, hands it to the device and starts the thread
+	// that services it; Stop() ends that thread once the device work is done. On a build without CUDA the clients are ordinary threads and
+	// Start() also registers the "gpu" VFS, which the device registers for itself in VSystem::Initialize().
+	class GpuVHost
+	{
+	public:
+		static RC Start();
+		static void Stop();
+		static void Stats(int64 *requests, int64 *batches);
+	};
+}
@@ -0,0 +1,2336 @@
+﻿// os_unix.c
+#include "Core.cu.h"
+#if OS_UNIX // This file is used on unix only
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifndef OMIT_LOAD_EXTENSION
+#include <dlfcn.h>
+#endif
+#include <pthread.h>
+#if defined(__linux__) && defined(__has_include) && !defined(HAVE_IO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#include <new>
+
+namespace Core
+{
+#pragma region Preamble
+
+#if defined(TEST) || defined(_DEBUG)
+	bool OsTrace = true;
+#define OSTRACE(X, ...) if (OsTrace) { printf(X, ##__VA_ARGS__); }
+#else
+#define OSTRACE(X, ...)
+#endif
+
+#ifdef TEST
+	int io_error_hit = 0;            // Total number of I/O Errors
+	int io_error_hardhit = 0;        // Number of non-benign errors
+	int io_error_pending = 0;        // Count down to first I/O error
+	int io_error_persist = 0;        // True if I/O errors persist
+	int io_error_benign = 0;         // True if errors are benign
+	int diskfull_pending = 0;
+	int diskfull = 0;
+#define SimulateIOErrorBenign(X) io_error_benign=(X)
+#define SimulateIOError(CODE) \
+	if ((io_error_persist && io_error_hit) || io_error_pending-- == 1) { local_ioerr(); CODE; }
+	static void local_ioerr() { OSTRACE("IOERR\n"); io_error_hit++; if (!io_error_benign) io_error_hardhit++; }
+#define SimulateDiskfullError(CODE) \
+	if (diskfull_pending) { if (diskfull_pending == 1) { \
+	local_ioerr(); diskfull = 1; io_error_hit = 1; CODE; \
+	} else diskfull_pending--; }
+#else
+#define SimulateIOErrorBenign(X)
+#define SimulateIOError(A)
+#define SimulateDiskfullError(A)
+#endif
+
+	// When testing, keep a count of the number of open files.
+#ifdef TEST
+	int open_file_count = 0;
+#define OpenCounter(X) open_file_count += (X)
+#else
+#define OpenCounter(X)
+#endif
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW 0
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#pragma endregion
+
+#pragma region UnixVFile
+
+	typedef struct UnixInodeInfo UnixInodeInfo;	// An i-node shared by every UnixVFile open on the same file
+	typedef struct UnixUnusedFd UnixUnusedFd;	// A file descriptor whose close() is deferred
+	typedef struct UnixAio UnixAio;				// Queue of ReadAsync()/WriteAsync() operations on one file
+
+	// unixFile
+	class UnixVFile : public VFile
+	{
+	public:
+		enum UNIXFILE : uint8
+		{
+			UNIXFILE_EXCL = 0x01,		// Connections from one process only
+			UNIXFILE_RDONLY = 0x02,		// Connection is read only
+			UNIXFILE_PERSIST_WAL = 0x04, // Persistent WAL mode
+			UNIXFILE_DIRSYNC = 0x08,	// Directory sync needed
+			UNIXFILE_PSOW = 0x10,		// SQLITE_IOCAP_POWERSAFE_OVERWRITE
+			UNIXFILE_DELETE = 0x20,		// Delete on close
+			UNIXFILE_NOLOCK = 0x80,		// Do no file locking
+		};
+
+		VSystem *Vfs;			// The VFS that created this file
+		UnixInodeInfo *Inode;	// Info about locks on this inode
+		int H;					// The file descriptor
+		LOCK Lock_;				// The type of lock held on this fd
+		uint8 CtrlFlags;		// Behavioral bits.  UNIXFILE_* flags
+		int LastErrno;			// The unix errno from the last I/O error
+		UnixUnusedFd *Unused;	// Pre-allocated UnixUnusedFd
+		const char *Path;		// Name of the file
+		int SizeChunk;          // Chunk size configured by FCNTL_CHUNK_SIZE
+		void *MapRegion;		// Memory mapped region of the file, or nullptr
+		int64 MapSize;			// Usable size of the mapping in bytes
+		int64 MapSizeActual;	// Actual size of the mapping as passed to mmap()
+		int64 MapSizeMax;		// Upper bound on the mapping, set by FCNTL_MMAP_SIZE
+		int FetchOuts;			// Number of outstanding Fetch() references into the mapping
+		UnixAio *Aio;			// Async I/O queue, created on the first ReadAsync()/WriteAsync()
+		int DirectAlign;		// Alignment of O_DIRECT transfers, or 0 if the file is not open for direct I/O
+	public:
+		__device__ virtual RC Read(void *buffer, int amount, int64 offset);
+		__device__ virtual RC Write(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Truncate(int64 size);
+		__device__ virtual RC Close();
+		__device__ virtual RC Sync(int flags);
+		__device__ virtual RC get_FileSize(int64 &size);
+
+		__device__ virtual RC Lock(LOCK lock);
+		__device__ virtual RC Unlock(LOCK lock);
+		__device__ virtual RC CheckReservedLock(int &lock);
+		__device__ virtual RC FileControl(FCNTL op, void *arg);
+
+		__device__ virtual uint get_SectorSize();
+		__device__ virtual IOCAP get_DeviceCharacteristics();
+
+		__device__ virtual RC Fetch(int64 offset, int amount, void **pp);
+		__device__ virtual RC Unfetch(int64 offset, void *p);
+
+		__device__ virtual RC Readv(IOVec *vecs, int count, int64 offset);
+		__device__ virtual RC Writev(const IOVec *vecs, int count, int64 offset);
+
+		__device__ virtual RC ReadAsync(void *buffer, int amount, int64 offset);
+		__device__ virtual RC WriteAsync(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Wait();
+	};
+
+#pragma endregion
+
+#pragma region UnixVSystem
+
+	class UnixVSystem : public VSystem
+	{
+	public:
+		__device__ virtual VFile *_AttachFile(void *buffer);
+		__device__ virtual RC Open(const char *path, VFile *file, OPEN flags, OPEN *outFlags);
+		__device__ virtual RC Delete(const char *path, bool syncDirectory);
+		__device__ virtual RC Access(const char *path, ACCESS flags, int *outRC);
+		__device__ virtual RC FullPathname(const char *path, int pathOutLength, char *pathOut);
+
+		__device__ virtual void *DlOpen(const char *filename);
+		__device__ virtual void DlError(int bufLength, char *buf);
+		__device__ virtual void (*DlSym(void *handle, const char *symbol))();
+		__device__ virtual void DlClose(void *handle);
+
+		__device__ virtual int Randomness(int bufLength, char *buf);
+		__device__ virtual int Sleep(int microseconds);
+		__device__ virtual RC CurrentTimeInt64(int64 *now);
+		__device__ virtual RC CurrentTime(double *now);
+		__device__ virtual RC GetLastError(int bufLength, char *buf);
+
+		__device__ virtual RC SetSystemCall(const char *name, syscall_ptr newFunc);
+		__device__ virtual syscall_ptr GetSystemCall(const char *name);
+		__device__ virtual const char *NextSystemCall(const char *name);
+	};
+
+#pragma endregion
+
+#pragma region Unix
+
+#ifndef DEFAULT_SECTOR_SIZE
+#define DEFAULT_SECTOR_SIZE 4096
+#endif
+#ifndef TEMP_FILE_PREFIX
+#define TEMP_FILE_PREFIX "etilqs_"
+#endif
+#ifndef DEFAULT_FILE_PERMISSIONS // Default permissions when creating a new file
+#define DEFAULT_FILE_PERMISSIONS 0644
+#endif
+#ifndef POWERSAFE_OVERWRITE // Files are assumed to have powersafe overwrite unless told otherwise
+#define POWERSAFE_OVERWRITE 1
+#endif
+#ifndef MINIMUM_FILE_DESCRIPTOR // Do not use file descriptors 0, 1 or 2, since an errant write() to stdout or stderr would corrupt the database
+#define MINIMUM_FILE_DESCRIPTOR 3
+#endif
+#define MAX_PATHNAME 512
+#if !defined(HAVE_PREADV) && (defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__))
+#define HAVE_PREADV 1
+#endif
+#if !defined(HAVE_POSIX_FADVISE) && defined(__linux__)
+#define HAVE_POSIX_FADVISE 1
+#endif
+#if !defined(HAVE_PUNCH_HOLE) && defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+#define HAVE_PUNCH_HOLE 1
+#endif
+#ifndef UNIX_IOV_MAX // Buffers passed to one preadv()/pwritev() call
+#define UNIX_IOV_MAX 64
+#endif
+#ifndef UNIX_AIO_DEPTH // Async operations one file may have in flight. A power of two, as it also sizes the io_uring submission queue
+#define UNIX_AIO_DEPTH 64
+#endif
+#ifndef UNIX_AIO_BATCH // Queued io_uring entries that are passed to the kernel in one io_uring_enter() call
+#define UNIX_AIO_BATCH 8
+#endif
+#ifndef MAX_MMAP_SIZE // Largest mapping a single file may hold, kept under 2GiB so a 32-bit process does not exhaust its address space
+#define MAX_MMAP_SIZE 0x7fff0000
+#endif
+#if defined(__linux__) && !defined(HAVE_FDATASYNC)
+#define HAVE_FDATASYNC 1
+#endif
+
+#pragma endregion
+
+#pragma region Syscall
+
+#ifndef SYSCALL
+#define SYSCALL syscall_ptr
+#endif
+
+	// open() is declared variadic, so a fixed-signature wrapper is needed to place it in the system call table.
+	static int posixOpen(const char *path, int flags, int mode) { return open(path, flags, mode); }
+#if HAVE_FDATASYNC
+	static int posixFdatasync(int fd) { return fdatasync(fd); }
+#else
+	static int posixFdatasync(int fd) { return fsync(fd); }
+#endif
+#if HAVE_PUNCH_HOLE
+	static int posixPunchHole(int fd, off_t offset, off_t len) { return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len); }
+#endif
+
+	static struct unix_syscall
+	{
+		const char *Name;            // Name of the system call
+		syscall_ptr Current; // Current value of the system call
+		syscall_ptr Default; // Default value
+	} Syscalls[] =
+	{
+		{"open", (SYSCALL)posixOpen, nullptr},
+#define osOpen ((int(*)(const char *,int,int))Syscalls[0].Current)
+		{"close", (SYSCALL)close, nullptr},
+#define osClose ((int(*)(int))Syscalls[1].Current)
+		{"access", (SYSCALL)access, nullptr},
+#define osAccess ((int(*)(const char *,int))Syscalls[2].Current)
+		{"getcwd", (SYSCALL)getcwd, nullptr},
+#define osGetcwd ((char*(*)(char *,size_t))Syscalls[3].Current)
+		{"stat", (SYSCALL)stat, nullptr},
+#define osStat ((int(*)(const char *,struct stat *))Syscalls[4].Current)
+		{"fstat", (SYSCALL)fstat, nullptr},
+#define osFstat ((int(*)(int,struct stat *))Syscalls[5].Current)
+		{"ftruncate", (SYSCALL)ftruncate, nullptr},
+#define osFtruncate ((int(*)(int,off_t))Syscalls[6].Current)
+		{"fcntl", (SYSCALL)fcntl, nullptr},
+#define osFcntl ((int(*)(int,int,...))Syscalls[7].Current)
+		{"pread", (SYSCALL)pread, nullptr},
+#define osPread ((ssize_t(*)(int,void *,size_t,off_t))Syscalls[8].Current)
+		{"pwrite", (SYSCALL)pwrite, nullptr},
+#define osPwrite ((ssize_t(*)(int,const void *,size_t,off_t))Syscalls[9].Current)
+		{"fchmod", (SYSCALL)fchmod, nullptr},
+#define osFchmod ((int(*)(int,mode_t))Syscalls[10].Current)
+		{"unlink", (SYSCALL)unlink, nullptr},
+#define osUnlink ((int(*)(const char *))Syscalls[11].Current)
+		{"fsync", (SYSCALL)fsync, nullptr},
+#define osFsync ((int(*)(int))Syscalls[12].Current)
+		{"fdatasync", (SYSCALL)posixFdatasync, nullptr},
+#define osFdatasync ((int(*)(int))Syscalls[13].Current)
+#if defined(HAVE_POSIX_FALLOCATE) && HAVE_POSIX_FALLOCATE
+		{"fallocate", (SYSCALL)posix_fallocate, nullptr},
+#else
+		{"fallocate", (SYSCALL)nullptr, nullptr},
+#endif
+#define osFallocate ((int(*)(int,off_t,off_t))Syscalls[14].Current)
+		{"mmap", (SYSCALL)mmap, nullptr},
+#define osMmap ((void*(*)(void*,size_t,int,int,int,off_t))Syscalls[15].Current)
+		{"munmap", (SYSCALL)munmap, nullptr},
+#define osMunmap ((int(*)(void*,size_t))Syscalls[16].Current)
+#if HAVE_PREADV
+		{"preadv", (SYSCALL)preadv, nullptr},
+#else
+		{"preadv", (SYSCALL)nullptr, nullptr},
+#endif
+#define osPreadv ((ssize_t(*)(int,const struct iovec*,int,off_t))Syscalls[17].Current)
+#if HAVE_PREADV
+		{"pwritev", (SYSCALL)pwritev, nullptr},
+#else
+		{"pwritev", (SYSCALL)nullptr, nullptr},
+#endif
+#define osPwritev ((ssize_t(*)(int,const struct iovec*,int,off_t))Syscalls[18].Current)
+#if HAVE_POSIX_FADVISE
+		{"fadvise", (SYSCALL)posix_fadvise, nullptr},
+#else
+		{"fadvise", (SYSCALL)nullptr, nullptr},
+#endif
+#define osFadvise ((int(*)(int,off_t,off_t,int))Syscalls[19].Current)
+		{"madvise", (SYSCALL)posix_madvise, nullptr},
+#define osMadvise ((int(*)(void*,size_t,int))Syscalls[20].Current)
+#if HAVE_PUNCH_HOLE
+		{"punchhole", (SYSCALL)posixPunchHole, nullptr},
+#else
+		{"punchhole", (SYSCALL)nullptr, nullptr},
+#endif
+#define osPunchHole ((int(*)(int,off_t,off_t))Syscalls[21].Current)
+	}; // End of the overrideable system calls
+
+	RC UnixVSystem::SetSystemCall(const char *name, syscall_ptr newFunc)
+	{
+		RC rc = RC::NOTFOUND;
+		if (name == nullptr)
+		{
+			// If no zName is given, restore all system calls to their default settings and return NULL
+			rc = RC::OK;
+			for (int i = 0; i < __arrayStaticLength(Syscalls); i++)
+				if (Syscalls[i].Default)
+					Syscalls[i].Current = Syscalls[i].Default;
+			return rc;
+		}
+		// If zName is specified, operate on only the one system call specified.
+		for (int i = 0; i < __arrayStaticLength(Syscalls); i++)
+		{
+			if (!strcmp(name, Syscalls[i].Name))
+			{
+				if (!Syscalls[i].Default)
+					Syscalls[i].Default = Syscalls[i].Current;
+				rc = RC::OK;
+				if (!newFunc) newFunc = Syscalls[i].Default;
+				Syscalls[i].Current = newFunc;
+				break;
+			}
+		}
+		return rc;
+	}
+
+	syscall_ptr UnixVSystem::GetSystemCall(const char *name)
+	{
+		for (int i = 0; i < __arrayStaticLength(Syscalls); i++)
+			if (!strcmp(name, Syscalls[i].Name)) return Syscalls[i].Current;
+		return nullptr;
+	}
+
+	const char *UnixVSystem::NextSystemCall(const char *name)
+	{
+		int i = -1;
+		if (name)
+			for (i = 0; i < __arrayStaticLength(Syscalls)-1; i++)
+				if (!strcmp(name, Syscalls[i].Name)) break;
+		for (i++; i < __arrayStaticLength(Syscalls); i++)
+			if (Syscalls[i].Current) return Syscalls[i].Name;
+		return 0;
+	}
+
+#pragma endregion
+
+#pragma region OS Errors
+
+#define unixLogError(a,b,c) unixLogErrorAtLine(a,b,c,__LINE__)
+	static RC unixLogErrorAtLine(RC errcode, const char *func, const char *path, int line)
+	{
+		int lastErrno = errno; // Error code to report
+		const char *msg = strerror(lastErrno); // Human readable error text
+		_assert(errcode != RC::OK);
+		if (!path) path = "";
+		SysEx_LOG(errcode, "os_unix.c:%d: (%d) %s(%s) - %s", line, lastErrno, func, path, msg);
+		return errcode;
+	}
+
+	// Map a posix errno from a failed locking call onto an RC. EAGAIN/EACCES and friends mean another process holds a conflicting lock, which is BUSY rather than an I/O error.
+	static RC errorFromPosixError(int posixError, RC ioErr)
+	{
+		switch (posixError)
+		{
+		case 0:
+			return RC::OK;
+		case EAGAIN:
+		case ETIMEDOUT:
+		case EBUSY:
+		case EINTR:
+		case ENOLCK:
+			return RC::BUSY;
+		case EACCES:
+			// EACCES is like EAGAIN during locking operations, but not any other time
+			if (ioErr == RC::IOERR_LOCK || ioErr == RC::IOERR_UNLOCK || ioErr == RC::IOERR_RDLOCK || ioErr == RC::IOERR_CHECKRESERVEDLOCK)
+				return RC::BUSY;
+			return RC::PERM;
+		case EPERM:
+			return RC::PERM;
+		default:
+			return ioErr;
+		}
+	}
+
+	// Retry open() on EINTR and never hand back a descriptor below MINIMUM_FILE_DESCRIPTOR. If a new file is created with mode m the permissions are forced to m regardless of umask.
+	static int robust_open(const char *path, int flags, mode_t mode)
+	{
+		int fd;
+		mode_t mode2 = (mode ? mode : DEFAULT_FILE_PERMISSIONS);
+		while (true)
+		{
+			fd = osOpen(path, flags|O_CLOEXEC, mode2);
+			if (fd < 0)
+			{
+				if (errno == EINTR) continue;
+				break;
+			}
+			if (fd >= MINIMUM_FILE_DESCRIPTOR) break;
+			osClose(fd);
+			SysEx_LOG(RC::CANTOPEN, "attempt to open \"%s\" as file descriptor %d", path, fd);
+			fd = -1;
+			if (osOpen("/dev/null", flags, mode) < 0) break;
+		}
+		if (fd >= 0)
+		{
+			if (mode != 0)
+			{
+				struct stat statbuf;
+				if (osFstat(fd, &statbuf) == 0 && statbuf.st_size == 0 && (statbuf.st_mode&0777) != mode)
+					osFchmod(fd, mode);
+			}
+#if defined(FD_CLOEXEC) && O_CLOEXEC == 0
+			osFcntl(fd, F_SETFD, osFcntl(fd, F_GETFD, 0) | FD_CLOEXEC);
+#endif
+		}
+		return fd;
+	}
+
+	static void robust_close(UnixVFile *file, int h, int line)
+	{
+		if (osClose(h))
+			unixLogErrorAtLine(RC::IOERR_CLOSE, "close", (file ? file->Path : nullptr), line);
+	}
+
+	static int robust_ftruncate(int h, int64 size)
+	{
+		int rc;
+		do { rc = osFtruncate(h, (off_t)size); } while (rc < 0 && errno == EINTR);
+		return rc;
+	}
+
+#pragma endregion
+
+#pragma region Inode
+
+	// An instance of the following structure is allocated for each open inode. A single inode can have multiple file descriptors, so each UnixVFile
+	// structure contains a pointer to an instance of this object and this object keeps a count of the number of UnixVFile pointing to it.
+	//
+	// POSIX advisory locks are per-process, not per-descriptor, and closing any descriptor on a file drops every lock the process holds on it. All the
+	// lock bookkeeping for connections within this process therefore lives here, and close() is deferred while locks are outstanding.
+	struct UnixFileId
+	{
+		dev_t Dev;				// Device number
+		ino_t Ino;				// Inode number
+	};
+
+	struct UnixUnusedFd
+	{
+		int FD;					// File descriptor to close
+		int Flags;				// Flags this file descriptor was opened with
+		UnixUnusedFd *Next;		// Next unused file descriptor on same file
+	};
+
+	struct UnixInodeInfo
+	{
+		UnixFileId FileId;		// The lookup key
+		int Shareds;			// Number of SHARED locks held
+		VFile::LOCK Lock_;		// One of SHARED_LOCK, RESERVED_LOCK etc.
+		int Refs;				// Number of pointers to this structure
+		int Locks;				// Number of outstanding file locks
+		UnixUnusedFd *Unused;	// Unused file descriptors to close
+		UnixInodeInfo *Next;	// List of all UnixInodeInfo objects
+		UnixInodeInfo *Prev;	//    .... doubly linked
+	};
+
+	static UnixInodeInfo *_inodeList = nullptr;
+
+	static void unixEnterMutex() { MutexEx::Enter(MutexEx::Alloc(MutexEx::MUTEX_STATIC_MASTER)); }
+	static void unixLeaveMutex() { MutexEx::Leave(MutexEx::Alloc(MutexEx::MUTEX_STATIC_MASTER)); }
+	static bool unixMutexHeld() { return MutexEx::Held(MutexEx::Alloc(MutexEx::MUTEX_STATIC_MASTER)); }
+
+	// Close all file descriptors accumuated in the UnixInodeInfo->Unused list.
+	static void closePendingFds(UnixVFile *file)
+	{
+		UnixInodeInfo *inode = file->Inode;
+		UnixUnusedFd *p;
+		UnixUnusedFd *next;
+		for (p = inode->Unused; p; p = next)
+		{
+			next = p->Next;
+			robust_close(file, p->FD, __LINE__);
+			SysEx::Free(p);
+		}
+		inode->Unused = nullptr;
+	}
+
+	// Add the file descriptor held by file to the list of descriptors closed once every lock on the inode has been released.
+	static void setPendingFd(UnixVFile *file)
+	{
+		UnixInodeInfo *inode = file->Inode;
+		UnixUnusedFd *p = file->Unused;
+		if (!p)
+			return;
+		p->Next = inode->Unused;
+		inode->Unused = p;
+		file->H = -1;
+		file->Unused = nullptr;
+	}
+
+	// Release a UnixInodeInfo structure previously allocated by findInodeInfo(). The mutex entered using the unixEnterMutex() function must be held when this function is called.
+	static void releaseInodeInfo(UnixVFile *file)
+	{
+		UnixInodeInfo *inode = file->Inode;
+		_assert(unixMutexHeld());
+		if (SysEx_ALWAYS(inode))
+		{
+			inode->Refs--;
+			if (inode->Refs == 0)
+			{
+				_assert(inode->Shareds == 0);
+				closePendingFds(file);
+				if (inode->Prev)
+				{
+					_assert(inode->Prev->Next == inode);
+					inode->Prev->Next = inode->Next;
+				}
+				else
+				{
+					_assert(_inodeList == inode);
+					_inodeList = inode->Next;
+				}
+				if (inode->Next)
+				{
+					_assert(inode->Next->Prev == inode);
+					inode->Next->Prev = inode->Prev;
+				}
+				SysEx::Free(inode);
+			}
+		}
+	}
+
+	// Given a file descriptor, locate the UnixInodeInfo object that describes that file descriptor.  Create a new one if necessary.  The return value
+	// might be uninitialized if an error occurs. The mutex entered using the unixEnterMutex() function must be held when this function is called.
+	static RC findInodeInfo(UnixVFile *file, UnixInodeInfo **inodeOut)
+	{
+		_assert(unixMutexHeld());
+		// Get low-level information about the file that we can used to create a unique name for the file.
+		struct stat statbuf;
+		if (osFstat(file->H, &statbuf) != 0)
+		{
+			file->LastErrno = errno;
+			return RC::IOERR;
+		}
+		UnixFileId fileId;
+		_memset(&fileId, 0, sizeof(fileId));
+		fileId.Dev = statbuf.st_dev;
+		fileId.Ino = statbuf.st_ino;
+		UnixInodeInfo *inode = _inodeList;
+		while (inode && _memcmp(&fileId, &inode->FileId, sizeof(fileId)))
+			inode = inode->Next;
+		if (!inode)
+		{
+			inode = (UnixInodeInfo *)SysEx::Alloc(sizeof(UnixInodeInfo), true);
+			if (!inode)
+				return RC::NOMEM;
+			_memcpy(&inode->FileId, &fileId, sizeof(fileId));
+			inode->Refs = 1;
+			inode->Next = _inodeList;
+			inode->Prev = nullptr;
+			if (_inodeList) _inodeList->Prev = inode;
+			_inodeList = inode;
+		}
+		else
+			inode->Refs++;
+		*inodeOut = inode;
+		return RC::OK;
+	}
+
+#pragma endregion
+
+#pragma region UnixVFile
+
+	// Seek to the offset passed as the second argument, then read cnt bytes into buffer. Return the number of bytes actually read.
+	// pread() is used so that no seek is required and concurrent readers on one descriptor do not race on the file pointer.
+	static int seekAndRead(UnixVFile *file, int64 offset, void *buffer, int count)
+	{
+		_assert(count == (count&0x1ffff));
+		int got;
+		int prior = 0;
+		do
+		{
+			got = (int)osPread(file->H, buffer, count, (off_t)offset);
+			SimulateIOError(got = -1);
+			if (got == count) break;
+			if (got < 0)
+			{
+				if (errno == EINTR) { got = 1; continue; }
+				prior = 0;
+				file->LastErrno = errno;
+				break;
+			}
+			else if (got > 0)
+			{
+				count -= got;
+				offset += got;
+				prior += got;
+				buffer = (void *)(got + (char *)buffer);
+			}
+		} while (got > 0);
+		OSTRACE("READ %-3d %5d %7lld\n", file->H, got + prior, offset - prior);
+		return got + prior;
+	}
+
+	// Write count bytes from buffer at offset. Return the number of bytes actually written, or a negative value on error with LastErrno set.
+	static int seekAndWrite(UnixVFile *file, int64 offset, const void *buffer, int count)
+	{
+		_assert(count == (count&0x1ffff));
+		int got;
+		do { got = (int)osPwrite(file->H, buffer, count, (off_t)offset); } while (got < 0 && errno == EINTR);
+		OSTRACE("WRITE %-3d %5d %7lld\n", file->H, got, offset);
+		if (got < 0)
+			file->LastErrno = errno;
+		return got;
+	}
+
+	// A file opened with O_DIRECT moves whole blocks of DirectAlign bytes, at aligned offsets, to and from aligned memory. A request that does
+	// not is carried through an aligned bounce buffer that covers the blocks around it. A write that only has its buffer out of line is copied
+	// over as it is; any other reads those blocks first so the bytes on either side survive, and cuts the file back if the last block took it
+	// past its old end.
+	static bool unixDirectAligned(UnixVFile *file, const void *buffer, int amount, int64 offset)
+	{
+		return ((((const char *)buffer - (const char *)0) | amount | offset) & (file->DirectAlign - 1)) == 0;
+	}
+
+	static RC unixDirectIO(UnixVFile *file, void *buffer, int amount, int64 offset, bool isWrite)
+	{
+		// Queued writes may touch the blocks read back here.
+		RC rc = (isWrite ? file->Wait() : RC::OK);
+		if (rc != RC::OK)
+			return rc;
+		int64 align = file->DirectAlign;
+		int64 start = offset & ~(align - 1); // Offset of the first block
+		int length = (int)(((offset + amount + align - 1) & ~(align - 1)) - start); // Bytes of whole blocks
+		void *bounce;
+		if (posix_memalign(&bounce, (size_t)align, (size_t)length))
+			return RC::NOMEM;
+		// Bytes of the blocks that were in the file. A write of whole blocks keeps none of them, so they are not read
+		int got = (isWrite && start == offset && length == amount ? length : seekAndRead(file, start, bounce, length));
+		if (got < 0)
+			rc = (isWrite ? RC::IOERR_WRITE : RC::IOERR_READ); // LastErrno set by seekAndRead
+		else
+		{
+			_memset(&((char *)bounce)[got], 0, length - got);
+			if (!isWrite)
+			{
+				_memcpy(buffer, &((char *)bounce)[offset - start], amount);
+				if (start + got < offset + amount)
+				{
+					file->LastErrno = 0; // not a system error
+					rc = RC::IOERR_SHORT_READ;
+				}
+			}
+			else
+			{
+				_memcpy(&((char *)bounce)[offset - start], buffer, amount);
+				int wrote = seekAndWrite(file, start, bounce, length);
+				if (wrote != length)
+				{
+					rc = (wrote < 0 && file->LastErrno != ENOSPC ? RC::IOERR_WRITE : RC::FULL);
+					if (wrote >= 0) file->LastErrno = 0;
+				}
+				else if (got < length && robust_ftruncate(file->H, (start + got > offset + amount ? start + got : offset + amount)))
+				{
+					file->LastErrno = errno;
+					rc = RC::IOERR_TRUNCATE;
+				}
+			}
+		}
+		free(bounce);
+		return rc;
+	}
+
+#pragma region Async I/O
+
+	// ReadAsync()/WriteAsync() queue an operation against the file descriptor and return at once; Wait() blocks until every queued operation has
+	// completed and reports the first error. Operations are carried by an io_uring instance owned by the file where the kernel provides one, and
+	// otherwise by a small pool of worker threads shared by the process. The pager only waits at sync points, so many page writes stay in flight.
+	struct UnixAioOp
+	{
+		UnixAio *Aio;			// Queue this operation belongs to
+		void *Buffer;			// Caller's buffer. Must stay valid until Wait()
+		int Amount;				// Bytes to transfer
+		int64 Offset;			// File offset
+		bool IsWrite;			// True for a write, false for a read
+		UnixAioOp *Next;		// Next in the free list or the worker queue
+	};
+
+	struct UnixAio
+	{
+		int H;					// File descriptor the operations run against
+		UnixAioOp Ops[UNIX_AIO_DEPTH]; // Operation slots
+		UnixAioOp *Free;		// Unused entries of Ops[]
+		int Pendings;			// Operations queued but not yet completed
+		RC ErrorRC;				// First error seen since the last Wait()
+		int ErrorErrno;			// errno that went with ErrorRC
+		pthread_mutex_t Mutex;	// Protects Pendings/ErrorRC when the thread pool is used
+		pthread_cond_t Done;	// Signalled when Pendings reaches zero
+#if HAVE_IO_URING
+		int RingFd;				// io_uring instance, or -1 to use the thread pool
+		uint32 RingEntries;		// Size of the submission queue
+		void *SqMap, *CqMap;	// Mapped submission and completion rings
+		size_t SqMapSize, CqMapSize;
+		struct io_uring_sqe *Sqes; // Mapped submission queue entries
+		uint32 *SqHead, *SqTail, *SqMask, *SqArray;
+		uint32 *CqHead, *CqTail, *CqMask;
+		struct io_uring_cqe *Cqes;
+		int ToSubmit;			// Entries added to the submission queue but not yet passed to the kernel
+#endif
+	};
+
+	// Run whatever is left of op synchronously, starting done bytes in. Used by the thread pool for the whole transfer, and by the io_uring
+	// completion path when the kernel transferred fewer bytes than asked. A read that hits end of file zero-fills the rest, as Read() does.
+	static RC unixAioFinish(UnixAioOp *op, int done, int *errnoOut)
+	{
+		while (done < op->Amount)
+		{
+			char *buf = &((char *)op->Buffer)[done];
+			ssize_t got = (op->IsWrite ? osPwrite(op->Aio->H, buf, op->Amount - done, (off_t)(op->Offset + done)) : osPread(op->Aio->H, buf, op->Amount - done, (off_t)(op->Offset + done)));
+			if (got < 0)
+			{
+				if (errno == EINTR) continue;
+				*errnoOut = errno;
+				return (!op->IsWrite ? RC::IOERR_READ : errno == ENOSPC ? RC::FULL : RC::IOERR_WRITE);
+			}
+			if (got == 0) break;
+			done += (int)got;
+		}
+		if (done == op->Amount)
+			return RC::OK;
+		if (op->IsWrite)
+			return RC::FULL;
+		_memset(&((char *)op->Buffer)[done], 0, op->Amount - done);
+		return RC::IOERR_SHORT_READ;
+	}
+
+	static void unixAioComplete(UnixAioOp *op, RC rc, int errno_)
+	{
+		UnixAio *aio = op->Aio;
+		if (rc != RC::OK && aio->ErrorRC == RC::OK)
+		{
+			aio->ErrorRC = rc;
+			aio->ErrorErrno = errno_;
+		}
+		op->Next = aio->Free;
+		aio->Free = op;
+		aio->Pendings--;
+	}
+
+#pragma region Thread pool
+
+#ifndef UNIX_AIO_THREADS
+#define UNIX_AIO_THREADS 4
+#endif
+
+	static struct UnixAioPool
+	{
+		pthread_once_t Once;
+		bool Started;
+		pthread_mutex_t Mutex;
+		pthread_cond_t Work;
+		UnixAioOp *Head, *Tail;	// Queued operations, oldest first
+	} _aioPool = { PTHREAD_ONCE_INIT, false, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, nullptr, nullptr };
+
+	static void *unixAioWorker(void *arg)
+	{
+		while (true)
+		{
+			pthread_mutex_lock(&_aioPool.Mutex);
+			while (!_aioPool.Head)
+				pthread_cond_wait(&_aioPool.Work, &_aioPool.Mutex);
+			UnixAioOp *op = _aioPool.Head;
+			_aioPool.Head = op->Next;
+			if (!_aioPool.Head) _aioPool.Tail = nullptr;
+			pthread_mutex_unlock(&_aioPool.Mutex);
+
+			int errno_ = 0;
+			RC rc = unixAioFinish(op, 0, &errno_);
+			UnixAio *aio = op->Aio;
+			pthread_mutex_lock(&aio->Mutex);
+			unixAioComplete(op, rc, errno_);
+			if (aio->Pendings == 0)
+				pthread_cond_signal(&aio->Done);
+			pthread_mutex_unlock(&aio->Mutex);
+		}
+		return nullptr;
+	}
+
+	// Workers are started on first use and live for the rest of the process. They are detached, so nothing has to join them at shutdown.
+	static void unixAioPoolStart()
+	{
+		int started = 0;
+		for (int i = 0; i < UNIX_AIO_THREADS; i++)
+		{
+			pthread_t thread;
+			if (pthread_create(&thread, nullptr, unixAioWorker, nullptr) == 0)
+			{
+				pthread_detach(thread);
+				started++;
+			}
+		}
+		_aioPool.Started = (started > 0);
+	}
+
+#pragma endregion
+
+#if HAVE_IO_URING
+#pragma region io_uring
+
+	static void unixAioRingClose(UnixAio *aio)
+	{
+		if (aio->Sqes) munmap(aio->Sqes, aio->RingEntries * sizeof(struct io_uring_sqe));
+		if (aio->CqMap && aio->CqMap != aio->SqMap) munmap(aio->CqMap, aio->CqMapSize);
+		if (aio->SqMap) munmap(aio->SqMap, aio->SqMapSize);
+		if (aio->RingFd >= 0) osClose(aio->RingFd);
+		aio->RingFd = -1;
+	}
+
+	// Set up an io_uring instance by hand, so that no liburing is needed. Returns false (and leaves RingFd at -1) when the kernel or a seccomp
+	// filter refuses, in which case the thread pool is used instead.
+	static bool unixAioRingOpen(UnixAio *aio)
+	{
+		struct io_uring_params p;
+		_memset(&p, 0, sizeof(p));
+		aio->RingFd = (int)syscall(__NR_io_uring_setup, UNIX_AIO_DEPTH, &p);
+		if (aio->RingFd < 0)
+			return false;
+		aio->RingEntries = p.sq_entries;
+		aio->SqMapSize = p.sq_off.array + p.sq_entries * sizeof(uint32);
+		aio->CqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			if (aio->CqMapSize > aio->SqMapSize) aio->SqMapSize = aio->CqMapSize;
+			aio->CqMapSize = aio->SqMapSize;
+		}
+		aio->SqMap = mmap(nullptr, aio->SqMapSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, aio->RingFd, IORING_OFF_SQ_RING);
+		if (aio->SqMap == MAP_FAILED) { aio->SqMap = nullptr; unixAioRingClose(aio); return false; }
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+			aio->CqMap = aio->SqMap;
+		else
+		{
+			aio->CqMap = mmap(nullptr, aio->CqMapSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, aio->RingFd, IORING_OFF_CQ_RING);
+			if (aio->CqMap == MAP_FAILED) { aio->CqMap = nullptr; unixAioRingClose(aio); return false; }
+		}
+		aio->Sqes = (struct io_uring_sqe *)mmap(nullptr, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, aio->RingFd, IORING_OFF_SQES);
+		if (aio->Sqes == MAP_FAILED) { aio->Sqes = nullptr; unixAioRingClose(aio); return false; }
+		uint8 *sq = (uint8 *)aio->SqMap;
+		aio->SqHead = (uint32 *)(sq + p.sq_off.head);
+		aio->SqTail = (uint32 *)(sq + p.sq_off.tail);
+		aio->SqMask = (uint32 *)(sq + p.sq_off.ring_mask);
+		aio->SqArray = (uint32 *)(sq + p.sq_off.array);
+		uint8 *cq = (uint8 *)aio->CqMap;
+		aio->CqHead = (uint32 *)(cq + p.cq_off.head);
+		aio->CqTail = (uint32 *)(cq + p.cq_off.tail);
+		aio->CqMask = (uint32 *)(cq + p.cq_off.ring_mask);
+		aio->Cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+		return true;
+	}
+
+	// Queue op on the submission ring. The kernel only sees it on the next io_uring_enter() made by unixAioRingReap().
+	static void unixAioRingSubmit(UnixAio *aio, UnixAioOp *op)
+	{
+		uint32 tail = *aio->SqTail;
+		uint32 index = tail & *aio->SqMask;
+		struct io_uring_sqe *sqe = &aio->Sqes[index];
+		_memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = (op->IsWrite ? IORING_OP_WRITE : IORING_OP_READ);
+		sqe->fd = aio->H;
+		sqe->off = (uint64)op->Offset;
+		sqe->addr = (uint64)(size_t)op->Buffer;
+		sqe->len = (uint32)op->Amount;
+		sqe->user_data = (uint64)(size_t)op;
+		aio->SqArray[index] = index;
+		__atomic_store_n(aio->SqTail, tail + 1, __ATOMIC_RELEASE);
+		aio->ToSubmit++;
+	}
+
+	// Complete the operations whose entries are on the completion ring. Returns how many there were.
+	static int unixAioRingComplete(UnixAio *aio)
+	{
+		int completed = 0;
+		uint32 head = *aio->CqHead;
+		uint32 tail = __atomic_load_n(aio->CqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++)
+		{
+			struct io_uring_cqe *cqe = &aio->Cqes[head & *aio->CqMask];
+			UnixAioOp *op = (UnixAioOp *)(size_t)cqe->user_data;
+			int errno_ = 0;
+			// A short transfer, an interrupted request or an opcode this kernel lacks (pre-5.6) is finished with plain pread()/pwrite().
+			RC rc;
+			if (cqe->res >= 0)
+				rc = unixAioFinish(op, cqe->res, &errno_);
+			else if (cqe->res == -EINTR || cqe->res == -EAGAIN || cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+				rc = unixAioFinish(op, 0, &errno_);
+			else
+			{
+				errno_ = -cqe->res;
+				rc = (!op->IsWrite ? RC::IOERR_READ : errno_ == ENOSPC ? RC::FULL : RC::IOERR_WRITE);
+			}
+			unixAioComplete(op, rc, errno_);
+			completed++;
+		}
+		__atomic_store_n(aio->CqHead, head, __ATOMIC_RELEASE);
+		return completed;
+	}
+
+	// The ring is unusable. Entries the kernel never took are run synchronously. The ones it took may still write into caller buffers, so their
+	// completions are awaited on the completion ring, which stays mapped, before the ring goes. Later operations go to the thread pool, which
+	// unixAioOpen() did not start for a file with a ring, or run synchronously if it cannot start.
+	static void unixAioRingRetire(UnixAio *aio)
+	{
+		uint32 head = __atomic_load_n(aio->SqHead, __ATOMIC_ACQUIRE);
+		for (uint32 tail = *aio->SqTail; head != tail; head++)
+		{
+			UnixAioOp *op = (UnixAioOp *)(size_t)aio->Sqes[aio->SqArray[head & *aio->SqMask]].user_data;
+			int errno_ = 0;
+			unixAioComplete(op, unixAioFinish(op, 0, &errno_), errno_);
+		}
+		aio->ToSubmit = 0;
+		while (aio->Pendings > 0)
+			if (!unixAioRingComplete(aio))
+				usleep(100); // Returning from the sleep also runs the kernel work that posts completions
+		unixAioRingClose(aio);
+		pthread_once(&_aioPool.Once, unixAioPoolStart);
+	}
+
+	// Pass queued entries to the kernel and reap completions until fewer than minPending operations remain outstanding.
+	static void unixAioRingReap(UnixAio *aio, int minPending)
+	{
+		while (aio->Pendings > minPending)
+		{
+			int submitted = (int)syscall(__NR_io_uring_enter, aio->RingFd, aio->ToSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (submitted < 0)
+			{
+				if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+				OSTRACE("AIO %-3d io_uring retired errno=%d\n", aio->H, errno);
+				unixAioRingRetire(aio);
+				return;
+			}
+			aio->ToSubmit -= submitted;
+			unixAioRingComplete(aio);
+		}
+	}
+
+#pragma endregion
+#endif
+
+	static UnixAio *unixAioOpen(UnixVFile *file)
+	{
+		if (file->Aio)
+			return file->Aio;
+		UnixAio *aio = (UnixAio *)SysEx::Alloc(sizeof(UnixAio), true);
+		if (!aio)
+			return nullptr;
+		aio->H = file->H;
+		for (int i = 0; i < UNIX_AIO_DEPTH; i++)
+		{
+			aio->Ops[i].Aio = aio;
+			aio->Ops[i].Next = aio->Free;
+			aio->Free = &aio->Ops[i];
+		}
+		pthread_mutex_init(&aio->Mutex, nullptr);
+		pthread_cond_init(&aio->Done, nullptr);
+#if HAVE_IO_URING
+		aio->RingFd = -1;
+		if (unixAioRingOpen(aio))
+		{
+			OSTRACE("AIO %-3d io_uring\n", file->H);
+			return (file->Aio = aio);
+		}
+#endif
+		pthread_once(&_aioPool.Once, unixAioPoolStart);
+		if (!_aioPool.Started)
+		{
+			pthread_cond_destroy(&aio->Done);
+			pthread_mutex_destroy(&aio->Mutex);
+			SysEx::Free(aio);
+			return nullptr;
+		}
+		OSTRACE("AIO %-3d threads\n", file->H);
+		return (file->Aio = aio);
+	}
+
+	// Block until no more than minPending operations are outstanding.
+	static void unixAioDrain(UnixAio *aio, int minPending)
+	{
+#if HAVE_IO_URING
+		if (aio->RingFd >= 0)
+		{
+			unixAioRingReap(aio, minPending);
+			return;
+		}
+#endif
+		pthread_mutex_lock(&aio->Mutex);
+		while (aio->Pendings > minPending)
+			pthread_cond_wait(&aio->Done, &aio->Mutex);
+		pthread_mutex_unlock(&aio->Mutex);
+	}
+
+	static void unixAioClose(UnixVFile *file)
+	{
+		UnixAio *aio = file->Aio;
+		if (aio)
+		{
+			unixAioDrain(aio, 0);
+#if HAVE_IO_URING
+			unixAioRingClose(aio);
+#endif
+			pthread_cond_destroy(&aio->Done);
+			pthread_mutex_destroy(&aio->Mutex);
+			SysEx::Free(aio);
+			file->Aio = nullptr;
+		}
+	}
+
+	static RC unixAioQueue(UnixVFile *file, void *buffer, int amount, int64 offset, bool isWrite)
+	{
+		UnixAio *aio = (file->DirectAlign && !unixDirectAligned(file, buffer, amount, offset) ? nullptr : unixAioOpen(file));
+		if (!aio) // No way to run the operation in the background, or it needs a bounce buffer: do it now
+			return (isWrite ? file->Write(buffer, amount, offset) : file->Read(buffer, amount, offset));
+#if HAVE_IO_URING
+		if (aio->RingFd >= 0)
+		{
+			if (!aio->Free)
+				unixAioRingReap(aio, UNIX_AIO_DEPTH - 1);
+			if (aio->RingFd >= 0)
+			{
+				UnixAioOp *op = aio->Free;
+				aio->Free = op->Next;
+				op->Buffer = buffer; op->Amount = amount; op->Offset = offset; op->IsWrite = isWrite;
+				aio->Pendings++;
+				unixAioRingSubmit(aio, op);
+				// Hand the kernel a batch once enough entries have built up, without waiting for any of them.
+				if (aio->ToSubmit >= UNIX_AIO_BATCH)
+				{
+					int submitted = (int)syscall(__NR_io_uring_enter, aio->RingFd, aio->ToSubmit, 0, 0, nullptr, 0);
+					if (submitted > 0) aio->ToSubmit -= submitted;
+				}
+				return RC::OK;
+			}
+			if (!_aioPool.Started) // The ring was retired and no worker could start
+				return (isWrite ? file->Write(buffer, amount, offset) : file->Read(buffer, amount, offset));
+		}
+#endif
+		pthread_mutex_lock(&aio->Mutex);
+		while (!aio->Free)
+			pthread_cond_wait(&aio->Done, &aio->Mutex);
+		UnixAioOp *op = aio->Free;
+		aio->Free = op->Next;
+		aio->Pendings++;
+		pthread_mutex_unlock(&aio->Mutex);
+		op->Buffer = buffer; op->Amount = amount; op->Offset = offset; op->IsWrite = isWrite;
+		op->Next = nullptr;
+		pthread_mutex_lock(&_aioPool.Mutex);
+		if (_aioPool.Tail) _aioPool.Tail->Next = op;
+		else _aioPool.Head = op;
+		_aioPool.Tail = op;
+		pthread_cond_signal(&_aioPool.Work);
+		pthread_mutex_unlock(&_aioPool.Mutex);
+		return RC::OK;
+	}
+
+	RC UnixVFile::ReadAsync(void *buffer, int amount, int64 offset)
+	{
+		_assert(offset >= 0);
+		_assert(amount > 0);
+		return unixAioQueue(this, buffer, amount, offset, false);
+	}
+
+	RC UnixVFile::WriteAsync(const void *buffer, int amount, int64 offset)
+	{
+		_assert(amount > 0);
+		return unixAioQueue(this, (void *)buffer, amount, offset, true);
+	}
+
+	RC UnixVFile::Wait()
+	{
+		UnixAio *aio = Aio;
+		if (!aio)
+			return RC::OK;
+		unixAioDrain(aio, 0);
+		RC rc = aio->ErrorRC;
+		if (rc != RC::OK)
+		{
+			LastErrno = aio->ErrorErrno;
+			aio->ErrorRC = RC::OK;
+			aio->ErrorErrno = 0;
+		}
+		return rc;
+	}
+
+#pragma endregion
+
+	// Release the memory mapped region, if any. Only legal when no page handed out by Fetch() is still referenced.
+	static void unixUnmapfile(UnixVFile *file)
+	{
+		_assert(file->FetchOuts == 0);
+		if (file->MapRegion)
+		{
+			osMunmap(file->MapRegion, (size_t)file->MapSizeActual);
+			file->MapRegion = nullptr;
+			file->MapSize = 0;
+			file->MapSizeActual = 0;
+		}
+	}
+
+	// Map the first size bytes of the file into memory, read-only. If size is negative the current size of the file is used. The mapping is clamped
+	// to MapSizeMax. A failed mmap() is not an error: mapping is switched off for this file and the pager keeps reading through Read().
+	static RC unixMapfile(UnixVFile *file, int64 size)
+	{
+		_assert(file->FetchOuts == 0);
+		if (size < 0)
+		{
+			struct stat statbuf; // Low-level file information
+			if (osFstat(file->H, &statbuf))
+			{
+				file->LastErrno = errno;
+				return RC::IOERR_FSTAT;
+			}
+			size = statbuf.st_size;
+		}
+		if (size > file->MapSizeMax)
+			size = file->MapSizeMax;
+		if (size == file->MapSize)
+			return RC::OK;
+		unixUnmapfile(file);
+		if (size > 0)
+		{
+			void *region = osMmap(nullptr, (size_t)size, PROT_READ, MAP_SHARED, file->H, 0);
+			if (region == MAP_FAILED)
+			{
+				unixLogError(RC::OK, "mmap", file->Path);
+				file->MapSizeMax = 0;
+				return RC::OK;
+			}
+			OSTRACE("MMAP %-3d %lld\n", file->H, size);
+			file->MapRegion = region;
+			file->MapSize = file->MapSizeActual = size;
+		}
+		return RC::OK;
+	}
+
+	static RC closeUnixFile(UnixVFile *file)
+	{
+		if (file->H >= 0)
+		{
+			robust_close(file, file->H, __LINE__);
+			file->H = -1;
+		}
+		OSTRACE("CLOSE %-3d\n", file->H);
+		OpenCounter(-1);
+		SysEx::Free(file->Unused);
+		file->Unused = nullptr;
+		return RC::OK;
+	}
+
+	RC UnixVFile::Close()
+	{
+		unixAioClose(this);
+		Unlock(LOCK_NO);
+		unixEnterMutex();
+		// unixFile.pInode is always valid here. Otherwise, a different close routine (e.g. nolockClose()) would be called instead.
+		_assert(Inode == nullptr || Inode->Locks > 0 || Inode->Unused == nullptr);
+		if (Inode)
+		{
+			// If there are outstanding locks, do not actually close the file just yet because that would clear those locks.  Instead, add the file
+			// descriptor to Inode->Unused list.  It will be automatically closed when the last lock is cleared.
+			if (Inode->Locks)
+				setPendingFd(this);
+			releaseInodeInfo(this);
+			Inode = nullptr;
+		}
+		unixUnmapfile(this);
+		RC rc = closeUnixFile(this);
+		unixLeaveMutex();
+		return rc;
+	}
+
+	RC UnixVFile::Read(void *buffer, int amount, int64 offset)
+	{
+		_assert(offset >= 0);
+		_assert(amount > 0);
+		if (DirectAlign && !unixDirectAligned(this, buffer, amount, offset))
+			return unixDirectIO(this, buffer, amount, offset, false);
+		int got = seekAndRead(this, offset, buffer, amount);
+		if (got == amount)
+			return RC::OK;
+		else if (got < 0)
+			return RC::IOERR_READ; // LastErrno set by seekAndRead
+		else
+		{
+			LastErrno = 0; // not a system error
+			// Unread parts of the buffer must be zero-filled
+			_memset(&((char *)buffer)[got], 0, amount - got);
+			return RC::IOERR_SHORT_READ;
+		}
+	}
+
+	RC UnixVFile::Write(const void *buffer, int amount, int64 offset)
+	{
+		_assert(amount > 0);
+		if (DirectAlign && !unixDirectAligned(this, buffer, amount, offset))
+			return unixDirectIO(this, (void *)buffer, amount, offset, true);
+		int wrote = 0;
+		while (amount > 0 && (wrote = seekAndWrite(this, offset, buffer, amount)) > 0)
+		{
+			amount -= wrote;
+			offset += wrote;
+			buffer = &((const char *)buffer)[wrote];
+		}
+		SimulateIOError((wrote = (-1), amount = 1));
+		SimulateDiskfullError((wrote = 0, amount = 1));
+		if (amount > 0)
+		{
+			if (wrote < 0 && LastErrno != ENOSPC)
+				return RC::IOERR_WRITE; // LastErrno set by seekAndWrite
+			LastErrno = 0; // not a system error
+			return RC::FULL; // Unable to write to a full disk
+		}
+		return RC::OK;
+	}
+
+	// Run a scatter/gather transfer with preadv()/pwritev(), UNIX_IOV_MAX buffers per call, restarting after a partial transfer. A read that reaches
+	// the end of the file zero-fills the rest of the buffers and returns IOERR_SHORT_READ.
+	static RC unixVectorIO(UnixVFile *file, const VFile::IOVec *vecs, int count, int64 offset, bool isWrite)
+	{
+		struct iovec iov[UNIX_IOV_MAX];
+		int next = 0; // First entry of vecs[] not yet loaded into iov[]
+		while (next < count)
+		{
+			int n;
+			for (n = 0; n < UNIX_IOV_MAX && next + n < count; n++)
+			{
+				iov[n].iov_base = vecs[next + n].Buffer;
+				iov[n].iov_len = (size_t)vecs[next + n].Amount;
+			}
+			int i = 0; // First entry of iov[] not yet complete
+			while (i < n)
+			{
+				ssize_t got = (isWrite ? osPwritev(file->H, &iov[i], n - i, (off_t)offset) : osPreadv(file->H, &iov[i], n - i, (off_t)offset));
+				OSTRACE("%s %-3d %5d %7lld\n", (isWrite ? "WRITEV" : "READV"), file->H, (int)got, offset);
+				if (got < 0)
+				{
+					if (errno == EINTR) continue;
+					file->LastErrno = errno;
+					return (!isWrite ? RC::IOERR_READ : errno == ENOSPC ? RC::FULL : RC::IOERR_WRITE);
+				}
+				if (got == 0)
+				{
+					file->LastErrno = 0; // not a system error
+					if (isWrite)
+						return RC::FULL;
+					for (; i < n; i++)
+						_memset(iov[i].iov_base, 0, iov[i].iov_len);
+					for (int j = next + n; j < count; j++)
+						_memset(vecs[j].Buffer, 0, vecs[j].Amount);
+					return RC::IOERR_SHORT_READ;
+				}
+				offset += got;
+				while (got > 0)
+				{
+					if ((size_t)got >= iov[i].iov_len)
+					{
+						got -= (ssize_t)iov[i].iov_len;
+						i++;
+					}
+					else
+					{
+						iov[i].iov_base = (void *)((char *)iov[i].iov_base + got);
+						iov[i].iov_len -= (size_t)got;
+						got = 0;
+					}
+				}
+			}
+			next += n;
+		}
+		return RC::OK;
+	}
+
+	// True if every buffer of vecs[] can go straight to a file open for direct I/O.
+	static bool unixDirectAlignedv(UnixVFile *file, const VFile::IOVec *vecs, int count, int64 offset)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (!unixDirectAligned(file, vecs[i].Buffer, vecs[i].Amount, offset))
+				return false;
+			offset += vecs[i].Amount;
+		}
+		return true;
+	}
+
+	RC UnixVFile::Readv(IOVec *vecs, int count, int64 offset)
+	{
+		_assert(offset >= 0);
+		if (!osPreadv || (DirectAlign && !unixDirectAlignedv(this, vecs, count, offset)))
+			return VFile::Readv(vecs, count, offset);
+		SimulateIOError(return RC::IOERR_READ);
+		return unixVectorIO(this, vecs, count, offset, false);
+	}
+
+	RC UnixVFile::Writev(const IOVec *vecs, int count, int64 offset)
+	{
+		if (!osPwritev || (DirectAlign && !unixDirectAlignedv(this, vecs, count, offset)))
+			return VFile::Writev(vecs, count, offset);
+		SimulateIOError(return RC::IOERR_WRITE);
+		SimulateDiskfullError(return RC::FULL);
+		return unixVectorIO(this, vecs, count, offset, true);
+	}
+
+	RC UnixVFile::Truncate(int64 size)
+	{
+		SimulateIOError(return RC::IOERR_TRUNCATE);
+		// Queued writes must land before the file is cut, or they would extend it again.
+		RC rc = Wait();
+		if (rc != RC::OK)
+			return rc;
+		// If the user has configured a chunk-size for this file, truncate the file so that it consists of an integer number of chunks (i.e. the
+		// actual file size after the operation may be larger than the requested size).
+		if (SizeChunk > 0)
+			size = ((size+SizeChunk-1)/SizeChunk)*SizeChunk;
+		OSTRACE("TRUNCATE %d %lld\n", H, size);
+		if (robust_ftruncate(H, size))
+		{
+			LastErrno = errno;
+			return unixLogError(RC::IOERR_TRUNCATE, "ftruncate", Path);
+		}
+		// Bytes past the new end of file must never be handed out by Fetch(), so shrink the usable part of the mapping. Touching them would raise SIGBUS.
+		if (size < MapSize)
+			MapSize = size;
+		return RC::OK;
+	}
+
+	// Open a file descriptor to the directory containing file path. Directories are opened read-only and only so they can be fsync()ed after a journal
+	// is created, making the new directory entry durable.
+	static RC openDirectory(const char *path, int *fdOut)
+	{
+		char dirName[MAX_PATHNAME+1];
+		snprintf(dirName, MAX_PATHNAME, "%s", path);
+		int ii;
+		for (ii = (int)strlen(dirName); ii > 1 && dirName[ii] != '/'; ii--) { }
+		if (ii > 0)
+			dirName[ii] = '\0';
+		else
+		{
+			if (dirName[0] != '/') dirName[0] = '.';
+			dirName[1] = 0;
+		}
+		int fd = robust_open(dirName, O_RDONLY|O_BINARY, 0);
+		if (fd >= 0)
+			OSTRACE("OPENDIR %-3d %s\n", fd, dirName);
+		*fdOut = fd;
+		return (fd >= 0 ? RC::OK : unixLogError(SysEx_CANTOPEN_BKPT, "open", dirName));
+	}
+
+	static int full_fsync(int fd, bool fullSync, bool dataOnly)
+	{
+#ifdef NO_SYNC // If we compiled with the NO_SYNC flag, then syncing is a no-op
+		return 0;
+#elif defined(F_FULLFSYNC)
+		// fsync() on OS-X only reaches the drive cache; F_FULLFSYNC is required to reach the platter.
+		int rc = (fullSync ? osFcntl(fd, F_FULLFSYNC, 0) : 1);
+		if (rc) rc = osFsync(fd);
+		return rc;
+#else
+		return (dataOnly ? osFdatasync(fd) : osFsync(fd));
+#endif
+	}
+
+#ifdef TEST
+	// Count the number of fullsyncs and normal syncs.  This is used to test that syncs and fullsyncs are occuring at the right times.
+	int sync_count = 0;
+	int fullsync_count = 0;
+#endif
+
+	RC UnixVFile::Sync(int flags)
+	{
+		bool isDataOnly = (flags & SYNC_DATAONLY);
+		bool isFullsync = ((flags&0x0F) == SYNC_FULL);
+		// Check that one of SQLITE_SYNC_NORMAL or FULL was passed
+		_assert((flags&0x0F) == SYNC_NORMAL || (flags&0x0F) == SYNC_FULL);
+		OSTRACE("SYNC %-3d\n", H);
+		// A sync point: everything queued with WriteAsync() has to be on the file before it is flushed.
+		RC waitRC = Wait();
+		if (waitRC != RC::OK)
+			return waitRC;
+		// Unix cannot, but some systems may return SQLITE_FULL from here. This line is to test that doing so does not cause any problems.
+		SimulateDiskfullError(return RC::FULL);
+#ifdef TEST
+		if (isFullsync)
+			fullsync_count++;
+		sync_count++;
+#endif
+		int rc = full_fsync(H, isFullsync, isDataOnly);
+		SimulateIOError(rc = 1);
+		if (rc)
+		{
+			LastErrno = errno;
+			return unixLogError(RC::IOERR_FSYNC, "full_fsync", Path);
+		}
+		// Also fsync the directory containing the file if the DIRSYNC flag is set. This is a one-time occurrence.  Many systems (examples: AIX)
+		// are unable to fsync a directory, so ignore errors on the fsync.
+		if (CtrlFlags & UNIXFILE_DIRSYNC)
+		{
+			int dirfd;
+			OSTRACE("DIRSYNC %s (fullsync=%d)\n", Path, isFullsync);
+			if (openDirectory(Path, &dirfd) == RC::OK && dirfd >= 0)
+			{
+				full_fsync(dirfd, false, false);
+				robust_close(this, dirfd, __LINE__);
+			}
+			CtrlFlags &= ~UNIXFILE_DIRSYNC;
+		}
+		return RC::OK;
+	}
+
+	RC UnixVFile::get_FileSize(int64 &size)
+	{
+		SimulateIOError(return RC::IOERR_FSTAT);
+		struct stat buf;
+		if (osFstat(H, &buf) != 0)
+		{
+			LastErrno = errno;
+			return RC::IOERR_FSTAT;
+		}
+		size = buf.st_size;
+		return RC::OK;
+	}
+
+	// Set a posix advisory lock, or clear it when lock->l_type is F_UNLCK. F_SETLK is used rather than F_SETLKW: the pager does its own retrying through the busy handler.
+	static int unixFileLock(UnixVFile *file, struct flock *lock)
+	{
+		_assert(unixMutexHeld());
+		return osFcntl(file->H, F_SETLK, lock);
+	}
+
+	RC UnixVFile::Lock(LOCK lock)
+	{
+		// The following describes the implementation of the various locks and lock transitions in terms of the POSIX advisory shared and exclusive lock primitives.
+		//    SHARED    -> a read-lock on the entire SHARED range, taken while a temporary read-lock on PENDING is held
+		//    RESERVED  -> a write-lock on the RESERVED byte
+		//    PENDING   -> a write-lock on the PENDING byte
+		//    EXCLUSIVE -> a write-lock on the entire SHARED range
+		// Locks are tracked per-inode in UnixInodeInfo so that several connections in one process share a single set of OS locks.
+		OSTRACE("LOCK %d %d was %d(%d,%d) pid=%d\n", H, lock, Lock_, (Inode ? Inode->Lock_ : 0), (Inode ? Inode->Shareds : 0), getpid());
+
+		// If there is already a lock of this type or more restrictive on the unixFile, do nothing.
+		if (Lock_ >= lock)
+			return RC::OK;
+		if (CtrlFlags & UNIXFILE_NOLOCK)
+		{
+			Lock_ = lock;
+			return RC::OK;
+		}
+
+		// Make sure the locking sequence is correct.
+		//  (1) We never move from unlocked to anything higher than shared lock.
+		//  (2) SQLite never explicitly requests a pendig lock.
+		//  (3) A shared lock is always held when a reserve lock is requested.
+		_assert(Lock_ != LOCK_NO || lock == LOCK_SHARED);
+		_assert(lock != LOCK_PENDING);
+		_assert(lock != LOCK_RESERVED || Lock_ == LOCK_SHARED);
+
+		// This mutex is needed because Inode is shared across threads
+		RC rc = RC::OK;
+		int tErrno = 0;
+		unixEnterMutex();
+		UnixInodeInfo *inode = Inode;
+		struct flock lock_;
+
+		// If some thread using this PID has a lock via a different UnixVFile handle that precludes the requested lock, return BUSY.
+		if (Lock_ != inode->Lock_ && (inode->Lock_ >= LOCK_PENDING || lock > LOCK_SHARED))
+		{
+			rc = RC::BUSY;
+			goto end_lock;
+		}
+
+		// If a SHARED lock is requested, and some thread using this PID already has a SHARED or RESERVED lock, then increment reference counts and return OK.
+		if (lock == LOCK_SHARED && (inode->Lock_ == LOCK_SHARED || inode->Lock_ == LOCK_RESERVED))
+		{
+			_assert(lock == LOCK_SHARED);
+			_assert(Lock_ == LOCK_NO);
+			_assert(inode->Shareds > 0);
+			Lock_ = LOCK_SHARED;
+			inode->Shareds++;
+			inode->Locks++;
+			goto end_lock;
+		}
+
+		// A PENDING lock is needed before acquiring a SHARED lock and before acquiring an EXCLUSIVE lock.  For the SHARED lock, the PENDING will be released.
+		lock_.l_len = 1L;
+		lock_.l_whence = SEEK_SET;
+		if (lock == LOCK_SHARED || (lock == LOCK_EXCLUSIVE && Lock_ < LOCK_PENDING))
+		{
+			lock_.l_type = (lock == LOCK_SHARED ? F_RDLCK : F_WRLCK);
+			lock_.l_start = PENDING_BYTE;
+			if (unixFileLock(this, &lock_))
+			{
+				tErrno = errno;
+				rc = errorFromPosixError(tErrno, RC::IOERR_LOCK);
+				if (rc != RC::BUSY)
+					LastErrno = tErrno;
+				goto end_lock;
+			}
+		}
+
+		// If control gets to this point, then actually go ahead and make operating system calls for the specified lock.
+		if (lock == LOCK_SHARED)
+		{
+			_assert(inode->Shareds == 0);
+			_assert(inode->Lock_ == LOCK_NO);
+			_assert(rc == RC::OK);
+
+			// Now get the read-lock
+			lock_.l_start = SHARED_FIRST;
+			lock_.l_len = SHARED_SIZE;
+			if (unixFileLock(this, &lock_))
+			{
+				tErrno = errno;
+				rc = errorFromPosixError(tErrno, RC::IOERR_LOCK);
+			}
+
+			// Drop the temporary PENDING lock
+			lock_.l_start = PENDING_BYTE;
+			lock_.l_len = 1L;
+			lock_.l_type = F_UNLCK;
+			if (unixFileLock(this, &lock_) && rc == RC::OK)
+			{
+				// This could happen with a network mount
+				tErrno = errno;
+				rc = RC::IOERR_UNLOCK;
+			}
+
+			if (rc != RC::OK)
+			{
+				if (rc != RC::BUSY)
+					LastErrno = tErrno;
+				goto end_lock;
+			}
+			Lock_ = LOCK_SHARED;
+			inode->Locks++;
+			inode->Shareds = 1;
+		}
+		else if (lock == LOCK_EXCLUSIVE && inode->Shareds > 1)
+			// We are trying for an exclusive lock but another thread in this same process is still holding a shared lock.
+			rc = RC::BUSY;
+		else
+		{
+			// The request was for a RESERVED or EXCLUSIVE lock.  It is assumed that there is a SHARED or greater lock on the file already.
+			_assert(Lock_ != LOCK_NO);
+			lock_.l_type = F_WRLCK;
+			_assert(lock == LOCK_RESERVED || lock == LOCK_EXCLUSIVE);
+			if (lock == LOCK_RESERVED)
+			{
+				lock_.l_start = RESERVED_BYTE;
+				lock_.l_len = 1L;
+			}
+			else
+			{
+				lock_.l_start = SHARED_FIRST;
+				lock_.l_len = SHARED_SIZE;
+			}
+			if (unixFileLock(this, &lock_))
+			{
+				tErrno = errno;
+				rc = errorFromPosixError(tErrno, RC::IOERR_LOCK);
+				if (rc != RC::BUSY)
+					LastErrno = tErrno;
+			}
+		}
+
+		if (rc == RC::OK)
+		{
+			Lock_ = lock;
+			inode->Lock_ = lock;
+		}
+		else if (lock == LOCK_EXCLUSIVE)
+		{
+			Lock_ = LOCK_PENDING;
+			inode->Lock_ = LOCK_PENDING;
+		}
+
+end_lock:
+		unixLeaveMutex();
+		OSTRACE("LOCK %d %d %s\n", H, lock, (rc == RC::OK ? "ok" : "failed"));
+		return rc;
+	}
+
+	RC UnixVFile::CheckReservedLock(int &lock)
+	{
+		SimulateIOError(return RC::IOERR_CHECKRESERVEDLOCK;);
+		if (CtrlFlags & UNIXFILE_NOLOCK)
+		{
+			lock = 0;
+			return RC::OK;
+		}
+		RC rc = RC::OK;
+		int reserved = 0;
+		unixEnterMutex();
+		// Check if a thread in this process holds such a lock
+		if (Inode->Lock_ > LOCK_SHARED)
+			reserved = 1;
+		// Otherwise see if some other process holds it.
+		if (!reserved)
+		{
+			struct flock lock_;
+			lock_.l_whence = SEEK_SET;
+			lock_.l_start = RESERVED_BYTE;
+			lock_.l_len = 1;
+			lock_.l_type = F_WRLCK;
+			if (osFcntl(H, F_GETLK, &lock_))
+			{
+				rc = RC::IOERR_CHECKRESERVEDLOCK;
+				LastErrno = errno;
+			}
+			else if (lock_.l_type != F_UNLCK)
+				reserved = 1;
+		}
+		unixLeaveMutex();
+		OSTRACE("TEST WR-LOCK %d %d\n", H, reserved);
+		lock = reserved;
+		return rc;
+	}
+
+	RC UnixVFile::Unlock(LOCK lock)
+	{
+		_assert(lock <= LOCK_SHARED);
+		OSTRACE("UNLOCK %d %d was %d(%d,%d) pid=%d\n", H, lock, Lock_, (Inode ? Inode->Lock_ : 0), (Inode ? Inode->Shareds : 0), getpid());
+		if (Lock_ <= lock)
+			return RC::OK;
+		if (CtrlFlags & UNIXFILE_NOLOCK)
+		{
+			Lock_ = lock;
+			return RC::OK;
+		}
+		RC rc = RC::OK;
+		unixEnterMutex();
+		UnixInodeInfo *inode = Inode;
+		_assert(inode->Shareds != 0);
+		struct flock lock_;
+		if (Lock_ > LOCK_SHARED)
+		{
+			_assert(inode->Lock_ == Lock_);
+			// Downgrade to a read-lock on the SHARED range, then drop PENDING and RESERVED together.
+			if (lock == LOCK_SHARED)
+			{
+				lock_.l_type = F_RDLCK;
+				lock_.l_whence = SEEK_SET;
+				lock_.l_start = SHARED_FIRST;
+				lock_.l_len = SHARED_SIZE;
+				if (unixFileLock(this, &lock_))
+				{
+					// In theory, the call to unixFileLock() cannot fail because another process is holding an incompatible lock. If it does, this
+					// indicates that the other process is not following the locking protocol. If this happens, return IOERR_RDLOCK.
+					LastErrno = errno;
+					rc = RC::IOERR_RDLOCK;
+					goto end_unlock;
+				}
+			}
+			lock_.l_type = F_UNLCK;
+			lock_.l_whence = SEEK_SET;
+			lock_.l_start = PENDING_BYTE;
+			lock_.l_len = 2L; _assert(PENDING_BYTE+1 == RESERVED_BYTE);
+			if (unixFileLock(this, &lock_) == 0)
+				inode->Lock_ = LOCK_SHARED;
+			else
+			{
+				LastErrno = errno;
+				rc = RC::IOERR_UNLOCK;
+				goto end_unlock;
+			}
+		}
+		if (lock == LOCK_NO)
+		{
+			// Decrement the shared lock counter.  Release the lock using an OS call only when all threads in this same process have released the lock.
+			inode->Shareds--;
+			if (inode->Shareds == 0)
+			{
+				lock_.l_type = F_UNLCK;
+				lock_.l_whence = SEEK_SET;
+				lock_.l_start = lock_.l_len = 0L;
+				if (unixFileLock(this, &lock_) == 0)
+					inode->Lock_ = LOCK_NO;
+				else
+				{
+					LastErrno = errno;
+					rc = RC::IOERR_UNLOCK;
+					inode->Lock_ = LOCK_NO;
+					Lock_ = LOCK_NO;
+				}
+			}
+			// Decrement the count of locks against this same file.  When the count reaches zero, close any other file descriptors whose close was deferred because of outstanding locks.
+			inode->Locks--;
+			_assert(inode->Locks >= 0);
+			if (inode->Locks == 0)
+				closePendingFds(this);
+		}
+
+end_unlock:
+		unixLeaveMutex();
+		if (rc == RC::OK)
+			Lock_ = lock;
+		return rc;
+	}
+
+	// This function is called to handle the FCNTL_SIZE_HINT file-control operation. If the file is configured with a chunk size it is grown to the
+	// next multiple of the chunk size that covers bytes, so later writes do not each have to extend the file.
+	static RC fcntlSizeHint(UnixVFile *file, int64 bytes)
+	{
+		if (file->SizeChunk > 0)
+		{
+			struct stat buf; // Used to hold return values of fstat()
+			if (osFstat(file->H, &buf))
+				return RC::IOERR_FSTAT;
+			int64 size = ((bytes+file->SizeChunk-1) / file->SizeChunk) * file->SizeChunk; // Required file size
+			if (size > (int64)buf.st_size)
+			{
+				if (osFallocate)
+				{
+					int err;
+					do { err = osFallocate(file->H, buf.st_size, (off_t)(size - buf.st_size)); } while (err == EINTR);
+					if (err)
+						return RC::IOERR_WRITE;
+				}
+				else
+				{
+					// If the OS does not have posix_fallocate(), fake it. First use ftruncate() to set the file size, then write a single byte to the last byte in each block within the extended region. This
+					// is the same technique used by glibc to implement posix_fallocate() on systems that do not have a real fallocate() system call.
+					int blockSize = (int)buf.st_blksize; // File-system block size
+					if (robust_ftruncate(file->H, size))
+					{
+						file->LastErrno = errno;
+						return unixLogError(RC::IOERR_TRUNCATE, "ftruncate", file->Path);
+					}
+					int64 offset = ((buf.st_size/blockSize)+1)*blockSize;
+					for (; offset < size; offset += blockSize)
+						if (seekAndWrite(file, offset-1, "", 1) != 1)
+							return RC::IOERR_WRITE;
+				}
+			}
+		}
+		return RC::OK;
+	}
+
+	static void unixModeBit(UnixVFile *file, uint8 mask, int *arg)
+	{
+		if (*arg < 0)
+			*arg = ((file->CtrlFlags & mask) != 0);
+		else if ((*arg) == 0)
+			file->CtrlFlags &= ~mask;
+		else
+			file->CtrlFlags |= mask;
+	}
+
+	static RC getTempname(int bufLength, char *buf);
+	RC UnixVFile::FileControl(FCNTL op, void *arg)
+	{
+		char *tfile;
+		switch (op)
+		{
+		case FCNTL_LOCKSTATE:
+			*(int*)arg = Lock_;
+			return RC::OK;
+		case FCNTL_LAST_ERRNO:
+			*(int*)arg = LastErrno;
+			return RC::OK;
+		case FCNTL_CHUNK_SIZE:
+			SizeChunk = *(int *)arg;
+			return RC::OK;
+		case FCNTL_SIZE_HINT: {
+			SimulateIOErrorBenign(true);
+			RC rc = fcntlSizeHint(this, *(int64 *)arg);
+			SimulateIOErrorBenign(false);
+			return rc; }
+		case FCNTL_PERSIST_WAL:
+			unixModeBit(this, (uint8)UNIXFILE_PERSIST_WAL, (int*)arg);
+			return RC::OK;
+		case FCNTL_POWERSAFE_OVERWRITE:
+			unixModeBit(this, (uint8)UNIXFILE_PSOW, (int*)arg);
+			return RC::OK;
+		case FCNTL_VFSNAME:
+			*(const char**)arg = Vfs->Name;
+			return RC::OK;
+		case FCNTL_MMAP_SIZE: {
+			// Set the upper bound on the mapping, then report the bound actually in effect. A negative argument only queries it.
+			int64 newLimit = *(int64 *)arg;
+			if (newLimit > MAX_MMAP_SIZE)
+				newLimit = MAX_MMAP_SIZE;
+			if (newLimit > 0 && DirectAlign)
+				newLimit = 0; // A mapping would be filled through the OS cache that direct I/O is there to avoid
+			if (newLimit >= 0)
+			{
+				MapSizeMax = newLimit;
+				if (FetchOuts == 0)
+					unixUnmapfile(this);
+			}
+			*(int64 *)arg = MapSizeMax;
+			return RC::OK; }
+		case FCNTL_PREFETCH: {
+			// arg is an int64[2] of offset and length that the caller expects to read soon. A range inside the mapping is advised on the mapping, as
+			// those pages are faulted in rather than read; anything else goes to the page cache. Both are hints only, so their errors are dropped.
+			int64 offset = ((int64 *)arg)[0];
+			int64 amount = ((int64 *)arg)[1];
+			if (amount <= 0)
+				return RC::OK;
+			if (MapRegion && offset + amount <= MapSize)
+			{
+				int64 pageSize = (int64)sysconf(_SC_PAGESIZE);
+				int64 start = offset & ~(pageSize - 1);
+				osMadvise(&((uint8 *)MapRegion)[start], (size_t)(offset + amount - start), POSIX_MADV_WILLNEED);
+			}
+#if HAVE_POSIX_FADVISE
+			else if (osFadvise)
+				osFadvise(H, (off_t)offset, (off_t)amount, POSIX_FADV_WILLNEED);
+#endif
+			return RC::OK; }
+		case FCNTL_PUNCH_HOLE: {
+			// arg is an int64[2] of offset and length to read back as zeros without taking space. NOTFOUND where the OS or file system cannot.
+			if (!osPunchHole || osPunchHole(H, (off_t)((int64 *)arg)[0], (off_t)((int64 *)arg)[1]) != 0)
+				return RC::NOTFOUND;
+			return RC::OK; }
+		case FCNTL_TEMPFILENAME:
+			tfile = (char *)SysEx::Alloc(Vfs->MaxPathname, true);
+			if (tfile)
+			{
+				getTempname(Vfs->MaxPathname, tfile);
+				*(char**)arg = tfile;
+			}
+			return RC::OK;
+		}
+		return RC::NOTFOUND;
+	}
+
+	uint UnixVFile::get_SectorSize()
+	{
+		return DEFAULT_SECTOR_SIZE;
+	}
+
+	VFile::IOCAP UnixVFile::get_DeviceCharacteristics()
+	{
+		return (VFile::IOCAP)((CtrlFlags & UNIXFILE_PSOW) ? VFile::IOCAP_POWERSAFE_OVERWRITE : 0);
+	}
+
+	// If the amount bytes at offset lie inside the memory mapped region, set *pp to point straight at them, otherwise set *pp to nullptr. The mapping
+	// is (re)built lazily, and only while no fetched page is outstanding, so it can never move underneath a caller; a file that has grown past the
+	// mapping simply falls back to Read() until every fetched page has been returned through Unfetch().
+	RC UnixVFile::Fetch(int64 offset, int amount, void **pp)
+	{
+		*pp = nullptr;
+		if (MapSizeMax > 0)
+		{
+			if (FetchOuts == 0 && MapSize < offset + amount)
+			{
+				RC rc = unixMapfile(this, -1);
+				if (rc != RC::OK) return rc;
+			}
+			if (MapSize >= offset + amount)
+			{
+				*pp = &((uint8 *)MapRegion)[offset];
+				FetchOuts++;
+			}
+		}
+		return RC::OK;
+	}
+
+	// Return a pointer obtained from Fetch(). A nullptr p instead asks for the mapping to be discarded so the next Fetch() maps the file afresh,
+	// which the pager does whenever another connection may have changed the size of the file.
+	RC UnixVFile::Unfetch(int64 offset, void *p)
+	{
+		_assert(p != nullptr || FetchOuts == 0);
+		_assert(p == nullptr || p == &((uint8 *)MapRegion)[offset]);
+		if (p)
+			FetchOuts--;
+		else
+			unixUnmapfile(this);
+		_assert(FetchOuts >= 0);
+		return RC::OK;
+	}
+
+#pragma endregion
+
+#pragma region UnixVSystem
+
+	// Return the name of a directory in which to put temporary files. If no suitable temporary file directory can be found, return NULL.
+	static const char *unixTempFileDir()
+	{
+		static const char *dirs[] = { 0, 0, "/var/tmp", "/usr/tmp", "/tmp", 0 };
+		if (!dirs[0]) dirs[0] = getenv("SQLITE_TMPDIR");
+		if (!dirs[1]) dirs[1] = getenv("TMPDIR");
+		const char *dir = nullptr;
+		struct stat buf;
+		for (int i = 0; i < __arrayStaticLength(dirs); dir = dirs[i++])
+		{
+			if (dir == nullptr) continue;
+			if (osStat(dir, &buf)) continue;
+			if (!S_ISDIR(buf.st_mode)) continue;
+			if (osAccess(dir, 07)) continue;
+			break;
+		}
+		return (dir ? dir : ".");
+	}
+
+	static RC getTempname(int bufLength, char *buf)
+	{
+		static const unsigned char chars[] =
+			"abcdefghijklmnopqrstuvwxyz"
+			"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"0123456789";
+		// It's odd to simulate an io-error here, but really this is just using the io-error infrastructure to test that SQLite handles this function failing.
+		SimulateIOError(return RC::IOERR);
+		const char *dir = unixTempFileDir();
+		// Check that the output buffer is large enough for the temporary file name. If it is not, return SQLITE_ERROR.
+		if ((strlen(dir) + strlen(TEMP_FILE_PREFIX) + 18) >= (size_t)bufLength)
+			return RC::ERROR;
+		do
+		{
+			snprintf(buf, bufLength-18, "%s/" TEMP_FILE_PREFIX, dir);
+			int j = (int)strlen(buf);
+			SysEx::PutRandom(15, &buf[j]);
+			for (int i = 0; i < 15; i++, j++)
+				buf[j] = (char)chars[((unsigned char)buf[j])%(sizeof(chars)-1)];
+			buf[j] = 0;
+			buf[j+1] = 0;
+		} while (osAccess(buf, 0) == 0);
+		OSTRACE("TEMP FILENAME: %s\n", buf);
+		return RC::OK;
+	}
+
+	// Journals and WAL files are created with the same permissions as the database they belong to, so that a process that can open the database can
+	// also recover it. Temporary files that are deleted on close are private (0600).
+	static RC findCreateFileMode(const char *path, int flags, mode_t *modeOut)
+	{
+		*modeOut = 0;
+		if (flags & (VSystem::OPEN_WAL|VSystem::OPEN_MAIN_JOURNAL))
+		{
+			char db[MAX_PATHNAME+1]; // Database file path
+			// The database name is the journal or WAL name with its "-suffix" removed.
+			int dbLength = (int)strlen(path) - 1;
+			while (dbLength > 0 && path[dbLength] != '-')
+				dbLength--;
+			if (dbLength == 0 || dbLength > MAX_PATHNAME) return RC::OK;
+			_memcpy(db, path, dbLength);
+			db[dbLength] = '\0';
+			struct stat dbStat;
+			if (osStat(db, &dbStat) == 0)
+				*modeOut = (dbStat.st_mode & 0777);
+			else
+				return RC::IOERR_FSTAT;
+		}
+		else if (flags & VSystem::OPEN_DELETEONCLOSE)
+			*modeOut = 0600;
+		return RC::OK;
+	}
+
+	VFile *UnixVSystem::_AttachFile(void *buffer)
+	{
+		return new (buffer) UnixVFile();
+	}
+
+	RC UnixVSystem::Open(const char *name, VFile *id, OPEN flags, OPEN *outFlags)
+	{
+		// 0x87f7f is a mask of SQLITE_OPEN_ flags that are valid to be passed down into the VFS layer.  Some SQLITE_OPEN_ flags (for example,
+		// SQLITE_OPEN_FULLMUTEX or SQLITE_OPEN_SHAREDCACHE) are blocked before reaching the VFS. OPEN_DIRECT is kept apart from the file type.
+		OPEN direct = (OPEN)(flags & OPEN_DIRECT);
+		flags = (OPEN)((uint)flags & 0x87f7f);
+
+		RC rc = RC::OK;
+		OPEN type = (OPEN)(flags & 0xFFFFFF00);  // Type of file to open
+		bool isExclusive = (flags & OPEN_EXCLUSIVE);
+		bool isDelete = (flags & OPEN_DELETEONCLOSE);
+		bool isCreate = (flags & OPEN_CREATE);
+		bool isReadonly = (flags & OPEN_READONLY);
+		bool isReadWrite = (flags & OPEN_READWRITE);
+		bool isNewJournal = (isCreate && (type == OPEN_MASTER_JOURNAL || type == OPEN_MAIN_JOURNAL || type == OPEN_WAL));
+
+		// Check the following statements are true:
+		//
+		//   (a) Exactly one of the READWRITE and READONLY flags must be set, and
+		//   (b) if CREATE is set, then READWRITE must also be set, and
+		//   (c) if EXCLUSIVE is set, then CREATE must also be set.
+		//   (d) if DELETEONCLOSE is set, then CREATE must also be set.
+		_assert((!isReadonly || !isReadWrite) && (isReadWrite || isReadonly));
+		_assert(!isCreate || isReadWrite);
+		_assert(!isExclusive || isCreate);
+		_assert(!isDelete || isCreate);
+
+		// The main DB, main journal, WAL file and master journal are never automatically deleted. Nor are they ever temporary files.
+		_assert((!isDelete && name) || type != OPEN_MAIN_DB);
+		_assert((!isDelete && name) || type != OPEN_MAIN_JOURNAL);
+		_assert((!isDelete && name) || type != OPEN_MASTER_JOURNAL);
+		_assert((!isDelete && name) || type != OPEN_WAL);
+
+		// Assert that the upper layer has set one of the "file-type" flags.
+		_assert(type == OPEN_MAIN_DB || type == OPEN_TEMP_DB ||
+			type == OPEN_MAIN_JOURNAL || type == OPEN_TEMP_JOURNAL ||
+			type == OPEN_SUBJOURNAL || type == OPEN_MASTER_JOURNAL ||
+			type == OPEN_TRANSIENT_DB || type == OPEN_WAL);
+
+		UnixVFile *file = (UnixVFile *)id;
+		_assert(file != nullptr);
+		_memset(file, 0, sizeof(UnixVFile));
+		file = new (file) UnixVFile();
+		file->H = -1;
+
+		// Only the main database holds locks, so only it needs a UnixUnusedFd to defer its close() while other connections in this process hold locks on the same inode.
+		UnixUnusedFd *unused = nullptr;
+		if (type == OPEN_MAIN_DB)
+		{
+			unused = (UnixUnusedFd *)SysEx::Alloc(sizeof(UnixUnusedFd), true);
+			if (!unused)
+				return RC::NOMEM;
+		}
+
+		// If the second argument to this function is NULL, generate a temporary file name to use
+		const char *path = name;
+		char tmpname[MAX_PATHNAME+2];
+		if (!path)
+		{
+			_assert(isDelete && !isNewJournal);
+			rc = getTempname(MAX_PATHNAME+2, tmpname);
+			if (rc != RC::OK)
+			{
+				SysEx::Free(unused);
+				return rc;
+			}
+			path = tmpname;
+		}
+
+		// Determine the value of the flags parameter passed to POSIX function open(). These must be calculated even if open() is not called, as
+		// they may be stored as part of the file handle and used by the 'conch file' locking functions later on.
+		int openFlags = 0;
+		if (isReadonly) openFlags |= O_RDONLY;
+		if (isReadWrite) openFlags |= O_RDWR;
+		if (isCreate) openFlags |= O_CREAT;
+		if (isExclusive) openFlags |= (O_EXCL|O_NOFOLLOW);
+		openFlags |= (O_LARGEFILE|O_BINARY);
+#ifdef O_DIRECT
+		// Direct I/O applies to the database and WAL files only; journals are written once and read back only by a rollback.
+		if (direct && (type == OPEN_MAIN_DB || type == OPEN_WAL))
+			openFlags |= O_DIRECT;
+#endif
+
+		mode_t openMode; // Permissions to create file with
+		rc = findCreateFileMode(path, flags, &openMode);
+		if (rc != RC::OK)
+		{
+			_assert(!unused);
+			_assert(type == OPEN_WAL || type == OPEN_MAIN_JOURNAL);
+			return rc;
+		}
+		int fd = robust_open(path, openFlags, openMode);
+		OSTRACE("OPENX %-3d %s 0%o\n", fd, path, openFlags);
+#ifdef O_DIRECT
+		if (fd < 0 && errno == EINVAL && (openFlags & O_DIRECT))
+		{
+			// The file system does not do direct I/O. Use the OS cache as usual.
+			openFlags &= ~O_DIRECT;
+			fd = robust_open(path, openFlags, openMode);
+		}
+#endif
+		if (fd < 0 && errno != EISDIR && isReadWrite && !isExclusive)
+		{
+			// Failed to open the file for read/write access. Try read-only.
+			flags = (OPEN)((flags & ~(OPEN_READWRITE|OPEN_CREATE)) | OPEN_READONLY);
+			openFlags &= ~(O_RDWR|O_CREAT);
+			openFlags |= O_RDONLY;
+			isReadonly = true;
+			fd = robust_open(path, openFlags, openMode);
+		}
+		if (fd < 0)
+		{
+			rc = unixLogError(SysEx_CANTOPEN_BKPT, "open", path);
+			SysEx::Free(unused);
+			return rc;
+		}
+#ifdef O_DIRECT
+		if (openFlags & O_DIRECT)
+			flags = (OPEN)(flags | OPEN_DIRECT);
+#endif
+		if (outFlags)
+			*outFlags = flags;
+		if (unused)
+		{
+			unused->FD = fd;
+			unused->Flags = flags;
+			file->Unused = unused;
+		}
+		// Unlink a delete-on-close file straight away: the inode lives on until the last descriptor is closed.
+		if (isDelete)
+			osUnlink(path);
+
+		uint8 ctrlFlags = 0;
+		if (isDelete) ctrlFlags |= UnixVFile::UNIXFILE_DELETE;
+		if (isReadonly) ctrlFlags |= UnixVFile::UNIXFILE_RDONLY;
+		if (POWERSAFE_OVERWRITE) ctrlFlags |= UnixVFile::UNIXFILE_PSOW;
+		if (type != OPEN_MAIN_DB) ctrlFlags |= UnixVFile::UNIXFILE_NOLOCK;
+		if (isNewJournal) ctrlFlags |= UnixVFile::UNIXFILE_DIRSYNC;
+
+		file->Opened = true;
+		file->Vfs = this;
+		file->H = fd;
+		file->CtrlFlags = ctrlFlags;
+		file->LastErrno = 0;
+		file->Path = name;
+		if (flags & OPEN_DIRECT)
+		{
+			// Transfers are aligned to the file system's block size, which is never finer than the device's logical block.
+			struct stat buf;
+			file->DirectAlign = (osFstat(fd, &buf) == 0 && buf.st_blksize >= 512 && buf.st_blksize <= 65536 && (buf.st_blksize & (buf.st_blksize - 1)) == 0 ? (int)buf.st_blksize : 4096);
+		}
+		if ((ctrlFlags & UnixVFile::UNIXFILE_NOLOCK) == 0)
+		{
+			unixEnterMutex();
+			rc = findInodeInfo(file, &file->Inode);
+			unixLeaveMutex();
+			if (rc != RC::OK)
+			{
+				robust_close(file, fd, __LINE__);
+				file->H = -1;
+				SysEx::Free(file->Unused);
+				file->Unused = nullptr;
+				file->Opened = false;
+				return rc;
+			}
+		}
+		OpenCounter(+1);
+		return rc;
+	}
+
+	RC UnixVSystem::Delete(const char *filename, bool syncDir)
+	{
+		SimulateIOError(return RC::IOERR_DELETE);
+		if (osUnlink(filename) == -1)
+		{
+			RC rc = (errno == ENOENT ? RC::IOERR_DELETE_NOENT : unixLogError(RC::IOERR_DELETE, "unlink", filename));
+			OSTRACE("DELETE \"%s\" failed\n", filename);
+			return rc;
+		}
+		RC rc = RC::OK;
+#ifndef DISABLE_DIRSYNC
+		if (syncDir)
+		{
+			int fd;
+			rc = openDirectory(filename, &fd);
+			if (rc == RC::OK)
+			{
+				if (full_fsync(fd, false, false))
+					rc = unixLogError(RC::IOERR_DIR_FSYNC, "fsync", filename);
+				robust_close(nullptr, fd, __LINE__);
+			}
+			else if (rc == RC::CANTOPEN)
+				rc = RC::OK;
+		}
+#endif
+		OSTRACE("DELETE \"%s\" %s\n", filename, (rc ? "failed" : "ok"));
+		return rc;
+	}
+
+	RC UnixVSystem::Access(const char *filename, ACCESS flags, int *resOut)
+	{
+		SimulateIOError(return RC::IOERR_ACCESS;);
+		int amode = 0;
+		switch (flags)
+		{
+		case ACCESS_EXISTS:
+			amode = F_OK;
+			break;
+		case ACCESS_READWRITE:
+			amode = W_OK|R_OK;
+			break;
+		case ACCESS_READ:
+			amode = R_OK;
+			break;
+		default:
+			_assert(!"Invalid flags argument");
+		}
+		*resOut = (osAccess(filename, amode) == 0);
+		// For an SQLITE_ACCESS_EXISTS query, treat a zero-length file as if it does not exist.
+		if (flags == ACCESS_EXISTS && *resOut)
+		{
+			struct stat buf;
+			if (osStat(filename, &buf) == 0 && buf.st_size == 0)
+				*resOut = 0;
+		}
+		return RC::OK;
+	}
+
+	RC UnixVSystem::FullPathname(const char *relative, int fullLength, char *full)
+	{
+		_assert(MaxPathname == MAX_PATHNAME);
+		SimulateIOError(return RC::ERROR);
+		full[fullLength-1] = '\0';
+		if (relative[0] == '/')
+			snprintf(full, fullLength, "%s", relative);
+		else
+		{
+			if (osGetcwd(full, fullLength-1) == 0)
+				return unixLogError(SysEx_CANTOPEN_BKPT, "getcwd", relative);
+			int n = (int)strlen(full);
+			snprintf(&full[n], fullLength-n, "/%s", relative);
+		}
+		return RC::OK;
+	}
+
+#ifndef OMIT_LOAD_EXTENSION
+	void *UnixVSystem::DlOpen(const char *filename)
+	{
+		return dlopen(filename, RTLD_NOW|RTLD_GLOBAL);
+	}
+
+	void UnixVSystem::DlError(int bufLength, char *buf)
+	{
+		unixEnterMutex();
+		const char *err = dlerror();
+		if (err)
+			snprintf(buf, bufLength, "%s", err);
+		unixLeaveMutex();
+	}
+
+	void (*UnixVSystem::DlSym(void *handle, const char *symbol))()
+	{
+		return (void(*)())dlsym(handle, symbol);
+	}
+
+	void UnixVSystem::DlClose(void *handle)
+	{
+		dlclose(handle);
+	}
+#else
+	void *UnixVSystem::DlOpen(const char *filename) { return nullptr; }
+	void UnixVSystem::DlError(int bufLength, char *buf) { }
+	void (*UnixVSystem::DlSym(void *handle, const char *symbol))() { return nullptr; }
+	void UnixVSystem::DlClose(void *handle) { }
+#endif
+
+	int UnixVSystem::Randomness(int bufLength, char *buf)
+	{
+		_assert((size_t)bufLength >= (sizeof(time_t)+sizeof(int)));
+		// We have to initialize buf to prevent valgrind from reporting errors.  The reports issued by valgrind are incorrect - we would
+		// prefer that the randomness be increased by making use of the uninitialized space in buf - but valgrind errors tend to worry some users.
+		memset(buf, 0, bufLength);
+#if !TEST
+		int fd = robust_open("/dev/urandom", O_RDONLY, 0);
+		if (fd < 0)
+		{
+			time_t t;
+			time(&t);
+			memcpy(buf, &t, sizeof(t));
+			int pid = getpid();
+			memcpy(&buf[sizeof(t)], &pid, sizeof(pid));
+			_assert(sizeof(t)+sizeof(pid) <= (size_t)bufLength);
+			bufLength = sizeof(t) + sizeof(pid);
+		}
+		else
+		{
+			int got;
+			do { got = (int)read(fd, buf, bufLength); } while (got < 0 && errno == EINTR);
+			robust_close(nullptr, fd, __LINE__);
+		}
+#endif
+		return bufLength;
+	}
+
+	int UnixVSystem::Sleep(int microseconds)
+	{
+		usleep(microseconds);
+		return microseconds;
+	}
+
+#ifdef TEST
+	int current_time = 0; // Fake system time in seconds since 1970.
+#endif
+	RC UnixVSystem::CurrentTimeInt64(int64 *now)
+	{
+		static const int64 unixEpoch = 24405875*(int64)8640000;
+		struct timeval sNow;
+		gettimeofday(&sNow, 0);
+		*now = unixEpoch + 1000*(int64)sNow.tv_sec + sNow.tv_usec/1000;
+#ifdef TEST
+		if (current_time)
+			*now = 1000*(int64)current_time + unixEpoch;
+#endif
+		return RC::OK;
+	}
+
+	RC UnixVSystem::CurrentTime(double *now)
+	{
+		int64 i = 0;
+		RC rc = CurrentTimeInt64(&i);
+		*now = i/86400000.0;
+		return rc;
+	}
+
+	RC UnixVSystem::GetLastError(int bufLength, char *buf)
+	{
+		if (bufLength > 0)
+			snprintf(buf, bufLength, "%s", strerror(errno));
+		return RC::OK;
+	}
+
+	static UnixVSystem _unixVfs;
+	RC VSystem::Initialize()
+	{
+		_unixVfs.SizeOsFile = sizeof(UnixVFile);
+		_unixVfs.MaxPathname = MAX_PATHNAME;
+		_unixVfs.Name = "unix";
+		// Double-check that the Syscalls[] array has been constructed correctly.
+		_assert(__arrayStaticLength(Syscalls) == 22);
+		RegisterVfs(&_unixVfs, true);
+		return RC::OK;
+	}
+
+	void VSystem::Shutdown()
+	{
+	}
+
+#pragma endregion
+
+}
+#endif
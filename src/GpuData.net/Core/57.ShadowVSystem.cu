@@ -0,0 +1,938 @@
+﻿// vfsshadow.c
+#include "Core.cu.h"
+#include "57.ShadowVSystem.cu.h"
+#include <new.h>
+
+namespace Core
+{
+#pragma region ShadowVFile
+
+	// Where one page of the database lives. A page whose Slot is 0 has never been written and reads as zeros.
+	struct ShadowEntry
+	{
+		uint32 Slot;
+		uint32 Generation;			// Commit that wrote the slot. One past the committed generation for a page written since
+		uint32 Checksum;			// Of the page as it was written to the slot
+	};
+
+	// One header block as read from the file
+	struct ShadowHeader
+	{
+		uint32 Generation;
+		uint32 PageSize;
+		uint32 Pages;
+		uint32 Slots;
+		uint32 MapSlot;
+		uint32 MapSlots;
+		uint32 MapChecksum[2];
+		uint32 Checksum[2];			// Of the header itself, which tells two headers of the same generation apart
+	};
+
+	// The file handed out by a ShadowVSystem. The base VFS's own file lives right after it, at Real. Map is what reads see and what writes change;
+	// Committed is what the newest header on disk describes. The two are equal except while Pending.
+	class ShadowVFile : public VFile
+	{
+	public:
+		ShadowVSystem *Vfs;			// The VFS this file was opened through
+		VFile *Real;				// The file opened by the base VFS
+		bool Shadowed;				// False if every call is passed straight to Real
+		bool Pending;				// Map holds writes that are not committed yet
+		LOCK Locked;				// Lock held on Real
+		uint8 HeaderBlock;			// Header block, 0 or 1, that holds the committed header
+		uint32 PageSize;			// 0 until the first write of an empty file
+		uint32 Generation;			// Of the committed header, 0 if nothing has been committed
+		uint32 Pages;				// Pages in Map, which is the size of the file as the caller sees it
+		uint32 CommittedPages;		// Pages in Committed
+		uint32 Slots;				// Slots the file extends to, used or free
+		uint32 MapSlot;				// First slot of the committed map, 0 if it has no pages
+		uint32 MapSlots;			// Slots the committed map takes
+		uint32 Allocated;			// Entries allocated for Map and for Committed. Those past Pages or CommittedPages are always zero
+		ShadowEntry *Map;
+		ShadowEntry *Committed;
+		uint8 *Used;				// Bitmap of the slots Map, Committed or the committed map itself refer to, or that a pending write took
+		uint32 UsedBytes;			// Bytes allocated for Used
+		uint32 Cursor;				// Slot the search for a free slot starts at
+		uint32 Rejected[2];			// Checksum of a header whose commit did not check out, which later loads, that do not check pages, must also pass over
+		uint8 *Buffer;				// PageSize bytes for partial writes and for checking pages
+
+	public:
+		__device__ virtual RC Read(void *buffer, int amount, int64 offset);
+		__device__ virtual RC Write(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Truncate(int64 size);
+		__device__ virtual RC Close();
+		__device__ virtual RC Sync(int flags);
+		__device__ virtual RC get_FileSize(int64 &size);
+
+		__device__ virtual RC Lock(LOCK lock);
+		__device__ virtual RC Unlock(LOCK lock);
+		__device__ virtual RC CheckReservedLock(int &lock);
+		__device__ virtual RC FileControl(FCNTL op, void *arg);
+
+		__device__ virtual uint get_SectorSize();
+		__device__ virtual IOCAP get_DeviceCharacteristics();
+
+		__device__ virtual RC ShmLock(int offset, int n, SHM flags);
+		__device__ virtual void ShmBarrier();
+		__device__ virtual RC ShmUnmap(bool deleteFlag);
+		__device__ virtual RC ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp);
+
+		__device__ virtual RC Fetch(int64 offset, int amount, void **pp);
+		__device__ virtual RC Unfetch(int64 offset, void *p);
+
+		__device__ virtual RC Readv(IOVec *vecs, int count, int64 offset);
+		__device__ virtual RC Writev(const IOVec *vecs, int count, int64 offset);
+
+		__device__ virtual RC ReadAsync(void *buffer, int amount, int64 offset);
+		__device__ virtual RC WriteAsync(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Wait();
+	};
+
+#define SHADOW_SLOTOFFSET(file, slot) ((int64)SHADOWVSYSTEM_DATA + (int64)((slot) - 1) * (file)->PageSize)
+#define SHADOW_ISUSED(file, slot) ((slot) / 8 < (file)->UsedBytes && ((file)->Used[(slot) / 8] & (1 << ((slot) & 7))) != 0)
+
+	// The same running sum the WAL uses, over big-endian words so a file checks out on any host. length must be a multiple of 8.
+	__device__ static void shadowChecksum(const uint8 *data, int length, uint32 *checksum)
+	{
+		_assert((length & 7) == 0);
+		uint32 s1 = 0, s2 = 0;
+		for (int i = 0; i < length; i += 8)
+		{
+			s1 += ConvertEx::Get4(&data[i]) + s2;
+			s2 += ConvertEx::Get4(&data[i + 4]) + s1;
+		}
+		checksum[0] = s1;
+		checksum[1] = s2;
+	}
+
+	__device__ static bool shadowIsPageSize(uint32 size)
+	{
+		return (size >= 512 && size <= 65536 && (size & (size - 1)) == 0);
+	}
+
+	__device__ static RC shadowSetPageSize(ShadowVFile *file, uint32 pageSize)
+	{
+		if (pageSize == file->PageSize && file->Buffer)
+			return RC::OK;
+		uint8 *buffer = (uint8 *)SysEx::Alloc(pageSize);
+		if (!buffer)
+			return RC::NOMEM;
+		SysEx::Free(file->Buffer);
+		file->Buffer = buffer;
+		file->PageSize = pageSize;
+		return RC::OK;
+	}
+
+	// Make room for pages entries in both Map and Committed.
+	__device__ static RC shadowReserve(ShadowVFile *file, uint32 pages)
+	{
+		if (pages <= file->Allocated)
+			return RC::OK;
+		uint32 allocated = (file->Allocated ? file->Allocated : 64);
+		while (allocated < pages)
+			allocated *= 2;
+		ShadowEntry *map = (ShadowEntry *)SysEx::Alloc(allocated * sizeof(ShadowEntry), true);
+		ShadowEntry *committed = (ShadowEntry *)SysEx::Alloc(allocated * sizeof(ShadowEntry), true);
+		if (!map || !committed)
+		{
+			SysEx::Free(map);
+			SysEx::Free(committed);
+			return RC::NOMEM;
+		}
+		if (file->Allocated)
+		{
+			_memcpy(map, file->Map, file->Allocated * sizeof(ShadowEntry));
+			_memcpy(committed, file->Committed, file->Allocated * sizeof(ShadowEntry));
+		}
+		SysEx::Free(file->Map);
+		SysEx::Free(file->Committed);
+		file->Map = map;
+		file->Committed = committed;
+		file->Allocated = allocated;
+		return RC::OK;
+	}
+
+	__device__ static RC shadowMark(ShadowVFile *file, uint32 slot)
+	{
+		uint32 bytes = slot / 8 + 1;
+		if (bytes > file->UsedBytes)
+		{
+			uint32 usedBytes = (file->UsedBytes ? file->UsedBytes : 64);
+			while (usedBytes < bytes)
+				usedBytes *= 2;
+			uint8 *used = (uint8 *)SysEx::Alloc(usedBytes, true);
+			if (!used)
+				return RC::NOMEM;
+			if (file->UsedBytes)
+				_memcpy(used, file->Used, file->UsedBytes);
+			SysEx::Free(file->Used);
+			file->Used = used;
+			file->UsedBytes = usedBytes;
+		}
+		file->Used[slot / 8] |= (1 << (slot & 7));
+		return RC::OK;
+	}
+
+	// Take count consecutive free slots, the first run from Cursor on, or else from the end of the file, which then grows.
+	__device__ static RC shadowAllocate(ShadowVFile *file, uint32 count, uint32 *slot)
+	{
+		uint32 first = 0;
+		uint32 run = 0;
+		for (uint32 i = file->Cursor; i <= file->Slots && run < count; i++)
+		{
+			if (SHADOW_ISUSED(file, i))
+				run = 0;
+			else if (run++ == 0)
+				first = i;
+		}
+		if (run < count)
+		{
+			// Too short a run, if any, at the end of the file: the allocation starts there and runs past the end
+			if (run == 0)
+				first = file->Slots + 1;
+			file->Slots = first + count - 1;
+		}
+		for (uint32 i = first; i < first + count; i++)
+		{
+			RC rc = shadowMark(file, i);
+			if (rc != RC::OK)
+				return rc;
+		}
+		if (count == 1)
+			file->Cursor = first + 1;
+		*slot = first;
+		return RC::OK;
+	}
+
+	// Work out Used again from the maps, which frees every slot only an older commit or a dropped write used. With shrink, a long enough run of free
+	// slots at the end of the file is cut off.
+	__device__ static RC shadowRebuild(ShadowVFile *file, bool shrink)
+	{
+		if (file->Used)
+			_memset(file->Used, 0, file->UsedBytes);
+		uint32 last = 0;
+		uint32 pages = (file->Pages > file->CommittedPages ? file->Pages : file->CommittedPages);
+		RC rc = RC::OK;
+		for (uint32 i = 0; i < pages && rc == RC::OK; i++)
+		{
+			uint32 slot = file->Map[i].Slot;
+			if (slot)
+			{
+				rc = shadowMark(file, slot);
+				if (slot > last) last = slot;
+			}
+			slot = file->Committed[i].Slot;
+			if (slot && rc == RC::OK)
+			{
+				rc = shadowMark(file, slot);
+				if (slot > last) last = slot;
+			}
+		}
+		for (uint32 i = 0; i < file->MapSlots && rc == RC::OK; i++)
+			rc = shadowMark(file, file->MapSlot + i);
+		if (file->MapSlots && file->MapSlot + file->MapSlots - 1 > last)
+			last = file->MapSlot + file->MapSlots - 1;
+		file->Cursor = 1;
+		if (rc == RC::OK && shrink && last < file->Slots / 2)
+		{
+			// Only a shrink that gives back half the file is worth it, as the free slots at the end are otherwise taken again by the next transaction
+			file->Slots = last;
+			file->Real->Truncate(SHADOW_SLOTOFFSET(file, last + 1));
+		}
+		return rc;
+	}
+
+	__device__ static bool shadowParseHeader(const uint8 *b, ShadowHeader *header)
+	{
+		uint32 checksum[2];
+		shadowChecksum(b, SHADOWVSYSTEM_HEADER - 8, checksum);
+		if (ConvertEx::Get4(b) != SHADOWVSYSTEM_MAGIC || ConvertEx::Get4(&b[4]) != SHADOWVSYSTEM_VERSION || ConvertEx::Get4(&b[40]) != checksum[0] || ConvertEx::Get4(&b[44]) != checksum[1])
+			return false;
+		header->Generation = ConvertEx::Get4(&b[8]);
+		header->PageSize = ConvertEx::Get4(&b[12]);
+		header->Pages = ConvertEx::Get4(&b[16]);
+		header->Slots = ConvertEx::Get4(&b[20]);
+		header->MapSlot = ConvertEx::Get4(&b[24]);
+		header->MapSlots = ConvertEx::Get4(&b[28]);
+		header->MapChecksum[0] = ConvertEx::Get4(&b[32]);
+		header->MapChecksum[1] = ConvertEx::Get4(&b[36]);
+		header->Checksum[0] = checksum[0];
+		header->Checksum[1] = checksum[1];
+		return (header->Generation > 0 && shadowIsPageSize(header->PageSize) && (uint64)header->MapSlots * header->PageSize >= (uint64)header->Pages * SHADOWVSYSTEM_ENTRY
+			&& (header->MapSlots == 0 || (header->MapSlot > 0 && header->MapSlot + header->MapSlots - 1 <= header->Slots)));
+	}
+
+	// Read the map a header describes and make it both Map and Committed. Returns CORRUPT if the map does not match its checksum or, with verify,
+	// if a page the header's commit wrote does not match its own.
+	__device__ static RC shadowLoadMap(ShadowVFile *file, uint8 block, ShadowHeader *header, bool verify)
+	{
+		uint32 pageSize = header->PageSize;
+		uint32 bytes = header->MapSlots * pageSize;
+		uint8 *body = nullptr;
+		RC rc = RC::OK;
+		if (bytes)
+		{
+			body = (uint8 *)SysEx::Alloc(bytes);
+			if (!body)
+				return RC::NOMEM;
+			rc = file->Real->Read(body, bytes, SHADOWVSYSTEM_DATA + (int64)(header->MapSlot - 1) * pageSize);
+			uint32 checksum[2];
+			if (rc == RC::OK)
+			{
+				shadowChecksum(body, bytes, checksum);
+				if (checksum[0] != header->MapChecksum[0] || checksum[1] != header->MapChecksum[1])
+					rc = RC::CORRUPT;
+			}
+			else if (rc == RC::IOERR_SHORT_READ)
+				rc = RC::CORRUPT;
+		}
+		if (rc == RC::OK) rc = shadowSetPageSize(file, pageSize);
+		if (rc == RC::OK) rc = shadowReserve(file, header->Pages);
+		for (uint32 i = 0; i < header->Pages && rc == RC::OK; i++)
+		{
+			const uint8 *b = &body[i * SHADOWVSYSTEM_ENTRY];
+			uint32 slot = ConvertEx::Get4(b);
+			if (slot > header->Slots)
+				rc = RC::CORRUPT;
+			else if (verify && slot && ConvertEx::Get4(&b[4]) == header->Generation)
+			{
+				// A commit is only as good as the pages it wrote, as the one sync does not order them before the header
+				uint32 checksum[2];
+				rc = file->Real->Read(file->Buffer, pageSize, SHADOWVSYSTEM_DATA + (int64)(slot - 1) * pageSize);
+				if (rc == RC::OK)
+				{
+					shadowChecksum(file->Buffer, pageSize, checksum);
+					if (checksum[1] != ConvertEx::Get4(&b[8]))
+						rc = RC::CORRUPT;
+				}
+				else if (rc == RC::IOERR_SHORT_READ)
+					rc = RC::CORRUPT;
+			}
+		}
+		if (rc == RC::OK)
+		{
+			uint32 pages = (file->Pages > file->CommittedPages ? file->Pages : file->CommittedPages);
+			if (pages)
+			{
+				_memset(file->Map, 0, pages * sizeof(ShadowEntry));
+				_memset(file->Committed, 0, pages * sizeof(ShadowEntry));
+			}
+			for (uint32 i = 0; i < header->Pages; i++)
+			{
+				const uint8 *b = &body[i * SHADOWVSYSTEM_ENTRY];
+				ShadowEntry *entry = &file->Map[i];
+				entry->Slot = ConvertEx::Get4(b);
+				entry->Generation = ConvertEx::Get4(&b[4]);
+				entry->Checksum = ConvertEx::Get4(&b[8]);
+			}
+			if (header->Pages)
+				_memcpy(file->Committed, file->Map, header->Pages * sizeof(ShadowEntry));
+			file->HeaderBlock = block;
+			file->Generation = header->Generation;
+			file->Pages = file->CommittedPages = header->Pages;
+			file->Slots = header->Slots;
+			file->MapSlot = header->MapSlot;
+			file->MapSlots = header->MapSlots;
+			file->Pending = false;
+			rc = shadowRebuild(file, false);
+		}
+		SysEx::Free(body);
+		return rc;
+	}
+
+	// Bring the maps up to the newest commit on disk, if it is not the one already loaded. Both header blocks are read in one call.
+	__device__ static RC shadowLoad(ShadowVFile *file, bool verify)
+	{
+		uint8 blocks[SHADOWVSYSTEM_HEADERSTRIDE + SHADOWVSYSTEM_HEADER];
+		RC rc = file->Real->Read(blocks, sizeof(blocks), 0);
+		if (rc != RC::OK && rc != RC::IOERR_SHORT_READ)
+			return rc;
+		ShadowHeader headers[2];
+		bool valid[2];
+		valid[0] = shadowParseHeader(blocks, &headers[0]);
+		valid[1] = shadowParseHeader(&blocks[SHADOWVSYSTEM_HEADERSTRIDE], &headers[1]);
+		for (int i = 0; i < 2; i++)
+			if (valid[i] && headers[i].Checksum[0] == file->Rejected[0] && headers[i].Checksum[1] == file->Rejected[1])
+				valid[i] = false;
+		int newest = (valid[1] && (!valid[0] || headers[1].Generation > headers[0].Generation) ? 1 : 0);
+		if (!valid[newest] || (headers[newest].Generation == file->Generation && newest == file->HeaderBlock))
+			return RC::OK;
+		rc = shadowLoadMap(file, (uint8)newest, &headers[newest], verify);
+		if (rc == RC::CORRUPT)
+		{
+			file->Rejected[0] = headers[newest].Checksum[0];
+			file->Rejected[1] = headers[newest].Checksum[1];
+			if (valid[1 - newest])
+				rc = shadowLoadMap(file, (uint8)(1 - newest), &headers[1 - newest], verify);
+			else if (headers[newest].Generation == 1)
+				rc = RC::OK; // The first commit was cut short, so nothing was ever committed
+		}
+		return rc;
+	}
+
+	// Publish Map: write it to free slots, then a header for it over the older header, then sync once if syncFlags asks for it.
+	__device__ static RC shadowCommit(ShadowVFile *file, int syncFlags)
+	{
+		if (!file->Pending)
+			return (syncFlags ? file->Real->Sync(syncFlags) : RC::OK);
+		_assert(file->PageSize);
+		uint32 pageSize = file->PageSize;
+		uint32 mapSlots = (file->Pages * SHADOWVSYSTEM_ENTRY + pageSize - 1) / pageSize;
+		uint32 mapSlot = 0;
+		uint32 mapChecksum[2] = { 0, 0 };
+		RC rc;
+		if (mapSlots)
+		{
+			uint8 *body = (uint8 *)SysEx::Alloc(mapSlots * pageSize, true);
+			if (!body)
+				return RC::NOMEM;
+			for (uint32 i = 0; i < file->Pages; i++)
+			{
+				uint8 *b = &body[i * SHADOWVSYSTEM_ENTRY];
+				ConvertEx::Put4(b, file->Map[i].Slot);
+				ConvertEx::Put4(&b[4], file->Map[i].Generation);
+				ConvertEx::Put4(&b[8], file->Map[i].Checksum);
+			}
+			shadowChecksum(body, mapSlots * pageSize, mapChecksum);
+			rc = shadowAllocate(file, mapSlots, &mapSlot);
+			if (rc == RC::OK)
+				rc = file->Real->Write(body, mapSlots * pageSize, SHADOW_SLOTOFFSET(file, mapSlot));
+			SysEx::Free(body);
+			if (rc != RC::OK)
+				return rc;
+		}
+		uint8 header[SHADOWVSYSTEM_HEADER];
+		uint32 generation = file->Generation + 1;
+		ConvertEx::Put4(header, SHADOWVSYSTEM_MAGIC);
+		ConvertEx::Put4(&header[4], SHADOWVSYSTEM_VERSION);
+		ConvertEx::Put4(&header[8], generation);
+		ConvertEx::Put4(&header[12], pageSize);
+		ConvertEx::Put4(&header[16], file->Pages);
+		ConvertEx::Put4(&header[20], file->Slots);
+		ConvertEx::Put4(&header[24], mapSlot);
+		ConvertEx::Put4(&header[28], mapSlots);
+		ConvertEx::Put4(&header[32], mapChecksum[0]);
+		ConvertEx::Put4(&header[36], mapChecksum[1]);
+		uint32 checksum[2];
+		shadowChecksum(header, SHADOWVSYSTEM_HEADER - 8, checksum);
+		ConvertEx::Put4(&header[40], checksum[0]);
+		ConvertEx::Put4(&header[44], checksum[1]);
+		uint8 block = (uint8)(1 - file->HeaderBlock);
+		rc = file->Real->Write(header, SHADOWVSYSTEM_HEADER, block * SHADOWVSYSTEM_HEADERSTRIDE);
+		if (rc == RC::OK && syncFlags)
+			rc = file->Real->Sync(syncFlags);
+		if (rc != RC::OK)
+			return rc;
+
+		file->HeaderBlock = block;
+		file->Generation = generation;
+		file->MapSlot = mapSlot;
+		file->MapSlots = mapSlots;
+		uint32 pages = (file->Pages > file->CommittedPages ? file->Pages : file->CommittedPages);
+		if (pages)
+			_memcpy(file->Committed, file->Map, pages * sizeof(ShadowEntry));
+		file->CommittedPages = file->Pages;
+		file->Pending = false;
+		return shadowRebuild(file, true);
+	}
+
+	__device__ static RC shadowRollback(ShadowVFile *file)
+	{
+		if (!file->Pending)
+			return RC::OK;
+		uint32 pages = (file->Pages > file->CommittedPages ? file->Pages : file->CommittedPages);
+		if (pages)
+			_memcpy(file->Map, file->Committed, pages * sizeof(ShadowEntry));
+		file->Pages = file->CommittedPages;
+		file->Pending = false;
+		return shadowRebuild(file, false);
+	}
+
+	__device__ static void shadowFree(ShadowVFile *file)
+	{
+		SysEx::Free(file->Map);
+		SysEx::Free(file->Committed);
+		SysEx::Free(file->Used);
+		SysEx::Free(file->Buffer);
+		file->Map = file->Committed = nullptr;
+		file->Used = file->Buffer = nullptr;
+		file->Allocated = file->UsedBytes = 0;
+	}
+
+	__device__ RC ShadowVFile::Read(void *buffer, int amount, int64 offset)
+	{
+		if (!Shadowed)
+			return Real->Read(buffer, amount, offset);
+		uint8 *out = (uint8 *)buffer;
+		bool shortRead = false;
+		while (amount > 0)
+		{
+			if (!PageSize)
+			{
+				_memset(out, 0, amount);
+				return RC::IOERR_SHORT_READ;
+			}
+			uint32 index = (uint32)(offset / PageSize);
+			uint32 within = (uint32)(offset % PageSize);
+			int n = (amount < (int)(PageSize - within) ? amount : (int)(PageSize - within));
+			if (index >= Pages)
+			{
+				_memset(out, 0, n);
+				shortRead = true;
+			}
+			else if (!Map[index].Slot)
+				_memset(out, 0, n);
+			else
+			{
+				RC rc = Real->Read(out, n, SHADOW_SLOTOFFSET(this, Map[index].Slot) + within);
+				if (rc != RC::OK)
+					return rc;
+			}
+			out += n;
+			offset += n;
+			amount -= n;
+		}
+		return (shortRead ? RC::IOERR_SHORT_READ : RC::OK);
+	}
+
+	// A write never lands on a slot the committed map uses. A page already written since the last commit is written again where it went, any
+	// other goes to a free slot. A write of part of a page reads the rest of it first.
+	__device__ RC ShadowVFile::Write(const void *buffer, int amount, int64 offset)
+	{
+		if (!Shadowed)
+			return Real->Write(buffer, amount, offset);
+		RC rc;
+		if ((uint32)amount != PageSize && Pages == 0 && CommittedPages == 0 && shadowIsPageSize(amount) && (offset % amount) == 0)
+		{
+			// The first write of a whole page to an empty file fixes the page size. It need not be page 1, as a cache spill can write
+			// later pages first
+			if ((rc = shadowSetPageSize(this, amount)) != RC::OK) return rc;
+			Slots = 0;
+			if ((rc = shadowRebuild(this, false)) != RC::OK) return rc;
+		}
+		if (!PageSize)
+			return RC::IOERR_WRITE;
+		const uint8 *in = (const uint8 *)buffer;
+		while (amount > 0)
+		{
+			uint32 index = (uint32)(offset / PageSize);
+			uint32 within = (uint32)(offset % PageSize);
+			int n = (amount < (int)(PageSize - within) ? amount : (int)(PageSize - within));
+			if ((rc = shadowReserve(this, index + 1)) != RC::OK)
+				return rc;
+			ShadowEntry *entry = &Map[index];
+			const uint8 *page = in;
+			if (n < (int)PageSize)
+			{
+				if (index < Pages && entry->Slot)
+				{
+					rc = Real->Read(Buffer, PageSize, SHADOW_SLOTOFFSET(this, entry->Slot));
+					if (rc != RC::OK)
+						return rc;
+				}
+				else
+					_memset(Buffer, 0, PageSize);
+				_memcpy(Buffer + within, in, n);
+				page = Buffer;
+			}
+			uint32 slot = entry->Slot;
+			if (!slot || entry->Generation != Generation + 1)
+			{
+				if ((rc = shadowAllocate(this, 1, &slot)) != RC::OK)
+					return rc;
+			}
+			if ((rc = Real->Write(page, PageSize, SHADOW_SLOTOFFSET(this, slot))) != RC::OK)
+				return rc;
+			uint32 checksum[2];
+			shadowChecksum(page, PageSize, checksum);
+			entry->Slot = slot;
+			entry->Generation = Generation + 1;
+			entry->Checksum = checksum[1];
+			if (index >= Pages)
+				Pages = index + 1;
+			Pending = true;
+			in += n;
+			offset += n;
+			amount -= n;
+		}
+		return RC::OK;
+	}
+
+	// Only the map shrinks. The slots are freed by the commit and the file itself only shrinks once most of it is free.
+	__device__ RC ShadowVFile::Truncate(int64 size)
+	{
+		if (!Shadowed)
+			return Real->Truncate(size);
+		if (!PageSize)
+			return RC::OK;
+		uint32 pages = (uint32)((size + PageSize - 1) / PageSize);
+		if (pages < Pages)
+			_memset(&Map[pages], 0, (Pages - pages) * sizeof(ShadowEntry));
+		else if (pages > Pages)
+		{
+			RC rc = shadowReserve(this, pages);
+			if (rc != RC::OK)
+				return rc;
+		}
+		if (pages != Pages)
+		{
+			Pages = pages;
+			Pending = true;
+		}
+		return RC::OK;
+	}
+
+	// Pending writes are dropped. They can only be left here by a caller that closes a file it holds no write lock on, as the unlock that ends
+	// a write transaction publishes them.
+	__device__ RC ShadowVFile::Close()
+	{
+		shadowFree(this);
+		RC rc = Real->Close();
+		Opened = false;
+		return rc;
+	}
+
+	__device__ RC ShadowVFile::Sync(int flags)
+	{
+		if (!Shadowed)
+			return Real->Sync(flags);
+		return shadowCommit(this, flags);
+	}
+
+	__device__ RC ShadowVFile::get_FileSize(int64 &size)
+	{
+		if (!Shadowed)
+			return Real->get_FileSize(size);
+		size = (int64)Pages * PageSize;
+		return RC::OK;
+	}
+
+	// Taking the first SHARED lock is when another connection's commits become visible, so the header is checked for a newer one then.
+	__device__ RC ShadowVFile::Lock(LOCK lock)
+	{
+		if (!Shadowed)
+			return Real->Lock(lock);
+		bool first = (Locked == LOCK_NO);
+		RC rc = Real->Lock(lock);
+		if (rc != RC::OK)
+			return rc;
+		if (lock > Locked)
+			Locked = lock;
+		if (first && !Pending)
+		{
+			rc = shadowLoad(this, false);
+			if (rc != RC::OK)
+			{
+				Real->Unlock(LOCK_NO);
+				Locked = LOCK_NO;
+			}
+		}
+		return rc;
+	}
+
+	// Ending a write transaction publishes what it wrote, without a sync, for callers that do not commit through Sync() or FCNTL_SHADOW_COMMIT.
+	// Writes that cannot be published are dropped rather than left behind once the lock is gone.
+	__device__ RC ShadowVFile::Unlock(LOCK lock)
+	{
+		if (!Shadowed)
+			return Real->Unlock(lock);
+		RC rc = RC::OK;
+		if (Pending && lock <= LOCK_SHARED)
+		{
+			if (Locked >= LOCK_RESERVED)
+				rc = shadowCommit(this, 0);
+			if (Pending)
+				shadowRollback(this);
+		}
+		RC rc2 = Real->Unlock(lock);
+		if (lock < Locked)
+			Locked = lock;
+		return (rc != RC::OK ? rc : rc2);
+	}
+
+	__device__ RC ShadowVFile::CheckReservedLock(int &lock)
+	{
+		return Real->CheckReservedLock(lock);
+	}
+
+	__device__ RC ShadowVFile::FileControl(FCNTL op, void *arg)
+	{
+		if (Shadowed)
+		{
+			switch (op)
+			{
+			case FCNTL_SHADOW_GENERATION:
+				*(uint32 *)arg = Generation;
+				return RC::OK;
+			case FCNTL_SHADOW_COMMIT:
+				return shadowCommit(this, *(int *)arg);
+			case FCNTL_SYNC_OMITTED:
+				// synchronous=off still commits where the sync would have
+				return shadowCommit(this, 0);
+			case FCNTL_SHADOW_ROLLBACK:
+				return shadowRollback(this);
+			case FCNTL_MMAP_SIZE:
+				// Pages are not where the caller thinks they are in the file, so there is nothing to map
+				*(int64 *)arg = 0;
+				return RC::OK;
+			case FCNTL_SIZE_HINT:
+				return RC::OK;
+			case FCNTL_PUNCH_HOLE:
+				// The range may still be the committed copy of a page, which is never written over
+				return RC::NOTFOUND;
+			case FCNTL_PREFETCH: {
+				// Hint the slots the range maps to, as runs of consecutive slots
+				int64 offset = ((int64 *)arg)[0];
+				int64 amount = ((int64 *)arg)[1];
+				if (!PageSize || amount <= 0)
+					return RC::OK;
+				int64 range[2] = { 0, 0 };
+				uint32 last = (uint32)((offset + amount - 1) / PageSize);
+				for (uint32 index = (uint32)(offset / PageSize); index <= last && index < Pages; index++)
+				{
+					uint32 slot = Map[index].Slot;
+					if (!slot)
+						continue;
+					int64 slotOffset = SHADOW_SLOTOFFSET(this, slot);
+					if (range[1] && range[0] + range[1] == slotOffset)
+					{
+						range[1] += PageSize;
+						continue;
+					}
+					if (range[1])
+						Real->FileControl(FCNTL_PREFETCH, range);
+					range[0] = slotOffset;
+					range[1] = PageSize;
+				}
+				if (range[1])
+					Real->FileControl(FCNTL_PREFETCH, range);
+				return RC::OK; }
+			}
+		}
+		return Real->FileControl(op, arg);
+	}
+
+	__device__ uint ShadowVFile::get_SectorSize()
+	{
+		return Real->get_SectorSize();
+	}
+
+	__device__ VFile::IOCAP ShadowVFile::get_DeviceCharacteristics()
+	{
+		return Real->get_DeviceCharacteristics();
+	}
+
+	__device__ RC ShadowVFile::ShmLock(int offset, int n, SHM flags)
+	{
+		return Real->ShmLock(offset, n, flags);
+	}
+
+	__device__ void ShadowVFile::ShmBarrier()
+	{
+		Real->ShmBarrier();
+	}
+
+	__device__ RC ShadowVFile::ShmUnmap(bool deleteFlag)
+	{
+		return Real->ShmUnmap(deleteFlag);
+	}
+
+	__device__ RC ShadowVFile::ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp)
+	{
+		return Real->ShmMap(region, sizeRegion, isWrite, pp);
+	}
+
+	__device__ RC ShadowVFile::Fetch(int64 offset, int amount, void **pp)
+	{
+		if (!Shadowed)
+			return Real->Fetch(offset, amount, pp);
+		*pp = nullptr;
+		return RC::OK;
+	}
+
+	__device__ RC ShadowVFile::Unfetch(int64 offset, void *p)
+	{
+		if (!Shadowed)
+			return Real->Unfetch(offset, p);
+		return RC::OK;
+	}
+
+	// A shadow paged file takes the VFile defaults, which go through Read() and Write() above.
+	__device__ RC ShadowVFile::Readv(IOVec *vecs, int count, int64 offset)
+	{
+		return (Shadowed ? VFile::Readv(vecs, count, offset) : Real->Readv(vecs, count, offset));
+	}
+
+	__device__ RC ShadowVFile::Writev(const IOVec *vecs, int count, int64 offset)
+	{
+		return (Shadowed ? VFile::Writev(vecs, count, offset) : Real->Writev(vecs, count, offset));
+	}
+
+	__device__ RC ShadowVFile::ReadAsync(void *buffer, int amount, int64 offset)
+	{
+		return (Shadowed ? VFile::ReadAsync(buffer, amount, offset) : Real->ReadAsync(buffer, amount, offset));
+	}
+
+	__device__ RC ShadowVFile::WriteAsync(const void *buffer, int amount, int64 offset)
+	{
+		return (Shadowed ? VFile::WriteAsync(buffer, amount, offset) : Real->WriteAsync(buffer, amount, offset));
+	}
+
+	__device__ RC ShadowVFile::Wait()
+	{
+		return (Shadowed ? VFile::Wait() : Real->Wait());
+	}
+
+#pragma endregion
+
+#pragma region ShadowVSystem
+
+	// The base file is placed after the ShadowVFile, rounded so it keeps the 8-byte alignment the caller gave the whole buffer.
+#define SHADOWVFILE_REAL(p) ((VFile *)((uint8 *)(p) + SysEx_ROUND8(sizeof(ShadowVFile))))
+
+	// Stack a new VFS called name on the registered VFS called base. name must stay valid until Unregister(). Returns null if base is not
+	// registered or the allocation fails.
+	__device__ ShadowVSystem *ShadowVSystem::Register(const char *name, const char *base, bool _default)
+	{
+		VSystem *baseVfs = VSystem::Find(base);
+		if (!baseVfs)
+			return nullptr;
+		ShadowVSystem *vfs = (ShadowVSystem *)SysEx::Alloc(sizeof(ShadowVSystem), true);
+		if (!vfs)
+			return nullptr;
+		vfs = new (vfs) ShadowVSystem();
+		vfs->Base = baseVfs;
+		vfs->Name = name;
+		vfs->SizeOsFile = SysEx_ROUND8(sizeof(ShadowVFile)) + baseVfs->SizeOsFile;
+		vfs->MaxPathname = baseVfs->MaxPathname;
+		VSystem::RegisterVfs(vfs, _default);
+		return vfs;
+	}
+
+	__device__ void ShadowVSystem::Unregister(ShadowVSystem *vfs)
+	{
+		if (!vfs) return;
+		VSystem::UnregisterVfs(vfs);
+		SysEx::Free(vfs);
+	}
+
+	__device__ VFile *ShadowVSystem::_AttachFile(void *buffer)
+	{
+		ShadowVFile *file = new (buffer) ShadowVFile();
+		file->Vfs = this;
+		file->Real = Base->_AttachFile(SHADOWVFILE_REAL(file));
+		return file;
+	}
+
+	// A main database is shadow paged unless it already holds an ordinary database, which always starts with the SQLite header string. Anything
+	// else, a torn first header included, is a shadow paged file, and loading it also checks the newest commit's pages.
+	__device__ RC ShadowVSystem::Open(const char *path, VFile *id, OPEN flags, OPEN *outFlags)
+	{
+		ShadowVFile *file = (ShadowVFile *)id;
+		_assert(file != nullptr);
+		_memset(file, 0, sizeof(ShadowVFile));
+		file = new (file) ShadowVFile();
+		file->Vfs = this;
+		file->Real = SHADOWVFILE_REAL(file);
+		RC rc = Base->Open(path, file->Real, flags, outFlags);
+		file->Opened = (rc == RC::OK && file->Real->Opened);
+		if (!file->Opened || (flags & OPEN_MAIN_DB) == 0)
+			return rc;
+		int64 size;
+		rc = file->Real->get_FileSize(size);
+		if (rc == RC::OK && size >= 16)
+		{
+			uint8 magic[16];
+			rc = file->Real->Read(magic, sizeof(magic), 0);
+			file->Shadowed = (rc == RC::OK && _memcmp(magic, "SQLite format 3", 16) != 0);
+		}
+		else
+			file->Shadowed = (rc == RC::OK);
+		file->HeaderBlock = 1;
+		if (rc == RC::OK && file->Shadowed)
+			rc = shadowLoad(file, true);
+		if (rc != RC::OK)
+		{
+			shadowFree(file);
+			file->Real->Close();
+			file->Opened = false;
+		}
+		return rc;
+	}
+
+	__device__ RC ShadowVSystem::Delete(const char *path, bool syncDirectory)
+	{
+		return Base->Delete(path, syncDirectory);
+	}
+
+	__device__ RC ShadowVSystem::Access(const char *path, ACCESS flags, int *outRC)
+	{
+		return Base->Access(path, flags, outRC);
+	}
+
+	__device__ RC ShadowVSystem::FullPathname(const char *path, int pathOutLength, char *pathOut)
+	{
+		return Base->FullPathname(path, pathOutLength, pathOut);
+	}
+
+	__device__ void *ShadowVSystem::DlOpen(const char *filename)
+	{
+		return Base->DlOpen(filename);
+	}
+
+	__device__ void ShadowVSystem::DlError(int bufLength, char *buf)
+	{
+		Base->DlError(bufLength, buf);
+	}
+
+	__device__ void (*ShadowVSystem::DlSym(void *handle, const char *symbol))()
+	{
+		return Base->DlSym(handle, symbol);
+	}
+
+	__device__ void ShadowVSystem::DlClose(void *handle)
+	{
+		Base->DlClose(handle);
+	}
+
+	__device__ int ShadowVSystem::Randomness(int bufLength, char *buf)
+	{
+		return Base->Randomness(bufLength, buf);
+	}
+
+	__device__ int ShadowVSystem::Sleep(int microseconds)
+	{
+		return Base->Sleep(microseconds);
+	}
+
+	__device__ RC ShadowVSystem::CurrentTimeInt64(int64 *now)
+	{
+		return Base->CurrentTimeInt64(now);
+	}
+
+	__device__ RC ShadowVSystem::CurrentTime(double *now)
+	{
+		return Base->CurrentTime(now);
+	}
+
+	__device__ RC ShadowVSystem::GetLastError(int bufLength, char *buf)
+	{
+		return Base->GetLastError(bufLength, buf);
+	}
+
+	__device__ RC ShadowVSystem::SetSystemCall(const char *name, syscall_ptr newFunc)
+	{
+		return Base->SetSystemCall(name, newFunc);
+	}
+
+	__device__ syscall_ptr ShadowVSystem::GetSystemCall(const char *name)
+	{
+		return Base->GetSystemCall(name);
+	}
+
+	__device__ const char *ShadowVSystem::NextSystemCall(const char *name)
+	{
+		return Base->NextSystemCall(name);
+	}
+
+#pragma endregion
+}
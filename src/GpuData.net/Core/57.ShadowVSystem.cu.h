@@ -0,0 +1,54 @@
+﻿// vfsshadow.c
+#pragma once
+namespace Core
+{
+#define SHADOWVSYSTEM_MAGIC 0x53484457	// "SHDW"
+#define SHADOWVSYSTEM_VERSION 1
+#define SHADOWVSYSTEM_HEADER 48			// Bytes used in each of the two header blocks
+#define SHADOWVSYSTEM_HEADERSTRIDE 512	// The second header block starts here, so the two never share a sector
+#define SHADOWVSYSTEM_DATA 4096			// Slot 1 starts here. Slot k is at SHADOWVSYSTEM_DATA + (k-1) * page size
+#define SHADOWVSYSTEM_ENTRY 12			// Bytes per page in the map: slot, generation and checksum
+
+	// A VFS stacked on another registered VFS that never overwrites a committed page of a main database. Every page written goes to a free slot
+	// of the file and a page map, kept in further free slots, says which slot holds each page. A commit writes the new map, then the new map's
+	// header into whichever of the two header blocks is older, and then syncs once. Recovery takes the newest header whose checksums hold and
+	// whose newly written pages check out, so a crash anywhere in a commit leaves the previous commit intact and there is no journal to play back.
+	// Slots the new map no longer uses are reused by the next transaction.
+	//
+	// Only main databases are shadow paged, and only ones created empty through this VFS. Any other file, and a main database that already holds
+	// an ordinary database, is passed through unchanged and answers FCNTL_SHADOW_GENERATION with NOTFOUND, which is how the pager tells whether
+	// journal_mode=shadow can be used. Writes are published by Sync(), by FCNTL_SHADOW_COMMIT, and by the unlock that ends a write transaction,
+	// so the other journal modes also work over this VFS. A writer holds EXCLUSIVE when it publishes, so no reader is left on the slots it frees.
+	//
+	// Each header is, big-endian: magic, version, generation, page size, pages, slots in the file, first slot of the map, slots of the map,
+	// the map's checksum (8) and the header's own checksum (8).
+	class ShadowVSystem : public VSystem
+	{
+	public:
+		VSystem *Base;				// The VFS every call is passed to
+
+		__device__ static ShadowVSystem *Register(const char *name, const char *base, bool _default);
+		__device__ static void Unregister(ShadowVSystem *vfs);
+
+		__device__ virtual IO::VFile *_AttachFile(void *buffer);
+		__device__ virtual RC Open(const char *path, IO::VFile *file, OPEN flags, OPEN *outFlags);
+		__device__ virtual RC Delete(const char *path, bool syncDirectory);
+		__device__ virtual RC Access(const char *path, ACCESS flags, int *outRC);
+		__device__ virtual RC FullPathname(const char *path, int pathOutLength, char *pathOut);
+
+		__device__ virtual void *DlOpen(const char *filename);
+		__device__ virtual void DlError(int bufLength, char *buf);
+		__device__ virtual void (*DlSym(void *handle, const char *symbol))();
+		__device__ virtual void DlClose(void *handle);
+
+		__device__ virtual int Randomness(int bufLength, char *buf);
+		__device__ virtual int Sleep(int microseconds);
+		__device__ virtual RC CurrentTimeInt64(int64 *now);
+		__device__ virtual RC CurrentTime(double *now);
+		__device__ virtual RC GetLastError(int bufLength, char *buf);
+
+		__device__ virtual RC SetSystemCall(const char *name, syscall_ptr newFunc);
+		__device__ virtual syscall_ptr GetSystemCall(const char *name);
+		__device__ virtual const char *NextSystemCall(const char *name);
+	};
+}
@@ -0,0 +1,396 @@
+﻿// vfsstat.c
+#include "Core.cu.h"
+#include "57.StatVSystem.cu.h"
+#include <new.h>
+
+namespace Core
+{
+#pragma region StatVFile
+
+	// The file handed out by a StatVSystem. The base VFS's own file lives right after it, at Real, and every call is passed on to it.
+	class StatVFile : public VFile
+	{
+	public:
+		StatVSystem *Vfs;			// The VFS this file was opened through, which holds the counters
+		VFile *Real;				// The file opened by the base VFS
+		StatVSystem::ROLE Role;		// What the file was opened for, from the OPEN_* flags
+
+	public:
+		__device__ virtual RC Read(void *buffer, int amount, int64 offset);
+		__device__ virtual RC Write(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Truncate(int64 size);
+		__device__ virtual RC Close();
+		__device__ virtual RC Sync(int flags);
+		__device__ virtual RC get_FileSize(int64 &size);
+
+		__device__ virtual RC Lock(LOCK lock);
+		__device__ virtual RC Unlock(LOCK lock);
+		__device__ virtual RC CheckReservedLock(int &lock);
+		__device__ virtual RC FileControl(FCNTL op, void *arg);
+
+		__device__ virtual uint get_SectorSize();
+		__device__ virtual IOCAP get_DeviceCharacteristics();
+
+		__device__ virtual RC ShmLock(int offset, int n, SHM flags);
+		__device__ virtual void ShmBarrier();
+		__device__ virtual RC ShmUnmap(bool deleteFlag);
+		__device__ virtual RC ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp);
+
+		__device__ virtual RC Fetch(int64 offset, int amount, void **pp);
+		__device__ virtual RC Unfetch(int64 offset, void *p);
+
+		__device__ virtual RC Readv(IOVec *vecs, int count, int64 offset);
+		__device__ virtual RC Writev(const IOVec *vecs, int count, int64 offset);
+
+		__device__ virtual RC ReadAsync(void *buffer, int amount, int64 offset);
+		__device__ virtual RC WriteAsync(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Wait();
+	};
+
+	__device__ RC StatVFile::Read(void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Read(buffer, amount, offset);
+		Vfs->Record(Role, StatVSystem::OP_READ, amount, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::Write(const void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Write(buffer, amount, offset);
+		Vfs->Record(Role, StatVSystem::OP_WRITE, amount, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::Truncate(int64 size)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Truncate(size);
+		Vfs->Record(Role, StatVSystem::OP_TRUNCATE, 0, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::Close()
+	{
+		RC rc = Real->Close();
+		Opened = false;
+		return rc;
+	}
+
+	__device__ RC StatVFile::Sync(int flags)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Sync(flags);
+		Vfs->Record(Role, StatVSystem::OP_SYNC, 0, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::get_FileSize(int64 &size)
+	{
+		return Real->get_FileSize(size);
+	}
+
+	__device__ RC StatVFile::Lock(LOCK lock)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Lock(lock);
+		Vfs->Record(Role, StatVSystem::OP_LOCK, 0, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::Unlock(LOCK lock)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Unlock(lock);
+		Vfs->Record(Role, StatVSystem::OP_LOCK, 0, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::CheckReservedLock(int &lock)
+	{
+		return Real->CheckReservedLock(lock);
+	}
+
+	__device__ RC StatVFile::FileControl(FCNTL op, void *arg)
+	{
+		return Real->FileControl(op, arg);
+	}
+
+	__device__ uint StatVFile::get_SectorSize()
+	{
+		return Real->get_SectorSize();
+	}
+
+	__device__ VFile::IOCAP StatVFile::get_DeviceCharacteristics()
+	{
+		return Real->get_DeviceCharacteristics();
+	}
+
+	__device__ RC StatVFile::ShmLock(int offset, int n, SHM flags)
+	{
+		return Real->ShmLock(offset, n, flags);
+	}
+
+	__device__ void StatVFile::ShmBarrier()
+	{
+		Real->ShmBarrier();
+	}
+
+	__device__ RC StatVFile::ShmUnmap(bool deleteFlag)
+	{
+		return Real->ShmUnmap(deleteFlag);
+	}
+
+	__device__ RC StatVFile::ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->ShmMap(region, sizeRegion, isWrite, pp);
+		Vfs->Record(Role, StatVSystem::OP_SHMMAP, sizeRegion, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::Fetch(int64 offset, int amount, void **pp)
+	{
+		return Real->Fetch(offset, amount, pp);
+	}
+
+	__device__ RC StatVFile::Unfetch(int64 offset, void *p)
+	{
+		return Real->Unfetch(offset, p);
+	}
+
+	__device__ RC StatVFile::Readv(IOVec *vecs, int count, int64 offset)
+	{
+		int64 amount = 0;
+		for (int i = 0; i < count; i++)
+			amount += vecs[i].Amount;
+		int64 start = SysEx::Now();
+		RC rc = Real->Readv(vecs, count, offset);
+		Vfs->Record(Role, StatVSystem::OP_READ, amount, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::Writev(const IOVec *vecs, int count, int64 offset)
+	{
+		int64 amount = 0;
+		for (int i = 0; i < count; i++)
+			amount += vecs[i].Amount;
+		int64 start = SysEx::Now();
+		RC rc = Real->Writev(vecs, count, offset);
+		Vfs->Record(Role, StatVSystem::OP_WRITE, amount, start);
+		return rc;
+	}
+
+	// Queued transfers are counted when they are queued, so their latency is only the cost of queuing them. The time spent waiting for them to
+	// complete shows up under OP_WAIT.
+	__device__ RC StatVFile::ReadAsync(void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->ReadAsync(buffer, amount, offset);
+		Vfs->Record(Role, StatVSystem::OP_READ, amount, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::WriteAsync(const void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->WriteAsync(buffer, amount, offset);
+		Vfs->Record(Role, StatVSystem::OP_WRITE, amount, start);
+		return rc;
+	}
+
+	__device__ RC StatVFile::Wait()
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Wait();
+		Vfs->Record(Role, StatVSystem::OP_WAIT, 0, start);
+		return rc;
+	}
+
+#pragma endregion
+
+#pragma region StatVSystem
+
+	// The base file is placed after the StatVFile, rounded so it keeps the 8-byte alignment the caller gave the whole buffer.
+#define STATVFILE_REAL(p) ((VFile *)((uint8 *)(p) + SysEx_ROUND8(sizeof(StatVFile))))
+
+	__device__ StatVSystem::ROLE StatVSystem::RoleOf(OPEN flags)
+	{
+		if (flags & OPEN_MAIN_DB) return ROLE_MAIN_DB;
+		if (flags & OPEN_MAIN_JOURNAL) return ROLE_MAIN_JOURNAL;
+		if (flags & OPEN_WAL) return ROLE_WAL;
+		if (flags & OPEN_SUBJOURNAL) return ROLE_SUBJOURNAL;
+		if (flags & OPEN_MASTER_JOURNAL) return ROLE_MASTER_JOURNAL;
+		if (flags & (OPEN_TEMP_DB | OPEN_TRANSIENT_DB | OPEN_TEMP_JOURNAL)) return ROLE_TEMP;
+		return ROLE_OTHER;
+	}
+
+	__device__ void StatVSystem::Record(ROLE role, OP op, int64 bytes, int64 start)
+	{
+		int64 elapsed = SysEx::Now() - start;
+		if (elapsed < 0) elapsed = 0;
+		int bucket = 0;
+		for (int64 v = elapsed; v > 0 && bucket < STATVSYSTEM_BUCKETS - 1; v >>= 1)
+			bucket++;
+		MutexEx::Enter(Mutex);
+		Counter *counter = &Totals.Ops[role][op];
+		counter->Calls++;
+		counter->Bytes += bytes;
+		counter->Micros += elapsed;
+		counter->Histogram[bucket]++;
+		MutexEx::Leave(Mutex);
+	}
+
+	// Copy the counters into stats, if it is not null, and zero them if reset is set. Both happen under the mutex, so no call is lost or counted
+	// twice between two snapshots that reset.
+	__device__ void StatVSystem::Snapshot(Stats *stats, bool reset)
+	{
+		MutexEx::Enter(Mutex);
+		if (stats)
+			_memcpy(stats, &Totals, sizeof(Stats));
+		if (reset)
+			_memset(&Totals, 0, sizeof(Stats));
+		MutexEx::Leave(Mutex);
+	}
+
+	__device__ static const char *const _statRoleNames[] = { "main_db", "main_journal", "wal", "subjournal", "master_journal", "temp", "other" };
+	__device__ static const char *const _statOpNames[] = { "read", "write", "sync", "truncate", "lock", "shmmap", "wait" };
+
+	__device__ const char *StatVSystem::RoleName(ROLE role)
+	{
+		return (role < ROLE_COUNT ? _statRoleNames[role] : nullptr);
+	}
+
+	__device__ const char *StatVSystem::OpName(OP op)
+	{
+		return (op < OP_COUNT ? _statOpNames[op] : nullptr);
+	}
+
+	// Stack a new VFS called name on the registered VFS called base. name must stay valid until Unregister(). Returns null if base is not
+	// registered or the allocation fails.
+	__device__ StatVSystem *StatVSystem::Register(const char *name, const char *base, bool _default)
+	{
+		VSystem *baseVfs = VSystem::Find(base);
+		if (!baseVfs)
+			return nullptr;
+		StatVSystem *vfs = (StatVSystem *)SysEx::Alloc(sizeof(StatVSystem), true);
+		if (!vfs)
+			return nullptr;
+		vfs = new (vfs) StatVSystem();
+		vfs->Base = baseVfs;
+		vfs->Name = name;
+		vfs->SizeOsFile = SysEx_ROUND8(sizeof(StatVFile)) + baseVfs->SizeOsFile;
+		vfs->MaxPathname = baseVfs->MaxPathname;
+		vfs->Mutex = MutexEx::Alloc(MutexEx::MUTEX_FAST);
+		VSystem::RegisterVfs(vfs, _default);
+		return vfs;
+	}
+
+	__device__ void StatVSystem::Unregister(StatVSystem *vfs)
+	{
+		if (!vfs) return;
+		VSystem::UnregisterVfs(vfs);
+		MutexEx::Free(vfs->Mutex);
+		SysEx::Free(vfs);
+	}
+
+	__device__ VFile *StatVSystem::_AttachFile(void *buffer)
+	{
+		StatVFile *file = new (buffer) StatVFile();
+		file->Vfs = this;
+		file->Real = Base->_AttachFile(STATVFILE_REAL(file));
+		return file;
+	}
+
+	__device__ RC StatVSystem::Open(const char *path, VFile *id, OPEN flags, OPEN *outFlags)
+	{
+		StatVFile *file = (StatVFile *)id;
+		_assert(file != nullptr);
+		_memset(file, 0, sizeof(StatVFile));
+		file = new (file) StatVFile();
+		file->Vfs = this;
+		file->Real = STATVFILE_REAL(file);
+		file->Role = RoleOf(flags);
+		RC rc = Base->Open(path, file->Real, flags, outFlags);
+		file->Opened = (rc == RC::OK && file->Real->Opened);
+		return rc;
+	}
+
+	__device__ RC StatVSystem::Delete(const char *path, bool syncDirectory)
+	{
+		return Base->Delete(path, syncDirectory);
+	}
+
+	__device__ RC StatVSystem::Access(const char *path, ACCESS flags, int *outRC)
+	{
+		return Base->Access(path, flags, outRC);
+	}
+
+	__device__ RC StatVSystem::FullPathname(const char *path, int pathOutLength, char *pathOut)
+	{
+		return Base->FullPathname(path, pathOutLength, pathOut);
+	}
+
+	__device__ void *StatVSystem::DlOpen(const char *filename)
+	{
+		return Base->DlOpen(filename);
+	}
+
+	__device__ void StatVSystem::DlError(int bufLength, char *buf)
+	{
+		Base->DlError(bufLength, buf);
+	}
+
+	__device__ void (*StatVSystem::DlSym(void *handle, const char *symbol))()
+	{
+		return Base->DlSym(handle, symbol);
+	}
+
+	__device__ void StatVSystem::DlClose(void *handle)
+	{
+		Base->DlClose(handle);
+	}
+
+	__device__ int StatVSystem::Randomness(int bufLength, char *buf)
+	{
+		return Base->Randomness(bufLength, buf);
+	}
+
+	__device__ int StatVSystem::Sleep(int microseconds)
+	{
+		return Base->Sleep(microseconds);
+	}
+
+	__device__ RC StatVSystem::CurrentTimeInt64(int64 *now)
+	{
+		return Base->CurrentTimeInt64(now);
+	}
+
+	__device__ RC StatVSystem::CurrentTime(double *now)
+	{
+		return Base->CurrentTime(now);
+	}
+
+	__device__ RC StatVSystem::GetLastError(int bufLength, char *buf)
+	{
+		return Base->GetLastError(bufLength, buf);
+	}
+
+	__device__ RC StatVSystem::SetSystemCall(const char *name, syscall_ptr newFunc)
+	{
+		return Base->SetSystemCall(name, newFunc);
+	}
+
+	__device__ syscall_ptr StatVSystem::GetSystemCall(const char *name)
+	{
+		return Base->GetSystemCall(name);
+	}
+
+	__device__ const char *StatVSystem::NextSystemCall(const char *name)
+	{
+		return Base->NextSystemCall(name);
+	}
+
+#pragma endregion
+}
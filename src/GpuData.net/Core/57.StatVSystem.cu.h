@@ -0,0 +1,84 @@
+﻿// vfsstat.c
+#pragma once
+namespace Core
+{
+#ifndef STATVSYSTEM_BUCKETS // Latency buckets per counter. Bucket b counts calls that took at least 2^(b-1) and under 2^b microseconds
+#define STATVSYSTEM_BUCKETS 24
+#endif
+
+	// A VFS stacked on another registered VFS that passes every call through and counts the calls, bytes and latency of the file operations,
+	// split by the role the file was opened for. Register() creates one over the VFS named base; Snapshot() copies out what it has counted so far.
+	class StatVSystem : public VSystem
+	{
+	public:
+		enum ROLE : uint8
+		{
+			ROLE_MAIN_DB = 0,
+			ROLE_MAIN_JOURNAL = 1,
+			ROLE_WAL = 2,
+			ROLE_SUBJOURNAL = 3,
+			ROLE_MASTER_JOURNAL = 4,
+			ROLE_TEMP = 5,			// Temp and transient databases and their journals
+			ROLE_OTHER = 6,
+			ROLE_COUNT = 7,
+		};
+
+		enum OP : uint8
+		{
+			OP_READ = 0,			// Read(), Readv() and ReadAsync()
+			OP_WRITE = 1,			// Write(), Writev() and WriteAsync()
+			OP_SYNC = 2,
+			OP_TRUNCATE = 3,
+			OP_LOCK = 4,			// Lock() and Unlock()
+			OP_SHMMAP = 5,
+			OP_WAIT = 6,			// Wait() for queued async transfers
+			OP_COUNT = 7,
+		};
+
+		struct Counter
+		{
+			int64 Calls;
+			int64 Bytes;			// Bytes requested by reads and writes
+			int64 Micros;			// Total time spent in the calls
+			int64 Histogram[STATVSYSTEM_BUCKETS]; // Calls by latency, the last bucket also takes everything slower
+		};
+
+		struct Stats
+		{
+			Counter Ops[ROLE_COUNT][OP_COUNT];
+		};
+
+		VSystem *Base;				// The VFS every call is passed to
+		MutexEx Mutex;				// Guards Totals
+		Stats Totals;				// Counted since Register() or the last reset
+
+		__device__ static StatVSystem *Register(const char *name, const char *base, bool _default);
+		__device__ static void Unregister(StatVSystem *vfs);
+		__device__ void Snapshot(Stats *stats, bool reset);
+		__device__ void Record(ROLE role, OP op, int64 bytes, int64 start);
+		__device__ static ROLE RoleOf(OPEN flags);
+		__device__ static const char *RoleName(ROLE role);
+		__device__ static const char *OpName(OP op);
+
+		__device__ virtual IO::VFile *_AttachFile(void *buffer);
+		__device__ virtual RC Open(const char *path, IO::VFile *file, OPEN flags, OPEN *outFlags);
+		__device__ virtual RC Delete(const char *path, bool syncDirectory);
+		__device__ virtual RC Access(const char *path, ACCESS flags, int *outRC);
+		__device__ virtual RC FullPathname(const char *path, int pathOutLength, char *pathOut);
+
+		__device__ virtual void *DlOpen(const char *filename);
+		__device__ virtual void DlError(int bufLength, char *buf);
+		__device__ virtual void (*DlSym(void *handle, const char *symbol))();
+		__device__ virtual void DlClose(void *handle);
+
+		__device__ virtual int Randomness(int bufLength, char *buf);
+		__device__ virtual int Sleep(int microseconds);
+		__device__ virtual RC CurrentTimeInt64(int64 *now);
+		__device__ virtual RC CurrentTime(double *now);
+		__device__ virtual RC GetLastError(int bufLength, char *buf);
+
+		__device__ virtual RC SetSystemCall(const char *name, syscall_ptr newFunc);
+		__device__ virtual syscall_ptr GetSystemCall(const char *name);
+		__device__ virtual const char *NextSystemCall(const char *name);
+	};
+}
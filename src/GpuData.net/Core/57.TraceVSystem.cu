@@ -0,0 +1,685 @@
+﻿// vfstrace.c
+#include "Core.cu.h"
+#include "57.StatVSystem.cu.h"
+#include "57.TraceVSystem.cu.h"
+#include <new.h>
+
+namespace Core
+{
+#pragma region TraceVFile
+
+	// The file handed out by a TraceVSystem. The base VFS's own file lives right after it, at Real.
+	class TraceVFile : public VFile
+	{
+	public:
+		TraceVSystem *Vfs;			// The VFS this file was opened through, which holds the trace
+		VFile *Real;				// The file opened by the base VFS
+		uint16 ID;					// File number recorded with every call on this file
+		uint8 Role;					// StatVSystem::ROLE of the file, from the OPEN_* flags
+
+	public:
+		__device__ virtual RC Read(void *buffer, int amount, int64 offset);
+		__device__ virtual RC Write(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Truncate(int64 size);
+		__device__ virtual RC Close();
+		__device__ virtual RC Sync(int flags);
+		__device__ virtual RC get_FileSize(int64 &size);
+
+		__device__ virtual RC Lock(LOCK lock);
+		__device__ virtual RC Unlock(LOCK lock);
+		__device__ virtual RC CheckReservedLock(int &lock);
+		__device__ virtual RC FileControl(FCNTL op, void *arg);
+
+		__device__ virtual uint get_SectorSize();
+		__device__ virtual IOCAP get_DeviceCharacteristics();
+
+		__device__ virtual RC ShmLock(int offset, int n, SHM flags);
+		__device__ virtual void ShmBarrier();
+		__device__ virtual RC ShmUnmap(bool deleteFlag);
+		__device__ virtual RC ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp);
+
+		__device__ virtual RC Fetch(int64 offset, int amount, void **pp);
+		__device__ virtual RC Unfetch(int64 offset, void *p);
+
+		__device__ virtual RC Readv(IOVec *vecs, int count, int64 offset);
+		__device__ virtual RC Writev(const IOVec *vecs, int count, int64 offset);
+
+		__device__ virtual RC ReadAsync(void *buffer, int amount, int64 offset);
+		__device__ virtual RC WriteAsync(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Wait();
+	};
+
+	__device__ RC TraceVFile::Read(void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Read(buffer, amount, offset);
+		Vfs->Record(TraceVSystem::TRACEOP_READ, Role, ID, amount, offset, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Write(const void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Write(buffer, amount, offset);
+		Vfs->Record(TraceVSystem::TRACEOP_WRITE, Role, ID, amount, offset, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Truncate(int64 size)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Truncate(size);
+		Vfs->Record(TraceVSystem::TRACEOP_TRUNCATE, Role, ID, 0, size, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Close()
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Close();
+		Vfs->Record(TraceVSystem::TRACEOP_CLOSE, Role, ID, 0, 0, start, 0, rc, nullptr);
+		Opened = false;
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Sync(int flags)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Sync(flags);
+		Vfs->Record(TraceVSystem::TRACEOP_SYNC, Role, ID, 0, 0, start, (uint32)flags, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::get_FileSize(int64 &size)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->get_FileSize(size);
+		Vfs->Record(TraceVSystem::TRACEOP_FILESIZE, Role, ID, 0, size, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Lock(LOCK lock)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Lock(lock);
+		Vfs->Record(TraceVSystem::TRACEOP_LOCK, Role, ID, 0, 0, start, (uint32)lock, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Unlock(LOCK lock)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Unlock(lock);
+		Vfs->Record(TraceVSystem::TRACEOP_UNLOCK, Role, ID, 0, 0, start, (uint32)lock, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::CheckReservedLock(int &lock)
+	{
+		return Real->CheckReservedLock(lock);
+	}
+
+	__device__ RC TraceVFile::FileControl(FCNTL op, void *arg)
+	{
+		return Real->FileControl(op, arg);
+	}
+
+	__device__ uint TraceVFile::get_SectorSize()
+	{
+		return Real->get_SectorSize();
+	}
+
+	__device__ VFile::IOCAP TraceVFile::get_DeviceCharacteristics()
+	{
+		return Real->get_DeviceCharacteristics();
+	}
+
+	__device__ RC TraceVFile::ShmLock(int offset, int n, SHM flags)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->ShmLock(offset, n, flags);
+		Vfs->Record(TraceVSystem::TRACEOP_SHMLOCK, Role, ID, n, offset, start, (uint32)flags, rc, nullptr);
+		return rc;
+	}
+
+	__device__ void TraceVFile::ShmBarrier()
+	{
+		Real->ShmBarrier();
+	}
+
+	__device__ RC TraceVFile::ShmUnmap(bool deleteFlag)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->ShmUnmap(deleteFlag);
+		Vfs->Record(TraceVSystem::TRACEOP_SHMUNMAP, Role, ID, 0, 0, start, deleteFlag, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->ShmMap(region, sizeRegion, isWrite, pp);
+		Vfs->Record(TraceVSystem::TRACEOP_SHMMAP, Role, ID, sizeRegion, region, start, isWrite, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Fetch(int64 offset, int amount, void **pp)
+	{
+		return Real->Fetch(offset, amount, pp);
+	}
+
+	__device__ RC TraceVFile::Unfetch(int64 offset, void *p)
+	{
+		return Real->Unfetch(offset, p);
+	}
+
+	__device__ RC TraceVFile::Readv(IOVec *vecs, int count, int64 offset)
+	{
+		int64 amount = 0;
+		for (int i = 0; i < count; i++)
+			amount += vecs[i].Amount;
+		int64 start = SysEx::Now();
+		RC rc = Real->Readv(vecs, count, offset);
+		Vfs->Record(TraceVSystem::TRACEOP_READ, Role, ID, amount, offset, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Writev(const IOVec *vecs, int count, int64 offset)
+	{
+		int64 amount = 0;
+		for (int i = 0; i < count; i++)
+			amount += vecs[i].Amount;
+		int64 start = SysEx::Now();
+		RC rc = Real->Writev(vecs, count, offset);
+		Vfs->Record(TraceVSystem::TRACEOP_WRITE, Role, ID, amount, offset, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::ReadAsync(void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->ReadAsync(buffer, amount, offset);
+		Vfs->Record(TraceVSystem::TRACEOP_READASYNC, Role, ID, amount, offset, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::WriteAsync(const void *buffer, int amount, int64 offset)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->WriteAsync(buffer, amount, offset);
+		Vfs->Record(TraceVSystem::TRACEOP_WRITEASYNC, Role, ID, amount, offset, start, 0, rc, nullptr);
+		return rc;
+	}
+
+	__device__ RC TraceVFile::Wait()
+	{
+		int64 start = SysEx::Now();
+		RC rc = Real->Wait();
+		Vfs->Record(TraceVSystem::TRACEOP_WAIT, Role, ID, 0, 0, start, 0, rc, nullptr);
+		return rc;
+	}
+
+#pragma endregion
+
+#pragma region Record
+
+#define TRACEVFILE_REAL(p) ((VFile *)((uint8 *)(p) + SysEx_ROUND8(sizeof(TraceVFile))))
+#define TRACE_FLAGS ((VSystem::OPEN)(VSystem::OPEN_TRANSIENT_DB | VSystem::OPEN_READWRITE | VSystem::OPEN_CREATE))
+
+	__device__ static const char _traceMagic[] = "GpuDataTrace";
+
+	__device__ static void tracePut8(uint8 *p, int64 v)
+	{
+		ConvertEx::Put4(p, (uint32)(v >> 32));
+		ConvertEx::Put4(&p[4], (uint32)v);
+	}
+
+	__device__ static int64 traceGet8(const uint8 *p)
+	{
+		return ((int64)ConvertEx::Get4(p) << 32) | ConvertEx::Get4(&p[4]);
+	}
+
+	// Write the buffered records to the trace. The caller holds the mutex.
+	__device__ static RC traceFlush(TraceVSystem *vfs)
+	{
+		if (vfs->TraceError != RC::OK || vfs->BufferLength == 0)
+			return vfs->TraceError;
+		RC rc = vfs->Trace->Write(vfs->Buffer, vfs->BufferLength, vfs->TraceOffset);
+		if (rc == RC::OK)
+			vfs->TraceOffset += vfs->BufferLength;
+		else
+			vfs->TraceError = rc;
+		vfs->BufferLength = 0;
+		return rc;
+	}
+
+	__device__ RC TraceVSystem::Flush()
+	{
+		MutexEx::Enter(Mutex);
+		RC rc = traceFlush(this);
+		MutexEx::Leave(Mutex);
+		return rc;
+	}
+
+	// Append one record. Records are added as calls complete, so calls made from several threads may not be in start time order.
+	__device__ void TraceVSystem::Record(TRACEOP op, uint8 role, uint16 file, int64 amount, int64 offset, int64 start, uint32 arg, RC rc, const char *path)
+	{
+		int64 elapsed = SysEx::Now() - start;
+		int pathLength = (path ? _strlen30(path) : 0);
+		if (pathLength > TRACEVSYSTEM_BUFFER - TRACEVSYSTEM_RECORD)
+			pathLength = TRACEVSYSTEM_BUFFER - TRACEVSYSTEM_RECORD;
+		MutexEx::Enter(Mutex);
+		if (BufferLength + TRACEVSYSTEM_RECORD + pathLength > TRACEVSYSTEM_BUFFER)
+			traceFlush(this);
+		if (TraceError == RC::OK)
+		{
+			uint8 *p = &Buffer[BufferLength];
+			p[0] = (uint8)op;
+			p[1] = role;
+			ConvertEx::Put2(&p[2], file);
+			ConvertEx::Put4(&p[4], (uint32)(op == TRACEOP_OPEN || op == TRACEOP_DELETE ? pathLength : amount));
+			tracePut8(&p[8], offset);
+			tracePut8(&p[16], start - Start);
+			ConvertEx::Put4(&p[24], (uint32)elapsed);
+			ConvertEx::Put4(&p[28], arg);
+			ConvertEx::Put4(&p[32], (uint32)rc);
+			if (pathLength > 0)
+				_memcpy(&p[TRACEVSYSTEM_RECORD], path, pathLength);
+			BufferLength += TRACEVSYSTEM_RECORD + pathLength;
+		}
+		MutexEx::Leave(Mutex);
+	}
+
+#pragma endregion
+
+#pragma region TraceVSystem
+
+	// Stack a new VFS called name on the registered VFS called base and start a trace in tracePath, which is created or overwritten through base.
+	// name and tracePath must stay valid until Unregister(). Returns null if base is not registered, the trace cannot be opened or memory runs out.
+	__device__ TraceVSystem *TraceVSystem::Register(const char *name, const char *base, const char *tracePath, bool _default)
+	{
+		VSystem *baseVfs = VSystem::Find(base);
+		if (!baseVfs)
+			return nullptr;
+		TraceVSystem *vfs = (TraceVSystem *)SysEx::Alloc(sizeof(TraceVSystem), true);
+		if (!vfs)
+			return nullptr;
+		vfs = new (vfs) TraceVSystem();
+		vfs->Base = baseVfs;
+		vfs->Trace = (VFile *)SysEx::Alloc(baseVfs->SizeOsFile, true);
+		vfs->Buffer = (uint8 *)SysEx::Alloc(TRACEVSYSTEM_BUFFER);
+		if (!vfs->Trace || !vfs->Buffer || baseVfs->Open(tracePath, vfs->Trace, TRACE_FLAGS, nullptr) != RC::OK || vfs->Trace->Truncate(0) != RC::OK)
+		{
+			if (vfs->Trace && vfs->Trace->Opened) vfs->Trace->Close();
+			SysEx::Free(vfs->Trace);
+			SysEx::Free(vfs->Buffer);
+			SysEx::Free(vfs);
+			return nullptr;
+		}
+		_memcpy(vfs->Buffer, _traceMagic, TRACEVSYSTEM_HEADER - 4);
+		ConvertEx::Put4(&vfs->Buffer[TRACEVSYSTEM_HEADER - 4], TRACEVSYSTEM_RECORD);
+		vfs->BufferLength = TRACEVSYSTEM_HEADER;
+		vfs->Start = SysEx::Now();
+		vfs->Name = name;
+		vfs->SizeOsFile = SysEx_ROUND8(sizeof(TraceVFile)) + baseVfs->SizeOsFile;
+		vfs->MaxPathname = baseVfs->MaxPathname;
+		vfs->Mutex = MutexEx::Alloc(MutexEx::MUTEX_FAST);
+		VSystem::RegisterVfs(vfs, _default);
+		return vfs;
+	}
+
+	// Unregister the VFS, write out what is still buffered and close the trace. Files opened through it must be closed first. Returns the first
+	// error met writing the trace, in which case the trace is cut short at that point.
+	__device__ RC TraceVSystem::Unregister(TraceVSystem *vfs)
+	{
+		if (!vfs) return RC::OK;
+		VSystem::UnregisterVfs(vfs);
+		RC rc = traceFlush(vfs);
+		if (rc == RC::OK)
+			rc = vfs->Trace->Sync(VFile::SYNC_NORMAL);
+		vfs->Trace->Close();
+		MutexEx::Free(vfs->Mutex);
+		SysEx::Free(vfs->Trace);
+		SysEx::Free(vfs->Buffer);
+		SysEx::Free(vfs);
+		return rc;
+	}
+
+	__device__ VFile *TraceVSystem::_AttachFile(void *buffer)
+	{
+		TraceVFile *file = new (buffer) TraceVFile();
+		file->Vfs = this;
+		file->Real = Base->_AttachFile(TRACEVFILE_REAL(file));
+		return file;
+	}
+
+	__device__ RC TraceVSystem::Open(const char *path, VFile *id, OPEN flags, OPEN *outFlags)
+	{
+		TraceVFile *file = (TraceVFile *)id;
+		_assert(file != nullptr);
+		_memset(file, 0, sizeof(TraceVFile));
+		file = new (file) TraceVFile();
+		file->Vfs = this;
+		file->Real = TRACEVFILE_REAL(file);
+		file->Role = (uint8)StatVSystem::RoleOf(flags);
+		MutexEx::Enter(Mutex);
+		file->ID = NextFile++;
+		MutexEx::Leave(Mutex);
+		int64 start = SysEx::Now();
+		RC rc = Base->Open(path, file->Real, flags, outFlags);
+		Record(TRACEOP_OPEN, file->Role, file->ID, 0, 0, start, (uint32)flags, rc, path);
+		file->Opened = (rc == RC::OK && file->Real->Opened);
+		return rc;
+	}
+
+	__device__ RC TraceVSystem::Delete(const char *path, bool syncDirectory)
+	{
+		int64 start = SysEx::Now();
+		RC rc = Base->Delete(path, syncDirectory);
+		Record(TRACEOP_DELETE, StatVSystem::ROLE_OTHER, 0, 0, 0, start, syncDirectory, rc, path);
+		return rc;
+	}
+
+	__device__ RC TraceVSystem::Access(const char *path, ACCESS flags, int *outRC)
+	{
+		return Base->Access(path, flags, outRC);
+	}
+
+	__device__ RC TraceVSystem::FullPathname(const char *path, int pathOutLength, char *pathOut)
+	{
+		return Base->FullPathname(path, pathOutLength, pathOut);
+	}
+
+	__device__ void *TraceVSystem::DlOpen(const char *filename)
+	{
+		return Base->DlOpen(filename);
+	}
+
+	__device__ void TraceVSystem::DlError(int bufLength, char *buf)
+	{
+		Base->DlError(bufLength, buf);
+	}
+
+	__device__ void (*TraceVSystem::DlSym(void *handle, const char *symbol))()
+	{
+		return Base->DlSym(handle, symbol);
+	}
+
+	__device__ void TraceVSystem::DlClose(void *handle)
+	{
+		Base->DlClose(handle);
+	}
+
+	__device__ int TraceVSystem::Randomness(int bufLength, char *buf)
+	{
+		return Base->Randomness(bufLength, buf);
+	}
+
+	__device__ int TraceVSystem::Sleep(int microseconds)
+	{
+		return Base->Sleep(microseconds);
+	}
+
+	__device__ RC TraceVSystem::CurrentTimeInt64(int64 *now)
+	{
+		return Base->CurrentTimeInt64(now);
+	}
+
+	__device__ RC TraceVSystem::CurrentTime(double *now)
+	{
+		return Base->CurrentTime(now);
+	}
+
+	__device__ RC TraceVSystem::GetLastError(int bufLength, char *buf)
+	{
+		return Base->GetLastError(bufLength, buf);
+	}
+
+	__device__ RC TraceVSystem::SetSystemCall(const char *name, syscall_ptr newFunc)
+	{
+		return Base->SetSystemCall(name, newFunc);
+	}
+
+	__device__ syscall_ptr TraceVSystem::GetSystemCall(const char *name)
+	{
+		return Base->GetSystemCall(name);
+	}
+
+	__device__ const char *TraceVSystem::NextSystemCall(const char *name)
+	{
+		return Base->NextSystemCall(name);
+	}
+
+#pragma endregion
+
+#pragma region Replay
+
+#ifndef TRACEVSYSTEM_REPLAY_FILES // Files a replay can have open at once
+#define TRACEVSYSTEM_REPLAY_FILES 32
+#endif
+
+	// State of one replay: the trace being read, the files it has opened and the scratch buffer every transfer uses.
+	struct TraceReplay
+	{
+		VSystem *Vfs;				// The VFS the trace is replayed against
+		VFile *Trace;				// The trace, opened through Vfs
+		int64 TraceSize;			// Size of the trace in bytes
+		int64 TraceOffset;			// Trace offset of Buffer[0]
+		uint8 *Buffer;				// TRACEVSYSTEM_BUFFER bytes of the trace
+		int BufferLength;			// Bytes of Buffer[] holding trace
+		int BufferOffset;			// Next unread byte of Buffer[]
+		uint8 *Scratch;				// Zeros written by writes, and where reads land
+		int ScratchLength;			// Size of Scratch[] in bytes
+		uint16 IDs[TRACEVSYSTEM_REPLAY_FILES]; // Trace file numbers of the files open in Files[]
+		VFile *Files[TRACEVSYSTEM_REPLAY_FILES]; // Open files, or null for a free slot
+		char *Paths[TRACEVSYSTEM_REPLAY_FILES]; // Paths they were opened with, which the VFS may keep pointing at until they close
+	};
+
+	// Copy the next amount bytes of the trace to out, reading another buffer of it as needed. Returns false at the end of the trace.
+	__device__ static bool replayRead(TraceReplay *r, uint8 *out, int amount)
+	{
+		while (amount > 0)
+		{
+			if (r->BufferOffset == r->BufferLength)
+			{
+				r->TraceOffset += r->BufferLength;
+				int64 left = r->TraceSize - r->TraceOffset;
+				if (left <= 0)
+					return false;
+				r->BufferLength = (int)(left < TRACEVSYSTEM_BUFFER ? left : TRACEVSYSTEM_BUFFER);
+				r->BufferOffset = 0;
+				if (r->Trace->Read(r->Buffer, r->BufferLength, r->TraceOffset) != RC::OK)
+					return false;
+			}
+			int n = r->BufferLength - r->BufferOffset;
+			if (n > amount) n = amount;
+			_memcpy(out, &r->Buffer[r->BufferOffset], n);
+			r->BufferOffset += n;
+			out += n;
+			amount -= n;
+		}
+		return true;
+	}
+
+	__device__ static int replayFind(TraceReplay *r, uint16 id)
+	{
+		for (int i = 0; i < TRACEVSYSTEM_REPLAY_FILES; i++)
+			if (r->Files[i] && r->IDs[i] == id)
+				return i;
+		return -1;
+	}
+
+	// Make Scratch[] at least amount bytes. Queued transfers may still point into the old buffer, so they are waited for before it is freed.
+	__device__ static bool replayScratch(TraceReplay *r, int64 amount)
+	{
+		if (amount <= r->ScratchLength)
+			return true;
+		if (amount > 0x7fffffff)
+			return false;
+		int newLength = (r->ScratchLength ? r->ScratchLength : 4096);
+		while (newLength < amount)
+			newLength = (newLength > 0x3fffffff ? 0x7fffffff : newLength * 2);
+		uint8 *scratch = (uint8 *)SysEx::Alloc(newLength, true);
+		if (!scratch)
+			return false;
+		for (int i = 0; i < TRACEVSYSTEM_REPLAY_FILES; i++)
+			if (r->Files[i])
+				r->Files[i]->Wait();
+		SysEx::Free(r->Scratch);
+		r->Scratch = scratch;
+		r->ScratchLength = newLength;
+		return true;
+	}
+
+	// Closes replay file i, if its open still holds, and releases its slot. Returns the result of the close.
+	__device__ static RC replayClose(TraceReplay *r, int i)
+	{
+		RC rc = RC::OK;
+		if (r->Files[i]->Opened)
+			rc = r->Files[i]->Close();
+		SysEx::Free(r->Files[i]);
+		SysEx::Free(r->Paths[i]);
+		r->Files[i] = nullptr;
+		r->Paths[i] = nullptr;
+		return rc;
+	}
+
+	// Issue one record against the replay VFS and return its result. A record that cannot be issued, because its file is not open or a buffer
+	// cannot be had, returns RC::MISUSE or RC::NOMEM, which no recorded call returns from these operations.
+	__device__ static RC replayRecord(TraceReplay *r, TraceVSystem::TRACEOP op, uint16 id, int64 amount, int64 offset, uint32 arg, char *path)
+	{
+		int i;
+		if (op == TraceVSystem::TRACEOP_OPEN)
+		{
+			for (i = 0; i < TRACEVSYSTEM_REPLAY_FILES && r->Files[i]; i++) { }
+			if (i == TRACEVSYSTEM_REPLAY_FILES)
+				return RC::MISUSE;
+			VFile *file = (VFile *)SysEx::Alloc(r->Vfs->SizeOsFile, true);
+			if (!file)
+				return RC::NOMEM;
+			VSystem::OPEN outFlags;
+			RC rc = r->Vfs->Open(path, file, (VSystem::OPEN)arg, &outFlags);
+			if (rc != RC::OK)
+			{
+				SysEx::Free(file);
+				return rc;
+			}
+			r->Files[i] = file;
+			r->Paths[i] = path;
+			r->IDs[i] = id;
+			return rc;
+		}
+		if (op == TraceVSystem::TRACEOP_DELETE)
+			return r->Vfs->Delete(path, arg != 0);
+		if ((i = replayFind(r, id)) < 0)
+			return RC::MISUSE;
+		VFile *file = r->Files[i];
+		int64 size;
+		void volatile *region;
+		switch (op)
+		{
+		case TraceVSystem::TRACEOP_CLOSE:
+			return replayClose(r, i);
+		case TraceVSystem::TRACEOP_READ:
+			if (!replayScratch(r, amount)) return RC::NOMEM;
+			return file->Read(r->Scratch, (int)amount, offset);
+		case TraceVSystem::TRACEOP_WRITE:
+			if (!replayScratch(r, amount)) return RC::NOMEM;
+			return file->Write(r->Scratch, (int)amount, offset);
+		case TraceVSystem::TRACEOP_READASYNC:
+			if (!replayScratch(r, amount)) return RC::NOMEM;
+			return file->ReadAsync(r->Scratch, (int)amount, offset);
+		case TraceVSystem::TRACEOP_WRITEASYNC:
+			if (!replayScratch(r, amount)) return RC::NOMEM;
+			return file->WriteAsync(r->Scratch, (int)amount, offset);
+		case TraceVSystem::TRACEOP_WAIT: return file->Wait();
+		case TraceVSystem::TRACEOP_TRUNCATE: return file->Truncate(offset);
+		case TraceVSystem::TRACEOP_SYNC: return file->Sync((int)arg);
+		case TraceVSystem::TRACEOP_FILESIZE: return file->get_FileSize(size);
+		case TraceVSystem::TRACEOP_LOCK: return file->Lock((VFile::LOCK)arg);
+		case TraceVSystem::TRACEOP_UNLOCK: return file->Unlock((VFile::LOCK)arg);
+		case TraceVSystem::TRACEOP_SHMMAP: return file->ShmMap((int)offset, (int)amount, arg != 0, &region);
+		case TraceVSystem::TRACEOP_SHMLOCK: return file->ShmLock((int)offset, (int)amount, (VFile::SHM)arg);
+		case TraceVSystem::TRACEOP_SHMUNMAP: return file->ShmUnmap(arg != 0);
+		}
+		return RC::MISUSE;
+	}
+
+	// Replay the trace in tracePath against vfs, which also opens the trace. Every recorded path has suffix appended, if it is not null, so a replay
+	// need not touch the files the trace was taken from. With timed set each call is held back until its recorded time from the start of the trace;
+	// otherwise calls are issued back to back. Returns an error only if the trace cannot be read; calls that fail are counted in result->Failed.
+	__device__ RC TraceVSystem::Replay(VSystem *vfs, const char *tracePath, const char *suffix, bool timed, ReplayResult *result)
+	{
+		_memset(result, 0, sizeof(ReplayResult));
+		TraceReplay *r = (TraceReplay *)SysEx::Alloc(sizeof(TraceReplay), true);
+		if (!r)
+			return RC::NOMEM;
+		r->Vfs = vfs;
+		r->Trace = (VFile *)SysEx::Alloc(vfs->SizeOsFile, true);
+		r->Buffer = (uint8 *)SysEx::Alloc(TRACEVSYSTEM_BUFFER);
+		RC rc;
+		if (!r->Trace || !r->Buffer)
+			rc = RC::NOMEM;
+		else if ((rc = vfs->Open(tracePath, r->Trace, (VSystem::OPEN)(VSystem::OPEN_TRANSIENT_DB | VSystem::OPEN_READONLY), nullptr)) == RC::OK)
+			rc = r->Trace->get_FileSize(r->TraceSize);
+		uint8 header[TRACEVSYSTEM_HEADER];
+		if (rc == RC::OK && (!replayRead(r, header, TRACEVSYSTEM_HEADER) || _memcmp(header, _traceMagic, TRACEVSYSTEM_HEADER - 4) || ConvertEx::Get4(&header[TRACEVSYSTEM_HEADER - 4]) != TRACEVSYSTEM_RECORD))
+			rc = RC::NOTADB;
+		int suffixLength = (suffix ? _strlen30(suffix) : 0);
+		int64 start = SysEx::Now();
+		uint8 record[TRACEVSYSTEM_RECORD];
+		while (rc == RC::OK && replayRead(r, record, TRACEVSYSTEM_RECORD))
+		{
+			TRACEOP op = (TRACEOP)record[0];
+			uint16 id = ConvertEx::Get2(&record[2]);
+			int64 amount = ConvertEx::Get4(&record[4]);
+			int64 offset = traceGet8(&record[8]);
+			int64 time = traceGet8(&record[16]);
+			uint32 arg = ConvertEx::Get4(&record[28]);
+			RC recorded = (RC)ConvertEx::Get4(&record[32]);
+			char *path = nullptr;
+			if ((op == TRACEOP_OPEN || op == TRACEOP_DELETE) && amount > 0)
+			{
+				if (!(path = (char *)SysEx::Alloc((int)amount + suffixLength + 1)))
+				{
+					rc = RC::NOMEM;
+					break;
+				}
+				if (!replayRead(r, (uint8 *)path, (int)amount))
+				{
+					SysEx::Free(path);
+					rc = RC::NOTADB;
+					break;
+				}
+				if (suffixLength > 0)
+					_memcpy(&path[amount], suffix, suffixLength);
+				path[amount + suffixLength] = 0;
+			}
+			if (timed)
+			{
+				int64 wait = start + time - SysEx::Now();
+				if (wait > 0)
+					vfs->Sleep((int)wait);
+			}
+			RC got = replayRecord(r, op, id, amount, offset, arg, path);
+			if (path && (op != TRACEOP_OPEN || got != RC::OK))
+				SysEx::Free(path);
+			result->Records++;
+			if (got != recorded)
+				result->Failed++;
+		}
+		result->Micros = SysEx::Now() - start;
+		for (int i = 0; i < TRACEVSYSTEM_REPLAY_FILES; i++)
+			if (r->Files[i])
+				replayClose(r, i);
+		if (r->Trace && r->Trace->Opened)
+			r->Trace->Close();
+		SysEx::Free(r->Trace);
+		SysEx::Free(r->Buffer);
+		SysEx::Free(r->Scratch);
+		SysEx::Free(r);
+		return rc;
+	}
+
+#pragma endregion
+}
@@ -0,0 +1,85 @@
+﻿// vfstrace.c
+#pragma once
+namespace Core
+{
+#ifndef TRACEVSYSTEM_BUFFER // Bytes of trace held in memory before they are written out, and the read size used by Replay()
+#define TRACEVSYSTEM_BUFFER (64 * 1024)
+#endif
+#define TRACEVSYSTEM_HEADER 16		// "GpuDataTrace", then the record size as a 4-byte big-endian integer
+#define TRACEVSYSTEM_RECORD 36		// Bytes in one record, not counting the path that follows OPEN and DELETE
+
+	// A VFS stacked on another registered VFS that passes every call through and appends one record per call to a binary trace file, written
+	// through the base VFS. Replay() issues a recorded trace against any VFS, as fast as it can or at the recorded times, so the I/O of a real
+	// workload can be run again unchanged against another VFS or sync policy. Register a StatVSystem over the replay target to see where the time goes.
+	//
+	// Each record is, big-endian: op (1), file role (1), file number (2), amount (4), offset (8), start time in microseconds from the start of the
+	// trace (8), elapsed microseconds (4), argument (4) and result code (4). OPEN and DELETE are followed by amount bytes of path; an OPEN of a
+	// temporary file has no path. Replay does not have the data, so it writes zeros.
+	class TraceVSystem : public VSystem
+	{
+	public:
+		enum TRACEOP : uint8
+		{
+			TRACEOP_OPEN = 1,		// Argument is the OPEN flags, the file number is the one later records use
+			TRACEOP_CLOSE = 2,
+			TRACEOP_READ = 3,		// Also Readv(), as one read of the total length
+			TRACEOP_WRITE = 4,		// Also Writev(), as one write of the total length
+			TRACEOP_READASYNC = 5,
+			TRACEOP_WRITEASYNC = 6,
+			TRACEOP_WAIT = 7,
+			TRACEOP_TRUNCATE = 8,	// Offset is the new size
+			TRACEOP_SYNC = 9,		// Argument is the sync flags
+			TRACEOP_FILESIZE = 10,
+			TRACEOP_LOCK = 11,		// Argument is the lock level
+			TRACEOP_UNLOCK = 12,
+			TRACEOP_SHMMAP = 13,	// Offset is the region, amount the region size, argument is isWrite
+			TRACEOP_SHMLOCK = 14,	// Offset is the first lock, amount the count, argument the SHM flags
+			TRACEOP_SHMUNMAP = 15,	// Argument is deleteFlag
+			TRACEOP_DELETE = 16,	// Argument is syncDirectory
+		};
+
+		struct ReplayResult
+		{
+			int64 Records;			// Records issued
+			int64 Failed;			// Records whose result differed from the recorded one, or that named a file that did not open
+			int64 Micros;			// Time taken by the whole replay
+		};
+
+		VSystem *Base;				// The VFS every call is passed to
+		MutexEx Mutex;				// Guards everything below
+		IO::VFile *Trace;			// Trace file, opened through Base
+		int64 TraceOffset;			// Bytes of trace already written to Trace
+		uint8 *Buffer;				// Records not yet written to Trace
+		int BufferLength;			// Bytes of Buffer[] in use
+		int64 Start;				// SysEx::Now() when the trace began
+		uint16 NextFile;			// File number given to the next OPEN
+		RC TraceError;				// First error writing Trace, after which nothing more is recorded
+
+		__device__ static TraceVSystem *Register(const char *name, const char *base, const char *tracePath, bool _default);
+		__device__ static RC Unregister(TraceVSystem *vfs);
+		__device__ static RC Replay(VSystem *vfs, const char *tracePath, const char *suffix, bool timed, ReplayResult *result);
+		__device__ RC Flush();
+		__device__ void Record(TRACEOP op, uint8 role, uint16 file, int64 amount, int64 offset, int64 start, uint32 arg, RC rc, const char *path);
+
+		__device__ virtual IO::VFile *_AttachFile(void *buffer);
+		__device__ virtual RC Open(const char *path, IO::VFile *file, OPEN flags, OPEN *outFlags);
+		__device__ virtual RC Delete(const char *path, bool syncDirectory);
+		__device__ virtual RC Access(const char *path, ACCESS flags, int *outRC);
+		__device__ virtual RC FullPathname(const char *path, int pathOutLength, char *pathOut);
+
+		__device__ virtual void *DlOpen(const char *filename);
+		__device__ virtual void DlError(int bufLength, char *buf);
+		__device__ virtual void (*DlSym(void *handle, const char *symbol))();
+		__device__ virtual void DlClose(void *handle);
+
+		__device__ virtual int Randomness(int bufLength, char *buf);
+		__device__ virtual int Sleep(int microseconds);
+		__device__ virtual RC CurrentTimeInt64(int64 *now);
+		__device__ virtual RC CurrentTime(double *now);
+		__device__ virtual RC GetLastError(int bufLength, char *buf);
+
+		__device__ virtual RC SetSystemCall(const char *name, syscall_ptr newFunc);
+		__device__ virtual syscall_ptr GetSystemCall(const char *name);
+		__device__ virtual const char *NextSystemCall(const char *name);
+	};
+}
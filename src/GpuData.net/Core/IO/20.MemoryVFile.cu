@@ -4,29 +4,23 @@
 
 namespace Core { namespace IO
 {
-#define JOURNAL_CHUNKSIZE ((int)(1024 - sizeof(FileChunk *)))
-
-	typedef struct FilePoint FilePoint;
-	typedef struct FileChunk FileChunk;
-
-	struct FileChunk
-	{
-		FileChunk *Next;				// Next chunk in the journal
-		uint8 Chunk[JOURNAL_CHUNKSIZE];	// Content of this chunk
-	};
-
-	struct FilePoint
-	{
-		int64 Offset;		// Offset from the beginning of the file
-		FileChunk *Chunk;	// Specific chunk into which cursor points
-	};
+	// Chunks double in size from MEMORYVFILE_CHUNKMIN until they reach the file's largest chunk size, MEMORYVFILE_CHUNKMAX unless changed with
+	// FCNTL_CHUNK_SIZE, so a small sub-journal costs a single small allocation and a large journal needs few. Both sizes are powers of two.
+#ifndef MEMORYVFILE_CHUNKMIN
+#define MEMORYVFILE_CHUNKMIN 1024
+#endif
+#ifndef MEMORYVFILE_CHUNKMAX
+#define MEMORYVFILE_CHUNKMAX 65536
+#endif
 
 	class MemoryVFile : public VFile
 	{
 	private:
-		FileChunk *First;       // Head of in-memory chunk-list
-		FilePoint _endpoint;    // Pointer to the end of the file
-		FilePoint _readpoint;   // Pointer to the end of the last xRead()
+		uint8 **Chunks;			// Chunk directory, indexed by chunk number
+		int ChunksLength;		// Chunks allocated, kept after Truncate(0) so they can be reused
+		int ChunksAlloc;		// Slots in the chunk directory
+		int ChunkMax;			// Largest chunk size, or 0 for MEMORYVFILE_CHUNKMAX
+		int64 EndOffset;		// Size of the file
 	public:
 		//bool Opened;
 		__device__ virtual RC Read(void *buffer, int amount, int64 offset);
@@ -35,84 +29,126 @@ namespace Core { namespace IO
 		__device__ virtual RC Close();
 		__device__ virtual RC Sync(int flags);
 		__device__ virtual RC get_FileSize(int64 &size);
+		__device__ virtual RC FileControl(FCNTL op, void *arg);
+	private:
+		__device__ int FindChunk(int64 offset, int64 *start);
+		__device__ int ChunkSize(int chunk);
 	};
 
-	__device__ RC MemoryVFile::Read(void *buffer, int amount, int64 offset)
+	// Returns the number of the chunk holding offset and sets *start to the offset of the first byte of that chunk. Only the growing chunks
+	// at the front of the file are stepped over, the rest are found by division.
+	__device__ int MemoryVFile::FindChunk(int64 offset, int64 *start)
 	{
-		// SQLite never tries to read past the end of a rollback journal file
-		_assert(offset + amount <= _endpoint.Offset);
-		FileChunk *chunk;
-		if (_readpoint.Offset != offset || offset == 0)
+		int chunkMax = (ChunkMax ? ChunkMax : MEMORYVFILE_CHUNKMAX);
+		int chunk = 0;
+		int64 begin = 0;
+		int size = MEMORYVFILE_CHUNKMIN;
+		while (size < chunkMax && offset >= begin + size)
+		{
+			begin += size;
+			size <<= 1;
+			chunk++;
+		}
+		if (offset >= begin + size)
 		{
-			int64 offset2 = 0;
-			for (chunk = First; SysEx_ALWAYS(chunk) && (offset2 + JOURNAL_CHUNKSIZE) <= offset; chunk = chunk->Next)
-				offset2 += JOURNAL_CHUNKSIZE;
+			int64 n = (offset - begin) / chunkMax;
+			chunk += (int)n;
+			begin += n * chunkMax;
 		}
-		else
-			chunk = _readpoint.Chunk;
-		int chunkOffset = (int)(offset % JOURNAL_CHUNKSIZE);
+		*start = begin;
+		return chunk;
+	}
+
+	__device__ int MemoryVFile::ChunkSize(int chunk)
+	{
+		int chunkMax = (ChunkMax ? ChunkMax : MEMORYVFILE_CHUNKMAX);
+		int size = MEMORYVFILE_CHUNKMIN;
+		for (; chunk > 0 && size < chunkMax; chunk--)
+			size <<= 1;
+		return size;
+	}
+
+	__device__ RC MemoryVFile::Read(void *buffer, int amount, int64 offset)
+	{
+		// SQLite never tries to read past the end of a rollback journal file
+		_assert(offset + amount <= EndOffset);
+		int64 start;
+		int chunk = FindChunk(offset, &start);
+		int chunkOffset = (int)(offset - start);
 		uint8 *out = (uint8 *)buffer;
-		int read = amount;
-		do
+		while (amount > 0)
 		{
-			int space = JOURNAL_CHUNKSIZE - chunkOffset;
-			int copy = MIN(read, (JOURNAL_CHUNKSIZE - chunkOffset));
-			_memcpy(out, &chunk->Chunk[chunkOffset], copy);
+			_assert(chunk < ChunksLength);
+			int copy = ChunkSize(chunk) - chunkOffset;
+			if (copy > amount) copy = amount;
+			_memcpy(out, &Chunks[chunk][chunkOffset], copy);
 			out += copy;
-			read -= space;
+			amount -= copy;
 			chunkOffset = 0;
-		} while (read >= 0 && (chunk = chunk->Next) && read > 0);
-		_readpoint.Offset = offset + amount;
-		_readpoint.Chunk = chunk;
+			chunk++;
+		}
 		return RC::OK;
 	}
 
 	__device__ RC MemoryVFile::Write(const void *buffer, int amount, int64 offset)
 	{
 		// An in-memory journal file should only ever be appended to. Random access writes are not required by sqlite.
-		_assert(offset == _endpoint.Offset);
+		_assert(offset == EndOffset);
+		int64 start;
+		int chunk = FindChunk(offset, &start);
+		int chunkOffset = (int)(offset - start);
 		uint8 *b = (uint8 *)buffer;
 		while (amount > 0)
 		{
-			FileChunk *chunk = _endpoint.Chunk;
-			int chunkOffset = (int)(_endpoint.Offset % JOURNAL_CHUNKSIZE);
-			int space = MIN(amount, JOURNAL_CHUNKSIZE - chunkOffset);
-			if (chunkOffset == 0)
+			if (chunk == ChunksLength)
 			{
-				// New chunk is required to extend the file
-				FileChunk *newChunk = new FileChunk();
+				// New chunk is required to extend the file, and perhaps a larger directory to hold it
+				if (ChunksLength == ChunksAlloc)
+				{
+					int newAlloc = (ChunksAlloc ? ChunksAlloc * 2 : 16);
+					uint8 **newChunks = (uint8 **)SysEx::Alloc(newAlloc * sizeof(uint8 *));
+					if (!newChunks)
+						return RC::IOERR_NOMEM;
+					if (Chunks)
+					{
+						_memcpy(newChunks, Chunks, ChunksLength * sizeof(uint8 *));
+						SysEx::Free(Chunks);
+					}
+					Chunks = newChunks;
+					ChunksAlloc = newAlloc;
+				}
+				uint8 *newChunk = (uint8 *)SysEx::Alloc(ChunkSize(chunk));
 				if (!newChunk)
 					return RC::IOERR_NOMEM;
-				newChunk->Next = nullptr;
-				if (chunk) { _assert(First); chunk->Next = newChunk; }
-				else { _assert(!First); First = newChunk; }
-				_endpoint.Chunk = newChunk;
+				Chunks[ChunksLength++] = newChunk;
 			}
-			_memcpy(&_endpoint.Chunk->Chunk[chunkOffset], b, space);
+			int space = ChunkSize(chunk) - chunkOffset;
+			if (space > amount) space = amount;
+			_memcpy(&Chunks[chunk][chunkOffset], b, space);
 			b += space;
 			amount -= space;
-			_endpoint.Offset += space;
+			EndOffset += space;
+			chunkOffset = 0;
+			chunk++;
 		}
 		return RC::OK;
 	}
 
+	// The chunks are kept for reuse: a sub-journal is truncated each time its outermost savepoint is released and then grows again. They are
+	// freed by Close().
 	__device__ RC MemoryVFile::Truncate(int64 size)
 	{
 		_assert(size == 0);
-		FileChunk *chunk = First;
-		while (chunk)
-		{
-			FileChunk *tmp = chunk;
-			chunk = chunk->Next;
-			SysEx::Free(tmp);
-		}
-		MemoryVFileOpen(this);
+		EndOffset = 0;
 		return RC::OK;
 	}
 
 	__device__ RC MemoryVFile::Close()
 	{
-		Truncate(0);
+		for (int i = 0; i < ChunksLength; i++)
+			SysEx::Free(Chunks[i]);
+		SysEx::Free(Chunks);
+		MemoryVFileOpen(this);
 		return RC::OK;
 	}
 
@@ -123,10 +159,26 @@ namespace Core { namespace IO
 
 	__device__ RC MemoryVFile::get_FileSize(int64 &size)
 	{
-		size = (int64)_endpoint.Offset;
+		size = EndOffset;
 		return RC::OK;
 	}
 
+	__device__ RC MemoryVFile::FileControl(FCNTL op, void *arg)
+	{
+		if (op == FCNTL_CHUNK_SIZE)
+		{
+			// The chunk layout cannot change under existing chunks
+			if (ChunksLength > 0)
+				return RC::MISUSE;
+			int chunkMax = MEMORYVFILE_CHUNKMIN;
+			while (chunkMax < *(int *)arg && chunkMax < (1 << 24))
+				chunkMax <<= 1;
+			ChunkMax = chunkMax;
+			return RC::OK;
+		}
+		return RC::NOTFOUND;
+	}
+
 	// extensions
 	__device__ void VFile::MemoryVFileOpen(VFile *file)
 	{
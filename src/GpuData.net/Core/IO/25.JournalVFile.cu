@@ -1,10 +1,22 @@
 ﻿// journal.c
 #include "../Core.cu.h"
 #include <new.h>
-#ifdef ENABLE_ATOMIC_WRITE
 
 namespace Core { namespace IO
 {
+	// Once the real journal is open, records are held in a write-behind buffer and handed to it in large writes that end on
+	// JOURNAL_WRITEBEHIND_BLOCK boundaries, when the buffer fills and when the journal is synced or flushed. Writes at offset 0 go straight through. The buffer is sized from the
+	// amount written between recent syncs, within JOURNAL_WRITEBEHIND_MIN and JOURNAL_WRITEBEHIND_MAX.
+#ifndef JOURNAL_WRITEBEHIND_BLOCK
+#define JOURNAL_WRITEBEHIND_BLOCK 4096
+#endif
+#ifndef JOURNAL_WRITEBEHIND_MIN
+#define JOURNAL_WRITEBEHIND_MIN (64 * 1024)
+#endif
+#ifndef JOURNAL_WRITEBEHIND_MAX
+#define JOURNAL_WRITEBEHIND_MAX (1024 * 1024)
+#endif
+
 	class JournalVFile : public VFile
 	{
 	public:
@@ -15,7 +27,15 @@ namespace Core { namespace IO
 		VSystem *Vfs;				// The "real" underlying VFS
 		VFile *Real;					// The "real" underlying file descriptor
 		const char *Journal;			// Name of the journal file
+		char *Pending;					// Write-behind buffer, records not yet written to Real
+		int PendingAlloc;				// Size of Pending[] in bytes
+		int PendingLength;				// Bytes of Pending[] in use
+		int64 PendingOffset;			// Journal offset of Pending[0]
+		int64 Written;					// Bytes written since the last sync
+		int64 History;					// Running average of the bytes written between syncs
 		__device__ RC CreateFile();
+		__device__ RC Flush();
+		__device__ void SizePending();
 	public:
 		//bool Opened;
 		__device__ virtual RC Close();
@@ -24,6 +44,9 @@ namespace Core { namespace IO
 		__device__ virtual RC Truncate(int64 size);
 		__device__ virtual RC Sync(int flags);
 		__device__ virtual RC get_FileSize(int64 &size);
+		__device__ virtual RC FileControl(FCNTL op, void *arg);
+		__device__ virtual uint get_SectorSize();
+		__device__ virtual IOCAP get_DeviceCharacteristics();
 	};
 
 	__device__ RC JournalVFile::CreateFile()
@@ -32,7 +55,7 @@ namespace Core { namespace IO
 		if (!Real)
 		{
 			VFile *real = (VFile *)&this[1];
-			rc = Vfs->Open(Journal, Real, Flags, 0);
+			rc = Vfs->Open(Journal, real, Flags, 0);
 			if (rc == RC::OK)
 			{
 				Real = real;
@@ -53,18 +76,67 @@ namespace Core { namespace IO
 		return rc;
 	}
 
+	__device__ RC JournalVFile::Flush()
+	{
+		if (PendingLength == 0)
+			return RC::OK;
+		RC rc = Real->Write(Pending, PendingLength, PendingOffset);
+		if (rc == RC::OK)
+		{
+			PendingOffset += PendingLength;
+			PendingLength = 0;
+		}
+		return rc;
+	}
+
+	// Called with the write-behind buffer empty. Picks a size that holds about one and a half times what recent transactions wrote between
+	// syncs, and only reallocates when that is more than twice or less than half the current size. If the allocation fails the old buffer,
+	// or no buffer, is used.
+	__device__ void JournalVFile::SizePending()
+	{
+		_assert(PendingLength == 0);
+		int64 want = History + History / 2;
+		if (want < JOURNAL_WRITEBEHIND_MIN) want = JOURNAL_WRITEBEHIND_MIN;
+		if (want > JOURNAL_WRITEBEHIND_MAX) want = JOURNAL_WRITEBEHIND_MAX;
+		want = (want + JOURNAL_WRITEBEHIND_BLOCK - 1) & ~(int64)(JOURNAL_WRITEBEHIND_BLOCK - 1);
+		if (Pending && want <= PendingAlloc * 2 && want * 2 >= PendingAlloc)
+			return;
+		char *newPending = (char *)SysEx::Alloc((size_t)want);
+		if (!newPending)
+			return;
+		SysEx::Free(Pending);
+		Pending = newPending;
+		PendingAlloc = (int)want;
+	}
+
 	__device__ RC JournalVFile::Close()
 	{
+		RC rc = RC::OK;
 		if (Real)
+		{
+			rc = Flush();
 			Real->Close();
+		}
 		SysEx::Free(Buffer);
-		return RC::OK;
+		SysEx::Free(Pending);
+		Opened = false;
+		return rc;
 	}
 
 	__device__ RC JournalVFile::Read(void *buffer, int amount, int64 offset)
 	{
 		if (Real)
+		{
+			// Served from the write-behind buffer when it holds all of the range, otherwise the buffer is written out first
+			if (PendingLength > 0 && offset >= PendingOffset && offset + amount <= PendingOffset + PendingLength)
+			{
+				_memcpy((char *)buffer, &Pending[offset - PendingOffset], amount);
+				return RC::OK;
+			}
+			RC rc = Flush();
+			if (rc != RC::OK) return rc;
 			return Real->Read(buffer, amount, offset);
+		}
 		if ((amount + offset) > Size)
 			return RC::IOERR_SHORT_READ;
 		_memcpy((char *)buffer, &Buffer[offset], amount);
@@ -76,21 +148,74 @@ namespace Core { namespace IO
 		RC rc = RC::OK;
 		if (!Real && (offset + amount) > BufferLength)
 			rc = CreateFile();
-		if (rc == RC::OK)
+		if (rc != RC::OK)
+			return rc;
+		if (!Real)
 		{
-			if (Real)
-				return Real->Write(buffer, amount, offset);
 			_memcpy(&Buffer[offset], (char *)buffer, amount);
 			if (Size < (offset + amount))
 				Size = (int)(offset + amount);
+			return RC::OK;
 		}
-		return rc;
+
+		Written += amount;
+		// The header at offset 0 starts a journal or, zeroed, finalizes a commit that may not be followed by a sync, so it is never held back
+		if (offset == 0)
+		{
+			if ((rc = Flush()) != RC::OK) return rc;
+			return Real->Write(buffer, amount, offset);
+		}
+		const char *b = (const char *)buffer;
+		// Bytes that rewrite part of the buffered records, such as the record count in a journal header, are patched in place
+		int64 end = PendingOffset + PendingLength;
+		if (PendingLength > 0 && offset >= PendingOffset && offset < end)
+		{
+			int patch = (int)(end - offset);
+			if (patch > amount) patch = amount;
+			_memcpy(&Pending[offset - PendingOffset], b, patch);
+			b += patch;
+			offset += patch;
+			amount -= patch;
+		}
+		while (amount > 0)
+		{
+			// Anything that does not carry on from the buffered records starts a new run
+			if (PendingLength == 0 || offset != PendingOffset + PendingLength)
+			{
+				if ((rc = Flush()) != RC::OK) return rc;
+				PendingOffset = offset;
+				SizePending();
+				if (!Pending)
+					return Real->Write(b, amount, offset);
+			}
+			// A run ends on a block boundary, so every full buffer goes out as whole blocks
+			int space = PendingAlloc - (int)(PendingOffset % JOURNAL_WRITEBEHIND_BLOCK) - PendingLength;
+			if (space <= 0)
+			{
+				if ((rc = Flush()) != RC::OK) return rc;
+				continue;
+			}
+			if (space > amount) space = amount;
+			_memcpy(&Pending[PendingLength], b, space);
+			PendingLength += space;
+			b += space;
+			offset += space;
+			amount -= space;
+		}
+		return RC::OK;
 	}
 
 	__device__ RC JournalVFile::Truncate(int64 size)
 	{
 		if (Real)
+		{
+			// Buffered records past the new end are dropped rather than written
+			if (size <= PendingOffset) PendingLength = 0;
+			else if (size < PendingOffset + PendingLength) PendingLength = (int)(size - PendingOffset);
+			RC rc = Flush();
+			if (rc != RC::OK) return rc;
 			return Real->Truncate(size);
+		}
 		if (size < Size)
 			Size = size;
 		return RC::OK;
@@ -99,37 +224,72 @@ namespace Core { namespace IO
 	__device__ RC JournalVFile::Sync(int flags)
 	{
 		if (Real)
+		{
+			RC rc = Flush();
+			if (rc != RC::OK) return rc;
+			History = (History * 3 + Written) / 4;
+			Written = 0;
 			return Real->Sync(flags);
+		}
 		return RC::OK;
 	}
 
 	__device__ RC JournalVFile::get_FileSize(int64 &size)
 	{
 		if (Real)
-			return Real->get_FileSize(size);
+		{
+			RC rc = Real->get_FileSize(size);
+			if (rc == RC::OK && PendingLength > 0 && size < PendingOffset + PendingLength)
+				size = PendingOffset + PendingLength;
+			return rc;
+		}
 		size = (int64)Size;
 		return RC::OK;
 	}
 
+	__device__ RC JournalVFile::FileControl(FCNTL op, void *arg)
+	{
+		return (Real ? Real->FileControl(op, arg) : RC::NOTFOUND);
+	}
+
+	__device__ uint JournalVFile::get_SectorSize()
+	{
+		return (Real ? Real->get_SectorSize() : 0);
+	}
+
+	__device__ VFile::IOCAP JournalVFile::get_DeviceCharacteristics()
+	{
+		return (Real ? Real->get_DeviceCharacteristics() : (VFile::IOCAP)0);
+	}
+
 	// extensions
 	__device__ RC VFile::JournalVFileOpen(VSystem *vfs, const char *name, VFile *file, VSystem::OPEN flags, int bufferLength)
 	{
 		_memset(file, 0, JournalVFileSize(vfs));
 		file = new (file) JournalVFile();
 		JournalVFile *p = (JournalVFile *)file;
+		p->Type = 2;
+		p->Flags = flags;
+		p->Journal = name;
+		p->Vfs = vfs;
 		if (bufferLength > 0)
 		{
 			p->Buffer = (char *)SysEx::Alloc(bufferLength, true);
 			if (!p->Buffer)
 				return RC::NOMEM;
+			p->BufferLength = bufferLength;
 		}
 		else
+		{
+#ifdef OMIT_JOURNAL_WRITEBEHIND
 			return vfs->Open(name, file, flags, 0);
-		p->Type = 2;
-		p->BufferLength = bufferLength;
-		p->Flags = flags;
-		p->Journal = name;
-		p->Vfs = vfs;
+#else
+			RC rc = p->CreateFile();
+			if (rc != RC::OK)
+				return rc;
+#endif
+		}
+		p->Opened = true;
 		return RC::OK;
 	}
 
@@ -140,6 +300,13 @@ namespace Core { namespace IO
 		return ((JournalVFile *)file)->CreateFile();
 	}
 
+	__device__ RC VFile::JournalVFileFlush(VFile *file)
+	{
+		if (file->Type != 2 || !((JournalVFile *)file)->Real)
+			return RC::OK;
+		return ((JournalVFile *)file)->Flush();
+	}
+
 	__device__ bool VFile::HasJournalVFile(VFile *file)
 	{
 		return (file->Type != 2 || ((JournalVFile *)file)->Real != nullptr);
@@ -150,5 +317,3 @@ namespace Core { namespace IO
 		return (vfs->SizeOsFile + sizeof(JournalVFile));
 	}
 }}
-
-#endif
\ No newline at end of file
@@ -14,4 +14,37 @@ namespace Core { namespace IO
 	__device__ void VFile::ShmBarrier() { }
 	__device__ RC VFile::ShmUnmap(bool deleteFlag) { return RC::OK; }
 	__device__ RC VFile::ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp) { return RC::OK; }
+
+	// A file that cannot be memory-mapped hands back a nullptr, and the caller falls back to Read().
+	__device__ RC VFile::Fetch(int64 offset, int amount, void **pp) { *pp = nullptr; return RC::OK; }
+	__device__ RC VFile::Unfetch(int64 offset, void *p) { return RC::OK; }
+
+	__device__ RC VFile::Readv(IOVec *vecs, int count, int64 offset)
+	{
+		RC rc = RC::OK;
+		for (int i = 0; i < count; i++)
+		{
+			RC rc2 = Read(vecs[i].Buffer, vecs[i].Amount, offset);
+			if (rc2 == RC::IOERR_SHORT_READ) rc = rc2; // keep going, so every later buffer is zero-filled too
+			else if (rc2 != RC::OK) return rc2;
+			offset += vecs[i].Amount;
+		}
+		return rc;
+	}
+
+	__device__ RC VFile::Writev(const IOVec *vecs, int count, int64 offset)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			RC rc = Write(vecs[i].Buffer, vecs[i].Amount, offset);
+			if (rc != RC::OK) return rc;
+			offset += vecs[i].Amount;
+		}
+		return RC::OK;
+	}
+
+	// A file without a background queue performs the operation straight away, so there is never anything to wait for.
+	__device__ RC VFile::ReadAsync(void *buffer, int amount, int64 offset) { return Read(buffer, amount, offset); }
+	__device__ RC VFile::WriteAsync(const void *buffer, int amount, int64 offset) { return Write(buffer, amount, offset); }
+	__device__ RC VFile::Wait() { return RC::OK; }
 }}
\ No newline at end of file
@@ -31,6 +31,7 @@ namespace Core { namespace IO
 			SYNC_DATAONLY = 0x00010,
 			// wal.h
 			SYNC_WAL_TRANSACTIONS = 0x20,    // Sync at the end of each transaction
+			SYNC_WAL_DEFERRED = 0x40,        // Pad the transaction as SYNC_WAL_TRANSACTIONS would, but leave its sync to Wal::WaitSync()
 			SYNC_WAL_MASK = 0x13,            // Mask off the SQLITE_SYNC_* values
 		};
 
@@ -54,6 +55,11 @@ namespace Core { namespace IO
 			FCNTL_BUSYHANDLER = 15,
 			FCNTL_TEMPFILENAME = 16,
 			FCNTL_MMAP_SIZE = 18,
+			FCNTL_PREFETCH = 19,
+			FCNTL_SHADOW_GENERATION = 20,	// ShadowVSystem: arg is a uint32 * that gets the committed generation. NOTFOUND if the file is not shadow paged
+			FCNTL_SHADOW_COMMIT = 21,		// ShadowVSystem: arg is an int * of sync flags, 0 to publish without syncing
+			FCNTL_SHADOW_ROLLBACK = 22,		// ShadowVSystem: drop every write since the last commit
+			FCNTL_PUNCH_HOLE = 23,			// arg is an int64[2] of offset and length to zero and release the space of. NOTFOUND if the file cannot
 			// os.h
 			FCNTL_DB_UNCHANGED = 0xca093fa0,
 		};
@@ -86,6 +92,13 @@ namespace Core { namespace IO
 			SHM_MAX = 8,
 		};
 
+		// One buffer of a scatter/gather transfer
+		struct IOVec
+		{
+			void *Buffer;
+			int Amount;
+		};
+
 		char Type;
 		bool Opened;
 
@@ -109,6 +122,20 @@ namespace Core { namespace IO
 		__device__ virtual RC ShmUnmap(bool deleteFlag);
 		__device__ virtual RC ShmMap(int region, int sizeRegion, bool isWrite, void volatile **pp);
 
+		__device__ virtual RC Fetch(int64 offset, int amount, void **pp);
+		__device__ virtual RC Unfetch(int64 offset, void *p);
+
+		// Transfer count buffers to or from consecutive bytes of the file starting at offset, in a single call where the file supports it. Readv()
+		// zero-fills whatever lies past the end of the file and returns IOERR_SHORT_READ, as Read() does.
+		__device__ virtual RC Readv(IOVec *vecs, int count, int64 offset);
+		__device__ virtual RC Writev(const IOVec *vecs, int count, int64 offset);
+
+		// Queue a read or write and return without waiting for it. The buffer must stay valid and unchanged, and the range must not be touched by
+		// Read()/Write(), until Wait() returns. Wait() reports the first error of every operation queued since the last call. Sync() and Truncate() wait implicitly.
+		__device__ virtual RC ReadAsync(void *buffer, int amount, int64 offset);
+		__device__ virtual RC WriteAsync(const void *buffer, int amount, int64 offset);
+		__device__ virtual RC Wait();
+
 		__device__ inline RC Read4(int64 offset, uint32 *valueOut)
 		{
 			unsigned char ac[4];
@@ -126,17 +153,11 @@ namespace Core { namespace IO
 		}
 
 		// extensions
-#ifdef ENABLE_ATOMIC_WRITE
 		__device__ static RC JournalVFileOpen(VSystem *vfs, const char *name, VFile *file, VSystem::OPEN flags, int bufferLength);
 		__device__ static int JournalVFileSize(VSystem *vfs);
 		__device__ static RC JournalVFileCreate(VFile *file);
+		__device__ static RC JournalVFileFlush(VFile *file);
 		__device__ static bool HasJournalVFile(VFile *file);
-#else
-		__device__ inline static int JournalVFileSize(VSystem *vfs) { return vfs->SizeOsFile; }
-		__device__ inline bool HasJournalVFile(VFile *file) { return true; }
-		//#define JournalSize(vfs) ((vfs)->SizeOsFile)
-		//#define HasJournal(file) true
-#endif
 		__device__ static void MemoryVFileOpen(VFile *file);
 		__device__ static bool HasMemoryVFile(VFile *file);
 		__device__ static int MemoryVFileSize() ;
@@ -1,5 +1,7 @@
 //#include "..\GpuData\Core\Core.cu.h"
 #include "..\GpuData.net\Core+Pager\Core+Pager.cu.h"
+#include "..\GpuData.net\Core\57.StatVSystem.cu.h"
+#include "..\GpuData.net\Core\57.TraceVSystem.cu.h"
 #include <stdio.h>
 #include <string.h>
 using namespace Core;
@@ -11,13 +13,17 @@ namespace Core
 }
 
 static void TestVFS();
-static void TestPager();
+static void TestPager(VSystem *vfs);
+static void TestTrace();
+static void TestCodec(VSystem *vfs);
 
 void main()
 {
 	SysEx::Initialize();
 	//TestVFS();
-	TestPager();
+	TestPager(VSystem::Find("win32"));
+	//TestTrace();
+	//TestCodec(VSystem::Find("win32"));
 }
 
 static void TestVFS()
@@ -70,9 +76,8 @@ _out:
 	return pager;
 }
 
-static void TestPager()
+static void TestPager(VSystem *vfs)
 {
-	auto vfs = VSystem::Find("win32");
 	auto pager = Open(vfs);
 	if (pager == nullptr)
 		throw;
@@ -97,6 +102,117 @@ static void TestPager()
 		pager->Close();
 }
 
+// Record the pager test through a trace VFS, then replay the trace twice through a stat VFS: back to back, and at the recorded times.
+static void TestTrace()
+{
+	auto trace = TraceVSystem::Register("trace", "win32", "C:\\T_\\Test.trace", false);
+	if (trace == nullptr)
+		throw;
+	TestPager(trace);
+	if (TraceVSystem::Unregister(trace) != RC::OK)
+		throw;
+	auto stat = StatVSystem::Register("stat", "win32", false);
+	for (int timed = 0; timed < 2; timed++)
+	{
+		TraceVSystem::ReplayResult result;
+		stat->Snapshot(nullptr, true);
+		auto rc = TraceVSystem::Replay(stat, "C:\\T_\\Test.trace", "-replay", timed != 0, &result);
+		printf("replay%s: %d, %lld records, %lld failed, %lldus\n", (timed ? " timed" : ""), rc, result.Records, result.Failed, result.Micros);
+		StatVSystem::Stats stats;
+		stat->Snapshot(&stats, false);
+		for (int role = 0; role < StatVSystem::ROLE_COUNT; role++)
+			for (int op = 0; op < StatVSystem::OP_COUNT; op++)
+			{
+				auto counter = &stats.Ops[role][op];
+				if (counter->Calls)
+					printf("  %s %s: %lld calls, %lld bytes, %lldus\n", StatVSystem::RoleName((StatVSystem::ROLE)role), StatVSystem::OpName((StatVSystem::OP)op), counter->Calls, counter->Bytes, counter->Micros);
+			}
+	}
+	StatVSystem::Unregister(stat);
+}
+
+// Fill a page with rows of text, which compress, or with noise, which does not.
+static void FillPage(uint8 *data, int length, Pid id, bool noise)
+{
+	uint32 x = id * 2654435761U;
+	for (int i = 0; i < length; )
+		if (noise)
+			data[i++] = (uint8)((x = x * 1103515245 + 12345) >> 16);
+		else
+		{
+			char row[64];
+			int n = sprintf(row, "row %u of page %u, value %u;", i / 32, id, (x = x * 1103515245 + 12345) % 1000);
+			for (int k = 0; k < n && i < length; k++)
+				data[i++] = (uint8)row[k];
+		}
+}
+
+// Round-trip pages through CompressCodec, first straight through Code() and then through a pager that writes them to a file and reads them
+// back. The reserved bytes the codec keeps its header in are left out of the comparisons.
+static void TestCodec(VSystem *vfs)
+{
+	const int pageSize = 8192;
+	const int length = pageSize - COMPRESSCODEC_RESERVE;
+	uint8 *page = (uint8 *)SysEx::Alloc(pageSize, true);
+	uint8 *copy = (uint8 *)SysEx::Alloc(pageSize, true);
+	auto codec = (CompressCodec *)SysEx::Alloc(sizeof(CompressCodec), true);
+	CompressCodec::SizeChange(codec, pageSize, COMPRESSCODEC_RESERVE);
+	for (Pid id = 1; id <= 64; id++)
+	{
+		memset(page, 0, pageSize);
+		if (id % 8 != 0) // Every eighth page is left empty
+			FillPage(page, length, id, (id % 4 == 3));
+		auto out = (uint8 *)CompressCodec::Code(codec, page, id, 6);
+		memcpy(copy, out, pageSize);
+		CompressCodec::Code(codec, copy, id, 3);
+		if (memcmp(page, copy, length))
+			throw;
+	}
+	printf("codec: %lld pages, %lld of %lld bytes stored\n", codec->Pages, codec->Stored, codec->Pages * pageSize);
+	CompressCodec::Free(codec);
+
+	auto flags = (IPager::PAGEROPEN)0;
+	auto vfsFlags = (VSystem::OPEN)((int)VSystem::OPEN_CREATE | (int)VSystem::OPEN_READWRITE | (int)VSystem::OPEN_MAIN_DB);
+	vfs->Delete("C:\\T_\\Codec.db", false);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		Pager *pager;
+		if (Pager::Open(vfs, &pager, "C:\\T_\\Codec.db", 0, flags, vfsFlags, nullptr) != RC::OK)
+			throw;
+		if (CompressCodec::Attach(pager) != RC::OK)
+			throw;
+		uint32 size = pageSize;
+		if (pager->SetPageSize(&size, COMPRESSCODEC_RESERVE) != RC::OK || size != pageSize || pager->SharedLock() != RC::OK)
+			throw;
+		if (pass == 0 && pager->Begin(false, false) != RC::OK)
+			throw;
+		for (Pid id = 1; id <= 64; id++)
+		{
+			IPage *p = nullptr;
+			if (pager->Acquire(id, &p, false) != RC::OK)
+				throw;
+			memset(page, 0, pageSize);
+			if (id % 8 != 0)
+				FillPage(page, length, id, (id % 4 == 3));
+			if (pass == 0)
+			{
+				if (Pager::Write(p) != RC::OK)
+					throw;
+				memcpy(&((uint8 *)p->Data)[100], &page[100], length - 100); // The first 100 bytes hold the database header
+			}
+			else if (memcmp(&((uint8 *)p->Data)[100], &page[100], length - 100))
+				throw;
+			Pager::Unref(p);
+		}
+		if (pass == 0 && (pager->CommitPhaseOne(nullptr, false) != RC::OK || pager->CommitPhaseTwo() != RC::OK))
+			throw;
+		pager->Close();
+	}
+	printf("codec: 64 pages written and read back through the pager\n");
+	SysEx::Free(copy);
+	SysEx::Free(page);
+}
+
 void TestBitvec()
 {
 	int ops[] = { 5, 1, 1, 1, 0 };